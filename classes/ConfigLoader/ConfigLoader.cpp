@@ -1,5 +1,16 @@
 #include "ConfigLoader.h"
 
+#include <cerrno>
+#include <chrono>
+#include <clocale>
+#include <cstring>
+#include <filesystem>
+#include <locale.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
 bool ConfigLoader::isInteger(const std::string& str, int& result) const {
     char* p;
     long value = strtol(str.c_str(), &p, 10);
@@ -45,7 +56,7 @@ bool ConfigLoader::isQuotedString(const std::string& str, std::string& result) c
     return false;
 }
 
-void ConfigLoader::processLine(const std::string& line) {
+void ConfigLoader::processLine(const std::string& line, ConfigData& out) const {
     // Process comments
     std::string lineWithoutComment = line;
     size_t commentPos = line.find('#');
@@ -79,13 +90,13 @@ void ConfigLoader::processLine(const std::string& line) {
     std::string stringResult;
 
     if (isInteger(value, intResult)) {
-        configData[key] = intResult;
+        out[key] = intResult;
     } else if (isDouble(value, doubleResult)) {
-        configData[key] = doubleResult;
+        out[key] = doubleResult;
     } else if (isBoolean(value, boolResult)) {
-        configData[key] = boolResult;
+        out[key] = boolResult;
     } else if (isQuotedString(value, stringResult)) {
-        configData[key] = stringResult;
+        out[key] = stringResult;
     } else {
         throw std::runtime_error(
             "Key \"" + key + "\" with value \"" + value + "\" type not recognized.\n" + TypeExample
@@ -93,7 +104,7 @@ void ConfigLoader::processLine(const std::string& line) {
     }
 }
 
-void ConfigLoader::loadTxt(const std::string& filename) {
+void ConfigLoader::loadTxt(const std::string& filename, ConfigData& out) const {
     std::ifstream file(filename);
     if (!file.is_open()) {
         throw std::runtime_error("Cannot open text file: " + filename);
@@ -103,16 +114,16 @@ void ConfigLoader::loadTxt(const std::string& filename) {
     while (getline(file, line)) {
         // Skip empty lines or comments
         if (line.empty() || line[0] == '#') continue;
-        processLine(line);
+        processLine(line, out);
     }
 }
 
-void ConfigLoader::loadToml(const std::string& filename) {
+void ConfigLoader::loadToml(const std::string& filename, ConfigData& out) const {
     auto config = toml::parse_file(filename);
-    processTomlTable(config);
+    processTomlTable(config, out);
 }
 
-ConfigTypes ConfigLoader::processSimpleValue(const toml::node& value) {
+ConfigTypes ConfigLoader::processSimpleValue(const toml::node& value) const {
     if (value.is_integer()) {
         return static_cast<int>(value.as_integer()->get());
     } else if (value.is_floating_point()) {
@@ -126,7 +137,7 @@ ConfigTypes ConfigLoader::processSimpleValue(const toml::node& value) {
     }
 }
 
-ConfigTypes ConfigLoader::processArray(const toml::array& array) {
+ConfigTypes ConfigLoader::processArray(const toml::array& array) const {
     if (array.empty()) {
         throw std::runtime_error("Empty arrays are not supported.");
     }
@@ -176,19 +187,19 @@ ConfigTypes ConfigLoader::processArray(const toml::array& array) {
     }
 }
 
-void ConfigLoader::processTomlTable(const toml::table& table, const std::string& prefix) {
+void ConfigLoader::processTomlTable(const toml::table& table, ConfigData& out, const std::string& prefix) const {
     for (const auto& [key, value] : table) {
         std::string fullKey = prefix.empty() ? std::string(key.str()) : prefix + "." + std::string(key.str());
 
         if (value.is_table()) {
             // Process tables recursively
-            processTomlTable(*value.as_table(), fullKey);
+            processTomlTable(*value.as_table(), out, fullKey);
         } else if (value.is_array()) {
             // Process arrays and store them as vector<T>.
-            configData[fullKey] = processArray(*value.as_array());
+            out[fullKey] = processArray(*value.as_array());
         } else {
             // Process simple values
-            configData[fullKey] = processSimpleValue(value);
+            out[fullKey] = processSimpleValue(value);
         }
     }
 }
@@ -197,19 +208,143 @@ void ConfigLoader::load(const std::string& filename) {
     // Save the current global locale and set the locale to "en_US.UTF-8"
     std::locale originalLocale = std::locale::global(std::locale("en_US.UTF-8"));
     
+    ConfigData data = parse(filename);
+    
+    // Restore the original global locale to ensure no side effects on the rest of the program
+    std::locale::global(originalLocale);
+
+    apply(data, filename);
+}
+
+ConfigLoader::ConfigData ConfigLoader::parse(const std::string& filename) const {
+    ConfigData data;
     // Check the file extension and load the appropriate format
     if (filename.ends_with(".toml")) {
-        loadToml(filename);  // Load the TOML file if it has a .toml extension
+        loadToml(filename, data);  // Load the TOML file if it has a .toml extension
     } else {
-        loadTxt(filename);   // Otherwise, load the file as a text file
+        loadTxt(filename, data);   // Otherwise, load the file as a text file
     }
-    
-    // Restore the original global locale to ensure no side effects on the rest of the program
-    std::locale::global(originalLocale);
+    return data;
+}
+
+void ConfigLoader::apply(const ConfigData& data, const std::string& filename) {
+    std::unique_lock lock(dataMutex);
+    for (const auto& [key, value] : data) {
+        auto slot = slots.find(key);
+        if (slot != slots.end() && !slot->second->publish(value)) {
+            // handles keep their type, so does the key
+            std::cerr << "ConfigLoader: " << filename << ": key \"" << key << "\" changed from "
+                      << getTypeName(configData[key]) << " to " << getTypeName(value) << ", keeping the previous value" << std::endl;
+            continue;
+        }
+        configData[key] = value;
+    }
+    if (std::find(files.begin(), files.end(), filename) == files.end()) {
+        files.push_back(filename);
+    }
+    loads.fetch_add(1, std::memory_order_release);
+}
+
+ConfigLoader::~ConfigLoader() {
+    stopWatching();
+}
+
+void ConfigLoader::startWatching() {
+    if (watcher.joinable()) return;
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd < 0 || stopFd < 0) {
+        const std::string error = std::strerror(errno);
+        stopWatching();
+        throw std::runtime_error("Cannot watch the configuration files: " + error);
+    }
+    // Directories are watched, not the files: editors often save by renaming a new file over the old one
+    std::vector<std::string> watched;
+    {
+        std::shared_lock lock(dataMutex);
+        watched = files;
     }
+    std::vector<int> watches;
+    for (const auto& file : watched) {
+        const auto dir = std::filesystem::path(file).parent_path();
+        const int wd = inotify_add_watch(inotifyFd, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0) {
+            const std::string error = std::strerror(errno);
+            stopWatching();
+            throw std::runtime_error("Cannot watch " + file + ": " + error);
+        }
+        watches.push_back(wd);
+    }
+    watcher = std::thread(&ConfigLoader::watchLoop, this, std::move(watched), std::move(watches));
+}
+
+void ConfigLoader::stopWatching() {
+    if (watcher.joinable()) {
+        const uint64_t one = 1;
+        [[maybe_unused]] auto n = write(stopFd, &one, sizeof(one));
+        watcher.join();
+    }
+    if (inotifyFd >= 0) close(inotifyFd);
+    if (stopFd >= 0) close(stopFd);
+    inotifyFd = stopFd = -1;
+}
+
+void ConfigLoader::watchLoop(std::vector<std::string> watched, std::vector<int> watches) {
+    // strtod and strtol of the text files follow the locale of the thread: the one load() sets, without touching the
+    // global locale of the running component
+    locale_t parseLocale = newlocale(LC_ALL_MASK, "en_US.UTF-8", locale_t(0));
+    if (parseLocale == locale_t(0)) parseLocale = newlocale(LC_ALL_MASK, "C", locale_t(0));
+    if (parseLocale != locale_t(0)) uselocale(parseLocale);
+
+    std::vector<bool> changed(watched.size(), false);
+    alignas(inotify_event) char buffer[4096];
+    bool pending = false;
+    while (true) {
+        pollfd fds[2] = {{stopFd, POLLIN, 0}, {inotifyFd, POLLIN, 0}};
+        // a save can come as several events, the files are read once they have been quiet for a moment
+        const int ready = poll(fds, 2, pending ? 50 : -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0 || (fds[0].revents & POLLIN)) break;
+
+        if (ready == 0) {
+            for (size_t i = 0; i < watched.size(); i++) {
+                if (!changed[i]) continue;
+                changed[i] = false;
+                try {
+                    apply(parse(watched[i]), watched[i]);
+                } catch (const std::exception& e) {
+                    std::cerr << "ConfigLoader: reloading " << watched[i] << " failed, keeping the previous values: " << e.what() << std::endl;
+                }
+            }
+            pending = false;
+            continue;
+        }
+
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + event->len;
+                if (event->len == 0) continue;
+                for (size_t i = 0; i < watched.size(); i++) {
+                    if (event->wd == watches[i] && std::filesystem::path(watched[i]).filename() == event->name) {
+                        changed[i] = pending = true;
+                    }
+                }
+            }
+        }
+    }
+
+    if (parseLocale != locale_t(0)) {
+        uselocale(LC_GLOBAL_LOCALE);
+        freelocale(parseLocale);
+    }
+}
 
 
 void ConfigLoader::printConfig() const {
+        std::shared_lock lock(dataMutex);
         for (const auto& [key, value] : configData) {
             std::cout << key << " = ";
             std::visit([&](auto&& v) { 
@@ -11,6 +11,14 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <toml++/toml.h>
 
 
@@ -35,13 +43,71 @@ const std::string TypeExample =
     "- std::vector<bool> = [true, false, true]\n"
     "<You can comment with #>\n";
 
+/**
+ * @brief Current value of one key, shared by all the handles to it. Only the loader writes it.
+ *
+ * int, double and bool live in an atomic. Strings and vectors are immutable copies, swapped by pointer; the
+ * previous copies stay allocated until the loader is destroyed, so a reference to a value stays valid after a reload.
+ */
+class ConfigSlotBase {
+public:
+    virtual ~ConfigSlotBase() = default;
+    // false if the value has another type, then the slot keeps the previous one
+    virtual bool publish(const ConfigTypes& value) = 0;
+};
+
+template <typename T>
+class ConfigSlot : public ConfigSlotBase {
+    static constexpr bool scalar = std::is_arithmetic_v<T>;
+public:
+    using Value = std::conditional_t<scalar, T, const T&>;
+
+    explicit ConfigSlot(const T& value) { store(value); }
+    bool publish(const ConfigTypes& value) override;
+    Value load() const;
+
+private:
+    void store(const T& value);
+    std::atomic<std::conditional_t<scalar, T, const T*>> current{};
+    std::vector<std::unique_ptr<const T>> history;
+};
+
+/**
+ * @brief Key resolved once by ConfigLoader::handle: reading it is one atomic load, without lookups or locks.
+ * Valid while the loader that created it lives.
+ */
+template <typename T>
+class ConfigHandle {
+public:
+    ConfigHandle() = default;
+    typename ConfigSlot<T>::Value get() const { return slot->load(); }
+    typename ConfigSlot<T>::Value operator*() const { return get(); }
+    bool valid() const { return slot != nullptr; }
+
+private:
+    friend class ConfigLoader;
+    explicit ConfigHandle(const ConfigSlot<T>* slot_) : slot(slot_) {}
+    const ConfigSlot<T>* slot = nullptr;
+};
+
 /**
  * @class ConfigLoader
  * @brief A class to load and manage configuration data from TOML and text files.
  */
 class ConfigLoader {
 private:
-    std::unordered_map<std::string, ConfigTypes> configData;
+    using ConfigData = std::unordered_map<std::string, ConfigTypes>;
+    ConfigData configData;
+
+    // configData and slots; taken exclusively only to create a handle or to apply a load
+    mutable std::shared_mutex dataMutex;
+    std::unordered_map<std::string, std::unique_ptr<ConfigSlotBase>> slots;
+    std::vector<std::string> files;
+    std::atomic<std::uint64_t> loads{0};
+
+    std::thread watcher;
+    int inotifyFd = -1;
+    int stopFd = -1;
 
     // Helper functions for type detection
     bool isInteger(const std::string& str, int& result) const;
@@ -50,24 +116,36 @@ private:
     bool isQuotedString(const std::string& str, std::string& result) const;
 
     // Helper to process a line from a text configuration file
-    void processLine(const std::string& line);
+    void processLine(const std::string& line, ConfigData& out) const;
 
     // Loaders for specific file types
-    void loadTxt(const std::string& filename);
-    void loadToml(const std::string& filename);
+    void loadTxt(const std::string& filename, ConfigData& out) const;
+    void loadToml(const std::string& filename, ConfigData& out) const;
+    ConfigData parse(const std::string& filename) const;
+
+    // Merges a parsed file into configData and publishes its values to the handles
+    void apply(const ConfigData& data, const std::string& filename);
+    void watchLoop(std::vector<std::string> watched, std::vector<int> watches);
 
-    ConfigTypes processArray(const toml::array& array);
-    ConfigTypes processSimpleValue(const toml::node& value);
+    ConfigTypes processArray(const toml::array& array) const;
+    ConfigTypes processSimpleValue(const toml::node& value) const;
 
     template <typename T>
     static std::string vectorToString(const std::vector<T>& vec);
 
     // Recursive processing of TOML tables
-    void processTomlTable(const toml::table& table, const std::string& prefix = "");
+    void processTomlTable(const toml::table& table, ConfigData& out, const std::string& prefix = "") const;
 
     static std::string getTypeName(const ConfigTypes& value);
+    template <typename T>
+    static std::runtime_error typeMismatch(const std::string& key, const ConfigTypes& value);
 
 public:
+    ConfigLoader() = default;
+    ConfigLoader(const ConfigLoader&) = delete;
+    ConfigLoader& operator=(const ConfigLoader&) = delete;
+    ~ConfigLoader();
+
     /**
      * @brief Retrieves the value for a given key and casts it to the specified type.
      * @tparam T The expected type of the value.
@@ -80,12 +158,41 @@ public:
 
     ConfigTypes get(const std::string& key) const;
 
+    /**
+     * @brief Resolves a key once, for reading it in a loop. The handle follows the reloads of the key.
+     *
+     * auto maxSpeed = config.handle<double>("planner.max_speed");
+     * ...
+     * double v = maxSpeed.get();
+     *
+     * @throws std::runtime_error If the key is not found or the type does not match, like get.
+     */
+    template <typename T>
+    ConfigHandle<T> handle(const std::string& key);
+
     /**
      * @brief Loads a configuration file (TOML or text format).
      * @param filename The path to the configuration file.
      */
     void load(const std::string& filename);
 
+    /**
+     * @brief Reloads the files given to load so far when they change on disk, in a thread of its own (inotify).
+     *
+     * Every value is published atomically, so handles never see a torn value. Two handles read one after the other
+     * can belong to different loads; loadCount tells whether a load happened in between. A file that fails to parse,
+     * or a key whose type changes, is reported on std::cerr and the previous values stay. Keys removed from the
+     * file keep their last value.
+     * @throws std::runtime_error If inotify cannot be set up.
+     */
+    void startWatching();
+    void stopWatching();
+
+    /**
+     * @brief Number of loads applied, the initial ones included.
+     */
+    std::uint64_t loadCount() const { return loads.load(std::memory_order_acquire); }
+
     /**
      * @brief Prints all loaded configuration data to the console.
      */
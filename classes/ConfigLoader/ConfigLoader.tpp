@@ -5,34 +5,74 @@
 
 template <typename T>
 T ConfigLoader::get(const std::string& key) const {
+    std::shared_lock lock(dataMutex);
     auto it = configData.find(key);
     if (it == configData.end()) {
         throw std::runtime_error("Key not found: " + key);
     }
 
-    try {
-        return std::get<T>(it->second);
-    } catch (const std::bad_variant_access& e) {
-        throw std::runtime_error("Key \"" + key + "\" type mismatch.\n"
-        "Type identified: " + ConfigLoader::getTypeName(it->second) + "\n"
-        "Requested type: " +
-            ([] {
-                // Mapeo de nombres de typeid a nombres legibles
-                static const std::unordered_map<std::string, std::string> typeNames = {
-                    {"i", "int"},
-                    {"d", "double"},
-                    {"b", "bool"},
-                    {"NSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEE", "std::string"},
-                    {"St3vectorIiE", "std::vector<int>"},
-                    {"St3vectorIdE", "std::vector<double>"},
-                    {"St3vectorIbE", "std::vector<bool>"},
-                    {"St3vectorINSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEE", "std::vector<std::string>"}
-                };
-
-                auto it = typeNames.find(typeid(T).name());
-                return (it != typeNames.end()) ? it->second : std::string(typeid(T).name());
-            })() +
-            "\n" + TypeExample);
+    if (const T* value = std::get_if<T>(&it->second)) {
+        return *value;
+    }
+    throw typeMismatch<T>(key, it->second);
+}
+
+template <typename T>
+std::runtime_error ConfigLoader::typeMismatch(const std::string& key, const ConfigTypes& value) {
+    return std::runtime_error("Key \"" + key + "\" type mismatch.\n"
+        "Type identified: " + getTypeName(value) + "\n"
+        "Requested type: " + getTypeName(ConfigTypes(std::in_place_type<T>)) + "\n" + TypeExample);
+}
+
+template <typename T>
+ConfigHandle<T> ConfigLoader::handle(const std::string& key) {
+    std::unique_lock lock(dataMutex);
+    auto it = configData.find(key);
+    if (it == configData.end()) {
+        throw std::runtime_error("Key not found: " + key);
+    }
+    const T* value = std::get_if<T>(&it->second);
+    if (value == nullptr) {
+        throw typeMismatch<T>(key, it->second);
+    }
+
+    // One slot per key, its type is the one of the first handle
+    auto& slot = slots[key];
+    if (!slot) {
+        slot = std::make_unique<ConfigSlot<T>>(*value);
+    }
+    return ConfigHandle<T>(static_cast<const ConfigSlot<T>*>(slot.get()));
+}
+
+template <typename T>
+bool ConfigSlot<T>::publish(const ConfigTypes& value) {
+    const T* v = std::get_if<T>(&value);
+    if (v == nullptr) {
+        return false;
+    }
+    store(*v);
+    return true;
+}
+
+template <typename T>
+typename ConfigSlot<T>::Value ConfigSlot<T>::load() const {
+    if constexpr (scalar) {
+        return current.load(std::memory_order_acquire);
+    } else {
+        return *current.load(std::memory_order_acquire);
+    }
+}
+
+template <typename T>
+void ConfigSlot<T>::store(const T& value) {
+    if constexpr (scalar) {
+        current.store(value, std::memory_order_release);
+    } else {
+        if (!history.empty() && *history.back() == value) {
+            return;
+        }
+        history.push_back(std::make_unique<const T>(value));
+        current.store(history.back().get(), std::memory_order_release);
     }
 }
 
@@ -3,6 +3,153 @@
 //
 
 #include "abstract_graphic_viewer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+namespace
+{
+    // pixels per scene unit rounded down to a power of two, so the decimated copy survives small zoom steps
+    int lod_level_of(qreal pixels_per_unit)
+    {
+        return (int)std::floor(std::log2(std::max(pixels_per_unit, 1e-9)));
+    }
+    QRectF bounds_of(const std::vector<QPointF> &points, qreal margin)
+    {
+        if (points.empty())
+            return QRectF();
+        auto [min_x, max_x] = std::minmax_element(points.begin(), points.end(), [](const auto &a, const auto &b){ return a.x() < b.x(); });
+        auto [min_y, max_y] = std::minmax_element(points.begin(), points.end(), [](const auto &a, const auto &b){ return a.y() < b.y(); });
+        return QRectF(min_x->x() - margin, min_y->y() - margin, max_x->x() - min_x->x() + 2 * margin, max_y->y() - min_y->y() + 2 * margin);
+    }
+    // half the pen in scene units; a cosmetic pen keeps its width in pixels, measured with the last zoom painted
+    qreal margin_of(const QPen &pen, qreal pixels_per_unit)
+    {
+        const qreal width = std::max<qreal>(pen.widthF(), 1);
+        return (pen.isCosmetic() ? width / pixels_per_unit : width) / 2 + 1 / pixels_per_unit;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PointCloudItem::PointCloudItem(const QColor &color, qreal size, bool cosmetic, QGraphicsItem *parent) : QGraphicsItem(parent)
+{
+    pen = QPen(color, size, Qt::SolidLine, Qt::RoundCap);
+    pen.setCosmetic(cosmetic);
+}
+void PointCloudItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+    if (points.empty())
+        return;
+    pixels_per_unit = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int level = lod_level_of(pixels_per_unit);
+    if (not lod_valid or level != lod_level)
+    {
+        lod_level = level;
+        lod_valid = true;
+        lod_points.clear();
+        // one point per pixel, only worth it when there are many more points than pixels under them
+        const qreal cell = std::ldexp(1.0, -level);
+        if ((bounds.width() / cell) * (bounds.height() / cell) < 4.0 * points.size())
+        {
+            std::vector<std::pair<std::uint64_t, std::uint32_t>> keys(points.size());
+            for (std::uint32_t i = 0; i < points.size(); i++)
+            {
+                const auto cx = (std::uint32_t)(std::int32_t)std::floor((points[i].x() - bounds.left()) / cell);
+                const auto cy = (std::uint32_t)(std::int32_t)std::floor((points[i].y() - bounds.top()) / cell);
+                keys[i] = {(std::uint64_t(cx) << 32) | cy, i};
+            }
+            std::sort(keys.begin(), keys.end());
+            for (std::size_t i = 0; i < keys.size(); i++)
+                if (i == 0 or keys[i].first != keys[i - 1].first)
+                    lod_points.push_back(points[keys[i].second]);
+        }
+    }
+    painter->setPen(pen);
+    const auto &drawn = lod_points.empty() ? points : lod_points;
+    painter->drawPoints(drawn.data(), (int)drawn.size());
+}
+void PointCloudItem::clear()
+{
+    points.clear();
+    points_changed();
+}
+void PointCloudItem::set_color(const QColor &color)
+{
+    pen.setColor(color);
+    update();
+}
+void PointCloudItem::set_size(qreal size, bool cosmetic)
+{
+    pen.setWidthF(size);
+    pen.setCosmetic(cosmetic);
+    points_changed();
+}
+void PointCloudItem::points_changed()
+{
+    lod_valid = false;
+    lod_points.clear();
+    const QRectF new_bounds = bounds_of(points, margin_of(pen, pixels_per_unit));
+    if (new_bounds != bounds)
+    {
+        prepareGeometryChange();
+        bounds = new_bounds;
+    }
+    update();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PolylineItem::PolylineItem(const QPen &pen_, QGraphicsItem *parent) : QGraphicsItem(parent), pen(pen_)
+{}
+void PolylineItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+    if (vertices.size() < 2)
+        return;
+    pixels_per_unit = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int level = lod_level_of(pixels_per_unit);
+    if (not lod_valid or level != lod_level)
+    {
+        lod_level = level;
+        lod_valid = true;
+        const qreal min_step = std::ldexp(1.0, -level);
+        lod_vertices.clear();
+        lod_vertices.push_back(vertices.front());
+        for (std::size_t i = 1; i + 1 < vertices.size(); i++)
+            if (std::abs(vertices[i].x() - lod_vertices.back().x()) + std::abs(vertices[i].y() - lod_vertices.back().y()) >= min_step)
+                lod_vertices.push_back(vertices[i]);
+        lod_vertices.push_back(vertices.back());
+    }
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    painter->drawPolyline(lod_vertices.data(), (int)lod_vertices.size());
+}
+void PolylineItem::clear()
+{
+    vertices.clear();
+    path_changed();
+}
+void PolylineItem::set_pen(const QPen &pen_)
+{
+    pen = pen_;
+    path_changed();
+}
+void PolylineItem::path_changed()
+{
+    lod_valid = false;
+    const QRectF new_bounds = bounds_of(vertices, margin_of(pen, pixels_per_unit));
+    if (new_bounds != bounds)
+    {
+        prepareGeometryChange();
+        bounds = new_bounds;
+    }
+    update();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 AbstractGraphicViewer::AbstractGraphicViewer(QWidget *parent, QRectF dim_, bool draw_axis)
 {
     QVBoxLayout *vlayout = new QVBoxLayout(parent);
@@ -55,6 +202,20 @@ void AbstractGraphicViewer::draw_contour()
     auto sr = scene.addRect(r, QPen(QColor("Gray"), 100));
     sr->setZValue(15);
 }
+PointCloudItem* AbstractGraphicViewer::add_point_cloud(const QColor &color, qreal size, bool cosmetic, qreal z)
+{
+    auto item = new PointCloudItem(color, size, cosmetic);
+    item->setZValue(z);
+    scene.addItem(item);
+    return item;
+}
+PolylineItem* AbstractGraphicViewer::add_polyline(const QPen &pen, qreal z)
+{
+    auto item = new PolylineItem(pen);
+    item->setZValue(z);
+    scene.addItem(item);
+    return item;
+}
 QGraphicsPolygonItem* AbstractGraphicViewer::robot_poly()
 {
     return robot_polygon;
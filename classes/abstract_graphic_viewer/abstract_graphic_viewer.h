@@ -15,7 +15,87 @@
 #include <QApplication>
 #include <QVBoxLayout>
 #include <QGraphicsPolygonItem>
+#include <QPainter>
+#include <QPen>
+#include <QStyleOptionGraphicsItem>
 #include <iostream>
+#include <iterator>
+#include <vector>
+
+// Many points as a single scene item: they live in one buffer, refilled in place by set_points, and are painted with
+// one drawPoints call. Use it instead of an ellipse or rect item per point, with one item per color.
+// Zoomed out, the points that fall in the same pixel are drawn once; that decimated copy is recomputed only when the
+// points change or the zoom crosses a power of two.
+class PointCloudItem : public QGraphicsItem
+{
+public:
+    // size: diameter of the points, in pixels if cosmetic, in scene units otherwise
+    explicit PointCloudItem(const QColor &color = QColor("Green"), qreal size = 4, bool cosmetic = true, QGraphicsItem *parent = nullptr);
+
+    QRectF boundingRect() const override
+    { return bounds; };
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+    // any container of points with x() and y(): QPointF, Eigen::Vector2f, Eigen::Vector3f...
+    template <typename Container>
+    void set_points(const Container &new_points)
+    {
+        points.clear();
+        points.reserve(std::size(new_points));
+        for (const auto &p : new_points)
+            points.emplace_back(p.x(), p.y());
+        points_changed();
+    };
+    void clear();
+    void set_color(const QColor &color);
+    void set_size(qreal size, bool cosmetic = true);
+    std::size_t size() const { return points.size(); };
+
+private:
+    void points_changed();
+    std::vector<QPointF> points;
+    QRectF bounds;
+    QPen pen;
+    mutable std::vector<QPointF> lod_points;
+    mutable int lod_level = 0;
+    mutable bool lod_valid = false;
+    mutable qreal pixels_per_unit = 1;      // of the last paint, to size the margin of cosmetic points
+};
+
+// A path as one polyline item, with the same level of detail: vertices closer than a pixel to the previous one are
+// skipped when zoomed out
+class PolylineItem : public QGraphicsItem
+{
+public:
+    explicit PolylineItem(const QPen &pen = QPen(QColor("Orange"), 20), QGraphicsItem *parent = nullptr);
+
+    QRectF boundingRect() const override
+    { return bounds; };
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+    template <typename Container>
+    void set_path(const Container &path)
+    {
+        vertices.clear();
+        vertices.reserve(std::size(path));
+        for (const auto &p : path)
+            vertices.emplace_back(p.x(), p.y());
+        path_changed();
+    };
+    void clear();
+    void set_pen(const QPen &pen);
+    std::size_t size() const { return vertices.size(); };
+
+private:
+    void path_changed();
+    std::vector<QPointF> vertices;
+    QRectF bounds;
+    QPen pen;
+    mutable std::vector<QPointF> lod_vertices;
+    mutable int lod_level = 0;
+    mutable bool lod_valid = false;
+    mutable qreal pixels_per_unit = 1;
+};
 
 
 class AbstractGraphicViewer : public QGraphicsView
@@ -34,6 +114,9 @@ class AbstractGraphicViewer : public QGraphicsView
                                                                            float laser_y_offset= 100,
                                                                            QColor color= QColor("Blue"));
         void draw_contour();
+        // layers owned by the scene, to be refilled every frame with set_points / set_path
+        PointCloudItem* add_point_cloud(const QColor &color = QColor("Green"), qreal size = 4, bool cosmetic = true, qreal z = 10);
+        PolylineItem* add_polyline(const QPen &pen = QPen(QColor("Orange"), 20), qreal z = 10);
         QGraphicsScene scene;
         QGraphicsPolygonItem* robot_poly();
         QGraphicsEllipseItem* laser_in_robot();
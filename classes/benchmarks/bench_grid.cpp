@@ -0,0 +1,282 @@
+//
+// classes/grid2d: Grid::update_map, update_map_dda and update_map_log_odds of a 360 beam scan, compute_path and
+// compute_path_astar across the map, update_costs and update_costs_edt, and DStarLite replanning after cost-only edits
+// of the cells or of the layered costmap. Two kinds of maps:
+//      Synthetic  a 10 x 10 m room with seeded round obstacles, mapped from a ring of scan poses before the timing starts
+//      Recorded   the map of a real run saved with Grid::saveToBinaryFile, given in the environment variable
+//                 RC_BENCH_GRID_MAP. Skipped when it is not set
+// The maps are headless (Grid::initialize_fast without a scene), so no tile items are timed. BM_Initialize compares
+// initialize, which creates an item per tile in a QGraphicsScene with an offscreen QApplication, with initialize_fast
+//
+
+#include <grid2d/grid.h>
+#include <grid2d/dstar_lite.h>
+#include <threadpool/threadpool.h>
+#include <benchmark/benchmark.h>
+#include <QApplication>
+#include <QGraphicsScene>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr float MAX_LASER_RANGE = 6000.f;
+
+    QGraphicsScene &scene()
+    {
+        static int argc = 1;
+        static char name[] = "bench_grid";
+        static char *argv[] = {name, nullptr};
+        static QApplication *app = []()
+        {
+            if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            return new QApplication(argc, argv);
+        }();
+        static QGraphicsScene s;
+        (void)app;
+        return s;
+    }
+
+    struct Obstacle { float x, y, r; };
+
+    std::vector<Obstacle> obstacles()
+    {
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<float> pos(-4000.f, 4000.f), radius(100.f, 400.f);
+        std::vector<Obstacle> o;
+        while (o.size() < 40)
+            if (const Obstacle c{pos(rng), pos(rng), radius(rng)}; std::hypot(c.x, c.y) > c.r + 500.f)  // keep the centre clear
+                o.push_back(c);
+        return o;
+    }
+
+    // 360 beams from robot against the obstacles and the walls of the room, in grid coordinates
+    std::vector<Eigen::Vector2f> scan(const std::vector<Obstacle> &obs, const Eigen::Vector2f &robot)
+    {
+        std::vector<Eigen::Vector2f> points;
+        points.reserve(360);
+        for (int i = 0; i < 360; i++)
+        {
+            const float a = static_cast<float>(i) * static_cast<float>(M_PI) / 180.f;
+            const Eigen::Vector2f d(std::cos(a), std::sin(a));
+            float t = MAX_LASER_RANGE;
+            for (int axis = 0; axis < 2; axis++)
+                if (std::fabs(d[axis]) > 1e-6f)
+                    t = std::min(t, ((d[axis] > 0 ? 4900.f : -4900.f) - robot[axis]) / d[axis]);
+            for (const auto &o : obs)
+            {
+                const Eigen::Vector2f oc = robot - Eigen::Vector2f(o.x, o.y);
+                const float b = oc.dot(d), c = oc.squaredNorm() - o.r * o.r, disc = b * b - c;
+                if (disc >= 0)
+                    if (const float hit = -b - std::sqrt(disc); hit > 0)
+                        t = std::min(t, hit);
+            }
+            points.emplace_back(robot + t * d);
+        }
+        return points;
+    }
+
+    std::vector<Eigen::Vector2f> poses()
+    {
+        std::vector<Eigen::Vector2f> p{Eigen::Vector2f::Zero()};
+        for (int i = 0; i < 16; i++)
+        {
+            const float a = static_cast<float>(i) * static_cast<float>(M_PI) / 8.f;
+            p.emplace_back(3000.f * std::cos(a), 3000.f * std::sin(a));
+        }
+        return p;
+    }
+
+    std::unique_ptr<Grid> synthetic_map()
+    {
+        auto grid = std::make_unique<Grid>();
+        grid->initialize_fast(QRectF(-5000, -5000, 10000, 10000), 100);
+        const auto obs = obstacles();
+        for (const auto &p : poses())
+            grid->update_map(scan(obs, p), p, MAX_LASER_RANGE);
+        grid->update_costs(true);
+        return grid;
+    }
+
+    // nullptr when RC_BENCH_GRID_MAP is not set or can not be read
+    std::unique_ptr<Grid> recorded_map()
+    {
+        const char *file = std::getenv("RC_BENCH_GRID_MAP");
+        if (file == nullptr)
+            return nullptr;
+        auto grid = std::make_unique<Grid>();
+        grid->initialize_fast(QRectF(-5000, -5000, 10000, 10000), 100);
+        if (not grid->readFromBinaryFile(file))
+            return nullptr;
+        return grid;
+    }
+
+    // the map of the benchmark, state.range(0) == 0 synthetic and 1 recorded. Marks the state skipped if there is none
+    std::unique_ptr<Grid> map_of(benchmark::State &state)
+    {
+        auto grid = state.range(0) == 0 ? synthetic_map() : recorded_map();
+        if (not grid)
+            state.SkipWithError("no recorded map, set RC_BENCH_GRID_MAP to a file saved with Grid::saveToBinaryFile");
+        return grid;
+    }
+
+    // 40 x 40 m in 100 mm tiles. mode 0 initialize with tile items, 1 initialize_fast, 2 initialize_fast on 4 workers
+    void BM_Initialize(benchmark::State &state)
+    {
+        const QRectF dim(-20000, -20000, 40000, 40000);
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(0) == 2)
+            pool = std::make_unique<ThreadPool>(4);
+        for (auto _ : state)
+        {
+            Grid grid;
+            if (state.range(0) == 0)
+                grid.initialize(dim, 100, &scene(), false);
+            else
+                grid.initialize_fast(dim, 100, nullptr, pool.get());
+            benchmark::DoNotOptimize(grid.size());
+            state.PauseTiming();
+            for (auto &[key, cell] : grid)   // deleting an item takes it out of the scene
+                delete cell.tile;
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(state.iterations() * 400 * 400);
+    }
+    BENCHMARK(BM_Initialize)->Arg(0)->Arg(1)->Arg(2)->ArgName("mode")->Unit(benchmark::kMillisecond)->UseRealTime();
+
+    // map updates always run on the synthetic room, the scans being generated from it
+    template <int Kind>
+    void BM_UpdateMap(benchmark::State &state)
+    {
+        Grid grid;
+        grid.initialize_fast(QRectF(-5000, -5000, 10000, 10000), 100);
+        const auto obs = obstacles();
+        std::vector<std::pair<Eigen::Vector2f, std::vector<Eigen::Vector2f>>> scans;
+        for (const auto &p : poses())
+            scans.emplace_back(p, scan(obs, p));
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(0) > 0)
+            pool = std::make_unique<ThreadPool>(static_cast<uint32_t>(state.range(0)));
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            const auto &[robot, points] = scans[i++ % scans.size()];
+            if constexpr (Kind == 0)
+                grid.update_map(points, robot, MAX_LASER_RANGE);
+            else if constexpr (Kind == 1)
+                grid.update_map_dda(points, robot, MAX_LASER_RANGE, pool.get());
+            else
+                grid.update_map_log_odds(points, robot, MAX_LASER_RANGE, pool.get());
+        }
+        state.SetItemsProcessed(state.iterations() * 360);
+    }
+    BENCHMARK(BM_UpdateMap<0>)->Name("BM_UpdateMap")->Arg(0)->ArgName("workers");
+    BENCHMARK(BM_UpdateMap<1>)->Name("BM_UpdateMapDDA")->Arg(0)->Arg(4)->ArgName("workers")->UseRealTime();
+    BENCHMARK(BM_UpdateMap<2>)->Name("BM_UpdateMapLogOdds")->Arg(0)->Arg(4)->ArgName("workers")->UseRealTime();
+
+    // corner to corner, so the search crosses the whole map
+    template <bool UseAStar>
+    void BM_ComputePath(benchmark::State &state)
+    {
+        const auto grid = map_of(state);
+        if (not grid)
+            return;
+        const auto &d = grid->dim;
+        const QPointF source(d.left() + 0.1 * d.width(), d.top() + 0.1 * d.height());
+        const QPointF target(d.right() - 0.1 * d.width(), d.bottom() - 0.1 * d.height());
+        std::size_t length = 0;
+        for (auto _ : state)
+        {
+            const auto path = UseAStar ? grid->compute_path_astar(source, target) : grid->compute_path(source, target);
+            length = path.size();
+            benchmark::DoNotOptimize(path.data());
+        }
+        state.counters["path"] = static_cast<double>(length);
+    }
+    BENCHMARK(BM_ComputePath<false>)->Name("BM_ComputePath")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_ComputePath<true>)->Name("BM_ComputePathAStar")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+
+    // full recomputation, every cell marked as changed before each call
+    template <bool Edt>
+    void BM_UpdateCosts(benchmark::State &state)
+    {
+        const auto grid = map_of(state);
+        if (not grid)
+            return;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            grid->mark_all_changed();
+            state.ResumeTiming();
+            if constexpr (Edt)
+                grid->update_costs_edt();
+            else
+                grid->update_costs(true);
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(grid->cells().slots()));
+    }
+    BENCHMARK(BM_UpdateCosts<false>)->Name("BM_UpdateCosts")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_UpdateCosts<true>)->Name("BM_UpdateCostsEDT")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+
+    // DStarLite replanning after a cost-only edit: a 1 x 1 m block around the middle of the first path costs 50 and 1 in
+    // turns, only the compute_path after each edit is timed. Fails if the path does not move off the costly block.
+    // Layered puts the block in the semantic layer of the layered costmap, cleared to NO_INFORMATION in the other turns
+    template <bool Layered>
+    void BM_DStarLiteCostChange(benchmark::State &state)
+    {
+        const auto grid = map_of(state);
+        if (not grid)
+            return;
+        LayeredCostmap::Layer *zones = nullptr;
+        if constexpr (Layered)
+        {
+            zones = grid->enable_layered_costmap().find("semantic");
+            grid->update_costmap();
+        }
+        const auto set_block = [&](const QPolygonF &block, bool costly)
+        {
+            if constexpr (Layered)
+            {
+                zones->fill(grid->rasterize(block), costly ? 50.f : LayeredCostmap::NO_INFORMATION);
+                grid->update_costmap();
+            }
+            else
+                grid->modifyCostInGrid(block, costly ? 50.f : 1.f);
+        };
+        const auto &d = grid->dim;
+        const QPointF source(d.left() + 0.1 * d.width(), d.top() + 0.1 * d.height());
+        const QPointF target(d.right() - 0.1 * d.width(), d.bottom() - 0.1 * d.height());
+        DStarLite planner(*grid);
+        const auto before = planner.compute_path(source, target);
+        if (before.empty())
+        {
+            state.SkipWithError("no path between the corners of the map");
+            return;
+        }
+        const Eigen::Vector2f mid = before[before.size() / 2];
+        const QPolygonF block(QRectF(mid.x() - 500, mid.y() - 500, 1000, 1000));
+        set_block(block, true);
+        if (planner.compute_path(source, target) == before)
+        {
+            state.SkipWithError("the path of DStarLite did not change with the costs");
+            return;
+        }
+        bool costly = true;
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            costly = not costly;
+            set_block(block, costly);
+            state.ResumeTiming();
+            const auto path = planner.compute_path(source, target);
+            benchmark::DoNotOptimize(path.data());
+        }
+        state.counters["expanded"] = static_cast<double>(planner.expanded());
+    }
+    BENCHMARK(BM_DStarLiteCostChange<false>)->Name("BM_DStarLiteCostChange")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_DStarLiteCostChange<true>)->Name("BM_DStarLiteCostChangeLayered")->Arg(0)->Arg(1)->ArgName("recorded")->Unit(benchmark::kMillisecond);
+}
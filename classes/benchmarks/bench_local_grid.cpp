@@ -0,0 +1,120 @@
+//
+// classes/local_grid: polar updates of an egocentric Local_Grid (360 degrees in 2 degree bins, 4 m in 100 mm bins) with
+// a seeded scan of angle, range pairs, counts and fixed-point log odds, the 3D point update and the scoring of 500
+// (v, w) rollouts against the map of that scan
+//
+
+#include <local_grid/local_grid.h>
+#include <threadpool/threadpool.h>
+#include <benchmark/benchmark.h>
+#include <QApplication>
+#include <QGraphicsScene>
+#include <random>
+#include <vector>
+
+namespace
+{
+    constexpr float MAX_LASER_RANGE = 4000.f;
+
+    QGraphicsScene &scene()
+    {
+        static int argc = 1;
+        static char name[] = "bench_local_grid";
+        static char *argv[] = {name, nullptr};
+        static QApplication *app = []()
+        {
+            if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            return new QApplication(argc, argv);
+        }();
+        static QGraphicsScene s;
+        (void)app;
+        return s;
+    }
+
+    void initialize(Local_Grid &grid)
+    {
+        grid.initialize(Local_Grid::Ranges{-180.f, 180.f, 2.f}, Local_Grid::Ranges{0.f, MAX_LASER_RANGE, 100.f}, &scene());
+    }
+
+    // one beam per degree: x is the angle, y the range
+    std::vector<Eigen::Vector2f> polar_scan()
+    {
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<float> range(300.f, 1.2f * MAX_LASER_RANGE);
+        std::vector<Eigen::Vector2f> points;
+        for (int a = -180; a < 180; a++)
+            points.emplace_back(static_cast<float>(a), std::min(range(rng), MAX_LASER_RANGE));
+        return points;
+    }
+
+    void BM_PolarData(benchmark::State &state)
+    {
+        Local_Grid grid;
+        initialize(grid);
+        const auto points = polar_scan();
+        for (auto _ : state)
+            grid.update_map_from_polar_data(points, MAX_LASER_RANGE);
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(points.size()));
+    }
+    BENCHMARK(BM_PolarData);
+
+    void BM_PolarDataLogOdds(benchmark::State &state)
+    {
+        Local_Grid grid;
+        initialize(grid);
+        const auto points = polar_scan();
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(0) > 0)
+            pool = std::make_unique<ThreadPool>(static_cast<uint32_t>(state.range(0)));
+        for (auto _ : state)
+            grid.update_map_from_polar_data_log_odds(points, MAX_LASER_RANGE, pool.get());
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(points.size()));
+    }
+    BENCHMARK(BM_PolarDataLogOdds)->Arg(0)->Arg(4)->ArgName("workers")->UseRealTime();
+
+    // x, y, z rows of a seeded cloud around the robot, as a depth camera gives them
+    void BM_3DPoints(benchmark::State &state)
+    {
+        Local_Grid grid;
+        initialize(grid);
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<float> xy(-MAX_LASER_RANGE, MAX_LASER_RANGE), z(0.f, 2000.f);
+        std::vector<float> xyz(3 * state.range(0));
+        for (std::size_t i = 0; i < xyz.size(); i += 3)
+        {
+            xyz[i] = xy(rng);
+            xyz[i + 1] = xy(rng);
+            xyz[i + 2] = z(rng);
+        }
+        for (auto _ : state)
+            grid.update_map_from_3D_points(xyz.data(), state.range(0), 3);
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(BM_3DPoints)->Arg(1 << 14)->Arg(1 << 18)->ArgName("points");
+
+    // 25 speeds x 20 turn rates, 2 s ahead
+    void BM_Rollouts(benchmark::State &state)
+    {
+        Local_Grid grid;
+        initialize(grid);
+        grid.update_map_from_polar_data(polar_scan(), MAX_LASER_RANGE);
+        grid.update_costs(true);
+        std::vector<RolloutKernel::Arc> arcs;
+        for (int i = 0; i < 25; i++)
+            for (int j = 0; j < 20; j++)
+                arcs.push_back(RolloutKernel::Arc{50.f + 40.f * i, -1.f + 0.1f * j});
+        grid.set_rollout_arcs(arcs);
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(0) > 0)
+            pool = std::make_unique<ThreadPool>(static_cast<uint32_t>(state.range(0)));
+        std::vector<RolloutKernel::Score> scores;
+        for (auto _ : state)
+        {
+            grid.evaluate_rollouts(scores, pool.get());
+            benchmark::DoNotOptimize(scores.data());
+        }
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(arcs.size()));
+    }
+    BENCHMARK(BM_Rollouts)->Arg(0)->Arg(4)->ArgName("workers")->UseRealTime();
+}
@@ -0,0 +1,46 @@
+//
+// classes/logpolar: LPolar::convert and convertPromedio of a 640x480 frame, grey and color, serial and on a ThreadPool.
+// The frame is seeded noise, so every run converts the same pixels
+//
+
+#include <logpolar/lpolar.h>
+#include <threadpool/threadpool.h>
+#include <benchmark/benchmark.h>
+#include <memory>
+
+namespace
+{
+    cv::Mat frame(int channels)
+    {
+        cv::Mat m(480, 640, CV_8UC(channels));
+        cv::theRNG().state = 42;
+        cv::randu(m, cv::Scalar::all(0), cv::Scalar::all(255));
+        return m;
+    }
+
+    // state.range(0) channels, state.range(1) pool workers (0 for the calling thread)
+    template <bool Averaged>
+    void BM_Convert(benchmark::State &state)
+    {
+        LPolar lp(64, 128, 480, 480);
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(1) > 0)
+        {
+            pool = std::make_unique<ThreadPool>(static_cast<uint32_t>(state.range(1)));
+            lp.setThreadPool(pool.get());
+        }
+        const cv::Mat in = frame(static_cast<int>(state.range(0)));
+        cv::Mat out;
+        for (auto _ : state)
+        {
+            if constexpr (Averaged)
+                lp.convertPromedio(in, out);
+            else
+                lp.convert(in, out);
+            benchmark::DoNotOptimize(out.data);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(BM_Convert<false>)->Name("BM_Convert")->ArgsProduct({{1, 3}, {0, 4}})->ArgNames({"channels", "workers"})->UseRealTime();
+    BENCHMARK(BM_Convert<true>)->Name("BM_ConvertPromedio")->ArgsProduct({{1, 3}, {0, 4}})->ArgNames({"channels", "workers"})->UseRealTime();
+}
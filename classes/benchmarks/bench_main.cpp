@@ -0,0 +1,25 @@
+//
+// main of the benchmarks: the JSON output carries the revision and build type it was measured on, so results taken at
+// different releases can be told apart and compared with benchmark's tools/compare.py
+//
+
+#include <benchmark/benchmark.h>
+
+#ifndef ROBOCOMP_GIT_REVISION
+#define ROBOCOMP_GIT_REVISION "unknown"
+#endif
+#ifndef ROBOCOMP_BUILD_TYPE
+#define ROBOCOMP_BUILD_TYPE "unknown"
+#endif
+
+int main(int argc, char **argv)
+{
+    benchmark::AddCustomContext("robocomp_revision", ROBOCOMP_GIT_REVISION);
+    benchmark::AddCustomContext("robocomp_build_type", ROBOCOMP_BUILD_TYPE);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,95 @@
+//
+// classes/particleFiltering: RCParticleFilter::step of a 2D localization filter (landmark ranges, odometry control),
+// serial and on a ThreadPool, with the stream seeded so every run draws the same particles
+//
+
+#include <particleFiltering/particleFilter.h>
+#include <benchmark/benchmark.h>
+#include <array>
+#include <span>
+
+namespace
+{
+    struct Ranges
+    {
+        std::array<double, 16> landmarks_x, landmarks_y, measured;
+    };
+    struct Odometry
+    {
+        double x = 0, y = 0, angle = 0;
+    };
+
+    class Pose : public RCParticleFilter_StaticParticle<Pose, Ranges, Odometry>
+    {
+        public:
+            void initialize(const Ranges &, const Odometry &control, const RCParticleFilter_Config *)
+            {
+                thread_local std::mt19937_64 rng(7);
+                std::normal_distribution<double> n(0., 500.);
+                x = control.x + n(rng);
+                y = control.y + n(rng);
+                angle = control.angle;
+            }
+            void adapt(const Odometry &back, const Odometry &now, bool, std::mt19937_64 &rng)
+            {
+                std::normal_distribution<double> n(0., 20.), a(0., 0.02);
+                x += now.x - back.x + n(rng);
+                y += now.y - back.y + n(rng);
+                angle += now.angle - back.angle + a(rng);
+            }
+            void computeWeight(const Ranges &data)
+            {
+                double e = 0;
+                for (std::size_t i = 0; i < data.measured.size(); i++)
+                {
+                    const double d = std::hypot(data.landmarks_x[i] - x, data.landmarks_y[i] - y) - data.measured[i];
+                    e += d * d;
+                }
+                weight = std::exp(-e / (2. * 100. * 100. * static_cast<double>(data.measured.size())));
+            }
+            double x = 0, y = 0, angle = 0;
+    };
+
+    Ranges ranges_from(const Odometry &pose)
+    {
+        Ranges r;
+        std::mt19937_64 rng(11);
+        std::uniform_real_distribution<double> u(-5000., 5000.);
+        for (std::size_t i = 0; i < r.measured.size(); i++)
+        {
+            r.landmarks_x[i] = u(rng);
+            r.landmarks_y[i] = u(rng);
+            r.measured[i] = std::hypot(r.landmarks_x[i] - pose.x, r.landmarks_y[i] - pose.y);
+        }
+        return r;
+    }
+
+    // state.range(0) particles, state.range(1) pool workers (0 for the serial filter)
+    void BM_Step(benchmark::State &state)
+    {
+        RCParticleFilter_Config config;
+        config.particles = static_cast<uint32_t>(state.range(0));
+        Odometry pose;
+        const Ranges first = ranges_from(pose);
+        RCParticleFilter<Ranges, Odometry, Pose> pf(&config, first, pose);
+        pf.seed(1234);
+        std::unique_ptr<ThreadPool> pool;
+        if (state.range(1) > 0)
+        {
+            pool = std::make_unique<ThreadPool>(static_cast<uint32_t>(state.range(1)));
+            pf.setThreadPool(pool.get());
+        }
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            pose.x += 10.;
+            pose.angle += 0.001;
+            const Ranges data = ranges_from(pose);
+            state.ResumeTiming();
+            pf.step(data, pose);
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.counters["ess"] = pf.effectiveSampleSize();
+    }
+    BENCHMARK(BM_Step)->ArgsProduct({{1000, 10000, 100000}, {0, 4}})->ArgNames({"particles", "workers"})->UseRealTime();
+}
@@ -0,0 +1,58 @@
+//
+// classes/simplifypath: recursive simplifyWithRDP against the iterative simplifyRDP, on a seeded noisy random walk
+//
+
+#include <simplifypath/simplifyPath.h>
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+    std::vector<Point> random_walk(std::size_t n)
+    {
+        std::mt19937_64 rng(42);
+        std::normal_distribution<double> turn(0., 0.2), noise(0., 5.);
+        std::vector<Point> points;
+        points.reserve(n);
+        double x = 0, y = 0, heading = 0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            heading += turn(rng);
+            x += 50. * std::cos(heading);
+            y += 50. * std::sin(heading);
+            points.emplace_back(x + noise(rng), y + noise(rng));
+        }
+        return points;
+    }
+
+    void BM_SimplifyWithRDP(benchmark::State &state)
+    {
+        const auto points = random_walk(state.range(0));
+        const simplifyPath s;
+        for (auto _ : state)
+        {
+            auto copy = points;
+            auto simplified = s.simplifyWithRDP(copy, 20.);
+            benchmark::DoNotOptimize(simplified.data());
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(BM_SimplifyWithRDP)->RangeMultiplier(8)->Range(64, 1 << 15);
+
+    void BM_SimplifyRDP(benchmark::State &state)
+    {
+        const auto points = random_walk(state.range(0));
+        const simplifyPath s;
+        std::vector<std::uint32_t> kept;
+        std::size_t size = 0;
+        for (auto _ : state)
+        {
+            size = s.simplifyRDP(points, 20., kept);
+            benchmark::DoNotOptimize(kept.data());
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.counters["kept"] = static_cast<double>(size);
+    }
+    BENCHMARK(BM_SimplifyRDP)->RangeMultiplier(8)->Range(64, 1 << 15);
+}
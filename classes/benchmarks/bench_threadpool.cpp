@@ -0,0 +1,97 @@
+//
+// classes/threadpool: cost of spawn_task and spawn_task_waitable, latency from the spawn of a task to its start, and
+// parallel_for over a scan sized range, for both queue modes
+//
+
+#include <threadpool/threadpool.h>
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    ThreadPool::Mode mode_of(const benchmark::State &state)
+    {
+        return state.range(0) == 0 ? ThreadPool::Mode::SHARED_QUEUE : ThreadPool::Mode::WORK_STEALING;
+    }
+
+    // fire and forget tasks, state.range(1) of them per iteration
+    void BM_Spawn(benchmark::State &state)
+    {
+        ThreadPool pool(4, mode_of(state));
+        std::atomic<int64_t> done{0};
+        const auto tasks = state.range(1);
+        int64_t expected = 0;
+        for (auto _ : state)
+        {
+            for (int64_t i = 0; i < tasks; i++)
+                pool.spawn_task([&done]() { done.fetch_add(1, std::memory_order_release); });
+            expected += tasks;
+            while (done.load(std::memory_order_acquire) != expected)
+                std::this_thread::yield();
+        }
+        state.SetItemsProcessed(state.iterations() * tasks);
+    }
+    BENCHMARK(BM_Spawn)->ArgsProduct({{0, 1}, {1, 64, 1024}})->ArgNames({"stealing", "tasks"})->UseRealTime();
+
+    void BM_SpawnWaitable(benchmark::State &state)
+    {
+        ThreadPool pool(4, mode_of(state));
+        const auto tasks = state.range(1);
+        std::vector<TaskFuture<int64_t>> futures;
+        futures.reserve(tasks);
+        for (auto _ : state)
+        {
+            futures.clear();
+            for (int64_t i = 0; i < tasks; i++)
+                futures.push_back(pool.spawn_task_waitable([i]() { return i; }));
+            int64_t sum = 0;
+            for (auto &f : futures)
+                sum += f.get();
+            benchmark::DoNotOptimize(sum);
+        }
+        state.SetItemsProcessed(state.iterations() * tasks);
+    }
+    BENCHMARK(BM_SpawnWaitable)->ArgsProduct({{0, 1}, {1, 64, 1024}})->ArgNames({"stealing", "tasks"})->UseRealTime();
+
+    // time from spawn_task to the first instruction of the task, on an idle pool
+    void BM_Latency(benchmark::State &state)
+    {
+        ThreadPool pool(4, mode_of(state));
+        double total = 0, worst = 0;
+        for (auto _ : state)
+        {
+            std::promise<clock::time_point> started;
+            auto f = started.get_future();
+            const auto sent = clock::now();
+            pool.spawn_task([&started]() { started.set_value(clock::now()); });
+            const double us = std::chrono::duration<double, std::micro>(f.get() - sent).count();
+            total += us;
+            worst = std::max(worst, us);
+        }
+        state.counters["latency_us"] = benchmark::Counter(total / static_cast<double>(state.iterations()));
+        state.counters["max_latency_us"] = worst;
+    }
+    BENCHMARK(BM_Latency)->Arg(0)->Arg(1)->ArgName("stealing")->UseRealTime();
+
+    void BM_ParallelFor(benchmark::State &state)
+    {
+        ThreadPool pool(4, mode_of(state));
+        std::vector<float> in(state.range(1)), out(in.size());
+        for (std::size_t i = 0; i < in.size(); i++)
+            in[i] = static_cast<float>(i);
+        for (auto _ : state)
+        {
+            pool.parallel_for(0, in.size(), 1024, [&](std::size_t i) { out[i] = std::sqrt(in[i]) * std::sin(in[i]); });
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(1));
+    }
+    BENCHMARK(BM_ParallelFor)->ArgsProduct({{0, 1}, {1 << 12, 1 << 16, 1 << 20}})->ArgNames({"stealing", "n"})->UseRealTime();
+}
@@ -8,13 +8,24 @@
 #include <math.h>
 
 #include <algorithm>
+#include <numeric>
 #include <vector>
 #include <string>
 
-#include <QObject>
+#include <random/xoshiro.h>
 
 #define BIASED_MULT 1000000.
 
+// Weighted random choice of candidate ids.
+// - Cumulative mode: sort() orders the candidates by decreasing weight and get() searches the cumulative weights, O(log N).
+// - Alias mode: get() is O(1) with the alias method (Vose), whose table is rebuilt in O(N) on the first get() after the
+//   weights change; setWeight does not sort. getFirst() and getNumber(n) are then answered from a partial sort of the
+//   first n + 1 candidates, made when they are called.
+//	BiasedSelector s(particles);
+//	s.setMode(BiasedSelector::Alias);
+//	for (i...) s.setWeight(i, w[i], false);
+//	for (i...) chosen[i] = s.get();
+
 struct BiasedCandidate
 {
 public:
@@ -31,7 +42,9 @@ class BiasedSelector
 {
 public:
 	// Constructor. The parameter 'size' stands for the maximum number of candidates.
-	BiasedSelector(uint32_t size=1)
+	enum Mode { Cumulative, Alias };
+
+	BiasedSelector(uint32_t size=1, Mode mode_=Cumulative) : mode(mode_)
 	{
 		resize(size, true);
 		totalWeight = 0.;
@@ -51,8 +64,14 @@ public:
 	{
 		candidates = other.candidates;
 		totalWeight = other.totalWeight;
+		mode = other.mode;
+		rng = other.rng;
+		changed();
 	}
 
+	void setMode(Mode m) { mode = m; changed(); }
+	void seed(uint64_t s) { rng.seed(s); }
+
 	double getTotalWeight() { return totalWeight; }
 
 	void resize(size_t size, bool initialize=false)
@@ -67,14 +86,29 @@ public:
 				candidates[i].weight = 0.;
 			}
 		}
+		totalWeight = 0.;
+		for (const auto &c : candidates)
+			totalWeight += c.weight;
+		changed();
 	}
 	uint32_t getFirst()
 	{
-		return candidates[0].id;
+		return getNumber(0);
 	}
 	uint32_t getNumber(uint32_t n)
 	{
-		return candidates[n].id;
+		if (mode == Cumulative)
+			return candidates[n].id;
+		if (ordered <= n)
+		{
+			// partial sort of positions, candidates keep their order so that setWeight finds them directly
+			order.resize(candidates.size());
+			std::iota(order.begin(), order.end(), 0);
+			ordered = std::min<size_t>(std::max<size_t>(2 * n + 1, 16), candidates.size());
+			std::partial_sort(order.begin(), order.begin() + ordered, order.end(),
+				[this](uint32_t a, uint32_t b) { return candidates[a].weight > candidates[b].weight; });
+		}
+		return candidates[order[n]].id;
 	}
 	uint32_t get()
 	{
@@ -82,13 +116,17 @@ public:
 		{
 			throw std::string("BiasedSelector::Error: No possible choice.");
 		}
-		const long double result = fmodl(qrand()/RAND_MAX, totalWeight);
-		for (size_t i=0; i<candidates.size(); i++)
+		if (mode == Alias)
 		{
-			if (candidates[i].accum >= result)
-				return candidates[i].id;
+			if (not aliasValid)
+				buildAlias();
+			const uint32_t i = rng.below(candidates.size());
+			return candidates[rng.uniform() < aliasProb[i] ? i : aliasIndex[i]].id;
 		}
-		return candidates[0].id;
+		const double result = rng.uniform() * totalWeight;
+		auto it = std::upper_bound(candidates.begin(), candidates.end(), result,
+			[](double r, const BiasedCandidate &c) { return r < c.accum; });
+		return it == candidates.end() ? candidates.back().id : it->id;
 	}
 	double getWeight(uint32_t id)
 	{
@@ -105,6 +143,16 @@ public:
 	{
 		if (p<0.)
 			throw std::string("Me does not allows negatif veilius");
+		changed();
+		// unsorted candidates are still at the position of their id
+		if (id < candidates.size() and candidates[id].id == id)
+		{
+			totalWeight += BIASED_MULT * p - candidates[id].weight;
+			candidates[id].weight = BIASED_MULT * p;
+			if (perform_sort and mode == Cumulative)
+				sort();
+			return false;
+		}
 		for (size_t i=0; i<candidates.size(); ++i)
 		{
 			if (candidates[i].id == id)
@@ -112,14 +160,20 @@ public:
 				totalWeight -= candidates[i].weight;
 				candidates[i].weight = BIASED_MULT * p;
 				totalWeight += candidates[i].weight;
-				if (perform_sort)
+				if (perform_sort and mode == Cumulative)
 					sort();
 			}
 		}
 		return false;
 	}
+	// Cumulative mode: orders the candidates for get(). Alias mode: builds the table now instead of in the next get()
 	void sort()
 	{
+		if (mode == Alias)
+		{
+			buildAlias();
+			return;
+		}
 		std::sort(candidates.begin(), candidates.end(), BiasedCandidate());
 		double accum = 0;
 		for (size_t i=0; i<candidates.size(); ++i)
@@ -127,7 +181,7 @@ public:
 			accum += candidates[i].weight;
 			candidates[i].accum = accum;
 		}
-		totalWeight = candidates[candidates.size()-1].accum;
+		totalWeight = accum;
 	}
 	void print()
 	{
@@ -140,6 +194,56 @@ public:
 
 	std::vector<BiasedCandidate> candidates;
 	double totalWeight;
+
+private:
+	Mode mode;
+	Xoshiro256 rng;
+	// alias table over the positions of the candidates, and positions by decreasing weight, valid up to 'ordered'
+	std::vector<double> aliasProb;
+	std::vector<uint32_t> aliasIndex, small, large, order;
+	bool aliasValid = false;
+	size_t ordered = 0;
+
+	void changed()
+	{
+		aliasValid = false;
+		ordered = 0;
+	}
+
+	// Vose's alias method: every column holds a share of one candidate and the rest of another one
+	void buildAlias()
+	{
+		const size_t n = candidates.size();
+		aliasProb.resize(n);
+		aliasIndex.resize(n);
+		small.clear();
+		large.clear();
+		double total = 0.;
+		for (const auto &c : candidates)
+			total += c.weight;
+		for (size_t i=0; i<n; ++i)
+		{
+			aliasProb[i] = candidates[i].weight * n / total;
+			aliasIndex[i] = i;
+			(aliasProb[i] < 1. ? small : large).push_back(i);
+		}
+		while (not small.empty() and not large.empty())
+		{
+			const uint32_t s = small.back(), l = large.back();
+			small.pop_back();
+			aliasIndex[s] = l;
+			aliasProb[l] -= 1. - aliasProb[s];
+			if (aliasProb[l] < 1.)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		// left overs are full columns, up to rounding
+		for (auto i : small) aliasProb[i] = 1.;
+		for (auto i : large) aliasProb[i] = 1.;
+		aliasValid = true;
+	}
 };
 
 #endif
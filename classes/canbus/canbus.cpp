@@ -1,4 +1,5 @@
 #include "canbus.h"
+#include <stdexcept>
 
 
 /**
@@ -25,7 +26,7 @@ CanBus::CanBus(QString device, int baudRate)
 */
 CanBus::~CanBus()
 {
-	
+	stopAsync();
 }
 /// PRIVATE METHODS
 int CanBus::setBaudRate(int baudRate)
@@ -66,6 +67,20 @@ int CanBus::setBaudRate(int baudRate)
 
 int CanBus::writeWaitReadMessage(VSCAN_MSG* msg)
 {
+	if (isAsync())
+	{
+		try
+		{
+			*msg = asyncRequest(*msg).get();
+			return 1;
+		}
+		catch (const std::exception &e)
+		{
+			printf("writeWaitReadMessage() ERROR: %s\n", e.what());
+			printMessageData(*msg);
+			return -1;
+		}
+	}
 	DWORD written,read;
 	VSCAN_MSG sended;
 	int retries=0, right_response = 0;
@@ -116,6 +131,26 @@ int CanBus::writeWaitReadMessage(VSCAN_MSG* msg)
 
 int CanBus::multiWriteWaitReadMessage(VSCAN_MSG* msgs, int msg_count)
 {
+	if (isAsync())
+	{
+		// all requests in flight at once, every answer is stored over its request
+		std::vector<std::future<VSCAN_MSG> > answers = asyncRequests(msgs, msg_count);
+		int result = 1;
+		for (int i=0; i<msg_count; i++)
+		{
+			try
+			{
+				msgs[i] = answers[i].get();
+			}
+			catch (const std::exception &e)
+			{
+				printf("multiWriteWaitReadMessage() ERROR: %s\n", e.what());
+				printMessageData(msgs[i]);
+				result = -1;
+			}
+		}
+		return result;
+	}
 	int status, retries=0;
 	uint8_t rec_count = 0, count_readed = 0;
 	DWORD   written,read;
@@ -193,6 +228,171 @@ int CanBus::checkMessage(VSCAN_MSG *send, VSCAN_MSG *received)
 	return correct;
 }
 
+/// ASYNCHRONOUS MODE
+
+bool CanBus::startAsync(size_t ringCapacity, std::chrono::microseconds timeout)
+{
+	if (rxRunning.load())
+		return true;
+	if (devHandler < 0)
+		return false;
+	requestTimeout = timeout;
+	ring.reset(new CanFrameRing(ringCapacity));
+	rxRunning = true;
+	rxThread = std::thread(&CanBus::rxLoop, this);
+	return true;
+}
+
+void CanBus::stopAsync()
+{
+	if (not rxRunning.exchange(false))
+		return;
+	rxThread.join();
+	expirePending(true);
+}
+
+std::future<VSCAN_MSG> CanBus::asyncRequest(const VSCAN_MSG &msg)
+{
+	return std::move(asyncRequests(&msg, 1).front());
+}
+
+std::vector<std::future<VSCAN_MSG> > CanBus::asyncRequests(const VSCAN_MSG *msgs, int msg_count)
+{
+	std::vector<std::future<VSCAN_MSG> > answers(msg_count);
+	std::vector<std::promise<VSCAN_MSG> > unanswered;
+	std::vector<int> unansweredIndex;
+	// registered before writing, so that an early answer finds its request
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		const auto deadline = std::chrono::steady_clock::now() + requestTimeout;
+		for (int i=0; i<msg_count; i++)
+		{
+			uint32_t key;
+			if (responseKey(msgs[i], true, key))
+			{
+				auto it = pending.emplace(key, Pending());
+				it->second.deadline = deadline;
+				answers[i] = it->second.promise.get_future();
+			}
+			else
+			{
+				unanswered.emplace_back();
+				answers[i] = unanswered.back().get_future();
+				unansweredIndex.push_back(i);
+			}
+		}
+	}
+	DWORD written = 0;
+	int status;
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		status = VSCAN_Write(devHandler, const_cast<VSCAN_MSG *>(msgs), msg_count, &written);
+		VSCAN_Flush(devHandler);
+	}
+	for (size_t u=0; u<unanswered.size(); u++)
+	{
+		if (status == 0)
+			unanswered[u].set_value(msgs[unansweredIndex[u]]);
+		else
+			unanswered[u].set_exception(std::make_exception_ptr(std::runtime_error("CanBus: write failed")));
+	}
+	if (status != 0)
+	{
+		// the requests written, if any, may still be answered; the rest fail at their deadline
+		printf("asyncRequests() ERROR: El comando no se escribio correctamente\n");
+	}
+	return answers;
+}
+
+bool CanBus::takeFrame(VSCAN_MSG &msg)
+{
+	return ring and ring->pop(msg);
+}
+
+bool CanBus::responseKey(const VSCAN_MSG &msg, bool request, uint32_t &key)
+{
+	const uint32_t node = msg.Id & 0x7F;
+	switch (msg.Id & 0x780)
+	{
+		case 0x600:		// SDO request, answered on 0x580 with the same object index
+			if (not request)
+				return false;
+			key = ((0x580 | node) << 16) | msg.Data[1] | (msg.Data[2] << 8);
+			return true;
+		case 0x580:
+			if (request)
+				return false;
+			key = (msg.Id << 16) | msg.Data[1] | (msg.Data[2] << 8);
+			return true;
+		case 0x300:		// Faulhaber command, answered on 0x280 with the same command byte
+			if (not request)
+				return false;
+			key = ((0x280 | node) << 16) | msg.Data[0];
+			return true;
+		case 0x280:
+			if (request)
+				return false;
+			key = (msg.Id << 16) | msg.Data[0];
+			return true;
+		default:
+			return false;
+	}
+}
+
+void CanBus::rxLoop()
+{
+	const int RX_BATCH = 64;
+	VSCAN_MSG frames[RX_BATCH];
+	while (rxRunning.load(std::memory_order_relaxed))
+	{
+		DWORD read = 0;
+		if (VSCAN_Read(devHandler, frames, RX_BATCH, &read) == 0 and read != 0)
+		{
+			for (DWORD i=0; i<read; i++)
+				dispatch(frames[i]);
+		}
+		else
+			usleep(100);
+		expirePending(false);
+	}
+}
+
+void CanBus::dispatch(const VSCAN_MSG &frame)
+{
+	uint32_t key;
+	if (responseKey(frame, false, key))
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		auto it = pending.lower_bound(key);
+		if (it != pending.end() and it->first == key)
+		{
+			it->second.promise.set_value(frame);
+			pending.erase(it);
+			return;
+		}
+	}
+	if (not ring->push(frame))
+		dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CanBus::expirePending(bool all)
+{
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	if (pending.empty())
+		return;
+	const auto now = std::chrono::steady_clock::now();
+	for (auto it = pending.begin(); it != pending.end(); )
+	{
+		if (all or it->second.deadline <= now)
+		{
+			it->second.promise.set_exception(std::make_exception_ptr(std::runtime_error(all ? "CanBus: asynchronous mode stopped" : "CanBus: no answer in time")));
+			it = pending.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
 //Check mensajes: 
 //enviado  => printMessageData() Id: 0x601, Size: 0X8 | Cmd Type: 0x2b, Obj. Id: 0x40 0x60, SubId: 00, Data: 0x6  00 00 00
 //recivido => printMessageData() Id: 0x581, Size: 0X8 | Cmd Type: 0x60, Obj. Id: 0x40 0x60, SubId: 00, Data: 00  00 00 00
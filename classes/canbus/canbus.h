@@ -25,6 +25,14 @@
 #include <stdint.h>
 #include <limits.h>
 #include <QtCore>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <qlog/qlog.h>
 
@@ -38,6 +46,47 @@
 #define MAX_READ_RETRIES 20
 
 
+// Single producer, single consumer ring of CAN frames, without locks: the receive thread of CanBus pushes and one
+// consumer thread pops. The capacity is rounded up to a power of two; push fails when the ring is full
+class CanFrameRing
+{
+  public:
+	explicit CanFrameRing(size_t capacity)
+	{
+		size_t c = 1;
+		while (c < capacity)
+			c <<= 1;
+		slots.reset(new VSCAN_MSG[c]);
+		mask = c - 1;
+	}
+	bool push(const VSCAN_MSG &m)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask)
+			return false;
+		slots[h & mask] = m;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	bool pop(VSCAN_MSG &m)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		m = slots[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+  private:
+	std::unique_ptr<VSCAN_MSG[]> slots;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head{0};
+	alignas(64) std::atomic<size_t> tail{0};
+};
+
+
 class CanBus
 {
   public:
@@ -56,13 +105,46 @@ class CanBus
 	int readIntegerResponse(VSCAN_MSG msg);
 	
 	int checkMessage(VSCAN_MSG* send, VSCAN_MSG* received);
-	
+
+	// Asynchronous mode. A receive thread drains the adapter. A frame answering a pending request completes the future
+	// of that request; requests and answers are matched by the COB-ID of the answer and the object index (SDO) or
+	// command (Faulhaber 0x300). Every other frame goes to a lock free ring of 'ringCapacity' frames, read with
+	// takeFrame. Requests to different nodes can be in flight at the same time. Requests without an answer for
+	// 'timeout' fail with std::runtime_error. Frames that expect no answer (NMT, SYNC, PDO) complete when written.
+	// writeWaitReadMessage and multiWriteWaitReadMessage keep their interface and wait on these futures.
+	bool startAsync(size_t ringCapacity = 1024, std::chrono::microseconds timeout = std::chrono::milliseconds(50));
+	void stopAsync();
+	bool isAsync() const { return rxRunning.load(); }
+	std::future<VSCAN_MSG> asyncRequest(const VSCAN_MSG &msg);
+	// All the frames with one write, e.g. a request per joint
+	std::vector<std::future<VSCAN_MSG> > asyncRequests(const VSCAN_MSG *msgs, int msg_count);
+	// Oldest frame received that answered no request. Only one thread may take frames
+	bool takeFrame(VSCAN_MSG &msg);
+	// Frames lost because the ring was full
+	uint64_t droppedFrames() const { return dropped.load(); }
+
 //   private:
 	int devHandler;
 	
+  private:
+	struct Pending
+	{
+		std::promise<VSCAN_MSG> promise;
+		std::chrono::steady_clock::time_point deadline;
+	};
+	// key of the answer a request expects, or of a received frame. False if there is none
+	static bool responseKey(const VSCAN_MSG &msg, bool request, uint32_t &key);
+	void rxLoop();
+	void dispatch(const VSCAN_MSG &frame);
+	void expirePending(bool all);
 
-	
-	
+	std::thread rxThread;
+	std::atomic<bool> rxRunning{false};
+	std::mutex writeMutex, pendingMutex;
+	std::multimap<uint32_t, Pending> pending;     // equal keys are answered in request order
+	std::unique_ptr<CanFrameRing> ring;
+	std::atomic<uint64_t> dropped{0};
+	std::chrono::microseconds requestTimeout;
 };
 
 
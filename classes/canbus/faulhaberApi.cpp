@@ -1,4 +1,5 @@
 #include "faulhaberApi.h"
+#include <algorithm>
 
 /**
 * \brief Default constructor
@@ -18,6 +19,15 @@ FaulHaberApi::~FaulHaberApi()
 
 void FaulHaberApi::Init_Node(int id)
 {
+	//PDO mappings can only be changed in pre-operational, before the node is started below
+	if (pdo)
+	{
+		msg = buildMessageData(CanOpenId,id,2,0x80,id,0x00,0x00000000);
+		writeWaitReadMessage(&msg);
+		if (configurePdo(id) != 1)
+			printf("Init_Node() ERROR: PDO mapping of node %d failed\n", id);
+	}
+
 	//tres tramas iniciales
 
 	msg = buildMessageData(CanOpenId,id,2,0x01,0x0000,0x00,0x00000000);
@@ -59,6 +69,11 @@ void FaulHaberApi::Init_Node(int id)
 
 int FaulHaberApi::getPosition(int id)
 {
+	if (pdo)
+	{
+		JointState state;
+		return cachedState(id, state) ? state.position : -1;
+	}
 
 	//qDebug()<<"read position"<<id;
 	//msg = buildMessageData(WriteObjectId,id,8,0x40,0x0000,0x00,0x00000000);
@@ -110,6 +125,19 @@ void FaulHaberApi::setInternalEncoderValue(int id, int value)
 
 int FaulHaberApi::syncGetPosition(int node_count,int* nodeIds,int* positions)
 {
+	if (pdo)
+	{
+		int status = syncCycle() == (int)pdoNodes.size() ? 1 : -1;
+		JointState state;
+		for(int count=0;count<node_count;count++)
+		{
+			if (cachedState(nodeIds[count], state))
+				positions[count] = state.position;
+			else
+				status = -1;
+		}
+		return status;
+	}
 
 	for(int count=0;count<node_count;count++)
 	{
@@ -147,6 +175,12 @@ void FaulHaberApi::setPosition(int id, int position)
 
 int FaulHaberApi::syncSetPosition(int node_count,int* nodeIds,int* positions)
 {
+	if (pdo)
+	{
+		for(int count=0;count<node_count;count++)
+			setTargetPosition(nodeIds[count], positions[count]);
+		return 1;
+	}
 	for(int count=0;count<node_count;count++)
 	{
 		qDebug()<<"sync"<<nodeIds[count]<<positions[count];
@@ -203,6 +237,12 @@ int FaulHaberApi::setVelocity(int id, int vel)
 }
 int FaulHaberApi::syncSetVelocity(int node_count,int* nodeIds,int* velocities)
 {
+	if (pdo)
+	{
+		for(int count=0;count<node_count;count++)
+			setTargetVelocity(nodeIds[count], velocities[count]);
+		return 1;
+	}
 	for(int count=0;count<node_count;count++)
 	{
 		msgs[count] = buildMessageData(WriteObjectId,nodeIds[count],8,0x23,0x6084,0x00,velocities[count]);//set position
@@ -260,6 +300,181 @@ VSCAN_MSG FaulHaberApi::buildFaulhaberCommand(uint8_t nodeId,uint8_t CommandSpec
 	return msg;
 
 }
+/// PDO MODE
+
+void FaulHaberApi::setPdoMode(bool enable, std::chrono::microseconds timeout)
+{
+	pdoTimeout = timeout;
+	if (enable and not startAsync())
+	{
+		printf("setPdoMode() ERROR: the bus can not run in asynchronous mode\n");
+		return;
+	}
+	pdo = enable;
+}
+
+//TPDO3 <= 0x6064 position actual value and 0x606C velocity actual value, RPDO3 => 0x6040 controlword and 0x607A target
+//position, RPDO4 => 0x60FF target velocity, all of them synchronous (transmission type 1). Each PDO is disabled while
+//its mapping is rewritten, as CiA 301 requires
+int FaulHaberApi::configurePdo(int id)
+{
+	struct Pdo
+	{
+		uint16_t communication, mapping;
+		uint32_t cobId;
+		uint32_t entries[2];
+		uint8_t entryCount;
+	};
+	static const Pdo pdos[] = {
+		{0x1802, 0x1A02, PositionPdoId, {0x60640020, 0x606C0020}, 2},
+		{0x1402, 0x1602, TargetPositionPdoId, {0x60400010, 0x607A0020}, 2},
+		{0x1403, 0x1603, TargetVelocityPdoId, {0x60FF0020, 0}, 1},
+	};
+	int result = 1;
+	auto write = [&](uint8_t cs, uint16_t index, uint8_t sub, uint32_t data)
+	{
+		msg = buildMessageData(WriteObjectId,id,8,cs,index,sub,data);
+		if (writeWaitReadMessage(&msg) != 1 or msg.Data[0] == 0x80)	//0x80 => SDO abort
+			result = -1;
+	};
+	for (const Pdo &p : pdos)
+	{
+		write(0x23, p.communication, 0x01, 0x80000000 | p.cobId | id);
+		write(0x2F, p.mapping, 0x00, 0);
+		for (uint8_t e=0; e<p.entryCount; e++)
+			write(0x23, p.mapping, e+1, p.entries[e]);
+		write(0x2F, p.mapping, 0x00, p.entryCount);
+		write(0x2F, p.communication, 0x02, 1);
+		write(0x23, p.communication, 0x01, p.cobId | id);
+	}
+	if (result == 1)
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		if (not nodes[id].mapped)
+			pdoNodes.push_back(id);
+		nodes[id] = PdoNode();
+		nodes[id].mapped = true;
+	}
+	return result;
+}
+
+static int32_t littleEndian32(const uint8_t *d)
+{
+	return (int32_t)((uint32_t)d[0] | ((uint32_t)d[1] << 8) | ((uint32_t)d[2] << 16) | ((uint32_t)d[3] << 24));
+}
+
+int FaulHaberApi::syncCycle()
+{
+	if (not pdo)
+		return -1;
+	VSCAN_MSG frame;
+	int reported = 0;
+	//answers to earlier cycles still queued update the cache, but do not count for this one
+	while (takeFrame(frame))
+		storePdo(frame, 0, reported);
+	reported = 0;
+
+	const uint64_t cycle = ++cycleCount;
+	burst.clear();
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		for (int id : pdoNodes)
+		{
+			PdoNode &n = nodes[id];
+			//the new setpoint bit of the controlword acts on its rising edge: it is raised with a new target and
+			//lowered on the next cycle
+			if (n.newPosition or n.rearm)
+			{
+				const uint16_t control = n.newPosition ? 0x3F : 0x0F;
+				const uint32_t p = n.targetPosition;
+				burst.push_back(buildRawMessageData(TargetPositionPdoId | id, 6, control & 0xFF, control >> 8, p & 0xFF, (p >> 8) & 0xFF, (p >> 16) & 0xFF, p >> 24, 0, 0));
+				n.rearm = n.newPosition;
+				n.newPosition = false;
+			}
+			if (n.newVelocity)
+			{
+				const uint32_t v = n.targetVelocity;
+				burst.push_back(buildRawMessageData(TargetVelocityPdoId | id, 4, v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24, 0, 0, 0, 0));
+				n.newVelocity = false;
+			}
+		}
+	}
+	burst.push_back(buildRawMessageData(SyncId, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+	try
+	{
+		//nothing in the burst expects an SDO answer, the futures are ready once it is written
+		asyncRequests(burst.data(), burst.size()).back().get();
+	}
+	catch (const std::exception &e)
+	{
+		printf("syncCycle() ERROR: %s\n", e.what());
+		return -1;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + pdoTimeout;
+	while (reported < (int)pdoNodes.size() and std::chrono::steady_clock::now() < deadline)
+	{
+		if (takeFrame(frame))
+			storePdo(frame, cycle, reported);
+		else
+			usleep(20);
+	}
+	return reported;
+}
+
+void FaulHaberApi::storePdo(const VSCAN_MSG &frame, uint64_t cycle, int &reported)
+{
+	const int id = frame.Id & 0x7F;
+	std::lock_guard<std::mutex> lock(stateMutex);
+	PdoNode &n = nodes[id];
+	if (not n.mapped)
+		return;
+	switch (frame.Id & 0x780)
+	{
+		case PositionPdoId:
+			if (frame.Size < 8)
+				return;
+			n.state.position = littleEndian32(frame.Data);
+			n.state.velocity = littleEndian32(frame.Data + 4);
+			n.state.valid = true;
+			if (cycle != 0 and n.state.cycle != cycle)
+				reported++;
+			n.state.cycle = std::max(n.state.cycle, cycle);
+			break;
+		case StatusWordId:
+			if (frame.Size >= 2)
+				n.state.status = frame.Data[0] | (frame.Data[1] << 8);
+			break;
+	}
+}
+
+bool FaulHaberApi::cachedState(int id, JointState &state)
+{
+	if (id < 0 or id >= MAX_NODE_ID)
+		return false;
+	std::lock_guard<std::mutex> lock(stateMutex);
+	state = nodes[id].state;
+	return nodes[id].mapped and state.valid;
+}
+
+void FaulHaberApi::setTargetPosition(int id, int position)
+{
+	if (id < 0 or id >= MAX_NODE_ID)
+		return;
+	std::lock_guard<std::mutex> lock(stateMutex);
+	nodes[id].targetPosition = position;
+	nodes[id].newPosition = true;
+}
+
+void FaulHaberApi::setTargetVelocity(int id, int velocity)
+{
+	if (id < 0 or id >= MAX_NODE_ID)
+		return;
+	std::lock_guard<std::mutex> lock(stateMutex);
+	nodes[id].targetVelocity = velocity;
+	nodes[id].newVelocity = true;
+}
+
 #define pasos_mm 166.66
 #define BRAZO 27  // 27 milimetros entre el centro ocular y el brazo de mando del ojo
 
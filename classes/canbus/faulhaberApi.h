@@ -28,8 +28,13 @@
 #define FaulhaberCommandId 0x300
 #define ReadObjectId 0x580
 #define WriteObjectId 0x600
+#define SyncId 0x080
+#define PositionPdoId 0x380		//TPDO3: actual position and velocity, sent on every SYNC
+#define TargetPositionPdoId 0x400	//RPDO3: controlword and target position, applied on the next SYNC
+#define TargetVelocityPdoId 0x500	//RPDO4: target velocity, applied on the next SYNC
 
 #define MAX_MOTORS 8
+#define MAX_NODE_ID 128
 
 class FaulHaberApi : public CanBus
 {
@@ -81,11 +86,47 @@ class FaulHaberApi : public CanBus
 	//Faulhaber Specific command
 	VSCAN_MSG buildFaulhaberCommand(uint8_t nodeId,uint8_t CommandSpecifier, uint32_t obj_data);
 
+	//PDO mode
+	//Set before Init_Node: every node initialized afterwards maps its position and velocity to a TPDO sent on SYNC,
+	//and its target position and velocity to RPDOs applied on SYNC. The bus runs in asynchronous mode. Each syncCycle()
+	//writes the pending setpoints and one SYNC in a single burst and collects the answers of every node, for up to
+	//'timeout', into a cache read without bus traffic. getPosition reads the cache, syncGetPosition runs a cycle and
+	//syncSetPosition/syncSetVelocity queue setpoints for the next cycle. syncCycle is called from a single thread,
+	//which owns CanBus::takeFrame; the cache and the setpoints can be used from any thread
+	struct JointState
+	{
+		int position;
+		int velocity;
+		uint16_t status;	//last statusword seen (TPDO1)
+		uint64_t cycle;		//cycle of the last position received
+		bool valid;
+	};
+	void setPdoMode(bool enable, std::chrono::microseconds timeout = std::chrono::milliseconds(2));
+	bool pdoMode() const { return pdo; }
+	int syncCycle();	//number of nodes that answered, -1 if the burst could not be written
+	bool cachedState(int id, JointState &state);
+	void setTargetPosition(int id, int position);
+	void setTargetVelocity(int id, int velocity);
+	uint64_t cycles() const { return cycleCount; }
+
   private:
 	VSCAN_MSG msg,msgs[MAX_MOTORS];
 
-	
-	
+	struct PdoNode
+	{
+		JointState state;
+		int targetPosition, targetVelocity;
+		bool mapped, newPosition, newVelocity, rearm;
+	};
+	bool pdo = false;
+	std::chrono::microseconds pdoTimeout;
+	PdoNode nodes[MAX_NODE_ID] = {};
+	std::vector<int> pdoNodes;
+	std::vector<VSCAN_MSG> burst;
+	std::atomic<uint64_t> cycleCount{0};
+	std::mutex stateMutex;
+	int configurePdo(int id);
+	void storePdo(const VSCAN_MSG &frame, uint64_t cycle, int &reported);
 };
 
 #endif
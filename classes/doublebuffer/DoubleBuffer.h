@@ -10,6 +10,14 @@
 //      decl: DoubleBuffer<RoboCompLaser::TLaserData, RoboCompLaser::TLaserData> laser_buffer;
 //      use:  laser_buffer.put(std::move(laserData), [](auto &&I, auto &T){ for(auto &&i , I){ T.append(i/2);}});
 //      decl: auto rgb_buffer = new DoubleBuffer<std::vector<std::uint8_t>, cv:::Mat>(std::chrono::milliseconds(100));
+// Example with a prebuilt converter of converters.h, laser scan to a 2xN matrix of Cartesian points
+//      decl: DoubleBuffer<RoboCompLaser::TLaserData, Eigen::Matrix2Xf> points_buffer;
+//      use:  points_buffer.put(std::move(laserData), converters::LaserToCartesian{});
+// Example of reading without copying the content, e.g. a point cloud shared by several consumers
+//      use:  auto cloud = cloud_buffer.get_shared();              // SlotPool<O>::Handle, a shared const reference
+// Example of waiting for new data from a coroutine, without blocking a thread
+//      use:  auto ldata = co_await laser_buffer.next();          // resumed in the writer thread
+//      use:  auto ldata = co_await laser_buffer.next(&pool);     // resumed as a task of pool
 
 
 #ifndef DOUBLEBUFFER_H
@@ -24,6 +32,9 @@
 #include <atomic>
 #include <future>
 #include "threadpool/threadpool.h"
+#include "threadpool/coroutine.h"
+#include "tracing/trace.h"
+#include "slot_pool.h"
 #include <optional>
 
 using namespace std::chrono_literals;
@@ -36,8 +47,8 @@ struct is_iterable : std::false_type
 {
 };
 template <typename T>
-//especialización del template si tiene función begin y end.
-struct is_iterable<T, std::void_t<decltype(std::declval<T>().begin()), decltype(std::declval<T>().end())>> : std::true_type
+//especialización del template si tiene función begin y end, y begin() se puede desreferenciar (no en las matrices de Eigen).
+struct is_iterable<T, std::void_t<decltype(*std::declval<T>().begin()), decltype(std::declval<T>().end())>> : std::true_type
 {
 };
 
@@ -50,18 +61,18 @@ class DoubleBuffer
         std::chrono::microseconds write_freq;
         std::chrono::time_point<std::chrono::steady_clock>  last_write;
 
-        O bufferA;
-        O bufferB;
-        O &readBuffer;// = bufferA;
-        O &writeBuffer;// = bufferB;
+        // The content is a slot of the pool. A put fills a free slot and swaps it with readBuffer, so the old content
+        // is reused by a later put once every shared reader has released it
+        SlotPool<O> slots;
+        typename SlotPool<O>::Handle readBuffer;
         std::atomic_bool empty;// = true;
+        coro::waiter_list waiters;      // before worker, a pending put resumes them
         ThreadPool worker;
 
     public:
-        DoubleBuffer() : write_freq(0us), readBuffer(bufferA), writeBuffer(bufferB), empty(true), worker(1) {};
+        DoubleBuffer() : write_freq(0us), empty(true), worker(1) {};
         explicit DoubleBuffer(std::chrono::milliseconds t) : write_freq(std::chrono::duration_cast<std::chrono::microseconds>(t)),
-                                                             readBuffer(bufferA), writeBuffer(bufferB), empty(true),
-                                                             worker(1) {};
+                                                             empty(true), worker(1) {};
 
         ~DoubleBuffer() {};
         void set_write_freq(const std::chrono::milliseconds &freq)
@@ -71,6 +82,7 @@ class DoubleBuffer
 
         // Waits for the buffer to be filled before retrieving its content
         O get(std::chrono::milliseconds t = 200ms ) {
+            RC_TRACE_SCOPE("doublebuffer", "DoubleBuffer::get");
             std::shared_lock lock(bufferMutex);
 
             //cambiar esto cuando se implemente atomic wait/notify
@@ -80,6 +92,19 @@ class DoubleBuffer
                 throw std::runtime_error("Timeout");
             }
             empty.store(true);
+            return *readBuffer;
+        }
+
+        // As get(), but returns a shared reference to the content instead of a copy
+        typename SlotPool<O>::Handle get_shared(std::chrono::milliseconds t = 200ms ) {
+            RC_TRACE_SCOPE("doublebuffer", "DoubleBuffer::get");
+            std::shared_lock lock(bufferMutex);
+            if (!cv.wait_until(bufferMutex,
+                               std::chrono::steady_clock::now() + t ,
+                               [this]() { return !empty.load();})){
+                throw std::runtime_error("Timeout");
+            }
+            empty.store(true);
             return readBuffer;
         }
 
@@ -92,7 +117,7 @@ class DoubleBuffer
                               [this]() { return !empty.load();})){
                throw std::runtime_error("Timeout");
            }
-            return readBuffer;
+            return *readBuffer;
        }
 
        std::optional<O> try_get()
@@ -101,11 +126,46 @@ class DoubleBuffer
                return {};
            }
 
+           std::shared_lock lock(bufferMutex);
+           empty.store(true);
+           return *readBuffer;
+       }
+
+       // As try_get(), but returns a shared reference to the content, empty if there is nothing new
+       typename SlotPool<O>::Handle try_get_shared()
+       {
+           if (empty.load()){
+               return {};
+           }
+
            std::shared_lock lock(bufferMutex);
            empty.store(true);
            return readBuffer;
        }
 
+       // Awaitable: co_await next() returns the content as get() does, suspending the coroutine until the buffer is
+       // filled. It is resumed on resume_on or, without a pool, in the worker that wrote the data
+       auto next(ThreadPool *resume_on = nullptr)
+       {
+           struct awaiter
+           {
+               DoubleBuffer &buffer;
+               ThreadPool *pool;
+               bool await_ready() const noexcept { return !buffer.empty.load(); }
+               bool await_suspend(std::coroutine_handle<> h)
+               {
+                   return buffer.waiters.suspend(h, pool, [this]() { return !buffer.empty.load(); });
+               }
+               O await_resume()
+               {
+                   std::shared_lock lock(buffer.bufferMutex);
+                   buffer.empty.store(true);
+                   return *buffer.readBuffer;
+               }
+           };
+           return awaiter{*this, resume_on};
+       }
+
        // checks if the buffer is filled up
        bool is_empty() const
        {
@@ -140,20 +200,23 @@ class DoubleBuffer
 
         bool put(I &&d, std::function<void(I &&, O &)> t = empty_fn)
         {
+            RC_TRACE_SCOPE("doublebuffer", "DoubleBuffer::put");
             auto now = std::chrono::steady_clock::now();
             if (std::chrono::duration_cast<std::chrono::microseconds>(now - last_write)  > write_freq) {
 
                 last_write = now;
                 worker.spawn_task([&, this, d = std::move(d), t = std::move(t)]() mutable {
-                    O temp;
-                    if (this->ItoO(std::move(d), temp, t))
+                    RC_TRACE_SCOPE("doublebuffer", "DoubleBuffer::convert");
+                    auto slot = slots.acquire();
+                    if (this->ItoO(std::move(d), *slot, t))
                     {
+                        auto written = std::move(slot).publish();
                         std::unique_lock lock(this->bufferMutex);
-                        this->writeBuffer = std::move(temp);
-                        std::swap(writeBuffer, readBuffer);
+                        std::swap(written, readBuffer);
                         empty.store(false);
                         cv.notify_all();
                     }
+                    waiters.resume_all();
                 });
 
                 return true;
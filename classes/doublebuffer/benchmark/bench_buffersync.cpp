@@ -0,0 +1,54 @@
+//
+// classes/doublebuffer_sync BufferSync with a single queue of 4 elements: the default private worker, inline
+// conversion, and a RingInOut queue. New elements are polled with read_last_shared
+//
+
+#include <doublebuffer_sync/doublebuffer_sync.h>
+#include "bench_common.h"
+
+namespace
+{
+    template <typename P, typename Buffer>
+    struct BufferSyncAdapter
+    {
+        Buffer buffer{4};
+
+        explicit BufferSyncAdapter(size_t) {}
+
+        void put(P &&p)
+        {
+            const auto stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(p.sent.time_since_epoch()).count();
+            buffer.template put<0>(std::move(p), stamp);
+        }
+        bool read_newer(uint64_t &seq, P &out)
+        {
+            const auto deadline = bench::clock::now() + std::chrono::milliseconds(100);
+            while (bench::clock::now() < deadline)
+            {
+                if (auto [h] = buffer.read_last_shared(); h and h->seq > seq)
+                {
+                    out = *h;
+                    seq = out.seq;
+                    return true;
+                }
+                std::this_thread::yield();
+            }
+            return false;
+        }
+        bool read_copy(P &out)
+        {
+            auto [v] = buffer.read_last();
+            if (not v) return false;
+            out = std::move(*v);
+            return true;
+        }
+    };
+
+    template <typename P> using Worker = BufferSyncAdapter<P, BufferSync<InOut<P, P>>>;
+    template <typename P> using Inline = BufferSyncAdapter<P, BasicBufferSync<InlineConversion, InOut<P, P>>>;
+    template <typename P> using Ring = BufferSyncAdapter<P, BasicBufferSync<InlineConversion, RingInOut<P, P>>>;
+}
+
+const bool registered_Worker = bench::register_all<Worker>("BufferSync/worker");
+const bool registered_Inline = bench::register_all<Inline>("BufferSync/inline");
+const bool registered_Ring = bench::register_all<Ring>("BufferSync/ring");
@@ -0,0 +1,159 @@
+//
+// Payloads and benchmark bodies shared by the benchmarks of the buffers. Each buffer is benchmarked in its own
+// translation unit, through an adapter, because DoubleBuffer, new_doublebuffer and BufferSync cannot be included together.
+// An adapter has:
+//      Adapter(size_t producers)
+//      void put(P &&p)                          called concurrently by the producers
+//      bool read_newer(uint64_t &seq, P &out)   waits (100 ms at most) for an element with a sequence number greater than seq
+//      bool read_copy(P &out)                   copies the newest element, false if there is none
+// Measures, per payload and for 1, 2 and 4 producers:
+//      Latency     time from the put of an element to its read, with producers putting as fast as they can
+//      Throughput  elements read by a consumer per second, and puts per second
+//      Copy        cost of a read of the newest element
+//
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+namespace bench
+{
+    using clock = std::chrono::steady_clock;
+
+    struct Small
+    {
+        double x = 0, y = 0, alpha = 0;
+        uint64_t seq = 0;
+        clock::time_point sent;
+        static Small make() { return {}; }
+    };
+
+    struct LaserScan
+    {
+        std::vector<float> angles, ranges;
+        uint64_t seq = 0;
+        clock::time_point sent;
+        static LaserScan make() { return {std::vector<float>(1440, 0.f), std::vector<float>(1440, 1.f), 0, clock::time_point{}}; }
+    };
+
+    struct Image
+    {
+        int width = 1920, height = 1080, depth = 3;
+        std::vector<uint8_t> data;
+        uint64_t seq = 0;
+        clock::time_point sent;
+        static Image make() { return {1920, 1080, 3, std::vector<uint8_t>(1920 * 1080 * 3, 128), 0, clock::time_point{}}; }
+    };
+
+    // Producers putting copies of a payload as fast as they can until they are stopped
+    template <typename Adapter, typename P>
+    class Producers
+    {
+        public:
+            Producers(Adapter &buffer, size_t n)
+            {
+                for (size_t i = 0; i < n; i++)
+                    threads.emplace_back([this, &buffer]()
+                    {
+                        const P model = P::make();
+                        while (not stop.load(std::memory_order_relaxed))
+                        {
+                            P p = model;
+                            p.seq = seq.fetch_add(1, std::memory_order_relaxed) + 1;
+                            p.sent = clock::now();
+                            buffer.put(std::move(p));
+                            puts.fetch_add(1, std::memory_order_relaxed);
+                            std::this_thread::yield();
+                        }
+                    });
+            }
+            ~Producers()
+            {
+                stop.store(true);
+                for (auto &t : threads)
+                    t.join();
+            }
+            std::atomic<uint64_t> puts{0};
+
+        private:
+            std::atomic<bool> stop{false};
+            std::atomic<uint64_t> seq{0};
+            std::vector<std::thread> threads;
+    };
+
+    // range(0): number of producers
+    template <typename Adapter, typename P>
+    void latency(benchmark::State &state)
+    {
+        Adapter buffer(state.range(0));
+        double total_us = 0;
+        uint64_t reads = 0, puts = 0;
+        {
+            Producers<Adapter, P> producers(buffer, state.range(0));
+            uint64_t seq = 0;
+            P p;
+            for (auto _ : state)
+            {
+                if (not buffer.read_newer(seq, p))
+                {
+                    state.SkipWithError("no new element in 100 ms");
+                    break;
+                }
+                total_us += std::chrono::duration<double, std::micro>(clock::now() - p.sent).count();
+                reads++;
+            }
+            puts = producers.puts.load();
+        }
+        state.counters["latency_us"] = reads ? total_us / reads : 0;
+        state.counters["reads"] = benchmark::Counter(reads, benchmark::Counter::kIsRate);
+        state.counters["puts"] = benchmark::Counter(puts, benchmark::Counter::kIsRate);
+    }
+
+    template <typename Adapter, typename P>
+    void copy(benchmark::State &state)
+    {
+        Adapter buffer(1);
+        P p = P::make();
+        p.seq = 1;
+        buffer.put(std::move(p));
+        const auto deadline = clock::now() + std::chrono::milliseconds(100);
+        while (not buffer.read_copy(p))
+            if (clock::now() > deadline)
+            {
+                state.SkipWithError("put not visible in 100 ms");
+                return;
+            }
+        for (auto _ : state)
+        {
+            buffer.read_copy(p);
+            benchmark::DoNotOptimize(p);
+        }
+    }
+
+    template <template <typename> class Adapter, typename P>
+    void register_payload(const std::string &name, const std::string &payload)
+    {
+        benchmark::RegisterBenchmark((name + "/latency/" + payload).c_str(), latency<Adapter<P>, P>)
+            ->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+        benchmark::RegisterBenchmark((name + "/copy/" + payload).c_str(), copy<Adapter<P>, P>);
+    }
+
+    // registers every benchmark of an adapter, from a static initializer: static bool r = bench::register_all<A>("name");
+    template <template <typename> class Adapter>
+    bool register_all(const std::string &name)
+    {
+        register_payload<Adapter, Small>(name, "small");
+        register_payload<Adapter, LaserScan>(name, "laser");
+        register_payload<Adapter, Image>(name, "image1080p");
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+//
+// BufferCore with the policies of each container, and the Shared read that none of them use for new elements
+//
+
+#include <doublebuffer/buffer_core.h>
+#include "bench_common.h"
+
+namespace
+{
+    using namespace buffer_policy;
+
+    ThreadPool &shared_pool()
+    {
+        static ThreadPool pool(4);
+        return pool;
+    }
+
+    template <typename P, class Storage, class Lock, class Executor, class Read>
+    struct CoreAdapter
+    {
+        BufferCore<P, P, Storage, Lock, Executor, Read> buffer;
+        clock::time_point last{};
+
+        explicit CoreAdapter(size_t) requires (not std::is_same_v<Executor, Pool>) {}
+        explicit CoreAdapter(size_t) requires std::is_same_v<Executor, Pool> : buffer(shared_pool()) {}
+
+        void put(P &&p) { buffer.put(std::move(p)); }
+        // the stamp is enough to wait for a newer element, the sequence number is attached to it
+        bool read_newer(uint64_t &seq, P &out)
+        {
+            auto r = buffer.wait_newer(last, std::chrono::milliseconds(100));
+            if (not r) return false;
+            last = r->stamp;
+            if constexpr (std::is_same_v<Read, Shared>) out = *r->value;
+            else out = std::move(r->value);
+            seq = out.seq;
+            return true;
+        }
+        bool read_copy(P &out)
+        {
+            auto r = buffer.latest();
+            if (not r) return false;
+            if constexpr (std::is_same_v<Read, Shared>) out = *r->value;
+            else out = std::move(r->value);
+            return true;
+        }
+    };
+
+    template <typename P> using DoubleBufferLike = CoreAdapter<P, Latest, SharedLock, Worker, Copy>;
+    template <typename P> using DoubleBufferLikeShared = CoreAdapter<P, Latest, SharedLock, Worker, Shared>;
+    template <typename P> using RingPool = CoreAdapter<P, Ring<4>, ExclusiveLock, Pool, Copy>;
+    template <typename P> using RingInline = CoreAdapter<P, Ring<4>, ExclusiveLock, Inline, Copy>;
+    template <typename P> using RingInlineShared = CoreAdapter<P, Ring<4>, SharedLock, Inline, Shared>;
+}
+
+const bool registered_DoubleBufferLike = bench::register_all<DoubleBufferLike>("core/latest_shared-lock_worker_copy");
+const bool registered_DoubleBufferLikeShared = bench::register_all<DoubleBufferLikeShared>("core/latest_shared-lock_worker_shared");
+const bool registered_RingPool = bench::register_all<RingPool>("core/ring4_mutex_pool_copy");
+const bool registered_RingInline = bench::register_all<RingInline>("core/ring4_mutex_inline_copy");
+const bool registered_RingInlineShared = bench::register_all<RingInlineShared>("core/ring4_shared-lock_inline_shared");
@@ -0,0 +1,48 @@
+//
+// classes/doublebuffer DoubleBuffer. Its put is not safe for concurrent producers, so they are serialized here,
+// and new elements are polled with try_get_shared, which does not wait
+//
+
+#include <doublebuffer/DoubleBuffer.h>
+#include "bench_common.h"
+
+namespace
+{
+    template <typename P>
+    struct DoubleBufferAdapter
+    {
+        DoubleBuffer<P, P> buffer;
+        std::mutex put_mutex;
+
+        explicit DoubleBufferAdapter(size_t) {}
+
+        void put(P &&p)
+        {
+            std::lock_guard<std::mutex> lock(put_mutex);
+            buffer.put(std::move(p));
+        }
+        bool read_newer(uint64_t &seq, P &out)
+        {
+            const auto deadline = bench::clock::now() + std::chrono::milliseconds(100);
+            while (bench::clock::now() < deadline)
+            {
+                if (auto h = buffer.try_get_shared(); h and h->seq > seq)
+                {
+                    out = *h;
+                    seq = out.seq;
+                    return true;
+                }
+                std::this_thread::yield();
+            }
+            return false;
+        }
+        bool read_copy(P &out)
+        {
+            if (buffer.is_empty()) return false;
+            out = buffer.get_idemp();
+            return true;
+        }
+    };
+}
+
+const bool registered_DoubleBufferAdapter = bench::register_all<DoubleBufferAdapter>("DoubleBuffer");
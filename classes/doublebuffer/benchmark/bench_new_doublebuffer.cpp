@@ -0,0 +1,42 @@
+//
+// classes/new_doublebuffer DoubleBuffer, with a ring of 4 elements, one conversion thread per producer and the in
+// place put, which keeps the capacity of the recycled elements
+//
+
+#include <new_doublebuffer/doublebuffer.h>
+#include "bench_common.h"
+
+namespace
+{
+    template <typename P>
+    struct RingDoubleBufferAdapter
+    {
+        DoubleBuffer<std::tuple<P>, std::tuple<P>> buffer;
+        std::chrono::steady_clock::time_point last{};
+
+        explicit RingDoubleBufferAdapter(size_t producers) : buffer(4, producers) {}
+
+        void put(P &&p)
+        {
+            buffer.put(std::tuple<P>(std::move(p)), [](std::tuple<P> &&in, std::tuple<P> &out) { std::get<0>(out) = std::get<0>(in); });
+        }
+        bool read_newer(uint64_t &seq, P &out)
+        {
+            auto e = buffer.wait_newer(last, std::chrono::milliseconds(100));
+            if (not e) return false;
+            last = e->timestamp;
+            out = std::move(std::get<0>(e->data));
+            seq = out.seq;
+            return true;
+        }
+        bool read_copy(P &out)
+        {
+            auto e = buffer.wait_newer(std::chrono::steady_clock::time_point::min(), std::chrono::milliseconds(0));
+            if (not e) return false;
+            out = std::move(std::get<0>(e->data));
+            return true;
+        }
+    };
+}
+
+const bool registered_RingDoubleBufferAdapter = bench::register_all<RingDoubleBufferAdapter>("new_doublebuffer");
@@ -0,0 +1,242 @@
+//
+// Policy based core of the producer/consumer buffers. DoubleBuffer, the ring of new_doublebuffer and each queue of
+// BufferSync make different choices for the same four things, which here are template arguments:
+//      Storage   what is kept: Latest (the newest element only) or Ring<N> (the N newest ones, timestamped)
+//      Lock      how readers and the writer exclude each other: SharedLock (readers in parallel) or ExclusiveLock
+//      Executor  where put converts the input: Inline (the caller), Worker (a private thread) or Pool (a shared ThreadPool)
+//      Read      what a read returns: Copy (an O) or Shared (a SlotPool<O>::Handle, no copy)
+// The content always lives in the slots of a SlotPool, so outputs keep their capacity across puts whatever the policies.
+// Example, the trade-offs of each container:
+//      BufferCore<TLaserData, TLaserData, buffer_policy::Latest, buffer_policy::SharedLock, buffer_policy::Worker>   // DoubleBuffer
+//      BufferCore<Image, Image, buffer_policy::Ring<8>, buffer_policy::ExclusiveLock, buffer_policy::Pool>           // new_doublebuffer
+//      BufferCore<Odom, Odom, buffer_policy::Ring<10>, buffer_policy::ExclusiveLock, buffer_policy::Inline>          // a BufferSync queue
+//      use: buffer.put(std::move(data));                                          // or put(std::move(data), [](auto &&i, auto &o){ ... })
+//      use: auto last = buffer.wait_newer(last_stamp, 100ms);                    // optional<Stamped>, for every new element
+//      use: auto odom = buffer.closest(laser_stamp);                             // optional<Stamped>, Ring storage only
+// benchmark/ compares these configurations and the three containers.
+//
+
+#ifndef BUFFER_CORE_H
+#define BUFFER_CORE_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include "threadpool/threadpool.h"
+#include "slot_pool.h"
+
+namespace buffer_policy
+{
+    using clock = std::chrono::steady_clock;
+
+    template <typename O>
+    struct Entry
+    {
+        typename SlotPool<O>::Handle value;
+        clock::time_point stamp{};
+    };
+
+    // Storage, always accessed under the lock of the buffer
+    struct Latest
+    {
+        template <typename O>
+        struct type
+        {
+            Entry<O> newest;
+
+            void store(Entry<O> &&e) { newest = std::move(e); }
+            const Entry<O> *back() const { return newest.value ? &newest : nullptr; }
+            const Entry<O> *closest(clock::time_point) const { return back(); }
+        };
+    };
+
+    template <size_t N>
+    struct Ring
+    {
+        static_assert(N > 0, "Ring storage needs room for one element");
+        template <typename O>
+        struct type
+        {
+            std::array<Entry<O>, N> entries;
+            size_t head = 0, count = 0;     // head: next slot written
+
+            // i-th oldest element
+            const Entry<O> &at(size_t i) const { return entries[(head + N - count + i) % N]; }
+            void store(Entry<O> &&e)
+            {
+                entries[head] = std::move(e);       // releases the evicted handle, its slot goes back to the pool
+                head = (head + 1) % N;
+                if (count < N) count++;
+            }
+            const Entry<O> *back() const { return count ? &entries[(head + N - 1) % N] : nullptr; }
+            // binary search, elements are stored in timestamp order
+            const Entry<O> *closest(clock::time_point t) const
+            {
+                if (count == 0) return nullptr;
+                size_t lo = 0, hi = count;
+                while (lo < hi)
+                {
+                    const size_t mid = (lo + hi) / 2;
+                    if (at(mid).stamp < t) lo = mid + 1;
+                    else hi = mid;
+                }
+                if (lo == count or (lo > 0 and t - at(lo - 1).stamp <= at(lo).stamp - t))
+                    lo--;
+                return &at(lo);
+            }
+        };
+    };
+
+    // Locking
+    struct SharedLock
+    {
+        using mutex_type = std::shared_mutex;
+        using read_lock = std::shared_lock<std::shared_mutex>;
+        using write_lock = std::unique_lock<std::shared_mutex>;
+    };
+    struct ExclusiveLock
+    {
+        using mutex_type = std::mutex;
+        using read_lock = std::unique_lock<std::mutex>;
+        using write_lock = std::unique_lock<std::mutex>;
+    };
+
+    // Conversion executors. run() is called by put with the whole conversion and publication
+    struct Inline
+    {
+        template <typename F> void run(F &&f) { f(); }
+    };
+    struct Worker
+    {
+        ThreadPool pool{1};
+        template <typename F> void run(F &&f) { pool.spawn_task(std::forward<F>(f)); }
+    };
+    struct Pool
+    {
+        explicit Pool(ThreadPool &p) : pool(&p) {}
+        ThreadPool *pool;
+        template <typename F> void run(F &&f) { pool->spawn_task(std::forward<F>(f)); }
+    };
+
+    // Read semantics
+    struct Copy
+    {
+        template <typename O> using result_type = O;
+        template <typename O> static O from(const typename SlotPool<O>::Handle &h) { return *h; }
+    };
+    struct Shared
+    {
+        template <typename O> using result_type = typename SlotPool<O>::Handle;
+        template <typename O> static typename SlotPool<O>::Handle from(const typename SlotPool<O>::Handle &h) { return h; }
+    };
+}
+
+template <class I, class O, class Storage = buffer_policy::Latest, class Lock = buffer_policy::SharedLock,
+          class Executor = buffer_policy::Inline, class Read = buffer_policy::Copy>
+class BufferCore
+{
+    public:
+        using clock = buffer_policy::clock;
+        using result_type = typename Read::template result_type<O>;
+        struct Stamped
+        {
+            result_type value;
+            clock::time_point stamp;
+        };
+        using Converter = std::function<void(I &&, O &)>;
+
+        // args construct the executor, e.g. BufferCore<..., buffer_policy::Pool>(pool)
+        template <typename... Args>
+        explicit BufferCore(Args &&...args) : executor(std::forward<Args>(args)...) {}
+        BufferCore(const BufferCore &) = delete;
+        BufferCore &operator=(const BufferCore &) = delete;
+        // waits for the pending puts, which may refer to the buffer
+        ~BufferCore()
+        {
+            typename Lock::write_lock lock(mutex);
+            cv.wait(lock, [this]() { return pending == 0; });
+        }
+
+        // Converts d into a recycled slot, with t or by assignment if none is given, and publishes it stamped with the time
+        // of publication, so the storage stays in timestamp order with any executor
+        void put(I &&d, Converter t = {})
+        {
+            {
+                typename Lock::write_lock lock(mutex);
+                pending++;
+            }
+            executor.run([this, d = std::move(d), t = std::move(t)]() mutable
+            {
+                auto slot = slots.acquire();
+                if (t)
+                    t(std::move(d), *slot);
+                else
+                {
+                    static_assert(std::is_assignable_v<O &, I &&>, "BufferCore: I is not assignable to O, put needs a converter");
+                    *slot = std::move(d);
+                }
+                auto handle = std::move(slot).publish();
+                // nothing of the buffer is used after the unlock, the destructor may run right then
+                typename Lock::write_lock lock(mutex);
+                storage.store({std::move(handle), clock::now()});
+                writes++;
+                pending--;
+                cv.notify_all();
+            });
+        }
+
+        // newest element, empty if nothing was put yet
+        std::optional<Stamped> latest() const
+        {
+            typename Lock::read_lock lock(mutex);
+            return stamped(storage.back());
+        }
+
+        // element closest in time to t, the newest one with Latest storage
+        std::optional<Stamped> closest(clock::time_point t) const
+        {
+            typename Lock::read_lock lock(mutex);
+            return stamped(storage.closest(t));
+        }
+
+        // Waits up to timeout for an element newer than last, the stamp of the previous read, and returns the newest one
+        template <typename Rep, typename Period>
+        std::optional<Stamped> wait_newer(clock::time_point last, std::chrono::duration<Rep, Period> timeout) const
+        {
+            typename Lock::read_lock lock(mutex);
+            const auto newer = [this, last]() { auto b = storage.back(); return b and b->stamp > last; };
+            if (not cv.wait_for(lock, timeout, newer))
+                return {};
+            return stamped(storage.back());
+        }
+
+        // number of elements published so far
+        uint64_t size() const
+        {
+            typename Lock::read_lock lock(mutex);
+            return writes;
+        }
+
+    private:
+        std::optional<Stamped> stamped(const buffer_policy::Entry<O> *e) const
+        {
+            if (e == nullptr) return {};
+            return Stamped{Read::template from<O>(e->value), e->stamp};
+        }
+
+        SlotPool<O> slots;      // before storage, which holds handles to its slots
+        typename Storage::template type<O> storage;
+        uint64_t writes = 0;
+        mutable typename Lock::mutex_type mutex;
+        mutable std::condition_variable_any cv;
+        size_t pending = 0;     // puts not yet published
+        Executor executor;      // last, a Worker finishes its tasks before the rest is destroyed
+};
+
+#endif
@@ -0,0 +1,257 @@
+//
+// Prebuilt converters for the put of DoubleBuffer and BufferSync, for the conversions every component writes by hand.
+// Each one is a function object taking (I &&, O &), so it is passed directly as the transform of put:
+//      DoubleBuffer<RoboCompLaser::TLaserData, Eigen::Matrix2Xf> laser_buffer;
+//      laser_buffer.put(std::move(ldata), converters::LaserToCartesian{});
+//      DoubleBuffer<RoboCompLaser::TLaserData, std::vector<Eigen::Vector2f>> polar_buffer;
+//      polar_buffer.put(std::move(ldata), converters::LaserToPolarBins(grid.angle_dim.init, grid.angle_dim.end, grid.angle_dim.step));
+//      DoubleBuffer<RoboCompRGBD::DepthSeq, Eigen::Matrix3Xf> cloud_buffer;
+//      cloud_buffer.put(std::move(depth), converters::DepthToCloud(640, 480, fx, fy, cx, cy));
+//      DoubleBuffer<RoboCompRGBD::imgType, std::vector<std::uint8_t>> gray_buffer;
+//      gray_buffer.put(std::move(rgb), converters::RGBToGray(640, 480));
+// The output is sized once and written in place in a single pass over plain arrays, without a push_back per element,
+// so the loops vectorize and, with the recycled slots of the buffers, a steady stream of frames does not allocate.
+// Laser inputs are ranges of elements with 'angle' (rad) and 'dist' (mm) members, as RoboCompLaser::TData.
+// Images are interleaved 8 bit rows without padding; depth images are rows of depth values in any arithmetic type.
+// Converters are copied on every put, so their tables are shared between copies.
+//
+
+#ifndef DOUBLEBUFFER_CONVERTERS_H
+#define DOUBLEBUFFER_CONVERTERS_H
+
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Dense>
+
+namespace converters
+{
+    namespace detail
+    {
+        // angles and distances of a laser scan, copied to contiguous arrays of the converting thread
+        struct PolarScratch
+        {
+            Eigen::ArrayXf angle, dist;
+        };
+        template <typename Laser>
+        Eigen::Index gather(const Laser &in, PolarScratch &s, float min_range, float max_range)
+        {
+            const auto n = static_cast<Eigen::Index>(std::size(in));
+            if (s.angle.size() < n)
+            {
+                s.angle.resize(n);
+                s.dist.resize(n);
+            }
+            Eigen::Index k = 0;
+            for (const auto &p : in)
+            {
+                s.angle[k] = p.angle;
+                s.dist[k] = p.dist;
+                k += (p.dist >= min_range and p.dist <= max_range);     // compaction without a branch
+            }
+            return k;
+        }
+    }
+
+    // Laser scan to Cartesian points (mm) in the robot frame, a 2xN matrix with x = dist * sin(angle) and y = dist * cos(angle).
+    // Readings outside [min_range, max_range] are dropped
+    struct LaserToCartesian
+    {
+        float min_range = 1.f;
+        float max_range = std::numeric_limits<float>::max();
+
+        template <typename Laser>
+        void operator()(Laser &&in, Eigen::Matrix2Xf &out) const
+        {
+            thread_local detail::PolarScratch s;
+            const auto n = detail::gather(in, s, min_range, max_range);
+            out.resize(2, n);       // no reallocation while the size does not change
+            const auto a = s.angle.head(n), d = s.dist.head(n);
+            out.row(0) = (d * a.sin()).matrix().transpose();
+            out.row(1) = (d * a.cos()).matrix().transpose();
+        }
+    };
+
+    // Laser scan to the polar bins of a Local_Grid: one (angle, dist) point per angular bin holding a reading, with the
+    // closest reading of the bin and the angle of its centre, in the convention of update_map_from_polar_data.
+    // Bins are given in degrees, as Local_Grid::angle_dim, and readings are binned as the grid does
+    class LaserToPolarBins
+    {
+        public:
+            LaserToPolarBins(float init_deg, float end_deg, float step_deg, float max_range_ = std::numeric_limits<float>::max())
+                : init(init_deg), step(step_deg), max_range(max_range_),
+                  bins(step_deg > 0 and end_deg > init_deg ? static_cast<int>(std::ceil((end_deg - init_deg) / step_deg)) : 0)
+            {
+                if (bins == 0)
+                    throw std::invalid_argument("LaserToPolarBins: empty angle range");
+            }
+
+            template <typename Laser>
+            void operator()(Laser &&in, std::vector<Eigen::Vector2f> &out) const
+            {
+                thread_local std::vector<float> closest;
+                closest.assign(bins, std::numeric_limits<float>::infinity());
+                for (const auto &p : in)
+                {
+                    float deg = p.angle * 180.f / float(M_PI);
+                    if (deg < 0) deg += 360.f;
+                    const int a = static_cast<int>(std::rint((deg - init) / step));
+                    if (a >= 0 and a < bins and p.dist > 0 and p.dist <= max_range and p.dist < closest[a])
+                        closest[a] = p.dist;
+                }
+                out.clear();        // keeps the capacity
+                for (int a = 0; a < bins; a++)
+                    if (std::isfinite(closest[a]))
+                    {
+                        float rad = (init + a * step) * float(M_PI) / 180.f;
+                        if (rad > float(M_PI)) rad -= 2.f * float(M_PI);
+                        out.emplace_back(rad, closest[a]);
+                    }
+            }
+
+        private:
+            float init, step, max_range;
+            int bins;
+    };
+
+    // Depth image to an organized point cloud in the camera frame (x right, y down, z forward), in the units of the depth
+    // times 'scale'. Every column of the 3xN output is a pixel, one every 'decimation' in both directions, so its size is
+    // fixed; pixels without depth are NaN
+    class DepthToCloud
+    {
+        public:
+            DepthToCloud(int width_, int height_, float fx, float fy, float cx, float cy, float scale_ = 1.f, int decimation_ = 1)
+                : width(width_), height(height_), decimation(std::max(decimation_, 1)), scale(scale_)
+            {
+                if (width <= 0 or height <= 0)
+                    throw std::invalid_argument("DepthToCloud: empty image");
+                auto t = std::make_shared<Rays>();
+                for (int u = 0; u < width; u += decimation)
+                    t->x.push_back((u - cx) / fx);
+                for (int v = 0; v < height; v += decimation)
+                    t->y.push_back((v - cy) / fy);
+                rays = std::move(t);
+            }
+
+            template <typename Depth>
+            void operator()(Depth &&in, Eigen::Matrix3Xf &out) const
+            {
+                if (static_cast<long>(std::size(in)) < static_cast<long>(width) * height)
+                    throw std::invalid_argument("DepthToCloud: depth image smaller than width x height");
+                const auto cols = static_cast<Eigen::Index>(rays->x.size()), rows = static_cast<Eigen::Index>(rays->y.size());
+                out.resize(3, cols * rows);
+                const auto *depth = std::data(in);
+                const float nan = std::numeric_limits<float>::quiet_NaN();
+                float *o = out.data();
+                for (Eigen::Index r = 0; r < rows; r++)
+                {
+                    const auto *row = depth + static_cast<std::size_t>(r) * decimation * width;
+                    const float ry = rays->y[r];
+                    for (Eigen::Index c = 0; c < cols; c++, o += 3)
+                    {
+                        const float z = static_cast<float>(row[c * decimation]) * scale;
+                        const float valid = z > 0 ? z : nan;
+                        o[0] = rays->x[c] * valid;
+                        o[1] = ry * valid;
+                        o[2] = valid;
+                    }
+                }
+            }
+
+        private:
+            struct Rays
+            {
+                std::vector<float> x, y;    // per column and row, ray direction at unit depth
+            };
+            int width, height, decimation;
+            float scale;
+            std::shared_ptr<const Rays> rays;
+    };
+
+    // Interleaved 8 bit RGB (or BGR with bgr = true) to 8 bit gray, with the integer weights of ITU-R BT.601
+    struct RGBToGray
+    {
+        int width, height;
+        bool bgr = false;
+
+        template <typename Image>
+        void operator()(Image &&in, std::vector<std::uint8_t> &out) const
+        {
+            const std::size_t n = static_cast<std::size_t>(width) * height;
+            if (std::size(in) < 3 * n)
+                throw std::invalid_argument("RGBToGray: image smaller than width x height x 3");
+            out.resize(n);
+            const auto *p = reinterpret_cast<const std::uint8_t *>(std::data(in));
+            const unsigned wr = bgr ? 29 : 77, wb = bgr ? 77 : 29;
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = static_cast<std::uint8_t>((wr * p[3 * i] + 150u * p[3 * i + 1] + wb * p[3 * i + 2] + 128u) >> 8);
+        }
+    };
+
+    // Swaps the first and third channel of interleaved 8 bit RGB, for BGR consumers such as OpenCV
+    struct SwapRB
+    {
+        template <typename Image>
+        void operator()(Image &&in, std::vector<std::uint8_t> &out) const
+        {
+            const std::size_t n = std::size(in) / 3;
+            out.resize(3 * n);
+            const auto *p = reinterpret_cast<const std::uint8_t *>(std::data(in));
+            for (std::size_t i = 0; i < n; i++)
+            {
+                out[3 * i] = p[3 * i + 2];
+                out[3 * i + 1] = p[3 * i + 1];
+                out[3 * i + 2] = p[3 * i];
+            }
+        }
+    };
+
+    // Halves an interleaved 8 bit image with 'channels' channels in both directions, averaging 2x2 blocks. An odd last
+    // row or column is dropped. Applied 'levels' times for a downscale by 2^levels
+    struct Downscale
+    {
+        int width, height, channels = 3, levels = 1;
+
+        template <typename Image>
+        void operator()(Image &&in, std::vector<std::uint8_t> &out) const
+        {
+            if (std::size(in) < static_cast<std::size_t>(width) * height * channels)
+                throw std::invalid_argument("Downscale: image smaller than width x height x channels");
+            thread_local std::vector<std::uint8_t> scratch;
+            const auto *src = reinterpret_cast<const std::uint8_t *>(std::data(in));
+            int w = width, h = height;
+            for (int l = 0; l < levels; l++)
+            {
+                // levels alternate between out and scratch so that the last one is written to out
+                auto &dst = (levels - l) % 2 == 1 ? out : scratch;
+                half(src, w, h, dst);
+                src = dst.data();
+                w /= 2;
+                h /= 2;
+            }
+        }
+
+        private:
+            void half(const std::uint8_t *src, int w, int h, std::vector<std::uint8_t> &dst) const
+            {
+                const int ow = w / 2, oh = h / 2, c = channels;
+                dst.resize(static_cast<std::size_t>(ow) * oh * c);
+                for (int y = 0; y < oh; y++)
+                {
+                    const std::uint8_t *r0 = src + static_cast<std::size_t>(2 * y) * w * c, *r1 = r0 + static_cast<std::size_t>(w) * c;
+                    std::uint8_t *o = dst.data() + static_cast<std::size_t>(y) * ow * c;
+                    for (int i = 0; i < ow * c; i++)
+                    {
+                        const int x = (i / c) * 2 * c + i % c;
+                        o[i] = static_cast<std::uint8_t>((r0[x] + r0[x + c] + r1[x] + r1[x + c] + 2) >> 2);
+                    }
+                }
+            }
+    };
+}
+
+#endif
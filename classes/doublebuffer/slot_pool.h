@@ -0,0 +1,165 @@
+//
+// Pool of recycled output objects shared between a producer and any number of readers without copies.
+// The producer fills a slot through a Writer and publishes it as a Handle, a reference counted pointer to a const
+// object that readers can keep as long as they need. When the last Handle of a slot is released the slot goes back to
+// the pool with its object, so the next acquire() reuses it and vectors or images keep their capacity.
+// Handles may outlive the pool: the shared state is freed with the last of them.
+// Used by DoubleBuffer and BufferSync for their shared reads:
+//      auto cloud = buffer.get_shared();      // SlotPool<O>::Handle, no copy of the point cloud
+//      for (const auto &p : *cloud) ...
+//
+
+#ifndef SLOT_POOL_H
+#define SLOT_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template <typename O>
+class SlotPool
+{
+    private:
+        struct State;
+        struct Slot
+        {
+            O value{};
+            std::atomic<uint32_t> refs{0};
+            State *state = nullptr;
+        };
+        // users is one for the pool plus one per slot out of the free list
+        struct State
+        {
+            std::mutex mutex;
+            std::vector<Slot *> free;
+            std::atomic<size_t> users{1};
+            bool closed = false;
+            ~State() { for (auto s : free) delete s; }
+        };
+
+        static void release(State *state)
+        {
+            if (state->users.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete state;
+        }
+        static void recycle(Slot *slot)
+        {
+            State *state = slot->state;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->closed)
+                    delete slot;
+                else
+                    state->free.push_back(slot);
+            }
+            release(state);
+        }
+
+        State *state;
+
+    public:
+        class Writer;
+
+        // Shared, read only reference to a published object. Empty when default constructed
+        class Handle
+        {
+            public:
+                using element_type = O;
+
+                Handle() = default;
+                Handle(const Handle &other) : slot(other.slot) { if (slot) slot->refs.fetch_add(1, std::memory_order_relaxed); }
+                Handle(Handle &&other) noexcept : slot(std::exchange(other.slot, nullptr)) {}
+                Handle &operator=(Handle other) noexcept { std::swap(slot, other.slot); return *this; }
+                ~Handle() { reset(); }
+
+                void reset()
+                {
+                    if (slot and slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        recycle(slot);
+                    slot = nullptr;
+                }
+                const O &operator*() const { return slot->value; }
+                const O *operator->() const { return &slot->value; }
+                const O *get() const { return slot ? &slot->value : nullptr; }
+                explicit operator bool() const { return slot != nullptr; }
+                uint32_t use_count() const { return slot ? slot->refs.load(std::memory_order_relaxed) : 0; }
+
+            private:
+                friend class Writer;
+                explicit Handle(Slot *s) : slot(s) {}
+                Slot *slot = nullptr;
+        };
+
+        // Exclusive access to a slot before it is published. Its object keeps whatever its last use left in it
+        class Writer
+        {
+            public:
+                Writer(const Writer &) = delete;
+                Writer &operator=(const Writer &) = delete;
+                Writer(Writer &&other) noexcept : slot(std::exchange(other.slot, nullptr)) {}
+                ~Writer() { if (slot) recycle(slot); }
+
+                O &operator*() { return slot->value; }
+                O *operator->() { return &slot->value; }
+                Handle publish() &&
+                {
+                    Slot *s = std::exchange(slot, nullptr);
+                    s->refs.store(1, std::memory_order_relaxed);
+                    return Handle(s);
+                }
+
+            private:
+                friend class SlotPool;
+                explicit Writer(Slot *s) : slot(s) {}
+                Slot *slot = nullptr;
+        };
+
+        SlotPool() : state(new State) {}
+        SlotPool(const SlotPool &) = delete;
+        SlotPool &operator=(const SlotPool &) = delete;
+        ~SlotPool()
+        {
+            std::vector<Slot *> free;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->closed = true;
+                free.swap(state->free);
+            }
+            for (auto s : free)
+                delete s;
+            release(state);
+        }
+
+        // a free slot, or a new one if all of them are in use
+        Writer acquire()
+        {
+            Slot *slot = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (not state->free.empty())
+                {
+                    slot = state->free.back();
+                    state->free.pop_back();
+                }
+            }
+            if (slot == nullptr)
+            {
+                slot = new Slot;
+                slot->state = state;
+            }
+            state->users.fetch_add(1, std::memory_order_relaxed);
+            return Writer(slot);
+        }
+
+        // publishes a copy of v, for values that are not stored in the pool
+        Handle make(const O &v)
+        {
+            auto w = acquire();
+            *w = v;
+            return std::move(w).publish();
+        }
+};
+
+#endif
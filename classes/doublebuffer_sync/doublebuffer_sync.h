@@ -30,9 +30,34 @@
 //           auto [laser, str] = buffer.read_last(max_diff);  Returns the last elements of the queues. It only returns the last element
 //           from queues when the difference between the last timestamp and the last element of the queues in less than `max_diff`.
 //
+//           auto [laser] = co_await buffer.next<0>(&pool);  From a coroutine, suspends until the next put to queue 0 and
+//           returns its last element. The coroutine is resumed as a task of pool, or in the buffer worker without one.
+//
+//           Queues declared with RingInOut instead of InOut are lock free rings of 'size' preallocated slots (see seqlock_ring.h)
+//           BufferSync<RingInOut<Imu, Imu>, InOut<Image, Image>> buffer(100);
+//           A put to a ring queue does not take the buffer lock and reads that only touch ring queues do not take it either,
+//           so a 1 kHz IMU producer does not contend with the readers of the other queues.
+//
+//           auto [cloud, image] = buffer.read_last_shared();  Same as read_last but without copies: each element is a
+//           SlotPool<O>::Handle, a shared const reference that keeps the element alive and unchanged while it is held.
+//           read_shared and read_first_shared are the counterparts of read and read_first.
+//
+//           The conversion executor is the first template argument of BasicBufferSync, BufferSync uses PrivateWorker:
+//           BasicBufferSync<InlineConversion, InOut<Imu, Imu>> imu_buffer;      converts and publishes in the thread calling put
+//           BasicBufferSync<SharedPool, InOut<Image, Image>> image_buffer(pool, 3);  converts in the tasks of an external ThreadPool
+//           buffer.wait_visible<0>();  Returns once every put to queue 0 made so far can be read. buffer.wait_visible() waits for all queues.
+//
+//           auto m = buffer.metrics();  Per queue counters: puts, drops, conversion time, inter-arrival time and jitter, age of the
+//           data and timestamp skew at read time. They are relaxed atomics, always on. buffer.reset_metrics() clears them.
+//           Built with -DRC_TRACING=1 puts, conversions and reads are also slices in the traces of tracing/trace.h.
+//
 //           It is also possible to use the functions to retrieve elements  from specific queues only.
 //           auto str = buffer.read<0>(timestamp);  Only returns the element from the first InOut<std::string, std::string> queue.
 //
+//           auto id = buffer.subscribe<0, 1>(20, [](auto &&laser, auto &&str){ ... });  Calls the lambda, in the buffer worker,
+//           as soon as queues 0 and 1 hold a pair of elements less than 20 apart that was not delivered before. Each argument
+//           is a std::pair of the value and its timestamp. buffer.unsubscribe(id) removes it.
+//
 //          Every read operation returns a value from the circular queue without consuming it, returns an optional
 //          and allows passing a max_time_diff to consider two values part of the same
 //          time group.
@@ -48,10 +73,15 @@
 
 #pragma once
 
+#include <array>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <mutex>
 #include <optional>
@@ -62,6 +92,10 @@
 #include <vector>
 
 #include <threadpool/threadpool.h>
+#include <threadpool/coroutine.h>
+#include <tracing/trace.h>
+#include <doublebuffer/slot_pool.h>
+#include "seqlock_ring.h"
 
 using namespace std::chrono_literals;
 
@@ -80,13 +114,14 @@ template <typename T, typename = void> struct is_iterable : std::false_type {};
  * The 'decltype' keyword is used to inspect the declared type of an entity or the type and value category
  * of an expression. std::declval<T>() is used to create a value of type T without needing to construct it.
  *
- * If a type T has both begin() and end() methods, the specialization of the struct 'is_iterable' for that type
+ * If a type T has both begin() and end() methods, and what begin() returns can be dereferenced (it cannot for the 2D
+ * matrices of Eigen, whose begin() is void), the specialization of the struct 'is_iterable' for that type
  * will be chosen over the primary template, and thus 'is_iterable<T>::value' will be true.
  * If a type T does not have either begin() or end() methods, the primary template will be used,
  * and 'is_iterable<T>::value' will be false.
  */
 template <typename T>
-struct is_iterable<T, std::void_t<decltype(std::declval<T>().begin()),
+struct is_iterable<T, std::void_t<decltype(*std::declval<T>().begin()),
                                   decltype(std::declval<T>().end())>>
     : std::true_type {};
 
@@ -126,10 +161,58 @@ struct InOut
 {
   typedef _I I;
   typedef _O O;
+  static constexpr bool lock_free = false;
+};
+
+// Same as InOut, but the queue is a fixed capacity SeqlockRing: puts and reads of it do not take the buffer lock
+template <typename _I, typename _O>
+struct RingInOut : InOut<_I, _O>
+{
+  static constexpr bool lock_free = true;
+};
+
+/**
+ * 'BufferSyncMetrics' is a snapshot of the counters of a buffer, one 'Queue' per data buffer, returned by 'metrics'.
+ * - 'drops' counts the elements lost before being read out of the window: popped or overwritten by a put to a full queue, or
+ *   discarded by a ring because they arrived out of order.
+ * - 'interarrival_s' and 'jitter_s' are smoothed with a gain of 1/16, the jitter as in RFC 3550, so a stalled sensor shows
+ *   up as a growing 'age' and a noisy one as a large 'jitter_s'.
+ * - 'age' is the time since the newest element of the queue was published, measured on every read returning an element of it.
+ * - 'skew' is, in timestamp units, the distance between the timestamp of the element read and the requested one, or the newest
+ *   timestamp among the elements returned together by 'read_last' and 'read_first'.
+ */
+struct BufferSyncMetrics
+{
+    struct Queue
+    {
+        uint64_t puts = 0;
+        uint64_t drops = 0;
+        double conversion_mean_s = 0, conversion_max_s = 0;
+        double interarrival_s = 0, jitter_s = 0;
+        uint64_t reads = 0;
+        double age_mean_s = 0, age_max_s = 0;
+        double skew_mean = 0;
+        size_t skew_max = 0;
+    };
+    std::vector<Queue> queues;
 };
 
 /**
- * BufferSync is a template class that provides a thread-safe buffer for synchronizing data between multiple threads.
+ * Conversion executors, the first template argument of 'BasicBufferSync'. They decide where 'put' converts and publishes its data:
+ * - 'PrivateWorker' uses a thread owned by the buffer, as 'BufferSync' always did. 'put' returns before the data is visible.
+ * - 'InlineConversion' uses the thread calling 'put', which returns once the data is visible. Best for cheap converters:
+ *   there is no task, no queueing and no context switch.
+ * - 'SharedPool' uses the tasks of an external 'ThreadPool' given to the constructor, so conversions run in parallel.
+ *   The destructor waits for the puts still pending.
+ * With the last two, puts to the same queue may run in several threads: publication is serialized per queue and elements
+ * that complete out of order are inserted in timestamp order, except in rings, which drop an element older than their newest one.
+ */
+struct PrivateWorker {};
+struct InlineConversion {};
+struct SharedPool {};
+
+/**
+ * BasicBufferSync is a template class that provides a thread-safe buffer for synchronizing data between multiple threads.
  * It is designed to be used in a producer-consumer scenario where data is produced by one or more threads (producers)
  * and consumed by another thread (consumer).
  *
@@ -137,11 +220,21 @@ struct InOut
  * Each type in 'DBs' is expected to be an instance of the 'InOut' template struct, which represents a pair of input and output types.
  *
 **/
-template <class... DBs> class BufferSync
+template <class Executor, class... DBs> class BasicBufferSync
 {
+    static_assert(std::is_same_v<Executor, PrivateWorker> || std::is_same_v<Executor, InlineConversion> || std::is_same_v<Executor, SharedPool>,
+                  "the executor must be PrivateWorker, InlineConversion or SharedPool");
     private:
         template <typename T> using pair_t_time = std::pair<T, size_t>;
         template <typename T> using deque_db_t = std::deque<pair_t_time<T>>;
+        template <typename DB> static constexpr bool lock_free_v = requires { requires DB::lock_free; };
+        template <size_t idx> static constexpr bool ring_v = lock_free_v<std::tuple_element_t<idx, std::tuple<DBs...>>>;
+        template <typename DB> using handle_t = typename SlotPool<typename DB::O>::Handle;
+        // trivially copyable values in rings are stored by value, everything else in slots shared with the readers
+        template <typename DB> using element_t = std::conditional_t<lock_free_v<DB> && std::is_trivially_copyable_v<typename DB::O>,
+                                                                    typename DB::O, handle_t<DB>>;
+        template <typename DB> using queue_t = std::conditional_t<lock_free_v<DB>, SeqlockRing<element_t<DB>>, deque_db_t<element_t<DB>>>;
+        template <size_t idx> using db_t = std::tuple_element_t<idx, std::tuple<DBs...>>;
 
         /**
         * 'DBs_size' is a static constexpr (constant expression) of type size_t. It is initialized with the number of types in the template parameter pack 'DBs'.
@@ -158,26 +251,84 @@ template <class... DBs> class BufferSync
         * 'deque_db_t<typename DBs::O>' is a deque that stores pairs, where each pair consists of an output type and a timestamp.
         * This tuple '_out' is used to store the output data for each type in 'DBs'. Each output data is associated with a timestamp.
         * The data is stored in a deque to allow efficient insertion and removal of elements at both ends.
+        * Queues declared with 'RingInOut' are a 'SeqlockRing' instead, with 'queue_size' slots allocated in the constructor.
+        * Elements are 'SlotPool' handles, except trivially copyable values in rings. 'pools' holds the slots of each data buffer:
+        * a put fills a free one, and a slot is free again when it has left the data buffer and no reader holds it.
         */
-        std::tuple<deque_db_t<typename DBs::O>...> _out;
-        std::array<size_t, DBs_size> last_write;
+        std::tuple<SlotPool<typename DBs::O>...> pools;
+        std::tuple<queue_t<DBs>...> _out;
+        std::array<std::atomic<size_t>, DBs_size> last_write{};
 
         mutable std::shared_mutex bufferMutex;
         std::atomic_bool empty;
+
+        /**
+        * 'writes' counts the puts completed on each queue and 'waiters' holds the coroutines suspended in 'next' on it.
+        * A coroutine waits until the counter of its queue moves past the value it saw when it called 'next'.
+        * Both are declared before 'worker' so a put still running while the buffer is destroyed can use them.
+        * 'submitted' counts the puts started, so 'wait_visible' waits until 'writes' reaches it.
+        * 'publish_mutex' serializes the publication to each queue when puts can run in several threads.
+        */
+        std::array<std::atomic<uint64_t>, DBs_size> writes{};
+        std::array<std::atomic<uint64_t>, DBs_size> submitted{};
+        std::array<std::mutex, DBs_size> publish_mutex;
+
+        /**
+        * 'Counters' are the metrics of a data buffer. The put side is written by the thread publishing to it, which is unique at any time,
+        * and the read side with relaxed 'fetch_add' by the readers. Durations are in 'steady_clock' ticks.
+        */
+        struct Counters
+        {
+            std::atomic<uint64_t> puts{0}, drops{0}, conversion{0}, conversion_max{0};
+            std::atomic<double> interarrival{0}, jitter{0};
+            std::atomic<uint64_t> reads{0}, age{0}, age_max{0}, skew{0}, skew_max{0};
+        };
+        std::array<Counters, DBs_size> counters;
+        std::array<coro::waiter_list, DBs_size> waiters;
+
+        /**
+        * 'Subscription' is a callback registered with 'subscribe'. 'queues' has a bit set for each data buffer it synchronizes
+        * and 'match' is called in the worker after every put to one of them, with the index and timestamp of the new element.
+        * 'subscribed' is the union of the 'queues' masks, so puts to data buffers nobody subscribed to skip the mutex.
+        */
+        struct Subscription
+        {
+            size_t id;
+            uint64_t queues;
+            std::function<void(size_t, size_t)> match;
+        };
+        std::mutex subscriptions_mutex;
+        std::vector<Subscription> subscriptions;
+        std::atomic<uint64_t> subscribed{0};
+        size_t last_subscription = 0;
         /**
         * 'worker' is an instance of the ThreadPool class.
         * ThreadPool is a class that manages a pool of worker threads.
         * These threads can be used to execute tasks concurrently, which can improve the performance of the program if the tasks can be run in parallel.
         * The 'worker' instance is used in the BufferSync class to spawn tasks that are executed in separate threads.
         * This is particularly used in the 'put' method where data is added to the buffer in a separate thread.
+        * It only exists with the 'PrivateWorker' executor. 'executor' points to it, or to the external pool with 'SharedPool'.
         */
-        ThreadPool worker;
+        std::optional<ThreadPool> worker;
+        ThreadPool *executor = nullptr;
         size_t queue_size;
 
     public:
-        BufferSync() : worker(1), queue_size(1) {};
-        BufferSync(size_t size) : worker(1), queue_size(size) {};
-        ~BufferSync() {};
+        template <size_t idx> using shared_t = handle_t<db_t<idx>>;
+
+        BasicBufferSync() requires (not std::is_same_v<Executor, SharedPool>) : BasicBufferSync(1) {};
+        BasicBufferSync(size_t size) requires (not std::is_same_v<Executor, SharedPool>) : _out(queue_arg<DBs>(size)...), queue_size(size)
+        {
+            if constexpr (std::is_same_v<Executor, PrivateWorker>)
+                executor = &worker.emplace(1);
+        };
+        BasicBufferSync(ThreadPool &pool, size_t size = 1) requires std::is_same_v<Executor, SharedPool>
+            : _out(queue_arg<DBs>(size)...), executor(&pool), queue_size(size) {};
+        ~BasicBufferSync()
+        {
+            if constexpr (std::is_same_v<Executor, SharedPool>)
+                wait_visible();
+        };
 
         /**
         * 'read_first' is a method that returns a tuple of optional output types for each data buffer.
@@ -210,19 +361,33 @@ template <class... DBs> class BufferSync
         * Finally, the method returns 'ret', which contains the first elements from the data buffers.
         * This method is used to retrieve the first elements from all data buffers at once, without removing them from the buffers.
         */
-        template <size_t... idx> auto read_first()
+        template <size_t... idx> auto read_first() { return read_first_as<false, idx...>(); }
+
+        /**
+        * 'read_first_shared' is the same as 'read_first' but returns a tuple of 'shared_t' handles instead of copies.
+        * An empty handle means that the data buffer is empty.
+        */
+        template <size_t... idx> auto read_first_shared() { return read_first_as<true, idx...>(); }
+
+    private:
+        template <bool shared, size_t... idx> auto read_first_as()
         {
-            auto ret = subtuple<idx...>();
+            RC_TRACE_SCOPE("buffersync", "BufferSync::read_first");
+            auto ret = result_t<shared, idx...>();
             if (empty.load())
                 return ret;
 
-            std::shared_lock lock(bufferMutex);
+            auto lock = shared_lock_for<idx...>();
+            std::array<std::optional<size_t>, DBs_size> stamps;
             (
-                [](auto &q, auto &r)
+                [&]<size_t i>()
                 {
-                  if (!q.empty())
-                    r = q.front().first;
-                }(std::get<idx>(_out), std::get<idx>(ret)), // arguments to call lambda in place
+                  if (auto e = oldest(std::get<i>(_out)))
+                  {
+                    std::get<i>(ret) = out<shared, i>(e->first);
+                    stamps[i] = e->second;
+                  }
+                }.template operator()<idx>(),
             ...);
 
             /**
@@ -232,9 +397,13 @@ template <class... DBs> class BufferSync
             if ((std::get<idx>(_out).empty() && ...))
                 empty.store(true);
 
+            account<idx...>(stamps, std::nullopt);
+
             return ret;
         }
 
+    public:
+
         /**  Note: 'read_last' is overloaded in two versions
         * This version of 'read_last' is a non-template function that creates an index sequence and then calls the second version of 'read_last' with this index sequence.
         * The 'max_diff' parameter is used to determine the maximum allowed difference between the timestamps of the data elements.
@@ -251,6 +420,19 @@ template <class... DBs> class BufferSync
                 }(seq);
         }
 
+        /**
+        * 'read_last_shared' is the same as 'read_last' but returns a tuple of 'shared_t' handles instead of copies.
+        * An empty handle means that there is no element for that data buffer. Several consumers reading the same element share it.
+        */
+        auto read_last_shared(size_t max_diff = std::numeric_limits<size_t>::max()) -> std::tuple<handle_t<DBs>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+                {
+                  return read_last_shared<Is...>(max_diff);
+                }(seq);
+        }
+
         /**
         * This version of 'read_last' is a template function that takes a variadic template argument 'idx...'. This argument represents the indices of the data buffers.
         * The function retrieves the last elements (NEWEST) from the data buffers at these indices.
@@ -264,30 +446,46 @@ template <class... DBs> class BufferSync
         * Finally, it returns 'ret', which contains the last elements from the data buffers.
         */
         template <size_t... idx>
-        auto read_last(size_t max_diff = std::numeric_limits<size_t>::max())
+        auto read_last(size_t max_diff = std::numeric_limits<size_t>::max()) { return read_last_as<false, idx...>(max_diff); }
+        template <size_t... idx>
+        auto read_last_shared(size_t max_diff = std::numeric_limits<size_t>::max()) { return read_last_as<true, idx...>(max_diff); }
+
+    private:
+        template <bool shared, size_t... idx>
+        auto read_last_as(size_t max_diff)
         {
-            auto ret = subtuple<idx...>();
+            RC_TRACE_SCOPE("buffersync", "BufferSync::read_last");
+            auto ret = result_t<shared, idx...>();
 
             if (empty.load())
               return ret;
 
-            std::shared_lock lock(bufferMutex);
+            auto lock = shared_lock_for<idx...>();
+            std::array<std::optional<size_t>, DBs_size> stamps;
             size_t max = *std::max_element(last_write.begin(), last_write.end());
             // fold expression
             (
-                [max, max_diff](auto &q, auto &r)
+                [&]<size_t i>()
                 {
-                  if (!q.empty() && (max - q.back().second < max_diff))
-                    r = q.back().first;
-                }(std::get<idx>(_out), std::get<idx>(ret)),
+                  auto e = newest(std::get<i>(_out));
+                  if (e && (max - e->second < max_diff))
+                  {
+                    std::get<i>(ret) = out<shared, i>(e->first);
+                    stamps[i] = e->second;
+                  }
+                }.template operator()<idx>(),
                 ...);
 
             if ((std::get<idx>(_out).empty() && ...))
               empty.store(true);
 
+            account<idx...>(stamps, std::nullopt);
+
             return ret;
         }
 
+    public:
+
         /**  Note: 'read' is overloaded in two versions
         * This version of 'read' is a non-template function that creates an index sequence and then calls the second version of 'read' with this index sequence.
         * The 'timestamp' and 'max_diff' parameters are used to determine the maximum allowed difference between the timestamps of the data elements.
@@ -305,49 +503,213 @@ template <class... DBs> class BufferSync
             }(seq);
         }
 
+        /**
+        * 'read_shared' is the same as 'read' but returns a tuple of 'shared_t' handles instead of copies.
+        * An empty handle means that no element of that data buffer is within 'max_diff' of 'timestamp'.
+        */
+        auto read_shared(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
+          -> std::tuple<handle_t<DBs>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return read_shared<Is...>(timestamp, max_diff);
+            }(seq);
+        }
+
         /**
         * This version of 'read' is a template function that takes a variadic template argument 'idx...'. This argument represents the indices of the data buffers.
         * The function retrieves the elements from the data buffers at these indices that are closest to the provided timestamp and within the 'max_diff' limit.
         * The function first creates a tuple 'ret' of optional output types for each data buffer.
         * If the buffer is empty (checked by 'empty.load()'), the function returns 'ret' immediately.
         * Otherwise, it locks the buffer for shared access using a 'std::shared_lock'.
-        * Then, for each data buffer, it calculates the absolute difference between the timestamp of each element and the provided timestamp.
-        * It finds the element with the minimum difference and if this difference is less than or equal to 'max_diff', it assigns this element to the corresponding element in 'ret'.
+        * Then, for each data buffer, it finds the element whose timestamp is closest to the provided timestamp with a binary search ('closest').
+        * Elements are appended in timestamp order, so this takes O(log n) comparisons and does not allocate.
+        * If the absolute difference is less than or equal to 'max_diff', it assigns this element to the corresponding element in 'ret'.
         * After that, the function checks if all data buffers are empty. If they are, it sets 'empty' to true.
         * Finally, it returns 'ret', which contains the elements from the data buffers that are closest to the provided timestamp and within the 'max_diff' limit.
         */
         template <size_t... idx>
         auto read(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
         {
-            auto ret = subtuple<idx...>();
+            return read_as<false, idx...>(timestamp, max_diff);
+        }
+        template <size_t... idx>
+        auto read_shared(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
+        {
+            return read_as<true, idx...>(timestamp, max_diff);
+        }
+
+    private:
+        template <bool shared, size_t... idx>
+        auto read_as(size_t timestamp, size_t max_diff)
+        {
+            RC_TRACE_SCOPE("buffersync", "BufferSync::read");
+            auto ret = result_t<shared, idx...>();
 
             if (empty.load())
             return ret;
 
-            std::shared_lock lock(bufferMutex);
-            size_t dropped = 0;
+            auto lock = shared_lock_for<idx...>();
+            std::array<std::optional<size_t>, DBs_size> stamps;
             // fold expression
             (
-                [timestamp, max_diff, &dropped](auto &q, auto &r) {
-                  std::vector<size_t> diffs;
-                  std::transform(q.begin(), q.end(), std::back_inserter(diffs),
-                                 [timestamp](auto &val) {
-                                   return std::abs(static_cast<ssize_t>(val.second) -
-                                                   static_cast<ssize_t>(timestamp));
-                                 });
-                  auto it_idx = std::min(diffs.begin(), diffs.end()) - diffs.begin();
-                  auto it = q.begin() + it_idx;
-                  if (it != q.end() && timestamp - it->second <= max_diff)
-                    r = it->first;
-                }(std::get<idx>(_out), std::get<idx>(ret)),
+                [&]<size_t i>() {
+                  auto e = closest(std::get<i>(_out), timestamp);
+                  if (e && distance(e->second, timestamp) <= max_diff)
+                  {
+                    std::get<i>(ret) = out<shared, i>(e->first);
+                    stamps[i] = e->second;
+                  }
+                }.template operator()<idx>(),
                 ...);
 
             if ((std::get<idx>(_out).empty() && ...))
               empty.store(true);
 
+            account<idx...>(stamps, timestamp);
+
             return ret;
         }
 
+    public:
+
+        /**
+        * 'Bracket' holds the elements of a data buffer around a timestamp, each one with its own timestamp.
+        * 'before' is the newest element with a timestamp less than or equal to the requested one and 'after' the oldest with a greater one.
+        * Either of them is empty when the timestamp lies outside the time span covered by the data buffer.
+        */
+        template <typename O> struct Bracket
+        {
+            std::optional<pair_t_time<O>> before;
+            std::optional<pair_t_time<O>> after;
+        };
+
+        /**  Note: 'read_bracket' is overloaded in two versions
+        * This version of 'read_bracket' is a non-template function that creates an index sequence and then calls the second version of 'read_bracket' with it.
+        * It returns a tuple with a 'Bracket' for every data buffer.
+        */
+        auto read_bracket(size_t timestamp) -> std::tuple<Bracket<typename DBs::O>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return read_bracket<Is...>(timestamp);
+            }(seq);
+        }
+
+        /**
+        * This version of 'read_bracket' is a template function that takes a variadic template argument 'idx...'. This argument represents the indices of the data buffers.
+        * The function retrieves, for each data buffer at these indices, the elements just before and just after the provided timestamp.
+        * It is meant for interpolation, e.g. of a 1 kHz IMU queue at the timestamp of a camera frame:
+        *      auto [imu] = buffer.read_bracket<0>(frame_stamp);
+        *      if (imu.before and imu.after) { float a = float(frame_stamp - imu.before->second) / (imu.after->second - imu.before->second); ... }
+        * The function locks the buffer for shared access using a 'std::shared_lock' (unless only rings are read) and uses a binary search on each data buffer,
+        * so it takes O(log n) comparisons and does not allocate. Elements are not consumed.
+        */
+        template <size_t... idx>
+        auto read_bracket(size_t timestamp)
+        {
+            RC_TRACE_SCOPE("buffersync", "BufferSync::read_bracket");
+            std::tuple<Bracket<typename std::tuple_element_t<idx, std::tuple<DBs...>>::O>...> ret;
+
+            if (empty.load())
+              return ret;
+
+            auto lock = shared_lock_for<idx...>();
+            (
+                [timestamp](auto &q, auto &r) {
+                  auto [before, after] = around(q, timestamp);
+                  r.before = to_value(before);
+                  r.after = to_value(after);
+                }(std::get<idx>(_out), std::get<idx>(ret)),
+                ...);
+
+            return ret;
+        }
+
+        /**
+        * 'subscribe' is a template method that registers a callback fired as soon as a time aligned set of elements exists in the data buffers at the indices 'idx...'.
+        * The method takes two parameters:
+        * - 'slop' is the maximum difference between the timestamps of the elements of a set, as in the ApproximateTime policy of ROS message_filters.
+        * - 'cb' is called with one argument per data buffer, a 'std::pair' with the element and its timestamp.
+        *
+        * After every put to one of the data buffers the new element is taken as pivot and, for each of the other data buffers,
+        * the element closest to it that is newer than the last one delivered from that data buffer.
+        * If all of them exist and are within 'slop' of each other, the set is delivered. So:
+        * - Every set is delivered once, in the put that completes it, with no added latency.
+        * - Every element is delivered at most once, and elements without partners within 'slop' are skipped.
+        * - Matching is greedy: a better partner arriving after the set was delivered is not used.
+        *
+        * The callback runs in the thread that published the put (see the executors), after the put is visible, so it must be short
+        * or hand its work to a thread pool.
+        * It must not call 'subscribe' or 'unsubscribe'. The method returns an id for 'unsubscribe'.
+        */
+        template <size_t... idx, typename Callback>
+        size_t subscribe(size_t slop, Callback &&cb)
+        {
+            static_assert(sizeof...(idx) > 0 and DBs_size <= 64, "subscribe needs at least one queue, and at most 64 in the buffer");
+            Subscription s;
+            s.queues = ((uint64_t(1) << idx) | ...);
+            s.match = [this, slop, cb = std::forward<Callback>(cb), delivered = std::array<std::optional<size_t>, sizeof...(idx)>{}]
+                      (size_t, size_t timestamp) mutable
+                      {
+                          match<idx...>(timestamp, slop, delivered, cb);
+                      };
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            s.id = ++last_subscription;
+            subscribed.fetch_or(s.queues);
+            subscriptions.push_back(std::move(s));
+            return last_subscription;
+        }
+
+        /**
+        * 'unsubscribe' removes the callback registered by 'subscribe' with the given 'id'.
+        * Once it returns the callback is not running and it will not be called again.
+        */
+        void unsubscribe(size_t id)
+        {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            std::erase_if(subscriptions, [id](const Subscription &s) { return s.id == id; });
+            uint64_t mask = 0;
+            for (const auto &s : subscriptions)
+                mask |= s.queues;
+            subscribed.store(mask);
+        }
+
+        /**
+        * 'next' is a template method that returns an awaitable for the next write to the data buffer at index 'idx'.
+        * The template parameter 'idx' represents the index of the data buffer.
+        * The method takes one parameter:
+        * - 'resume_on' is the pool where the coroutine is resumed. If it is null the coroutine runs in the thread that published the put
+        *   (see the executors), right after it, so it should hand long work to another pool.
+        *
+        * 'co_await buffer.next<idx>()' does the following:
+        * - If a put to the data buffer at index 'idx' has completed since 'next' was called, it does not suspend.
+        * - Otherwise it suspends the coroutine without blocking any thread until the next put to that data buffer completes.
+        * - It then returns the result of 'read_last<idx>()', a tuple with the newest element of the data buffer.
+        *
+        * This method is used by coroutines that process every new element, instead of polling 'read_last' or blocking a thread.
+        */
+        template <size_t idx>
+        auto next(ThreadPool *resume_on = nullptr)
+        {
+            struct awaiter
+            {
+                BasicBufferSync &buffer;
+                ThreadPool *pool;
+                uint64_t seen;
+                bool written() const { return buffer.writes[idx].load() != seen; }   // seq_cst, pairs with waiter_list
+                bool await_ready() const { return written(); }
+                bool await_suspend(std::coroutine_handle<> h)
+                {
+                    return buffer.waiters[idx].suspend(h, pool, [this]() { return written(); });
+                }
+                auto await_resume() { return buffer.template read_last<idx>(); }
+            };
+            return awaiter{*this, resume_on, writes[idx].load()};
+        }
+
         /**
         * 'put' is a template method that inserts a new data item into the buffer at a specific index.
         * The template parameter 'idx' represents the index of the data buffer.
@@ -356,37 +718,93 @@ template <class... DBs> class BufferSync
         * - 'timestamp' is the timestamp associated with the data item.
         * - 't' is a function that transforms the input data item to the output data type. It defaults to 'empty_fn' if not provided.
         *
-        * The method first spawns a new task in the worker thread pool. The task is a lambda function that does the following:
-        * - It creates a temporary variable 'temp' of output type 'typename InOut::O'.
-        * - It calls the 'ItoO' method to transform the input data item 'd' to the output data type and stores the result in 'temp'.
+        * The method counts the put in 'submitted' and calls 'publish', directly with 'InlineConversion' or in a task of 'executor' otherwise.
+        * 'publish' does the following:
+        * - It calls the 'ItoO' method to transform the input data item 'd' to the output data type, into a recycled slot of 'pools'
+        *   published as the handle 'temp' (for trivially copyable values in rings, directly into 'temp').
         * - It locks the buffer for exclusive access using a 'std::unique_lock'.
         * - It updates the 'last_write' timestamp for the data buffer at index 'idx'.
         * - If the size of the data buffer at index 'idx' is greater than or equal to 'queue_size', it removes the first element from the buffer.
         * - It inserts the transformed data item 'temp' and its associated timestamp into the data buffer at index 'idx'.
+        * - For a 'RingInOut' queue the lock is not taken: 'temp' is pushed to the ring, overwriting its oldest slot when it is full.
         * - It sets 'empty' to false to indicate that the buffer is not empty.
+        * - After releasing the lock, it counts the write and resumes the coroutines waiting in 'next' on the data buffer.
+        * - Finally, it runs the matching of the subscriptions that include the data buffer ('subscribe').
         *
-        * Finally, the method returns true to indicate that the data item was successfully inserted into the buffer.
+        * Finally, the method returns true. With 'InlineConversion' the data item is then visible, otherwise 'wait_visible' waits for it.
         */
         template <size_t idx, typename InOut = std::remove_cvref_t<decltype(std::get<idx>(std::tuple<DBs...>()))>>
         bool put(typename InOut::I &&d, size_t timestamp, std::function<void(typename InOut::I &&, typename InOut::O &)> t = empty_fn)
             {
-                worker.spawn_task
-                (
-                    [this, d = std::move(d), t = std::move(t), timestamp]() mutable
-                    {
-                      typename InOut::O temp;
-                      this->ItoO(std::move(d), temp, t);
-                      std::unique_lock lock(this->bufferMutex);
-                      last_write[idx] = std::chrono::steady_clock::now().time_since_epoch().count();
-                      if (std::get<idx>(_out).size() + 1 > queue_size)
-                        std::get<idx>(_out).pop_front();
-                      std::get<idx>(_out).emplace_back(std::move(temp), timestamp);
-                      empty.store(false);
-                    }
-                );
+                RC_TRACE_SCOPE("buffersync", "BufferSync::put");
+                submitted[idx].fetch_add(1, std::memory_order_relaxed);
+                if constexpr (std::is_same_v<Executor, InlineConversion>)
+                    publish<idx, InOut>(std::move(d), timestamp, t);
+                else
+                    executor->spawn_task
+                    (
+                        [this, d = std::move(d), t = std::move(t), timestamp]() mutable
+                        {
+                          publish<idx, InOut>(std::move(d), timestamp, t);
+                        }
+                    );
                 return true;
             }
 
+        /**
+        * 'metrics' returns a snapshot of the counters of every data buffer, see 'BufferSyncMetrics'. It only reads relaxed atomics,
+        * so it can be called often, e.g. from a monitoring timer, and values of different counters may be from slightly different times.
+        * 'reset_metrics' sets all of them to zero, but not the inter-arrival time and jitter.
+        */
+        BufferSyncMetrics metrics() const
+        {
+            auto seconds = [](double ticks) { return std::chrono::duration<double>(std::chrono::steady_clock::duration(1)).count() * ticks; };
+            BufferSyncMetrics m;
+            m.queues.resize(DBs_size);
+            for (size_t i = 0; i < DBs_size; i++)
+            {
+                const auto &c = counters[i];
+                auto &q = m.queues[i];
+                q.puts = c.puts.load(std::memory_order_relaxed);
+                q.drops = c.drops.load(std::memory_order_relaxed);
+                q.conversion_mean_s = q.puts ? seconds(double(c.conversion.load(std::memory_order_relaxed)) / q.puts) : 0;
+                q.conversion_max_s = seconds(double(c.conversion_max.load(std::memory_order_relaxed)));
+                q.interarrival_s = seconds(c.interarrival.load(std::memory_order_relaxed));
+                q.jitter_s = seconds(c.jitter.load(std::memory_order_relaxed));
+                q.reads = c.reads.load(std::memory_order_relaxed);
+                q.age_mean_s = q.reads ? seconds(double(c.age.load(std::memory_order_relaxed)) / q.reads) : 0;
+                q.age_max_s = seconds(double(c.age_max.load(std::memory_order_relaxed)));
+                q.skew_mean = q.reads ? double(c.skew.load(std::memory_order_relaxed)) / q.reads : 0;
+                q.skew_max = c.skew_max.load(std::memory_order_relaxed);
+            }
+            return m;
+        }
+
+        void reset_metrics()
+        {
+            for (auto &c : counters)
+                for (auto *a : {&c.puts, &c.drops, &c.conversion, &c.conversion_max, &c.reads, &c.age, &c.age_max, &c.skew, &c.skew_max})
+                    a->store(0, std::memory_order_relaxed);
+        }
+
+        /**
+        * 'wait_visible' blocks until every put to the data buffers at the indices 'idx' made before the call can be read.
+        * With no indices it waits for all the data buffers. It returns immediately with the 'InlineConversion' executor.
+        */
+        template <size_t... idx> void wait_visible()
+        {
+            if constexpr (sizeof...(idx) == 0)
+                [this]<std::size_t... Is>(std::index_sequence<Is...>) { (wait_visible<Is>(), ...); }(std::make_index_sequence<DBs_size>{});
+            else
+                (
+                    [this](std::atomic<uint64_t> &done, uint64_t target)
+                    {
+                      for (uint64_t w = done.load(); w < target; w = done.load())
+                        done.wait(w);
+                    }(writes[idx], submitted[idx].load(std::memory_order_relaxed)),
+                ...);
+        }
+
         /**
         * 'show' is a method that prints the contents of the data buffers to the standard output.
         * The method is constrained by a C++20 concept 'printable', which checks if the output types of the data buffers can be printed to the standard output.
@@ -415,10 +833,11 @@ template <class... DBs> class BufferSync
                     (
                         [&]<size_t idx>()
                         {
-                          if (i < std::get<idx>(_out).size())
+                          auto lock = shared_lock_for<idx>();
+                          if (auto e = element(std::get<idx>(_out), i))
                           {
-                            auto &[f, s] = std::get<idx>(_out)[i];
-                            std::cout << std::setw(4) << idx << " | " << std::setw(14) << f << " | " << std::setw(15) << s << "\n";
+                            auto &[f, s] = *e;
+                            std::cout << std::setw(4) << idx << " | " << std::setw(14) << value_of(f) << " | " << std::setw(15) << s << "\n";
                           }
                           else
                               std::cout << std::setw(4) << idx << " | " << std::setw(14) << " empty" << " |\n";
@@ -431,6 +850,310 @@ template <class... DBs> class BufferSync
 
     private:
 
+        /**
+        * 'publish' converts 'd' and inserts it into the data buffer at index 'idx', then wakes the coroutines and subscriptions waiting for it.
+        * See 'put' for the steps. With the 'PrivateWorker' executor it always runs in the single buffer worker, so rings have one producer
+        * and elements arrive in order; otherwise publication to a queue is serialized by its 'publish_mutex' and order is restored.
+        */
+        template <size_t idx, typename InOut>
+        void publish(typename InOut::I &&d, size_t timestamp, const std::function<void(typename InOut::I &&, typename InOut::O &)> &t)
+        {
+            RC_TRACE_SCOPE("buffersync", "BufferSync::publish");
+            constexpr bool concurrent = not std::is_same_v<Executor, PrivateWorker>;
+            const auto started = std::chrono::steady_clock::now();
+            element_t<InOut> temp;
+            if constexpr (std::is_same_v<element_t<InOut>, typename InOut::O>)
+              this->ItoO(std::move(d), temp, t);
+            else
+            {
+              auto slot = std::get<idx>(pools).acquire();
+              this->ItoO(std::move(d), *slot, t);
+              temp = std::move(slot).publish();
+            }
+            const auto converted = std::chrono::steady_clock::now();
+            const uint64_t conversion = (converted - started).count();
+            auto &c = counters[idx];
+            c.puts.fetch_add(1, std::memory_order_relaxed);
+            c.conversion.fetch_add(conversion, std::memory_order_relaxed);
+            raise(c.conversion_max, conversion);
+            if constexpr (ring_v<idx>)
+            {
+              std::unique_lock<std::mutex> order(publish_mutex[idx], std::defer_lock);
+              if constexpr (concurrent)
+                order.lock();
+              auto &q = std::get<idx>(_out);
+              if (not concurrent or q.empty() or q.back_stamp() <= timestamp)
+              {
+                arrival<idx>(converted);
+                const size_t before = q.size();
+                q.push(std::move(temp), timestamp);
+                if (q.size() == before)
+                  c.drops.fetch_add(1, std::memory_order_relaxed);
+                empty.store(false);
+              }
+              else
+                c.drops.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+              std::unique_lock lock(this->bufferMutex);
+              auto &q = std::get<idx>(_out);
+              arrival<idx>(converted);
+              if (q.size() + 1 > queue_size)
+              {
+                q.pop_front();
+                c.drops.fetch_add(1, std::memory_order_relaxed);
+              }
+              if (not concurrent or q.empty() or q.back().second <= timestamp)
+                q.emplace_back(std::move(temp), timestamp);
+              else
+                q.emplace(std::upper_bound(q.begin(), q.end(), timestamp, [](size_t ts, const auto &val) { return ts < val.second; }),
+                          std::move(temp), timestamp);
+              empty.store(false);
+            }
+            writes[idx].fetch_add(1);
+            writes[idx].notify_all();
+            waiters[idx].resume_all();
+            if (subscribed.load(std::memory_order_relaxed) & (uint64_t(1) << idx))
+            {
+              std::lock_guard<std::mutex> lock(subscriptions_mutex);
+              for (auto &s : subscriptions)
+                if (s.queues & (uint64_t(1) << idx))
+                  s.match(idx, timestamp);
+            }
+        }
+
+        /**
+        * 'arrival' records the publication of an element at 'now' in 'last_write' and updates the inter-arrival time and jitter.
+        * 'account' records, for each data buffer with an element in 'stamps', the age of its newest element and the skew of the
+        * element timestamp to 'reference', or to the newest timestamp in 'stamps' without one.
+        * 'raise' is an atomic maximum.
+        */
+        template <size_t idx> void arrival(std::chrono::steady_clock::time_point now)
+        {
+            const size_t ticks = now.time_since_epoch().count();
+            const size_t previous = last_write[idx].exchange(ticks, std::memory_order_relaxed);
+            if (previous == 0 or ticks < previous)
+                return;
+            auto &c = counters[idx];
+            const double gap = double(ticks - previous);
+            const double mean = c.interarrival.load(std::memory_order_relaxed);
+            if (mean == 0)
+            {
+                c.interarrival.store(gap, std::memory_order_relaxed);
+                return;
+            }
+            const double jitter = c.jitter.load(std::memory_order_relaxed);
+            c.jitter.store(jitter + (std::abs(gap - mean) - jitter) / 16, std::memory_order_relaxed);
+            c.interarrival.store(mean + (gap - mean) / 16, std::memory_order_relaxed);
+        }
+
+        template <size_t... idx> void account(const std::array<std::optional<size_t>, DBs_size> &stamps, std::optional<size_t> reference)
+        {
+            if (not reference)
+                ((stamps[idx] and (not reference or *stamps[idx] > *reference) ? (void)(reference = stamps[idx]) : void()), ...);
+            if (not reference)
+                return;
+            const size_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+            (
+                [&]<size_t i>()
+                {
+                  if (not stamps[i])
+                    return;
+                  auto &c = counters[i];
+                  const size_t written = last_write[i].load(std::memory_order_relaxed);
+                  const uint64_t age = now > written ? now - written : 0;
+                  const uint64_t skew = distance(*stamps[i], *reference);
+                  c.reads.fetch_add(1, std::memory_order_relaxed);
+                  c.age.fetch_add(age, std::memory_order_relaxed);
+                  raise(c.age_max, age);
+                  c.skew.fetch_add(skew, std::memory_order_relaxed);
+                  raise(c.skew_max, skew);
+                }.template operator()<idx>(),
+            ...);
+        }
+
+        static void raise(std::atomic<uint64_t> &max, uint64_t v)
+        {
+            uint64_t m = max.load(std::memory_order_relaxed);
+            while (v > m and not max.compare_exchange_weak(m, v, std::memory_order_relaxed));
+        }
+
+        /**
+        * 'match' is the approximate time matching of a subscription, called with the timestamp of the element just put.
+        * For every data buffer at the indices 'idx...' it takes the newest element not newer than 'timestamp' and the oldest newer one ('around'),
+        * and keeps the closest of them that is within 'slop' and newer than the last element delivered from that data buffer ('delivered').
+        * If every data buffer has one and the set spans at most 'slop', 'delivered' is updated and 'cb' is called without the buffer lock.
+        */
+        template <size_t... idx, typename Callback>
+        void match(size_t timestamp, size_t slop, std::array<std::optional<size_t>, sizeof...(idx)> &delivered, Callback &cb)
+        {
+            constexpr std::array<size_t, sizeof...(idx)> ids{idx...};
+            [&]<size_t... Is>(std::index_sequence<Is...>)
+            {
+                std::tuple<std::optional<pair_t_time<typename std::tuple_element_t<ids[Is], std::tuple<DBs...>>::O>>...> set;
+                bool complete = true;
+                {
+                    auto lock = shared_lock_for<idx...>();
+                    (
+                        [&](auto &q, auto &e, const std::optional<size_t> &last)
+                        {
+                          if (not complete)
+                            return;
+                          auto [before, after] = around(q, timestamp);
+                          auto usable = [&](const auto &c) { return c && (!last || c->second > *last) && distance(c->second, timestamp) <= slop; };
+                          if (usable(before) && (!usable(after) || distance(before->second, timestamp) <= distance(after->second, timestamp)))
+                            e = to_value(before);
+                          else if (usable(after))
+                            e = to_value(after);
+                          else
+                            complete = false;
+                        }(std::get<ids[Is]>(_out), std::get<Is>(set), delivered[Is]),
+                    ...);
+                }
+                if (not complete)
+                    return;
+                const size_t oldest_stamp = std::min({std::get<Is>(set)->second...});
+                const size_t newest_stamp = std::max({std::get<Is>(set)->second...});
+                if (newest_stamp - oldest_stamp > slop)
+                    return;
+                ((delivered[Is] = std::get<Is>(set)->second), ...);
+                cb(std::move(*std::get<Is>(set))...);
+            }(std::make_index_sequence<sizeof...(idx)>{});
+        }
+
+        /**
+        * 'result_t' is the tuple returned by a read of the data buffers 'idx...': optionals of copies or, if 'shared', handles.
+        * 'value_of' is the output value of an element of a data buffer, a handle or a value stored in a ring.
+        * 'out' converts an element to the type returned by a read. A shared read of a value stored in a ring publishes a copy of it.
+        * 'to_value' converts an element with its timestamp to a copy of the output value with its timestamp.
+        */
+        template <bool shared, size_t... idx> auto result_t()
+        {
+            if constexpr (shared)
+                return std::tuple<handle_t<db_t<idx>>...>{};
+            else
+                return subtuple<idx...>();
+        }
+
+        template <typename E> static constexpr bool is_handle_v =
+            requires { requires std::is_same_v<E, typename SlotPool<typename E::element_type>::Handle>; };
+
+        template <typename E> static const auto &value_of(const E &e)
+        {
+            if constexpr (is_handle_v<E>)
+                return *e;
+            else
+                return e;
+        }
+
+        template <bool shared, size_t idx, typename E> auto out(const E &e)
+        {
+            if constexpr (not shared)
+                return value_of(e);
+            else if constexpr (is_handle_v<E>)
+                return e;
+            else
+                return std::get<idx>(pools).make(e);
+        }
+
+        template <typename E> static auto to_value(const std::optional<pair_t_time<E>> &e)
+        {
+            using O = std::decay_t<decltype(value_of(std::declval<const E &>()))>;
+            if (not e)
+                return std::optional<pair_t_time<O>>{};
+            return std::optional<pair_t_time<O>>(std::in_place, value_of(e->first), e->second);
+        }
+
+        /**
+        * 'queue_arg' is the constructor argument of the queue of 'DB': the number of slots for a 'SeqlockRing' and an empty deque otherwise.
+        */
+        template <typename DB> static auto queue_arg(size_t size)
+        {
+            if constexpr (lock_free_v<DB>)
+                return size;
+            else
+                return queue_t<DB>{};
+        }
+
+        /**
+        * 'shared_lock_for' locks the buffer for shared access using a 'std::shared_lock', unless every data buffer at the indices 'idx...' is a ring.
+        * Rings are read without locks, so reads that only touch them do not contend with puts to the other data buffers.
+        */
+        template <size_t... idx> std::shared_lock<std::shared_mutex> shared_lock_for() const
+        {
+            if constexpr ((ring_v<idx> && ...))
+                return std::shared_lock<std::shared_mutex>(bufferMutex, std::defer_lock);
+            else
+                return std::shared_lock<std::shared_mutex>(bufferMutex);
+        }
+
+        /**
+        * 'oldest', 'newest', 'element', 'closest' and 'around' return copies of elements of a data buffer, a deque or a 'SeqlockRing'.
+        * For a deque they are called with the buffer locked. A 'SeqlockRing' returns consistent copies without locks.
+        * 'closest' returns the element whose timestamp is closest to 'timestamp'. Elements are appended in timestamp order,
+        * so 'std::lower_bound' finds the first element not older than 'timestamp' and only that element and the one before
+        * it have to be compared. On a tie the older element is returned.
+        * 'around' returns the newest element not newer than 'timestamp' and the oldest one newer than it.
+        */
+        template <typename T> static std::optional<pair_t_time<T>> oldest(const deque_db_t<T> &q)
+        {
+            if (q.empty()) return {};
+            return q.front();
+        }
+        template <typename T> static std::optional<pair_t_time<T>> oldest(const SeqlockRing<T> &q) { return q.front(); }
+
+        template <typename T> static std::optional<pair_t_time<T>> newest(const deque_db_t<T> &q)
+        {
+            if (q.empty()) return {};
+            return q.back();
+        }
+        template <typename T> static std::optional<pair_t_time<T>> newest(const SeqlockRing<T> &q) { return q.back(); }
+
+        template <typename T> static std::optional<pair_t_time<T>> element(const deque_db_t<T> &q, size_t i)
+        {
+            if (i >= q.size()) return {};
+            return q[i];
+        }
+        template <typename T> static std::optional<pair_t_time<T>> element(const SeqlockRing<T> &q, size_t i) { return q.at(i); }
+
+        template <typename T> static std::optional<pair_t_time<T>> closest(const deque_db_t<T> &q, size_t timestamp)
+        {
+            auto it = std::lower_bound(q.begin(), q.end(), timestamp,
+                                       [](const auto &val, size_t t) { return val.second < t; });
+            if (it == q.begin())
+                return it == q.end() ? std::nullopt : std::optional<pair_t_time<T>>(*it);
+            auto prev = std::prev(it);
+            if (it == q.end() || distance(prev->second, timestamp) <= distance(it->second, timestamp))
+                return *prev;
+            return *it;
+        }
+        template <typename T> static std::optional<pair_t_time<T>> closest(const SeqlockRing<T> &q, size_t timestamp)
+        {
+            return q.nearest(timestamp);
+        }
+
+        template <typename T>
+        static std::pair<std::optional<pair_t_time<T>>, std::optional<pair_t_time<T>>> around(const deque_db_t<T> &q, size_t timestamp)
+        {
+            std::pair<std::optional<pair_t_time<T>>, std::optional<pair_t_time<T>>> r;
+            auto it = std::upper_bound(q.begin(), q.end(), timestamp,
+                                       [](size_t t, const auto &val) { return t < val.second; });
+            if (it != q.begin())
+                r.first = *std::prev(it);
+            if (it != q.end())
+                r.second = *it;
+            return r;
+        }
+        template <typename T>
+        static std::pair<std::optional<pair_t_time<T>>, std::optional<pair_t_time<T>>> around(const SeqlockRing<T> &q, size_t timestamp)
+        {
+            return q.bracket(timestamp);
+        }
+
+        // absolute difference between two unsigned timestamps
+        static size_t distance(size_t a, size_t b) { return a > b ? a - b : b - a; }
+
         /**
         * 'subtuple' is a template method that creates a new tuple of optional output types for each data buffer.
         * The template parameters 'Is...' represent the indices of the data buffers.
@@ -491,3 +1214,6 @@ template <class... DBs> class BufferSync
             }
         };
 };
+
+// The buffer with its own conversion thread
+template <class... DBs> using BufferSync = BasicBufferSync<PrivateWorker, DBs...>;
@@ -0,0 +1,225 @@
+/**
+// Fixed capacity single producer ring of timestamped values used by BufferSync for the queues declared with RingInOut.
+// Slots are allocated once and reused, and every slot carries its own sequence number, so readers never take a lock
+// shared with other queues and the producer never waits for them.
+//
+// Trivially copyable values are stored as relaxed atomic words and read seqlock style: the copy is kept only if
+// the sequence number of the slot did not change while it was made. Other values are copied under a mutex of their
+// slot, which the producer only takes when it reuses that slot.
+//
+// Elements must be pushed in timestamp order, and from a single thread.
+**/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+template <typename O> class SeqlockRing
+{
+    public:
+        using value_type = std::pair<O, size_t>;
+
+        /**
+        * 'window' is the number of newest elements that can be read, as 'queue_size' in BufferSync.
+        * One more slot is allocated, so the slot being written is outside the readable window.
+        */
+        explicit SeqlockRing(size_t window_) : window(std::max<size_t>(window_, 1)), capacity(window + 1),
+                                               slots(std::make_unique<Slot[]>(capacity)) {}
+
+        SeqlockRing(const SeqlockRing &) = delete;
+        SeqlockRing &operator=(const SeqlockRing &) = delete;
+
+        /**
+        * 'push' publishes 'v' with timestamp 'stamp' as the newest element, overwriting the oldest one when the window is full.
+        * Only one thread may push.
+        */
+        void push(O &&v, size_t stamp)
+        {
+            const uint64_t n = head.load(std::memory_order_relaxed);
+            Slot &slot = slots[n % capacity];
+            if constexpr (trivial)
+            {
+                slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                uint64_t buf[WORDS]{};
+                std::memcpy(buf, &v, sizeof(O));
+                for (size_t w = 0; w < WORDS; w++)
+                    slot.words[w].store(buf[w], std::memory_order_relaxed);
+                slot.stamp.store(stamp, std::memory_order_relaxed);
+                slot.seq.store(2 * n + 2, std::memory_order_release);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(slot.mutex);
+                slot.value = std::move(v);
+                slot.stamp.store(stamp, std::memory_order_relaxed);
+                slot.seq.store(2 * n + 2, std::memory_order_release);
+            }
+            head.store(n + 1, std::memory_order_release);
+        }
+
+        bool empty() const { return head.load(std::memory_order_acquire) == 0; }
+        // timestamp of the newest element, for the producer to keep the order. Zero if empty
+        size_t back_stamp() const
+        {
+            const uint64_t hi = head.load(std::memory_order_acquire);
+            return hi == 0 ? 0 : stamp_of(hi - 1);
+        }
+        size_t size() const { return std::min<uint64_t>(head.load(std::memory_order_acquire), window); }
+
+        // oldest element in the window
+        std::optional<value_type> front() const
+        {
+            while (true)
+            {
+                const auto [lo, hi] = bounds();
+                if (lo == hi) return {};
+                if (auto r = read(lo)) return r;
+            }
+        }
+
+        // newest element
+        std::optional<value_type> back() const
+        {
+            while (true)
+            {
+                const auto [lo, hi] = bounds();
+                if (lo == hi) return {};
+                if (auto r = read(hi - 1)) return r;
+            }
+        }
+
+        // i-th oldest element of the window, empty if there are not so many
+        std::optional<value_type> at(size_t i) const
+        {
+            const auto [lo, hi] = bounds();
+            if (lo + i >= hi) return {};
+            return read(lo + i);
+        }
+
+        /**
+        * 'nearest' returns the element whose timestamp is closest to 'timestamp', the older one on a tie.
+        * It is a binary search over the slot timestamps, repeated if the element found is overwritten before it is copied.
+        */
+        std::optional<value_type> nearest(size_t timestamp) const
+        {
+            while (true)
+            {
+                const auto [lo, hi] = bounds();
+                if (lo == hi) return {};
+                uint64_t n = lower_bound(lo, hi, timestamp);
+                if (n == hi or (n > lo and timestamp - stamp_of(n - 1) <= stamp_of(n) - timestamp))
+                    n--;
+                if (auto r = read(n)) return r;
+            }
+        }
+
+        // newest element not newer than 'timestamp' and oldest one newer than it, for interpolation
+        std::pair<std::optional<value_type>, std::optional<value_type>> bracket(size_t timestamp) const
+        {
+            while (true)
+            {
+                const auto [lo, hi] = bounds();
+                const uint64_t n = upper_bound(lo, hi, timestamp);
+                std::pair<std::optional<value_type>, std::optional<value_type>> r;
+                if (n > lo and not (r.first = read(n - 1))) continue;
+                if (n < hi and not (r.second = read(n))) continue;
+                return r;
+            }
+        }
+
+    private:
+        static constexpr bool trivial = std::is_trivially_copyable_v<O>;
+        static constexpr size_t WORDS = (sizeof(O) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        struct TrivialSlot
+        {
+            std::array<std::atomic<uint64_t>, WORDS> words{};
+        };
+        struct LockedSlot
+        {
+            std::mutex mutex;
+            O value{};
+        };
+        // seq is 2n + 2 once the n-th element is in the slot, odd while a trivial value is being written
+        struct alignas(64) Slot : std::conditional_t<trivial, TrivialSlot, LockedSlot>
+        {
+            std::atomic<uint64_t> seq{0};
+            std::atomic<size_t> stamp{0};
+        };
+
+        const size_t window, capacity;
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<uint64_t> head{0};      // number of elements pushed
+
+        // absolute indices [lo, hi) of the readable elements
+        std::pair<uint64_t, uint64_t> bounds() const
+        {
+            const uint64_t hi = head.load(std::memory_order_acquire);
+            return {hi > window ? hi - window : 0, hi};
+        }
+
+        size_t stamp_of(uint64_t n) const { return slots[n % capacity].stamp.load(std::memory_order_relaxed); }
+
+        // first index in [lo, hi) with a timestamp not less than 'timestamp'
+        uint64_t lower_bound(uint64_t lo, uint64_t hi, size_t timestamp) const
+        {
+            while (lo < hi)
+            {
+                const uint64_t mid = lo + (hi - lo) / 2;
+                if (stamp_of(mid) < timestamp) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+        // first index in [lo, hi) with a timestamp greater than 'timestamp'
+        uint64_t upper_bound(uint64_t lo, uint64_t hi, size_t timestamp) const
+        {
+            while (lo < hi)
+            {
+                const uint64_t mid = lo + (hi - lo) / 2;
+                if (stamp_of(mid) <= timestamp) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+        // copy of the n-th element, empty if it has been overwritten
+        std::optional<value_type> read(uint64_t n) const
+        {
+            Slot &slot = slots[n % capacity];
+            const uint64_t expected = 2 * n + 2;
+            if constexpr (trivial)
+            {
+                if (slot.seq.load(std::memory_order_acquire) != expected)
+                    return {};
+                uint64_t buf[WORDS];
+                for (size_t w = 0; w < WORDS; w++)
+                    buf[w] = slot.words[w].load(std::memory_order_relaxed);
+                const size_t stamp = slot.stamp.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != expected)
+                    return {};
+                value_type r{O{}, stamp};
+                std::memcpy(&r.first, buf, sizeof(O));
+                return r;
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(slot.mutex);
+                if (slot.seq.load(std::memory_order_relaxed) != expected)
+                    return {};
+                return value_type{slot.value, slot.stamp.load(std::memory_order_relaxed)};
+            }
+        }
+};
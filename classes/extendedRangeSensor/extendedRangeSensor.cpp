@@ -17,6 +17,7 @@
  *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "extendedRangeSensor.h"
+#include <algorithm>
 
 ExtendedRangeSensor::ExtendedRangeSensor(const RoboCompLaser::TLaserData &laserData, const RoboCompDifferentialRobot::TBaseState &bState, InnerModel *innerModel_, double extensionRange_, double maxDist_, QString laserName_)
 {
@@ -31,56 +32,58 @@ ExtendedRangeSensor::ExtendedRangeSensor(const RoboCompLaser::TLaserData &laserD
 	pm = TAM_DATAEXT/2;
 	dataExtended.resize(TAM_DATAEXT);
 	laserDataExtCopy.resize(TAM_DATAEXT);
+	beamSin.resize(TAM_DATAEXT);
+	beamCos.resize(TAM_DATAEXT);
 
 	for (int i=0; i<dataExtended.size(); i++)
 	{
 		dataExtended[i].angle = extIndToRads(i);
 		dataExtended[i].dist = maxDist;
+		beamSin[i] = sin(dataExtended[i].angle);
+		beamCos[i] = cos(dataExtended[i].angle);
 		setExtended(i, maxDist, true, 1);
 	}
+	project();
 	printf("Extended field of view < %f -- %f >\n", dataExtended[0].angle, dataExtended[TAM_DATAEXT-1].angle);
 }
 
 
+namespace
+{
+	inline void sort2(double &a, double &b)
+	{
+		const double lo = std::min(a, b);
+		b = std::max(a, b);
+		a = lo;
+	}
+}
+
+/**
+ * Median of every 5 beam window. The three smallest ranges of each window come from a 9 comparator sorting network of
+ * min and max operations, without branches, so the loop over beams vectorizes. The median is the third smallest range,
+ * or the second or the smallest when it is out of range.
+ */
 void ExtendedRangeSensor::medianFilter(RoboCompLaser::TLaserData *laserData)
 {
-	double window[5];
-	double x[laserData->size()];
+	const int32_t n = laserData->size();
+	ranges.resize(n);
+	filtered.resize(n);
+	for (int32_t i=0; i<n; ++i)
+		ranges[i] = laserData->at(i).dist;
+	std::copy(ranges.begin(), ranges.end(), filtered.begin());
 
-	for (int32_t i=2; i<(int)laserData->size()-2; ++i)
+	const double *r = ranges.data();
+	double *x = filtered.data();
+	const double maxD = maxDist;
+	for (int32_t i=2; i<n-2; ++i)
 	{
-		for (int j=0; j<5; ++j)
-		{
-			window[j] = laserData->at(i - 2 + j).dist;
-		}
-		int j;
-		for (j=0; j<3; ++j)
-		{
-			int min = j;
-			for (int k = j + 1; k < 5; ++k)
-				if (window[k] < window[min])
-					min = k;
-			const double temp = window[j];
-			window[j] = window[min];
-			window[min] = temp;
-		}
-		if (window[j] >= maxDist)
-		{
-			if (window[j-1] >= maxDist)
-			{
-				x[i] = window[j-2];
-			}
-			else
-			{
-				x[i] = window[j-1];
-			}
-		}
-		else
-		{
-			x[i] = window[j];
-		}
+		double w0 = r[i-2], w1 = r[i-1], w2 = r[i], w3 = r[i+1], w4 = r[i+2];
+		sort2(w0, w1); sort2(w3, w4); sort2(w2, w4);
+		sort2(w2, w3); sort2(w0, w3); sort2(w0, w2);
+		sort2(w1, w4); sort2(w1, w3); sort2(w1, w2);
+		x[i] = w2 < maxD ? w2 : (w1 < maxD ? w1 : w0);
 	}
-	for (int32_t i=0; i<(int)laserData->size(); i++)
+	for (int32_t i=0; i<n; i++)
 	{
 		setExtended(angleToExtendedIndex(laserData->at(i).angle), x[i], true);
 	}
@@ -90,6 +93,7 @@ void ExtendedRangeSensor::medianFilter(RoboCompLaser::TLaserData *laserData)
 	setExtended(angleToExtendedIndex(laserData->at(dataExtended.size()-1).angle), laserData->at(dataExtended.size()-1-1).dist, true);
 	setExtended(angleToExtendedIndex(laserData->at(1).angle), laserData->at(1+1).dist, true);
 	setExtended(angleToExtendedIndex(laserData->at(0).angle), laserData->at(1).dist, true);
+	project();
 }
 
 /**
@@ -134,26 +138,42 @@ int ExtendedRangeSensor::angleToExtendedIndex( double angle)
 
 void ExtendedRangeSensor::update(const RoboCompLaser::TLaserData &laserData)
 {
-	QVector<TExt> dataExtendedBack = dataExtended;
+	const int n = dataExtended.size();
+	previousWorld.resize(3*n);
+	for (int i=0; i<n; i++)
+	{
+		const QVec &w = dataExtended[i].world;
+		previousWorld[3*i] = w(0);
+		previousWorld[3*i+1] = w(1);
+		previousWorld[3*i+2] = w(2);
+	}
 
 	/// a) Inicialización
-	for (int i=0; i<dataExtended.size(); i++)
+	for (int i=0; i<n; i++)
 	{
 		setExtended(i, maxDist, true);
 	}
 
-	/// b) Transformación a t+1
-	for (int i=0; i<dataExtendedBack.size(); i++)
+	/// b) Transformación a t+1, con la transformación root -> láser de este instante para todos los haces
+	const RTMat rootToLaser = innerModel->getTransformationMatrix(laserName, "root");
+	double M[3][4];
+	for (int r=0; r<3; r++)
+		for (int c=0; c<4; c++)
+			M[r][c] = rootToLaser(r, c);
+	for (int i=0; i<n; i++)
 	{
-		QVec l = innerModel->transform(laserName, dataExtendedBack[i].world, "root");
-		double sens = l.norm2();
-		double angle = atan2(l(0), l(2));
-		printf("%g -> %g\n", dataExtendedBack[i].angle, angle);
+		const double *w = &previousWorld[3*i];
+		double l[3];
+		for (int r=0; r<3; r++)
+			l[r] = M[r][0]*w[0] + M[r][1]*w[1] + M[r][2]*w[2] + M[r][3];
+		double sens = sqrt(l[0]*l[0] + l[1]*l[1] + l[2]*l[2]);
+		double angle = atan2(l[0], l[2]);
+// 		printf("%g -> %g\n", dataExtended[i].angle, angle);
 		int index = angleToExtendedIndex(angle);
 		if (fabs(angle) > extensionRange/2. and sens < maxDist)
 		{
 // 			printf ("%g (%g)-> %d %d\n", double(180.*angle/M_PIl), double(sens), i, index);
-// 			dataExtendedBack[i].world.print("w");
+// 			dataExtended[i].world.print("w");
 		}
 		if (sens < maxDist)
 		{
@@ -177,6 +197,8 @@ void ExtendedRangeSensor::update(const RoboCompLaser::TLaserData &laserData)
 	/// d) interpolación de los puntos no visitados
 // 	interpolation();
 
+	project();
+
 
 	/// Make a copy
 	for(int h=0; h<dataExtended.size(); h++)
@@ -192,12 +214,31 @@ void ExtendedRangeSensor::setExtended(int i, double dist, bool visit, double cer
 {
 	if (i<0 or i>=dataExtended.size()) qFatal("%s %d: i<0 or i>=dataExtended.size()\n", __FILE__, __LINE__);
 	dataExtended[i].dist = dist;
-	QVec v = innerModel->laserTo("root", laserName, dist, dataExtended[i].angle);
-	dataExtended[i].world = v;
 	dataExtended[i].visit = visit;
 	dataExtended[i].certainty = certainty;
 }
 
+/**
+ * World coordinates of all the beams. The beam at (dist, angle) is the point (dist sin(angle), 0, dist cos(angle)) of the
+ * laser, as in InnerModel::laserTo, so with the laser to root transform [R|T] its world point is dist * R(sin, 0, cos) + T:
+ * one product of R with the beam directions per scan instead of a frame lookup per beam.
+ */
+void ExtendedRangeSensor::project()
+{
+	const RTMat laserToRoot = innerModel->getTransformationMatrix("root", laserName);
+	double M[3][4];
+	for (int r=0; r<3; r++)
+		for (int c=0; c<4; c++)
+			M[r][c] = laserToRoot(r, c);
+	for (int i=0; i<dataExtended.size(); i++)
+	{
+		const double d = dataExtended[i].dist, s = beamSin[i], c = beamCos[i];
+		QVec &w = dataExtended[i].world;
+		for (int r=0; r<3; r++)
+			w(r) = d*(M[r][0]*s + M[r][2]*c) + M[r][3];
+	}
+}
+
 void ExtendedRangeSensor::interpolation(int first, int last)
 {
 	Q_ASSERT(first<last);
@@ -230,6 +271,7 @@ void ExtendedRangeSensor::interpolation(int first, int last)
 			}
 		}
 	}
+	project();
 }
 
 
@@ -21,6 +21,7 @@
 
 #include <DifferentialRobot.h>
 #include <Laser.h>
+#include <vector>
 
 #include <qmat/QMatAll>
 #include <innermodel/innermodel.h>
@@ -90,6 +91,8 @@ public:
 private:
 	void setExtended(int index, double dist, bool visit=false, double certainty=1.);
 	void interpolation(int first=-1, int last=-1);
+	/// World coordinates of every beam from its range, with the laser to root transform resolved once per call
+	void project();
 
 	QString laserName;
 	int LECTURAS;
@@ -103,6 +106,10 @@ int32_t pm;
 	InnerModel *innerModel;
 
 	void medianFilter(RoboCompLaser::TLaserData *laserData);
+	/// Scratch of update and medianFilter, sized once: previous world coordinates (x, y, z per beam), ranges
+	std::vector<double> previousWorld, ranges, filtered;
+	/// Direction of every extended beam in the laser frame
+	std::vector<double> beamSin, beamCos;
 	int laserIndToExtInd(int ind);
 	double extIndToRads(int ind);
 	int angleToExtendedIndex(double angle);
@@ -2,48 +2,50 @@
 // Example: fps.print("FPS:");
 // default refresh period is 1000
 
+#ifndef FPS_H
+#define FPS_H
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/times.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
 class FPSCounter
 {
 	public:
 		FPSCounter()
 		{
-			begin = std::chrono::high_resolution_clock::now();
-            FILE* file;
+			begin = std::chrono::steady_clock::now();
             struct tms timeSample;
-            char line[128];
 
             lastCPU = times(&timeSample);
             lastSysCPU = timeSample.tms_stime;
             lastUserCPU = timeSample.tms_utime;
 
-            file = fopen("/proc/cpuinfo", "r");
-            numProcessors = 0;
-            while(fgets(line, 128, file) != NULL){
-                if (strncmp(line, "processor", 9) == 0) numProcessors++;
-            }
-            fclose(file);
+            numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
 		}
         int print( const std::string &text, const unsigned int msPeriod = 1000)
         {
-            static int fps=0;
-            auto end = std::chrono::high_resolution_clock::now();
+            auto end = std::chrono::steady_clock::now();
             auto elapsed = std::chrono::duration<double>(end - begin).count() * 1000;
             if( elapsed > msPeriod)
             {
 				last_period = elapsed/cont;
                 float cpu = get_cpu_use();
                 int mem = get_mem_use();
-                std::cout << "Period = " << last_period << "ms. Fps = " << cont/(msPeriod/1000) << " " << text
+                fps = cont * 1000 / msPeriod;
+                std::cout << "Period = " << last_period << "ms. Fps = " << fps << " " << text
                           << " cpu = " << cpu << "%" << " mem = " << mem << "MB" << std::endl;
-                begin = std::chrono::high_resolution_clock::now();
-                fps=cont/(msPeriod/1000);
+                begin = std::chrono::steady_clock::now();
                 cont = 0;
             }
             cont++;
@@ -51,7 +53,7 @@ class FPSCounter
         }
 		void print( const std::string &text, std::function<void(int)> f, const unsigned int msPeriod = 1000)
 		{	
-			auto end = std::chrono::high_resolution_clock::now();
+			auto end = std::chrono::steady_clock::now();
 			auto elapsed = std::chrono::duration<double>(end - begin).count() * 1000;
             period = msPeriod;
 			if( elapsed > msPeriod)
@@ -61,7 +63,7 @@ class FPSCounter
                 int mem = get_mem_use();
                 std::cout << "Period = " << last_period << "ms. Fps = " << cont << " " << text
                           << " cpu = " << cpu << "%" << " mem = " << mem << "MB" << std::endl;
-				begin = std::chrono::high_resolution_clock::now();
+				begin = std::chrono::steady_clock::now();
 				f(cont);
 				cont = 0;
 			}
@@ -103,36 +105,27 @@ class FPSCounter
         }
         int get_mem_use()
         { //Note: this value is in MB!
-            FILE* file = fopen("/proc/self/status", "r");
-            int result = -1;
+            // resident pages are the second field of /proc/self/statm; the file is opened once per process and
+            // read again from the start each time
+            static const int statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+            static const long pageSize = sysconf(_SC_PAGESIZE);
             char line[128];
-
-            while (fgets(line, 128, file) != NULL)
-            {
-                if (strncmp(line, "VmRSS:", 6) == 0)
-                {
-                    result = parseLine(line);
-                    break;
-                }
-            }
-            fclose(file);
-            return result/1000;
-        }
-        int parseLine(char* line)
-        {
-            // This assumes that a digit will be found and the line ends in " Kb".
-            int i = strlen(line);
-            const char* p = line;
-            while (*p <'0' || *p > '9') p++;
-            line[i-3] = '\0';
-            i = atoi(p);
-            return i;
+            const ssize_t n = statm < 0 ? -1 : pread(statm, line, sizeof(line) - 1, 0);
+            if (n <= 0)
+                return -1;
+            line[n] = '\0';
+            unsigned long size = 0, resident = 0;
+            if (sscanf(line, "%lu %lu", &size, &resident) != 2)
+                return -1;
+            return int(resident * pageSize / 1000000);
         }
-		std::chrono::time_point<std::chrono::high_resolution_clock> begin;
+		std::chrono::time_point<std::chrono::steady_clock> begin;
 		unsigned int cont = 0;
+		int fps = 0;
 		float last_period = 0;
         clock_t lastCPU, lastSysCPU, lastUserCPU;
         int numProcessors;
         int period = 1000; //default period in ms
 };
 
+#endif
@@ -0,0 +1,241 @@
+/****************************************************************************
+* File name: GRAFCETScheduler.cpp
+* Date: 14/10/2026
+* Description: Timer wheel shared by the steps of a GRAFCET chart, so that the cyclic functions of hundreds of steps
+*              run from one thread instead of one QTimer per step on the event loop.
+****************************************************************************/
+
+#include "GRAFCETScheduler.h"
+
+#include <algorithm>
+
+/**
+ * @brief Builds the scheduler and launches its thread
+ *
+ * @param resolution_ms Duration of a tick, periods are rounded to it.
+ * @param slots Number of slots of the wheel, rounded up to a power of two. Steps with periods longer than the wheel
+ *        share slots, it only costs a comparison per step and turn.
+ */
+GRAFCETScheduler::GRAFCETScheduler(int resolution_ms, int slots)
+    : resolution(std::chrono::milliseconds(std::max(resolution_ms, 1))), epoch(Clock::now())
+{
+    std::size_t size = 1;
+    while (size < std::size_t(std::max(slots, 1)))
+        size <<= 1;
+    this->wheel.resize(size);
+    this->thread = std::thread(&GRAFCETScheduler::run, this);
+}
+
+/**
+ * @brief Destroy GRAFCETScheduler object
+ *
+ * Waits for the execution in progress, if any, and stops the thread. The steps still active are not run any more.
+ */
+GRAFCETScheduler::~GRAFCETScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->finish = true;
+    }
+    this->wakeup.notify_all();
+    this->thread.join();
+}
+
+/**
+ * @brief Starts the cyclic execution of a function
+ *
+ * The first execution is one period from now.
+ *
+ * @param period_ms Period of cyclic execution.
+ * @param function Function to execute.
+ * @return Handle of the activation for stop, setPeriod and getStats.
+ */
+int GRAFCETScheduler::start(int period_ms, const std::function<void()> &function)
+{
+    std::unique_lock<std::mutex> lock(this->mtx);
+    const std::int64_t now = (Clock::now() - this->epoch) / this->resolution;
+    if (this->entries.empty())
+        this->current = now;                        //The thread was idle, its tick is stale
+    Entry entry{std::make_shared<std::function<void()>>(function), toTicks(period_ms), 0, {}};
+    entry.deadline = std::max(now, this->current) + entry.period;
+    const int handle = this->next_handle++;
+    this->schedule(handle, entry);
+    lock.unlock();
+    this->wakeup.notify_all();
+    return handle;
+}
+
+/**
+ * @brief Stops a cyclic execution
+ *
+ * When called from another thread it returns once the function is not running, so the objects it uses can be
+ * released right after.
+ *
+ * @param handle Handle returned by start, unknown handles are ignored.
+ */
+void GRAFCETScheduler::stop(int handle)
+{
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->entries.erase(handle);
+    if (std::this_thread::get_id() != this->thread.get_id())
+        this->done.wait(lock, [this, handle](){ return this->running != handle; });
+}
+
+/**
+ * @brief Changes the period of a cyclic execution
+ *
+ * The next execution is one new period from now.
+ *
+ * @param handle Handle returned by start.
+ * @param period_ms Period of cyclic execution.
+ */
+void GRAFCETScheduler::setPeriod(int handle, int period_ms)
+{
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->entries.find(handle);
+    if (it == this->entries.end())
+        return;
+    const std::int64_t now = (Clock::now() - this->epoch) / this->resolution;
+    it->second.period = toTicks(period_ms);
+    it->second.deadline = std::max(now, this->current) + it->second.period;
+    this->schedule(handle, it->second);
+}
+
+/**
+ * @brief Get the statistics of a cyclic execution
+ *
+ * @param handle Handle returned by start.
+ * @return Statistics since start, empty for unknown handles.
+ */
+GRAFCETScheduler::Stats GRAFCETScheduler::getStats(int handle)
+{
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->entries.find(handle);
+    return it != this->entries.end() ? it->second.stats : Stats{};
+}
+
+/**
+ * @brief Get the duration of a tick
+ *
+ * @return Resolution in milliseconds.
+ */
+int GRAFCETScheduler::getResolution() const
+{
+    return int(std::chrono::duration_cast<std::chrono::milliseconds>(this->resolution).count());
+}
+
+std::int64_t GRAFCETScheduler::toTicks(int period_ms) const
+{
+    const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(std::max(period_ms, 1)));
+    return std::max<std::int64_t>(1, (period + this->resolution / 2) / this->resolution);
+}
+
+GRAFCETScheduler::Clock::time_point GRAFCETScheduler::timeOf(std::int64_t tick) const
+{
+    return this->epoch + tick * this->resolution;
+}
+
+//Called with mtx locked
+void GRAFCETScheduler::schedule(int handle, const Entry &entry)
+{
+    this->entries[handle] = entry;
+    this->wheel[std::size_t(entry.deadline) & (this->wheel.size() - 1)].push_back(handle);
+}
+
+/**
+ * @brief Thread of the scheduler
+ *
+ * Sleeps until the absolute time of the next tick and dispatches every tick up to now, so a late wake-up delays the
+ * steps but loses none.
+ */
+void GRAFCETScheduler::run()
+{
+    std::vector<int> batch;
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (not this->finish)
+    {
+        if (this->entries.empty())
+        {
+            this->wakeup.wait(lock);
+            continue;
+        }
+        if (Clock::now() < this->timeOf(this->current))
+        {
+            this->wakeup.wait_until(lock, this->timeOf(this->current));
+            continue;
+        }
+        const std::int64_t now = (Clock::now() - this->epoch) / this->resolution;
+        while (this->current <= now and not this->finish and not this->entries.empty())
+            this->dispatch(this->current++, batch);
+    }
+}
+
+/**
+ * @brief Executes every step due on a tick
+ *
+ * Called with mtx locked, it is released while each function runs. Steps stopped by an earlier function of the same
+ * batch do not run.
+ */
+void GRAFCETScheduler::dispatch(std::int64_t tick, std::vector<int> &batch)
+{
+    auto &slot = this->wheel[std::size_t(tick) & (this->wheel.size() - 1)];
+    batch.clear();
+    for (std::size_t i = 0; i < slot.size();)
+    {
+        auto it = this->entries.find(slot[i]);
+        const bool keep = it != this->entries.end() and it->second.deadline > tick and
+                          (std::size_t(it->second.deadline) & (this->wheel.size() - 1)) == (std::size_t(tick) & (this->wheel.size() - 1));
+        if (it != this->entries.end() and it->second.deadline <= tick and
+            std::find(batch.begin(), batch.end(), slot[i]) == batch.end())
+            batch.push_back(slot[i]);
+        if (keep)
+            i++;
+        else
+        {
+            slot[i] = slot.back();
+            slot.pop_back();
+        }
+    }
+
+    for (int handle : batch)
+    {
+        auto it = this->entries.find(handle);
+        if (it == this->entries.end())
+            continue;
+        const auto function = it->second.function;
+        const std::int64_t deadline = it->second.deadline;
+        this->running = handle;
+        this->mtx.unlock();
+        const auto begin = Clock::now();
+        (*function)();
+        const auto end = Clock::now();
+        this->mtx.lock();
+        this->running = 0;
+        this->done.notify_all();
+
+        it = this->entries.find(handle);
+        if (it == this->entries.end())
+            continue;                                   //Stopped while running
+        Entry &entry = it->second;
+        Stats &stats = entry.stats;
+        const double jitter = std::chrono::duration<double, std::micro>(begin - this->timeOf(deadline)).count();
+        const double duration = std::chrono::duration<double, std::micro>(end - begin).count();
+        stats.activations++;
+        stats.meanJitter += (jitter - stats.meanJitter) / double(stats.activations);
+        stats.maxJitter = std::max(stats.maxJitter, jitter);
+        stats.lastRun = duration;
+        stats.maxRun = std::max(stats.maxRun, duration);
+        if (entry.deadline != deadline)
+            continue;                                   //Rescheduled by setPeriod while running
+
+        //Next deadline from the previous one, not from now, skipping the ones already lost
+        const std::int64_t now = std::max<std::int64_t>((end - this->epoch) / this->resolution, tick);
+        entry.deadline += entry.period;
+        while (entry.deadline <= now)
+        {
+            entry.deadline += entry.period;
+            stats.overruns++;
+        }
+        this->schedule(handle, entry);
+    }
+}
@@ -0,0 +1,92 @@
+/****************************************************************************
+* File name: GRAFCETScheduler.h
+* Date: 14/10/2026
+* Description: Timer wheel shared by the steps of a GRAFCET chart, so that the cyclic functions of hundreds of steps
+*              run from one thread instead of one QTimer per step on the event loop.
+****************************************************************************/
+
+#ifndef GRAFCETSCHEDULER_H
+#define GRAFCETSCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * @class GRAFCETScheduler
+ * @brief Hashed timer wheel that runs the cyclic functions of GRAFCET steps in a thread of its own.
+ *
+ * Time is divided into ticks of a fixed resolution and every activation is hashed into the slot of the tick where it
+ * is due, so starting, stopping and dispatching a step costs O(1) whatever the number of steps. The thread sleeps
+ * until the absolute time of the next tick and the next deadline of a step is its previous deadline plus its period,
+ * never the time it actually ran plus the period, so periods do not drift. Every step due on a tick runs in the same
+ * wake-up, one after the other. When a step starts so late that its next deadline has already passed, the lost
+ * activations are skipped and counted as overruns.
+ *
+ * The functions run in the scheduler thread, not in the thread of the state machine. Signals emitted from them reach
+ * the transitions through queued connections as usual.
+ */
+class GRAFCETScheduler
+{
+public:
+    /**
+     * @brief Per step statistics, times in microseconds.
+     */
+    struct Stats
+    {
+        std::uint64_t activations = 0;  //Executions of the function
+        std::uint64_t overruns = 0;     //Activations skipped because the previous ones ran late
+        double meanJitter = 0;          //Delay from the deadline to the start of the execution
+        double maxJitter = 0;
+        double lastRun = 0;             //Duration of the execution
+        double maxRun = 0;
+    };
+
+    explicit GRAFCETScheduler(int resolution_ms = 1, int slots = 256);
+    ~GRAFCETScheduler();
+    GRAFCETScheduler(const GRAFCETScheduler &) = delete;
+    GRAFCETScheduler &operator=(const GRAFCETScheduler &) = delete;
+
+    int start(int period_ms, const std::function<void()> &function);
+    void stop(int handle);
+    void setPeriod(int handle, int period_ms);
+    Stats getStats(int handle);
+    int getResolution() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry
+    {
+        std::shared_ptr<std::function<void()>> function;
+        std::int64_t period;            //Ticks
+        std::int64_t deadline;          //Absolute tick of the next activation
+        Stats stats;
+    };
+
+    std::int64_t toTicks(int period_ms) const;
+    Clock::time_point timeOf(std::int64_t tick) const;
+    void schedule(int handle, const Entry &entry);
+    void run();
+    void dispatch(std::int64_t tick, std::vector<int> &batch);
+
+    const Clock::duration resolution;
+    const Clock::time_point epoch;
+    std::vector<std::vector<int>> wheel;    //Handles hashed by deadline, an entry may be left in a slot after stop
+    std::unordered_map<int, Entry> entries;
+    std::int64_t current = 0;               //Next tick to dispatch
+    int next_handle = 1;
+    int running = 0;                        //Handle executing now, 0 otherwise
+    bool finish = false;
+    std::mutex mtx;
+    std::condition_variable wakeup;         //Entries added or scheduler finishing
+    std::condition_variable done;           //An execution ended
+    std::thread thread;
+};
+#endif // GRAFCETSCHEDULER_H
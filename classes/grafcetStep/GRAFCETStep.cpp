@@ -51,6 +51,8 @@ GRAFCETStep::~GRAFCETStep()
     {
         this->timer_step->stop();  //Stop cyclic timer
         delete this->timer_step;   //Delete cyclic timer
+        if (this->scheduled != 0)
+            this->scheduler->stop(this->scheduled);  //Stop the shared scheduler activation
     }
     #if DEBUG
         std::cout << "Dell GRAFCETStep"<< this->objectName().toStdString()<<std::endl<<std::flush;
@@ -77,6 +79,8 @@ void GRAFCETStep::setPeriod(int period_ms)
             timer_step->stop();
             timer_step->start();
         }
+        if (this->scheduled != 0)
+            this->scheduler->setPeriod(this->scheduled, period_ms);
         this->mtx.unlock();
     }
 }
@@ -96,6 +100,52 @@ int GRAFCETStep::getPeriod()
         return -1;
 }
 
+/**
+ * @brief Runs the cyclic function from a scheduler shared by the steps of the chart
+ *
+ * Instead of the timer of the step, the function is executed by the timer wheel of the scheduler, in its thread,
+ * with drift-free periods and statistics. If the step is active it moves at once. The scheduler must outlive the step.
+ *
+ * @param scheduler Shared scheduler, nullptr to go back to the timer of the step.
+ */
+void GRAFCETStep::setScheduler(GRAFCETScheduler *scheduler)
+{
+    this->mtx.lock();
+    const bool active = this->scheduled != 0 or (this->N != nullptr and this->timer_step->isActive());
+    const int handle = this->scheduled;
+    GRAFCETScheduler *previous = this->scheduler;
+    this->scheduled = 0;
+    this->scheduler = scheduler;
+    this->mtx.unlock();
+    if (handle != 0)
+        previous->stop(handle);
+    if (active)
+    {
+        this->mtx.lock();
+        this->timer_step->stop();
+        if (this->scheduler != nullptr)
+            this->scheduled = this->scheduler->start(this->timer_step->interval(), this->N);
+        else
+            this->timer_step->start();
+        this->mtx.unlock();
+    }
+}
+
+/**
+ * @brief Get the statistics of the cyclic execution
+ *
+ * Activations, overruns, jitter and execution time, measured by the shared scheduler since the step was activated.
+ *
+ * @return Statistics of the current activation, empty without scheduler or while the step is not active.
+ */
+GRAFCETScheduler::Stats GRAFCETStep::getStats()
+{
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (this->scheduled == 0)
+        return GRAFCETScheduler::Stats{};
+    return this->scheduler->getStats(this->scheduled);
+}
+
 /**
  * @brief When the step is activated this function is executed. 
  *
@@ -109,7 +159,14 @@ void GRAFCETStep::onEntry(QEvent *event)
         this->P1();                     //Launches the entry function
 
     if (this->N != nullptr)
-        this->timer_step->start();     //Launches the cyclic timer
+    {
+        this->mtx.lock();
+        if (this->scheduler != nullptr)
+            this->scheduled = this->scheduler->start(this->timer_step->interval(), this->N);  //Launches the shared activation
+        else
+            this->timer_step->start();     //Launches the cyclic timer
+        this->mtx.unlock();
+    }
     #if DEBUG
         std::cout << "Entrando en GRAFCETStep "<< this->objectName().toStdString() <<std::endl<<std::flush;
     #endif
@@ -126,7 +183,11 @@ void GRAFCETStep::onExit(QEvent *event)
     if (this->N != nullptr){
         this->mtx.lock();
         this->timer_step->stop();      //Stops the cyclic timer
+        const int handle = this->scheduled;
+        this->scheduled = 0;
         this->mtx.unlock();
+        if (handle != 0)
+            this->scheduler->stop(handle);  //Stops the shared activation, waiting for N if running, outside mtx as N may use it
     }
     if (this->P0 != nullptr)
         this->P0();                    //Launches the exit function
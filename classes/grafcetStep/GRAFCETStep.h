@@ -13,6 +13,7 @@
 #include <QTimer>
 #include <iostream>
 #include <mutex>
+#include "GRAFCETScheduler.h"
 
 
 /**
@@ -30,6 +31,8 @@ public:
     ~GRAFCETStep();
     void setPeriod(int period_ms);
     int getPeriod();
+    void setScheduler(GRAFCETScheduler *scheduler);
+    GRAFCETScheduler::Stats getStats();
 
 protected:
     void onEntry(QEvent *event) ;
@@ -38,6 +41,8 @@ protected:
 private:
     std::mutex mtx;
     QTimer *timer_step;            //Cyclic timer of execution of the function
+    GRAFCETScheduler *scheduler = nullptr;  //Shared scheduler used instead of the timer, if any
+    int scheduled = 0;              //Handle of the activation in the scheduler while the step is active
     std::function<void()> N;        //Function to be executed cyclically
     std::function<void()> P1;       //Function to be executed at start step
     std::function<void()> P0;       //Function to be executed at end step
@@ -0,0 +1,294 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef ASTAR_H
+#define ASTAR_H
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// A* search over a dense cols x rows lattice whose scratch state survives between searches.
+// The open list is an indexed binary heap, g-scores and parents are flat arrays and the open/closed
+// membership is stamped with a generation counter, so starting a new search never clears anything.
+// Cells are indexed row-major (idx = row * cols + col). The cost functor returns the cost of entering
+// a cell (>= min_cost) or a negative value for blocked cells. Diagonal moves cost sqrt(2) times more
+// and are only allowed when both orthogonal cells are walkable (no corner cutting).
+//
+// Expansion::JPS applies Jump Point Search on regions of uniform cost (cost == uniform_cost).
+// Jumps stop at any cell that is, or touches, a cell with a different cost, and those cells are
+// expanded with the full 8-neighbourhood, so weighted areas are still searched exactly.
+class AStar
+{
+public:
+    enum class Expansion { OCTILE, JPS };
+    struct Params
+    {
+        Expansion expansion = Expansion::OCTILE;
+        float min_cost = 1.f;       // lower bound of cell costs, scales the octile heuristic
+        float uniform_cost = 1.f;   // cost of the regions where JPS may jump
+    };
+    static constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+
+    // Returns true if target is reachable. path holds cell indices from the first step after source to target
+    template<typename CostFn>
+    bool search(int cols_, int rows_, std::uint32_t source, std::uint32_t target, CostFn &&cost,
+                std::vector<std::uint32_t> &path, const Params &params = Params())
+    {
+        path.clear();
+        const std::size_t n = static_cast<std::size_t>(cols_) * rows_;
+        if (source >= n or target >= n or cost(target) < 0.f)
+            return false;
+        prepare(cols_, rows_);
+        push_or_decrease(source, 0.f, h(source, target, params), NONE);
+        while (not heap.empty())
+        {
+            const std::uint32_t u = pop();
+            if (u == target)
+            {
+                unwind(source, target, path);
+                return true;
+            }
+            closed[u] = generation;
+            if (params.expansion == Expansion::JPS)
+                expand_jps(u, target, cost, params);
+            else
+                expand_octile(u, target, cost, params);
+        }
+        return false;
+    }
+    int expanded() const { return expanded_count; };
+
+private:
+    static constexpr float SQRT2 = 1.41421356f;
+    static constexpr int DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static constexpr int DZ[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+    int cols = 0, rows = 0, expanded_count = 0;
+    std::uint32_t generation = 0;
+    std::vector<float> g;
+    std::vector<float> f;
+    std::vector<std::uint32_t> parent;
+    std::vector<std::uint32_t> seen;      // == generation when g/parent are valid for this search
+    std::vector<std::uint32_t> closed;    // == generation when the node has been expanded
+    std::vector<std::uint32_t> heap_pos;  // position in heap, valid if seen and not closed
+    std::vector<std::uint32_t> heap;
+
+    void prepare(int cols_, int rows_)
+    {
+        const std::size_t n = static_cast<std::size_t>(cols_) * rows_;
+        cols = cols_; rows = rows_;
+        if (g.size() != n)
+        {
+            g.assign(n, 0.f); f.assign(n, 0.f);
+            parent.assign(n, NONE); heap_pos.assign(n, 0);
+            seen.assign(n, 0); closed.assign(n, 0);
+            generation = 0;
+        }
+        if (++generation == 0)  // wrapped around: stamps are ambiguous, clear once every 2^32 searches
+        {
+            std::fill(seen.begin(), seen.end(), 0);
+            std::fill(closed.begin(), closed.end(), 0);
+            generation = 1;
+        }
+        heap.clear();
+        expanded_count = 0;
+    }
+    inline int col(std::uint32_t i) const { return static_cast<int>(i % cols); };
+    inline int row(std::uint32_t i) const { return static_cast<int>(i / cols); };
+    inline bool inside(int c, int r) const { return c >= 0 and r >= 0 and c < cols and r < rows; };
+    inline std::uint32_t at(int c, int r) const { return static_cast<std::uint32_t>(r) * cols + c; };
+    inline float h(std::uint32_t a, std::uint32_t b, const Params &params) const
+    {
+        const float dx = std::abs(col(a) - col(b)), dz = std::abs(row(a) - row(b));
+        return params.min_cost * ((dx + dz) + (SQRT2 - 2.f) * std::min(dx, dz));   // octile distance
+    }
+    template<typename CostFn>
+    inline bool walkable(int c, int r, CostFn &cost) const { return inside(c, r) and cost(at(c, r)) >= 0.f; };
+
+    // indexed binary heap on f
+    void sift_up(std::uint32_t pos)
+    {
+        const std::uint32_t node = heap[pos];
+        while (pos > 0)
+        {
+            const std::uint32_t up = (pos - 1) / 2;
+            if (f[heap[up]] <= f[node]) break;
+            heap[pos] = heap[up]; heap_pos[heap[pos]] = pos;
+            pos = up;
+        }
+        heap[pos] = node; heap_pos[node] = pos;
+    }
+    void sift_down(std::uint32_t pos)
+    {
+        const std::uint32_t node = heap[pos];
+        const std::uint32_t size = heap.size();
+        while (true)
+        {
+            std::uint32_t child = 2 * pos + 1;
+            if (child >= size) break;
+            if (child + 1 < size and f[heap[child + 1]] < f[heap[child]]) child++;
+            if (f[node] <= f[heap[child]]) break;
+            heap[pos] = heap[child]; heap_pos[heap[pos]] = pos;
+            pos = child;
+        }
+        heap[pos] = node; heap_pos[node] = pos;
+    }
+    std::uint32_t pop()
+    {
+        const std::uint32_t top = heap.front();
+        heap.front() = heap.back();
+        heap.pop_back();
+        if (not heap.empty()) sift_down(0);
+        expanded_count++;
+        return top;
+    }
+    void push_or_decrease(std::uint32_t v, float gv, float hv, std::uint32_t from)
+    {
+        if (seen[v] == generation)
+        {
+            if (closed[v] == generation or gv >= g[v]) return;
+            g[v] = gv; f[v] = gv + hv; parent[v] = from;
+            sift_up(heap_pos[v]);
+            return;
+        }
+        seen[v] = generation;
+        g[v] = gv; f[v] = gv + hv; parent[v] = from;
+        heap.push_back(v);
+        sift_up(heap.size() - 1);
+    }
+
+    template<typename CostFn>
+    void expand_octile(std::uint32_t u, std::uint32_t target, CostFn &cost, const Params &params)
+    {
+        const int c = col(u), r = row(u);
+        for (int d = 0; d < 8; d++)
+        {
+            const int nc = c + DX[d], nr = r + DZ[d];
+            if (not inside(nc, nr)) continue;
+            const std::uint32_t v = at(nc, nr);
+            if (closed[v] == generation) continue;
+            const float cv = cost(v);
+            if (cv < 0.f) continue;
+            const bool diagonal = DX[d] != 0 and DZ[d] != 0;
+            if (diagonal and (not walkable(c + DX[d], r, cost) or not walkable(c, r + DZ[d], cost))) continue;
+            push_or_decrease(v, g[u] + cv * (diagonal ? SQRT2 : 1.f), h(v, target, params), u);
+        }
+    }
+
+    // JPS helpers. "open" cells are walkable cells of uniform cost: the only ones a jump may cross
+    template<typename CostFn>
+    inline bool open(int c, int r, CostFn &cost, const Params &params) const
+    { return inside(c, r) and cost(at(c, r)) == params.uniform_cost; };
+    template<typename CostFn>
+    bool on_cost_border(int c, int r, CostFn &cost, const Params &params) const
+    {
+        if (not open(c, r, cost, params)) return true;
+        for (int d = 0; d < 8; d++)
+            if (walkable(c + DX[d], r + DZ[d], cost) and not open(c + DX[d], r + DZ[d], cost, params))
+                return true;
+        return false;
+    }
+    template<typename CostFn>
+    std::uint32_t jump(int c, int r, int dx, int dz, std::uint32_t target, CostFn &cost, const Params &params) const
+    {
+        while (true)
+        {
+            if (not walkable(c, r, cost)) return NONE;
+            const std::uint32_t v = at(c, r);
+            if (v == target or on_cost_border(c, r, cost, params)) return v;
+            if (dx != 0 and dz != 0)
+            {
+                if (jump(c + dx, r, dx, 0, target, cost, params) != NONE or jump(c, r + dz, 0, dz, target, cost, params) != NONE)
+                    return v;
+                if (not open(c + dx, r, cost, params) or not open(c, r + dz, cost, params))
+                    return NONE;
+            }
+            else if (dx != 0)
+            {
+                if ((open(c, r - 1, cost, params) and not open(c - dx, r - 1, cost, params)) or
+                    (open(c, r + 1, cost, params) and not open(c - dx, r + 1, cost, params)))
+                    return v;
+            }
+            else
+            {
+                if ((open(c - 1, r, cost, params) and not open(c - 1, r - dz, cost, params)) or
+                    (open(c + 1, r, cost, params) and not open(c + 1, r - dz, cost, params)))
+                    return v;
+            }
+            c += dx; r += dz;
+        }
+    }
+    template<typename CostFn>
+    void expand_jps(std::uint32_t u, std::uint32_t target, CostFn &cost, const Params &params)
+    {
+        const int c = col(u), r = row(u);
+        int dirs[8][2]; int nd = 0;
+        auto add = [&](int dx, int dz){ dirs[nd][0] = dx; dirs[nd][1] = dz; nd++; };
+        if (parent[u] == NONE or on_cost_border(c, r, cost, params))
+        {
+            for (int d = 0; d < 8; d++)
+                add(DX[d], DZ[d]);
+        }
+        else  // pruned neighbours given the direction we arrived from
+        {
+            const int dx = (c > col(parent[u])) - (c < col(parent[u]));
+            const int dz = (r > row(parent[u])) - (r < row(parent[u]));
+            if (dx != 0 and dz != 0)
+            {
+                add(dx, 0); add(0, dz); add(dx, dz);
+            }
+            else if (dx != 0)
+            {
+                add(dx, 0); add(dx, 1); add(dx, -1); add(0, 1); add(0, -1);
+            }
+            else
+            {
+                add(0, dz); add(1, dz); add(-1, dz); add(1, 0); add(-1, 0);
+            }
+        }
+        for (int i = 0; i < nd; i++)
+        {
+            const int dx = dirs[i][0], dz = dirs[i][1];
+            const bool diagonal = dx != 0 and dz != 0;
+            if (diagonal and (not walkable(c + dx, r, cost) or not walkable(c, r + dz, cost))) continue;
+            const std::uint32_t v = jump(c + dx, r + dz, dx, dz, target, cost, params);
+            if (v == NONE or closed[v] == generation) continue;
+            // every crossed cell has uniform cost; the jump point pays its own
+            const int steps = std::max(std::abs(col(v) - c), std::abs(row(v) - r));
+            const float step = diagonal ? SQRT2 : 1.f;
+            const float gv = g[u] + step * ((steps - 1) * params.uniform_cost + cost(v));
+            push_or_decrease(v, gv, h(v, target, params), u);
+        }
+    }
+
+    // Walks parents back from target. Jump segments are straight or diagonal lines, so they are filled in cell by cell
+    void unwind(std::uint32_t source, std::uint32_t target, std::vector<std::uint32_t> &path) const
+    {
+        for (std::uint32_t v = target; v != source and v != NONE; v = parent[v])
+        {
+            const std::uint32_t p = parent[v];
+            if (p == NONE) { path.push_back(v); break; }
+            const int dx = (col(v) > col(p)) - (col(v) < col(p));
+            const int dz = (row(v) > row(p)) - (row(v) < row(p));
+            for (int c = col(v), r = row(v); not (c == col(p) and r == row(p)); c -= dx, r -= dz)
+                path.push_back(at(c, r));
+        }
+        std::reverse(path.begin(), path.end());
+    }
+};
+
+#endif // ASTAR_H
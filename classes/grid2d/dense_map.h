@@ -0,0 +1,200 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef DENSE_MAP_H
+#define DENSE_MAP_H
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <iterator>
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+// Dense, row-major replacement for std::unordered_map<Key, T, KeyHasher> on a regular lattice.
+// Keys are expected to expose integer members x and z laid on a grid of "tile" units starting at (left, top),
+// so a key maps to slot (z - top)/tile * cols + (x - left)/tile without hashing. Other key layouts provide a
+// Traits class with x(k), z(k) and make(x, z), and the lattice may use a different step along z.
+// It keeps the subset of the unordered_map interface used by Grid (at, find, insert, emplace, size, clear,
+// begin, end) so existing code iterating "for(auto &[k, v] : fmap)" does not change.
+// Slots are preallocated by reset(). clear() only marks them as absent, keeping the geometry and storage.
+template<typename Key>
+struct DenseKeyTraits
+{
+    static long int x(const Key &k) { return k.x; };
+    static long int z(const Key &k) { return k.z; };
+    static Key make(long int x, long int z) { return Key(x, z); };
+};
+
+template<typename Key, typename T, typename Traits = DenseKeyTraits<Key>>
+class DenseMap
+{
+public:
+    using value_type = std::pair<Key, T>;
+    using size_type = std::size_t;
+    static constexpr size_type npos = std::numeric_limits<size_type>::max();
+
+    template<bool Const>
+    class Iterator
+    {
+        using Owner = std::conditional_t<Const, const DenseMap, DenseMap>;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = DenseMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const value_type &, value_type &>;
+        using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+
+        Iterator() = default;
+        Iterator(Owner *owner_, size_type i_) : owner(owner_), i(i_) { skip(); };
+        operator Iterator<true>() const { return Iterator<true>(owner, i); };
+        reference operator*() const { return owner->slots_[i]; };
+        pointer operator->() const { return &owner->slots_[i]; };
+        Iterator &operator++() { ++i; skip(); return *this; };
+        Iterator operator++(int) { auto tmp = *this; ++(*this); return tmp; };
+        bool operator==(const Iterator &o) const { return i == o.i; };
+        bool operator!=(const Iterator &o) const { return i != o.i; };
+        size_type index() const { return i; };
+
+    private:
+        void skip() { while (i < owner->slots_.size() and not owner->present_[i]) ++i; };
+        Owner *owner = nullptr;
+        size_type i = 0;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    // Sets the lattice geometry and allocates cols*rows absent slots. tile_z_ <= 0 means the same step as x
+    void reset(long int left_, long int top_, int cols_, int rows_, int tile_, int tile_z_ = 0)
+    {
+        left = left_; top = top_; cols_n = cols_; rows_n = rows_; tile = tile_; tile_z = tile_z_ > 0 ? tile_z_ : tile_;
+        slots_.assign(static_cast<size_type>(cols_n) * rows_n, value_type{});
+        present_.assign(slots_.size(), 0);
+        count = 0;
+    };
+
+    // Slot of a key or npos if it falls outside the lattice
+    inline size_type index_of(const Key &k) const
+    {
+        if (tile <= 0) return npos;
+        const long int dx = Traits::x(k) - left, dz = Traits::z(k) - top;
+        if (dx < 0 or dz < 0) return npos;
+        const long int cx = dx / tile, cz = dz / tile_z;
+        if (cx >= cols_n or cz >= rows_n) return npos;
+        return static_cast<size_type>(cz) * cols_n + cx;
+    };
+    inline size_type index_of(long int cx, long int cz) const  // lattice coordinates, not world
+    {
+        if (cx < 0 or cz < 0 or cx >= cols_n or cz >= rows_n) return npos;
+        return static_cast<size_type>(cz) * cols_n + cx;
+    };
+    inline std::pair<long int, long int> lattice_of(const Key &k) const  // lattice coordinates of a key aligned to the lattice
+    { return {(Traits::x(k) - left) / tile, (Traits::z(k) - top) / tile_z}; };
+    inline Key key_of(size_type idx) const
+    { return Traits::make(left + static_cast<long int>(idx % cols_n) * tile, top + static_cast<long int>(idx / cols_n) * tile_z); };
+    inline bool contains(size_type idx) const { return idx < slots_.size() and present_[idx]; };
+
+    // Direct slot access. No checks: use index_of/contains first
+    inline value_type &slot(size_type idx) { return slots_[idx]; };
+    inline const value_type &slot(size_type idx) const { return slots_[idx]; };
+    inline T *find_cell(const Key &k)
+    {
+        auto idx = index_of(k);
+        return contains(idx) ? &slots_[idx].second : nullptr;
+    };
+
+    T &at(const Key &k)
+    {
+        if (auto c = find_cell(k); c != nullptr) return *c;
+        throw std::out_of_range("DenseMap::at key not found");
+    };
+    const T &at(const Key &k) const
+    {
+        auto idx = index_of(k);
+        if (contains(idx)) return slots_[idx].second;
+        throw std::out_of_range("DenseMap::at key not found");
+    };
+    iterator find(const Key &k)
+    {
+        auto idx = index_of(k);
+        return contains(idx) ? iterator(this, idx) : end();
+    };
+    const_iterator find(const Key &k) const
+    {
+        auto idx = index_of(k);
+        return contains(idx) ? const_iterator(this, idx) : end();
+    };
+    bool contains(const Key &k) const { return contains(index_of(k)); };
+
+    // Same semantics as std::unordered_map: an existing element is not overwritten
+    std::pair<iterator, bool> insert(const value_type &v) { return emplace(v.first, v.second); };
+    std::pair<iterator, bool> emplace(const Key &k, const T &value)
+    {
+        auto idx = index_of(k);
+        if (idx == npos) return {end(), false};
+        if (present_[idx]) return {iterator(this, idx), false};
+        slots_[idx] = value_type{key_of(idx), value};
+        present_[idx] = 1;
+        count++;
+        return {iterator(this, idx), true};
+    };
+    size_type erase(const Key &k)
+    {
+        auto idx = index_of(k);
+        if (not contains(idx)) return 0;
+        present_[idx] = 0; count--;
+        return 1;
+    };
+    void clear()
+    {
+        std::fill(present_.begin(), present_.end(), 0);
+        count = 0;
+    };
+    // Bulk construction: slots [first, last) become present with make(idx) as value, without the checks of emplace.
+    // Disjoint ranges may be filled from different threads; call recount() once all of them are done
+    template<typename F>
+    void fill(size_type first, size_type last, F &&make)
+    {
+        for (size_type idx = first; idx < last and idx < slots_.size(); idx++)
+        {
+            slots_[idx] = value_type{key_of(idx), make(idx)};
+            present_[idx] = 1;
+        }
+    };
+    void recount()
+    { count = std::count(present_.begin(), present_.end(), std::uint8_t(1)); };
+
+    size_type size() const { return count; };
+    bool empty() const { return count == 0; };
+    size_type slots() const { return slots_.size(); };
+    int cols() const { return cols_n; };
+    int rows() const { return rows_n; };
+    // one byte per slot, 1 when present. Raw view for bulk readers such as the NumPy bindings
+    const std::uint8_t *presence() const { return present_.data(); };
+
+    iterator begin() { return iterator(this, 0); };
+    iterator end() { return iterator(this, slots_.size()); };
+    const_iterator begin() const { return const_iterator(this, 0); };
+    const_iterator end() const { return const_iterator(this, slots_.size()); };
+
+private:
+    std::vector<value_type> slots_;
+    std::vector<std::uint8_t> present_;
+    long int left = 0, top = 0;
+    int cols_n = 0, rows_n = 0, tile = 0, tile_z = 0;
+    size_type count = 0;
+};
+
+#endif // DENSE_MAP_H
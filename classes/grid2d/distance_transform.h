@@ -0,0 +1,120 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef DISTANCE_TRANSFORM_H
+#define DISTANCE_TRANSFORM_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+// Exact squared Euclidean distance transform in linear time
+// (Felzenszwalb & Huttenlocher, "Distance Transforms of Sampled Functions", 2012).
+// Works on a w x h row-major window. Besides the distance it returns, for every cell, the window index of
+// its closest obstacle (-1 if there is none), so nearest-obstacle queries become lookups.
+// Scratch buffers are kept between calls.
+class DistanceTransform
+{
+public:
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+
+    // is_obstacle(c, r) for 0 <= c < w, 0 <= r < h. dist2 and nearest are resized to w*h
+    template<typename IsObstacle>
+    void compute(int w, int h, IsObstacle &&is_obstacle, std::vector<float> &dist2, std::vector<std::int32_t> &nearest)
+    {
+        const std::size_t n = static_cast<std::size_t>(w) * h;
+        dist2.resize(n);
+        nearest.resize(n);
+        col_d.resize(n);
+        col_site.resize(n);
+        const int m = std::max(w, h);
+        f.resize(m); d.resize(m); v.resize(m); z.resize(m + 1); site.resize(m);
+
+        // columns: distance to the closest obstacle in the same column
+        for (int c = 0; c < w; c++)
+        {
+            for (int r = 0; r < h; r++)
+                f[r] = is_obstacle(c, r) ? 0.f : INF;
+            pass(h);
+            for (int r = 0; r < h; r++)
+            {
+                col_d[r * w + c] = d[r];
+                col_site[r * w + c] = site[r];
+            }
+        }
+        // rows over the column distances
+        for (int r = 0; r < h; r++)
+        {
+            for (int c = 0; c < w; c++)
+                f[c] = col_d[r * w + c];
+            pass(w);
+            for (int c = 0; c < w; c++)
+            {
+                const std::size_t i = static_cast<std::size_t>(r) * w + c;
+                dist2[i] = d[c];
+                nearest[i] = (site[c] < 0) ? -1 : col_site[r * w + site[c]] * w + site[c];
+            }
+        }
+    }
+
+private:
+    std::vector<float> f, d, z, col_d;
+    std::vector<std::int32_t> v, site, col_site;
+
+    // 1D lower envelope of parabolas rooted at the finite samples of f. Writes d and the argmin in site
+    void pass(int n)
+    {
+        int k = -1;
+        for (int q = 0; q < n; q++)
+        {
+            if (f[q] == INF) continue;
+            if (k < 0)
+            {
+                k = 0; v[0] = q; z[0] = -INF; z[1] = INF;
+                continue;
+            }
+            float s;
+            while (true)
+            {
+                const int p = v[k];
+                s = ((f[q] + float(q) * q) - (f[p] + float(p) * p)) / (2.f * (q - p));
+                if (s <= z[k] and k > 0) k--;
+                else break;
+            }
+            if (s <= z[k])  // k == 0: the new parabola hides the first one everywhere
+            {
+                v[0] = q; z[0] = -INF; z[1] = INF;
+                continue;
+            }
+            k++;
+            v[k] = q; z[k] = s; z[k + 1] = INF;
+        }
+        if (k < 0)
+        {
+            std::fill(d.begin(), d.begin() + n, INF);
+            std::fill(site.begin(), site.begin() + n, -1);
+            return;
+        }
+        for (int q = 0, j = 0; q < n; q++)
+        {
+            while (z[j + 1] < q) j++;
+            const float dq = float(q - v[j]);
+            d[q] = dq * dq + f[v[j]];
+            site[q] = v[j];
+        }
+    }
+};
+
+#endif // DISTANCE_TRANSFORM_H
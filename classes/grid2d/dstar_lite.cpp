@@ -0,0 +1,232 @@
+#include "dstar_lite.h"
+#include <cmath>
+#include <algorithm>
+
+DStarLite::DStarLite(Grid &grid_) : grid(grid_)
+{
+    change_log = grid.open_change_log();
+}
+DStarLite::~DStarLite()
+{
+    grid.close_change_log(change_log);
+}
+void DStarLite::reset()
+{
+    initialized = false;
+}
+std::vector<Eigen::Vector2f> DStarLite::compute_path(const QPointF &source_, const QPointF &target_)
+{
+    const auto ends = grid.admit_path_ends(source_, target_);
+    if (not ends.has_value())
+        return {};
+    const auto &[source_key, target_key] = ends.value();
+    const auto &cells = grid.cells();
+    const auto s = static_cast<std::uint32_t>(cells.index_of(source_key));
+    const auto t = static_cast<std::uint32_t>(cells.index_of(target_key));
+
+    auto changes = grid.take_changed_cells(change_log);
+    expanded_count = 0;
+    if (not initialized or t != goal or cols != cells.cols() or rows != cells.rows() or not changes.has_value())
+        initialize(s, t);   // also after a bulk change, cheaper than repairing every cell
+    else
+    {
+        // robot moved: keep priorities consistent without reordering the queue
+        km += h(last, s);
+        last = s;
+        start = s;
+        // a slot is logged once per change, repair it once
+        std::sort(changes->begin(), changes->end());
+        changes->erase(std::unique(changes->begin(), changes->end()), changes->end());
+        for (const auto v : changes.value())
+            cell_changed(v);
+    }
+    compute_shortest_path();
+
+    std::vector<std::uint32_t> slots;
+    if (not extract_path(slots))
+    {
+        qInfo() << __FUNCTION__ << "Path from (" << source_key.x << "," << source_key.z << ") to (" << target_.x() << "," << target_.y() << ") not  found. Returning empty path";
+        return {};
+    }
+    // keep one every two points as decimate_path does with Grid::computePath results
+    std::vector<Eigen::Vector2f> path;
+    path.reserve(slots.size() / 2 + 1);
+    for (std::size_t i = 0; i < slots.size(); i += 2)
+    {
+        const auto k = cells.key_of(slots[i]);
+        path.emplace_back(k.x, k.z);
+    }
+    return path;
+}
+void DStarLite::initialize(std::uint32_t start_, std::uint32_t goal_)
+{
+    const auto &cells = grid.cells();
+    cols = cells.cols();
+    rows = cells.rows();
+    const std::size_t n = cells.slots();
+    g.assign(n, INF);
+    rhs.assign(n, INF);
+    priority.assign(n, Priority{INF, INF});
+    heap_pos.assign(n, NONE);
+    heap.clear();
+    km = 0.f;
+    start = last = start_;
+    goal = goal_;
+    rhs[goal] = 0.f;
+    heap_push(goal, calculate_key(goal));
+    initialized = true;
+}
+float DStarLite::h(std::uint32_t a, std::uint32_t b) const
+{
+    const float dx = std::abs(col(a) - col(b)), dz = std::abs(row(a) - row(b));
+    return (dx + dz) + (SQRT2 - 2.f) * std::min(dx, dz);   // octile. Cell costs are >= 1
+}
+DStarLite::Priority DStarLite::calculate_key(std::uint32_t u) const
+{
+    const float m = std::min(g[u], rhs[u]);
+    return {m + h(start, u) + km, m};
+}
+float DStarLite::edge_cost(std::uint32_t u, int d) const
+{
+    const int c = col(u), r = row(u);
+    const int nc = c + DX[d], nr = r + DZ[d];
+    if (not inside(nc, nr)) return INF;
+    const float cv = grid.traversal_cost(at(nc, nr));
+    if (cv < 0.f) return INF;
+    if (DX[d] != 0 and DZ[d] != 0)
+    {
+        // no corner cutting, as in AStar
+        if (grid.traversal_cost(at(nc, r)) < 0.f or grid.traversal_cost(at(c, nr)) < 0.f) return INF;
+        return cv * SQRT2;
+    }
+    return cv;
+}
+void DStarLite::update_vertex(std::uint32_t u)
+{
+    if (u != goal)
+    {
+        float best = INF;
+        for (int d = 0; d < 8; d++)
+            if (const float c = edge_cost(u, d); c < INF)
+                best = std::min(best, c + g[at(col(u) + DX[d], row(u) + DZ[d])]);
+        rhs[u] = best;
+    }
+    if (heap_pos[u] != NONE)
+        heap_remove(u);
+    if (g[u] != rhs[u])
+        heap_push(u, calculate_key(u));
+}
+void DStarLite::cell_changed(std::uint32_t v)
+{
+    if (v >= g.size()) return;
+    // edges into v changed, and so did the diagonals running past it: all of them start at v or a neighbour of v
+    update_vertex(v);
+    for (int d = 0; d < 8; d++)
+        if (const int nc = col(v) + DX[d], nr = row(v) + DZ[d]; inside(nc, nr))
+            update_vertex(at(nc, nr));
+}
+void DStarLite::compute_shortest_path()
+{
+    while (not heap.empty() and (heap_top_key() < calculate_key(start) or rhs[start] != g[start]))
+    {
+        const Priority k_old = heap_top_key();
+        const std::uint32_t u = heap_pop();
+        expanded_count++;
+        if (const auto k_new = calculate_key(u); k_old < k_new)
+            heap_push(u, k_new);
+        else if (g[u] > rhs[u])
+        {
+            g[u] = rhs[u];
+            for (int d = 0; d < 8; d++)
+                if (const int nc = col(u) + DX[d], nr = row(u) + DZ[d]; inside(nc, nr))
+                    update_vertex(at(nc, nr));
+        }
+        else
+        {
+            g[u] = INF;
+            update_vertex(u);
+            for (int d = 0; d < 8; d++)
+                if (const int nc = col(u) + DX[d], nr = row(u) + DZ[d]; inside(nc, nr))
+                    update_vertex(at(nc, nr));
+        }
+    }
+}
+bool DStarLite::extract_path(std::vector<std::uint32_t> &path) const
+{
+    path.clear();
+    if (g[start] == INF)
+        return false;
+    std::uint32_t u = start;
+    const std::size_t max_steps = g.size();
+    while (u != goal and path.size() < max_steps)
+    {
+        std::uint32_t next = NONE;
+        float best = INF;
+        for (int d = 0; d < 8; d++)
+            if (const float c = edge_cost(u, d); c < INF)
+                if (const auto v = at(col(u) + DX[d], row(u) + DZ[d]); c + g[v] < best)
+                {
+                    best = c + g[v];
+                    next = v;
+                }
+        if (next == NONE)
+            return false;
+        path.push_back(next);
+        u = next;
+    }
+    return u == goal;
+}
+
+////////////////////////////// HEAP /////////////////////////////////////////////////////////
+void DStarLite::heap_push(std::uint32_t u, const Priority &p)
+{
+    priority[u] = p;
+    heap.push_back(u);
+    sift_up(heap.size() - 1);
+}
+void DStarLite::heap_remove(std::uint32_t u)
+{
+    const std::uint32_t pos = heap_pos[u];
+    heap_pos[u] = NONE;
+    const std::uint32_t last_node = heap.back();
+    heap.pop_back();
+    if (pos == heap.size())
+        return;
+    heap[pos] = last_node;
+    heap_pos[last_node] = pos;
+    sift_up(pos);
+    sift_down(heap_pos[last_node]);
+}
+std::uint32_t DStarLite::heap_pop()
+{
+    const std::uint32_t top = heap.front();
+    heap_remove(top);
+    return top;
+}
+void DStarLite::sift_up(std::uint32_t pos)
+{
+    const std::uint32_t node = heap[pos];
+    while (pos > 0)
+    {
+        const std::uint32_t up = (pos - 1) / 2;
+        if (not (priority[node] < priority[heap[up]])) break;
+        heap[pos] = heap[up]; heap_pos[heap[pos]] = pos;
+        pos = up;
+    }
+    heap[pos] = node; heap_pos[node] = pos;
+}
+void DStarLite::sift_down(std::uint32_t pos)
+{
+    const std::uint32_t node = heap[pos];
+    const std::uint32_t size = heap.size();
+    while (true)
+    {
+        std::uint32_t child = 2 * pos + 1;
+        if (child >= size) break;
+        if (child + 1 < size and priority[heap[child + 1]] < priority[heap[child]]) child++;
+        if (not (priority[heap[child]] < priority[node])) break;
+        heap[pos] = heap[child]; heap_pos[heap[pos]] = pos;
+        pos = child;
+    }
+    heap[pos] = node; heap_pos[node] = pos;
+}
@@ -0,0 +1,84 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef DSTAR_LITE_H
+#define DSTAR_LITE_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include "grid.h"
+
+// Incremental planner (D* Lite, Koenig & Likhachev 2002) bound to a Grid.
+// The search runs from the target towards the robot and is kept between calls. On every compute_path
+// the cells whose occupancy or cost changed in the grid since the previous call (update_map, setOccupied,
+// setCost, update_costs, the layered costmap...) are pulled from its own Grid change log and only the
+// affected part of the search tree is repaired. A new target, a grid re-initialization or a bulk change
+// (loading a map, set_all_costs...) restarts the search.
+class DStarLite
+{
+public:
+    explicit DStarLite(Grid &grid_);
+    ~DStarLite();
+    DStarLite(const DStarLite &) = delete;
+    DStarLite &operator=(const DStarLite &) = delete;
+
+    // Same admission rules and output format as Grid::compute_path
+    std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
+    void reset();
+    int expanded() const { return expanded_count; };  // vertices expanded in the last call
+
+private:
+    using Priority = std::pair<float, float>;
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+    static constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+    static constexpr float SQRT2 = 1.41421356f;
+    static constexpr int DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static constexpr int DZ[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+    Grid &grid;
+    int change_log = -1;
+    int cols = 0, rows = 0, expanded_count = 0;
+    bool initialized = false;
+    std::uint32_t start = NONE, goal = NONE, last = NONE;
+    float km = 0.f;
+    std::vector<float> g, rhs;
+    std::vector<Priority> priority;
+    std::vector<std::uint32_t> heap, heap_pos;  // heap_pos == NONE if not queued
+
+    void initialize(std::uint32_t start_, std::uint32_t goal_);
+    void compute_shortest_path();
+    void update_vertex(std::uint32_t u);
+    void cell_changed(std::uint32_t v);
+    float edge_cost(std::uint32_t u, int d) const;   // cost of moving from u to its neighbour in direction d
+    float h(std::uint32_t a, std::uint32_t b) const;
+    Priority calculate_key(std::uint32_t u) const;
+    bool extract_path(std::vector<std::uint32_t> &path) const;
+
+    inline int col(std::uint32_t i) const { return static_cast<int>(i % cols); };
+    inline int row(std::uint32_t i) const { return static_cast<int>(i / cols); };
+    inline bool inside(int c, int r) const { return c >= 0 and r >= 0 and c < cols and r < rows; };
+    inline std::uint32_t at(int c, int r) const { return static_cast<std::uint32_t>(r) * cols + c; };
+
+    // indexed binary heap ordered by priority
+    void heap_push(std::uint32_t u, const Priority &p);
+    void heap_remove(std::uint32_t u);
+    std::uint32_t heap_pop();
+    Priority heap_top_key() const { return heap.empty() ? Priority{INF, INF} : priority[heap.front()]; };
+    void sift_up(std::uint32_t pos);
+    void sift_down(std::uint32_t pos);
+};
+
+#endif // DSTAR_LITE_H
@@ -1,4 +1,14 @@
 #include "grid.h"
+#include <threadpool/threadpool.h>
+#include <local_grid/local_grid.h>
+#include <simplifypath/simplifyPath.h>
+#include <tracing/trace.h>
+#include "grid_file.h"
+#include "grid_delta.h"
+#include <numeric>
+#if COMPILE_GRID_LZ4==1
+#include <lz4.h>
+#endif
 #include <cppitertools/zip.hpp>
 #include <cppitertools/range.hpp>
 #include <cppitertools/slice.hpp>
@@ -32,49 +42,110 @@ void Grid::initialize(  QRectF dim_,
                         QGraphicsScene *scene_,
                         bool read_from_file,
                         const std::string &file_name,
-                        QPointF grid_center,
-                        float grid_angle)
+                        QPointF grid_center_,
+                        float grid_angle_)
 {
-    static QGraphicsRectItem *bounding_box = nullptr;
-    dim = dim_;
-    TILE_SIZE = tile_size;
-    scene = scene_;
-    qInfo() << __FILE__ << __FUNCTION__ <<  "World dimension: " << dim << TILE_SIZE << "I assume that Y+ axis goes upwards";
-    //qInfo() << __FUNCTION__ <<  "World dimension: ";
-    //qInfo() << "    " << "left:" << dim.left() << "right:" << dim.right() << "bottom:" << dim.bottom() << "top:" << dim.top() << "tile:" << TILE_SIZE;
-    /// CHECK DIMENSIONS BEFORE PROCEED
-    qInfo() << __FUNCTION__ << "Grid coordinates. Center:" << grid_center << "Angle:" << grid_angle;
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
-    if(bounding_box != nullptr) scene->removeItem(bounding_box);
-    fmap.clear();
-
+    reset_storage(dim_, tile_size, scene_, grid_center_, grid_angle_);
+    tile_items = scene != nullptr;
 //    if(read_from_file and not file_name.empty())
 //        readFromFile(file_name);
     QColor my_color = QColor("White");
     //my_color.setAlpha(40);
+    const int cols = fmap.cols(), rows = fmap.rows();
     std::uint32_t id=0;
     Eigen::Matrix2f matrix;
     matrix << cos(grid_angle) , -sin(grid_angle) , sin(grid_angle) , cos(grid_angle);
-    for (float i = dim.left(); i < dim.right(); i += TILE_SIZE)
-        for (float j = dim.top(); j < dim.bottom(); j += TILE_SIZE)
+    for (int cz = 0; cz < rows; cz++)
+        for (int cx = 0; cx < cols; cx++)
         {
+            float i = dim.left() + cx * TILE_SIZE;
+            float j = dim.top() + cz * TILE_SIZE;
             T aux;
             aux.id = id++;
             aux.free = true;
             aux.visited = false;
             aux.cost = 1.0;
-            QGraphicsRectItem* tile = scene->addRect(-TILE_SIZE/2, -TILE_SIZE/2, TILE_SIZE, TILE_SIZE, QPen(my_color), QBrush(my_color));
-            //tile->setZValue(50);
-            Eigen::Vector2f res = matrix * Eigen::Vector2f(i, j) + Eigen::Vector2f(grid_center.x(), grid_center.y());
-            tile->setPos(res.x(), res.y());
-            tile->setRotation(qRadiansToDegrees(grid_angle));
-            aux.tile = tile;
+            if (tile_items)
+            {
+                QGraphicsRectItem* tile = scene->addRect(-TILE_SIZE/2, -TILE_SIZE/2, TILE_SIZE, TILE_SIZE, QPen(my_color), QBrush(my_color));
+                //tile->setZValue(50);
+                Eigen::Vector2f res = matrix * Eigen::Vector2f(i, j) + Eigen::Vector2f(grid_center.x(), grid_center.y());
+                tile->setPos(res.x(), res.y());
+                tile->setRotation(qRadiansToDegrees(grid_angle));
+                aux.tile = tile;
+            }
             insert(Key(i, j), aux);
             //qInfo() << __FUNCTION__ << i << j << aux.id << aux.free << aux.tile->pos();
         }
+    draw_bounding_box();
+}
+void Grid::initialize_fast(QRectF dim_, int tile_size, QGraphicsScene *scene_, ThreadPool *pool, QPointF grid_center_, float grid_angle_)
+{
+    reset_storage(dim_, tile_size, scene_, grid_center_, grid_angle_);
+    tile_items = false;
+    // id == slot index, so every row of slots can be built on its own
+    const auto make = [](std::size_t idx)
+    {
+        T aux;
+        aux.id = static_cast<std::uint32_t>(idx);
+        aux.free = true;
+        aux.visited = false;
+        aux.cost = 1.0;
+        return aux;
+    };
+    const std::size_t cols = fmap.cols(), rows = fmap.rows();
+    if (pool != nullptr and rows > 1)
+        pool->parallel_for(0, rows, 16, [this, &make, cols](std::size_t r) { fmap.fill(r * cols, (r + 1) * cols, make); });
+    else
+        fmap.fill(0, fmap.slots(), make);
+    fmap.recount();
+    draw_bounding_box();
+}
+void Grid::reset_storage(QRectF dim_, int tile_size, QGraphicsScene *scene_, QPointF grid_center_, float grid_angle_)
+{
+    // items of the previous geometry belong to the previous scene
+    if (scene != nullptr)
+        for (const auto &[key, value]: fmap)
+            if (value.tile != nullptr)
+                scene->removeItem(value.tile);
+    if(texture != nullptr)
+    {
+        if (scene != nullptr)
+            scene->removeItem(texture);
+        delete texture;
+        texture = nullptr;
+    }
+    dim = dim_;
+    TILE_SIZE = tile_size;
+    scene = scene_;
+    grid_center = grid_center_;
+    grid_angle = grid_angle_;
+    qInfo() << __FILE__ << __FUNCTION__ <<  "World dimension: " << dim << TILE_SIZE << "I assume that Y+ axis goes upwards";
+    //qInfo() << __FUNCTION__ <<  "World dimension: ";
+    //qInfo() << "    " << "left:" << dim.left() << "right:" << dim.right() << "bottom:" << dim.bottom() << "top:" << dim.top() << "tile:" << TILE_SIZE;
+    /// CHECK DIMENSIONS BEFORE PROCEED
+    qInfo() << __FUNCTION__ << "Grid coordinates. Center:" << grid_center << "Angle:" << grid_angle;
+    mark_all_changed();
+    fmap.clear();
 
-    // draw bounding box
+    // dense storage: one slot per tile, row-major with z as row index, so that id == slot index
+    const int cols = static_cast<int>(std::ceil(dim.width() / TILE_SIZE));
+    const int rows = static_cast<int>(std::ceil(dim.height() / TILE_SIZE));
+    fmap.reset(static_cast<long int>(dim.left()), static_cast<long int>(dim.top()), cols, rows, TILE_SIZE);
+    cell_version.assign(fmap.slots(), 0);
+    if (costmap)
+        costmap->resize(cols, rows);   // the sensor layer is filled again by the next update_costmap
+}
+void Grid::draw_bounding_box()
+{
+    static QGraphicsRectItem *bounding_box = nullptr;
+    static QGraphicsScene *bounding_box_scene = nullptr;
+    if (bounding_box != nullptr and bounding_box_scene != nullptr)
+        bounding_box_scene->removeItem(bounding_box);
+    bounding_box = nullptr;
+    bounding_box_scene = scene;
+    if (scene == nullptr)
+        return;
     bounding_box = scene->addRect(dim, QPen(QColor("Grey"), 40));
     bounding_box->setPos(grid_center);
     bounding_box->setZValue(12);
@@ -88,46 +159,28 @@ inline std::tuple<bool, Grid::T&> Grid::getCell(long int x, long int z)
 {
     if (not dim.contains(QPointF(x, z)))
         return std::forward_as_tuple(false, T());
-    else
-        try
-        {
-            return std::forward_as_tuple(true, fmap.at(pointToKey(x, z)));
-        }
-        catch(const std::exception &e)
-        {
-            //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-            return std::forward_as_tuple(false, T());
-        }
+    if (auto cell = fmap.find_cell(pointToKey(x, z)); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Grid::T&> Grid::getCell(const Key &k)
 {
     if (not dim.contains(k.toQPointF()))
         return std::forward_as_tuple(false, T());
-    else
-      try
-      {
-          return std::forward_as_tuple(true, fmap.at(pointToKey(k.x, k.z)));
-      }
-      catch(const std::exception &e)
-      {
-          qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-          return std::forward_as_tuple(false, T());
-      }
+    if (auto cell = fmap.find_cell(pointToKey(k.x, k.z)); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Grid::T&> Grid::getCell(const Eigen::Vector2f &p)
 {
     if (not dim.contains(QPointF(p.x(), p.y())))
         return std::forward_as_tuple(false, T());
-    else
-        try
-        {
-            return std::forward_as_tuple(true, fmap.at(pointToKey(p.x(), p.y())));
-        }
-        catch(const std::exception &e)
-        {
-            //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-            return std::forward_as_tuple(false, T());
-        }
+    if (auto cell = fmap.find_cell(pointToKey(p.x(), p.y())); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 Grid::Key Grid::pointToKey(long int x, long int z) const
 {
@@ -189,8 +242,11 @@ void Grid::readFromString(const std::string &cadena)
         float cost;
         std::string node_name;
         ss >> x >> z >> free >> visited >> cost>> node_name;
-        fmap.emplace(pointToKey(x, z), T{count++, free, false, cost});
+        auto key = pointToKey(x, z);
+        fmap.emplace(key, T{static_cast<std::uint32_t>(fmap.index_of(key)), free, false, cost});
+        count++;
     }
+    mark_all_changed();
     std::cout << __FUNCTION__ << " " << fmap.size() << " elements read from "  << std::endl;
 }
 void Grid::readFromFile(const std::string &fich)
@@ -201,7 +257,7 @@ void Grid::readFromFile(const std::string &fich)
     if (!myfile)
     {
         std::cout << fich << " No file found" << std::endl;
-        std::terminate();
+        return;
     }
     while ( std::getline (myfile, line) )
     {
@@ -211,11 +267,372 @@ void Grid::readFromFile(const std::string &fich)
         bool free, visited;
         std::string node_name;
         ss >> x >> z >> free >> visited >> node_name;
-        fmap.emplace(pointToKey(x, z), T{count++, free, false, 1.f});
+        auto key = pointToKey(x, z);
+        fmap.emplace(key, T{static_cast<std::uint32_t>(fmap.index_of(key)), free, false, 1.f});
+        count++;
     }
+    mark_all_changed();
     std::cout << __FUNCTION__ << " " << fmap.size() << " elements read from " << fich << std::endl;
 }
 
+bool Grid::saveToBinaryFile(const std::string &fich, bool compress) const
+{
+    const std::string data = encode_binary(compress);
+    std::ofstream myfile(fich, std::ios::binary | std::ios::trunc);
+    if (not myfile)
+    {
+        qWarning() << __FUNCTION__ << "Could not open" << QString::fromStdString(fich);
+        return false;
+    }
+    myfile.write(data.data(), data.size());
+    std::cout << __FUNCTION__ << " " << fmap.size() << " elements written to " << fich << std::endl;
+    return myfile.good();
+}
+bool Grid::readFromBinaryFile(const std::string &fich)
+{
+    grid_file::MappedFile file(fich);
+    if (not file.ok())
+    {
+        qWarning() << __FUNCTION__ << "Could not map" << QString::fromStdString(fich);
+        return false;
+    }
+    return decode_binary(file.bytes(), file.size());
+}
+std::string Grid::saveToBinaryString(bool compress) const
+{
+    return encode_binary(compress);
+}
+bool Grid::readFromBinaryString(const std::string &cadena)
+{
+    return decode_binary(reinterpret_cast<const std::uint8_t *>(cadena.data()), cadena.size());
+}
+std::string Grid::encode_binary(bool compress) const
+{
+    const std::size_t n = fmap.slots();
+    const auto planes = grid_file::plane_offsets(n);
+    std::string raw(planes.size, '\0');
+    auto *base = reinterpret_cast<std::uint8_t *>(raw.data());
+    auto *present = base + planes.present;
+    auto *state = base + planes.state;
+    auto *cost = reinterpret_cast<float *>(base + planes.cost);
+    auto *hits = reinterpret_cast<float *>(base + planes.hits);
+    auto *misses = reinterpret_cast<float *>(base + planes.misses);
+    auto *log_odds = reinterpret_cast<float *>(base + planes.log_odds);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (not fmap.contains(i)) continue;
+        const auto &v = fmap.slot(i).second;
+        present[i] = 1;
+        state[i] = (v.free ? 1 : 0) | (v.visited ? 2 : 0);
+        cost[i] = v.cost;
+        hits[i] = v.hits;
+        misses[i] = v.misses;
+        log_odds[i] = static_cast<float>(v.log_odds);
+    }
+
+    grid_file::Header header{};
+    std::memcpy(header.magic, grid_file::MAGIC, sizeof(header.magic));
+    header.version = grid_file::VERSION;
+    header.left = dim.left(); header.top = dim.top(); header.width = dim.width(); header.height = dim.height();
+    header.tile_size = TILE_SIZE;
+    header.cols = fmap.cols(); header.rows = fmap.rows();
+    header.grid_angle = grid_angle;
+    header.center_x = grid_center.x(); header.center_y = grid_center.y();
+    header.raw_size = raw.size();
+    header.payload_size = raw.size();
+#if COMPILE_GRID_LZ4==1
+    if (compress)
+    {
+        std::string packed(LZ4_compressBound(raw.size()), '\0');
+        const int written = LZ4_compress_default(raw.data(), packed.data(), raw.size(), packed.size());
+        if (written > 0)
+        {
+            packed.resize(written);
+            raw.swap(packed);
+            header.flags |= grid_file::FLAG_LZ4;
+            header.payload_size = raw.size();
+        }
+    }
+#else
+    if (compress)
+        qWarning() << __FUNCTION__ << "Built without LZ4 (COMPILE_GRID_LZ4). Writing uncompressed map";
+#endif
+    std::string out(sizeof(header), '\0');
+    std::memcpy(out.data(), &header, sizeof(header));
+    out += raw;
+    return out;
+}
+bool Grid::decode_binary(const std::uint8_t *data, std::size_t size)
+{
+    grid_file::Header header;
+    if (size < sizeof(header))
+        return false;
+    std::memcpy(&header, data, sizeof(header));
+    if (not grid_file::valid_header(header, size))
+    {
+        qWarning() << __FUNCTION__ << "Not a valid grid map or unsupported version";
+        return false;
+    }
+    const std::uint8_t *base = data + sizeof(header);
+    std::vector<std::uint8_t> unpacked;
+    if (header.flags & grid_file::FLAG_LZ4)
+    {
+#if COMPILE_GRID_LZ4==1
+        unpacked.resize(header.raw_size);
+        const int read = LZ4_decompress_safe(reinterpret_cast<const char *>(base), reinterpret_cast<char *>(unpacked.data()),
+                                             header.payload_size, unpacked.size());
+        if (read != (int)header.raw_size)
+        {
+            qWarning() << __FUNCTION__ << "Corrupted LZ4 payload";
+            return false;
+        }
+        base = unpacked.data();
+#else
+        qWarning() << __FUNCTION__ << "Compressed map but built without LZ4 (COMPILE_GRID_LZ4)";
+        return false;
+#endif
+    }
+    else if (header.payload_size != header.raw_size)
+        return false;
+
+    // geometry. Tiles are only rebuilt when it changes
+    const QRectF file_dim(header.left, header.top, header.width, header.height);
+    if (file_dim != dim or header.tile_size != TILE_SIZE or header.cols != fmap.cols() or header.rows != fmap.rows())
+    {
+        if (tile_items)
+            initialize(file_dim, header.tile_size, scene, false, std::string(), QPointF(header.center_x, header.center_y), header.grid_angle);
+        else
+            initialize_fast(file_dim, header.tile_size, scene, nullptr, QPointF(header.center_x, header.center_y), header.grid_angle);
+        if (header.cols != fmap.cols() or header.rows != fmap.rows())
+            return false;
+    }
+
+    const std::size_t n = static_cast<std::size_t>(header.cols) * header.rows;
+    const auto planes = grid_file::plane_offsets(n);
+    const std::uint8_t *present = base + planes.present;
+    const std::uint8_t *state = base + planes.state;
+    const float *cost = reinterpret_cast<const float *>(base + planes.cost);
+    const float *hits = reinterpret_cast<const float *>(base + planes.hits);
+    const float *misses = reinterpret_cast<const float *>(base + planes.misses);
+    const float *log_odds = reinterpret_cast<const float *>(base + planes.log_odds);
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (not present[i] or not fmap.contains(i)) continue;
+        auto &v = fmap.slot(i).second;
+        v.free = state[i] & 1;
+        v.visited = state[i] & 2;
+        v.cost = cost[i];
+        v.hits = hits[i];
+        v.misses = misses[i];
+        v.log_odds = log_odds[i];
+        count++;
+    }
+    edt_valid = false;
+    mark_all_changed();
+    std::cout << __FUNCTION__ << " " << count << " elements read" << std::endl;
+    return true;
+}
+
+//////////////////////////////// DELTAS //////////////////////////////////////////
+std::string Grid::export_delta(std::uint32_t &since, bool compress)
+{
+    const std::size_t n = std::min(fmap.slots(), cell_version.size());
+    std::vector<std::uint32_t> slots;
+    for (std::size_t i = 0; i < n; i++)
+        if (cell_version[i] > since and fmap.contains(i))
+            slots.push_back(static_cast<std::uint32_t>(i));
+
+    grid_delta::Header header{};
+    std::memcpy(header.magic, grid_delta::MAGIC, sizeof(header.magic));
+    header.version = grid_delta::VERSION;
+    header.left = dim.left(); header.top = dim.top(); header.width = dim.width(); header.height = dim.height();
+    header.tile_size = TILE_SIZE;
+    header.cols = fmap.cols(); header.rows = fmap.rows();
+    header.from_version = since;
+    header.to_version = current_version;
+    header.cells = slots.size();
+
+    // runs of consecutive slots
+    std::string raw;
+    std::size_t next = 0;
+    for (std::size_t k = 0; k < slots.size();)
+    {
+        std::size_t e = k + 1;
+        while (e < slots.size() and slots[e] == slots[e - 1] + 1)
+            e++;
+        grid_delta::put_varint(raw, slots[k] - next);
+        grid_delta::put_varint(raw, e - k);
+        next = slots[e - 1] + 1;
+        header.runs++;
+        k = e;
+    }
+    const std::size_t occupied = raw.size(), counts = occupied + (slots.size() + 7) / 8;
+    raw.resize(counts + 2 * slots.size(), '\0');
+    auto *base = reinterpret_cast<std::uint8_t *>(raw.data());
+    LogOddsKernel::Value previous = 0;
+    std::string odds;
+    for (std::size_t k = 0; k < slots.size(); k++)
+    {
+        const auto &v = fmap.slot(slots[k]).second;
+        if (not v.free)
+            base[occupied + k / 8] |= static_cast<std::uint8_t>(1u << (k % 8));
+        base[counts + k] = static_cast<std::uint8_t>(std::clamp(std::lrint(v.hits), 0l, 255l));
+        base[counts + slots.size() + k] = static_cast<std::uint8_t>(std::clamp(std::lrint(v.misses), 0l, 255l));
+        const auto l = LogOddsKernel::to_fixed(static_cast<float>(v.log_odds));
+        grid_delta::put_varint(odds, grid_delta::zigzag(std::int64_t(l) - previous));
+        previous = l;
+    }
+    raw += odds;
+    header.raw_size = raw.size();
+    header.payload_size = raw.size();
+#if COMPILE_GRID_LZ4==1
+    if (compress and not raw.empty())
+    {
+        std::string packed(LZ4_compressBound(raw.size()), '\0');
+        const int written = LZ4_compress_default(raw.data(), packed.data(), raw.size(), packed.size());
+        if (written > 0 and static_cast<std::size_t>(written) < raw.size())
+        {
+            packed.resize(written);
+            raw.swap(packed);
+            header.flags |= grid_delta::FLAG_LZ4;
+            header.payload_size = raw.size();
+        }
+    }
+#else
+    if (compress)
+        qWarning() << __FUNCTION__ << "Built without LZ4 (COMPILE_GRID_LZ4). Writing uncompressed delta";
+#endif
+    // cells changed from now on belong to the next delta
+    since = current_version++;
+    std::string out(sizeof(header), '\0');
+    std::memcpy(out.data(), &header, sizeof(header));
+    out += raw;
+    return out;
+}
+bool Grid::apply_delta(const std::string &delta, const DeltaFusion &fusion)
+{
+    grid_delta::Header header;
+    if (delta.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, delta.data(), sizeof(header));
+    if (not grid_delta::valid_header(header, delta.size()))
+    {
+        qWarning() << __FUNCTION__ << "Not a valid grid delta or unsupported version";
+        return false;
+    }
+    if (header.cols != fmap.cols() or header.rows != fmap.rows() or header.tile_size != TILE_SIZE
+        or header.left != dim.left() or header.top != dim.top())
+    {
+        qWarning() << __FUNCTION__ << "Delta of a grid with a different geometry";
+        return false;
+    }
+    const auto *base = reinterpret_cast<const std::uint8_t *>(delta.data()) + sizeof(header);
+    std::vector<std::uint8_t> unpacked;
+    if (header.flags & grid_delta::FLAG_LZ4)
+    {
+#if COMPILE_GRID_LZ4==1
+        unpacked.resize(header.raw_size);
+        const int read = LZ4_decompress_safe(reinterpret_cast<const char *>(base), reinterpret_cast<char *>(unpacked.data()),
+                                             header.payload_size, unpacked.size());
+        if (read != (int)header.raw_size)
+        {
+            qWarning() << __FUNCTION__ << "Corrupted LZ4 payload";
+            return false;
+        }
+        base = unpacked.data();
+#else
+        qWarning() << __FUNCTION__ << "Compressed delta but built without LZ4 (COMPILE_GRID_LZ4)";
+        return false;
+#endif
+    }
+    else if (header.payload_size != header.raw_size)
+        return false;
+    const std::uint8_t *p = base, *end = base + header.raw_size;
+
+    std::vector<std::uint32_t> slots;
+    slots.reserve(header.cells);
+    std::uint64_t next = 0;
+    for (std::uint32_t r = 0; r < header.runs; r++)
+    {
+        std::uint64_t gap, length;
+        if (not grid_delta::get_varint(p, end, gap) or not grid_delta::get_varint(p, end, length)
+            or next + gap + length > fmap.slots() or slots.size() + length > header.cells)
+            return false;
+        for (std::uint64_t i = next + gap; i < next + gap + length; i++)
+            slots.push_back(static_cast<std::uint32_t>(i));
+        next += gap + length;
+    }
+    const std::size_t cells = header.cells;
+    if (slots.size() != cells or static_cast<std::size_t>(end - p) < (cells + 7) / 8 + 2 * cells)
+        return false;
+    const std::uint8_t *occupied = p, *hits = p + (cells + 7) / 8, *misses = hits + cells;
+    p = misses + cells;
+
+    const float w = std::clamp(fusion.weight, 0.f, 1.f);
+    int previous = 0;
+    for (std::size_t k = 0; k < cells; k++)
+    {
+        std::uint64_t z;
+        if (not grid_delta::get_varint(p, end, z))
+            return false;
+        const int remote = static_cast<int>(std::clamp<std::int64_t>(previous + grid_delta::unzigzag(z), -32767, 32767));
+        previous = remote;
+        const auto idx = slots[k];
+        if (not fmap.contains(idx))
+            continue;
+        auto &v = fmap.slot(idx).second;
+        const bool remote_occupied = occupied[k / 8] >> (k % 8) & 1;
+        const float rh = hits[k], rm = misses[k];
+        const int local = LogOddsKernel::to_fixed(static_cast<float>(v.log_odds));
+        int l = local;
+        bool free = v.free;
+        switch (fusion.mode)
+        {
+            case DeltaFusion::Mode::REPLACE:
+                l = remote; v.hits = rh; v.misses = rm; free = not remote_occupied;
+                break;
+            case DeltaFusion::Mode::MAX_CONFIDENCE:
+                l = std::abs(remote) > std::abs(local) ? remote : local;
+                if (rh + rm > v.hits + v.misses) { v.hits = rh; v.misses = rm; }
+                break;
+            case DeltaFusion::Mode::AVERAGE:
+                l = static_cast<int>(std::lrint((1.f - w) * local + w * remote));
+                v.hits = (1.f - w) * v.hits + w * rh;
+                v.misses = (1.f - w) * v.misses + w * rm;
+                break;
+            case DeltaFusion::Mode::SUM:
+                l = log_odds_kernel.add(static_cast<LogOddsKernel::Value>(local), static_cast<LogOddsKernel::Value>(remote));
+                v.hits = std::min(v.hits + rh, 20.f);
+                v.misses = std::min(v.misses + rm, 20.f);
+                break;
+        }
+        v.log_odds = LogOddsKernel::to_log_odds(static_cast<LogOddsKernel::Value>(l));
+        // occupancy from the fused evidence: counts as update_map, else log odds with the hysteresis of the kernel
+        if (fusion.mode != DeltaFusion::Mode::REPLACE)
+        {
+            if (v.hits + v.misses > 0)
+                free = v.hits / (v.hits + v.misses) < params.occupancy_threshold;
+            else if (l > log_odds_kernel.occupied_threshold())
+                free = false;
+            else if (l < log_odds_kernel.free_threshold())
+                free = true;
+            else if (l == 0)
+                free = v.free and not remote_occupied;
+        }
+        if (log_odds_valid and idx < log_odds_plane.size())
+            log_odds_plane[idx] = static_cast<LogOddsKernel::Value>(l);
+        note_evidence(idx);
+        if (free != v.free)
+        {
+            this->flipped++;
+            note_flip(v);
+            v.free = free;
+        }
+    }
+    return true;
+}
+
 //////////////////////////////// STATUS //////////////////////////////////////////
 //deprecated
 bool Grid::isFree(const Key &k)
@@ -240,6 +657,8 @@ void Grid::setFree(const Key &k)
     auto &&[success, v] = getCell(k);
     if(success)
     {
+        if(not v.free)
+            note_flip(v);
         v.free = true;
         if(v.tile != nullptr)
             v.tile->setBrush(QBrush(QColor("white")));
@@ -266,6 +685,8 @@ void Grid::set_free(long int x, long int y)
     auto &&[success, v] = getCell(x, y);
     if(success)
     {
+        if(not v.free)
+            note_flip(v);
         v.free = true;
         if (v.tile != nullptr)
             v.tile->setBrush(QBrush(QColor(params.free_color)));
@@ -277,6 +698,8 @@ void Grid::setOccupied(const Key &k)
     auto &&[success, v] = getCell(k);
     if(success)
     {
+        if(v.free)
+            note_flip(v);
         v.free = false;
 //        if(v.tile != nullptr)
 //            v.tile->setBrush(QBrush(QColor(params.occupied_color)));
@@ -287,6 +710,8 @@ void Grid::setOccupied(long int x, long int y)
     auto &&[success, v] = getCell(x,y);
     if(success)
     {
+        if(v.free)
+            note_flip(v);
         v.free = false;
 //        if(v.tile != nullptr)
 //            v.tile->setBrush(QBrush(QColor("red")));
@@ -301,12 +726,16 @@ void Grid::add_miss(const Eigen::Vector2f &p)
     auto &&[success, v] = getCell((long int)p.x(),(long int)p.y());
     if(success)
     {
+        note_evidence(v.id);
         v.misses++;
         if((float)v.hits/(v.hits+v.misses) < params.occupancy_threshold)
         //if((float)v.hits/(v.hits+v.misses) < params.prob_free)
         {
             if(not v.free)
+            {
                 this->flipped++;
+                note_flip(v);
+            }
             v.free = true;
             //v.tile->setBrush(QBrush(QColor(params.free_color)));
         }
@@ -321,12 +750,16 @@ void Grid::add_hit(const Eigen::Vector2f &p)
     auto &&[success, v] = getCell((long int)p.x(),(long int)p.y());
     if(success)
     {
+        note_evidence(v.id);
         v.hits++;
         if((float)v.hits/(v.hits+v.misses) >= params.occupancy_threshold)
         //if((float)v.hits/(v.hits+v.misses) >= params.prob_occ)
             {
             if(v.free)
+            {
                 this->flipped++;
+                note_flip(v);
+            }
             v.free = false;
             //v.tile->setBrush(QBrush(QColor(params.occupied_color)));
         }
@@ -336,25 +769,33 @@ void Grid::add_hit(const Eigen::Vector2f &p)
 }
 void Grid::log_update(const Eigen::Vector2f &p, float prob)
 {
-    static double TRESHOLD_P_FREE = log_odds(0.3);
-    static double TRESHOLD_P_OCC = log_odds(0.6);
+    // thresholds in log odds space, so no exp is needed to read the probability back
+    static const double TRESHOLD_L_FREE = log_odds(0.3);
+    static const double TRESHOLD_L_OCC = log_odds(0.6);
 
     // update probability matrix using inverse sensor model
     auto &&[success, v] = getCell(p);
     if(success)
     {
+        note_evidence(v.id);
         v.log_odds += log_odds(prob);
-        qInfo() << __FUNCTION__ << v.log_odds;
-        auto r = retrieve_p(v.log_odds);
-        if (r < TRESHOLD_P_FREE)
+        if (log_odds_valid and v.id < log_odds_plane.size())
+            log_odds_plane[v.id] = LogOddsKernel::to_fixed(v.log_odds);
+        if (v.log_odds < TRESHOLD_L_FREE)
         {
+            if (not v.free)
+                note_flip(v);
             v.free = true;
-            v.tile->setBrush(QColor("White"));
+            if (v.tile != nullptr)
+                v.tile->setBrush(QColor("White"));
         }
-        else if (r > TRESHOLD_P_OCC)
+        else if (v.log_odds > TRESHOLD_L_OCC)
         {
+            if (v.free)
+                note_flip(v);
             v.free = false;
-            v.tile->setBrush(QColor("Red"));
+            if (v.tile != nullptr)
+                v.tile->setBrush(QColor("Red"));
         }
     }
 }
@@ -375,6 +816,51 @@ double Grid::retrieve_p(double l)
 
     return 1 - 1 / (1 + exp(l));
 }
+void Grid::track_flipped_cells(bool enable)
+{
+    tracking_flips = enable;
+    flipped_cells.clear();
+}
+std::vector<std::uint32_t> Grid::take_flipped_cells()
+{
+    std::vector<std::uint32_t> res;
+    std::swap(res, flipped_cells);
+    return res;
+}
+int Grid::open_change_log()
+{
+    logging_changes = true;
+    for (auto &&[i, log] : change_logs | iter::enumerate)
+        if (not log.open)
+        {
+            log = ChangeLog{true, true, {}};
+            return i;
+        }
+    change_logs.push_back(ChangeLog{true, true, {}});   // a new reader starts from a bulk change
+    return change_logs.size() - 1;
+}
+void Grid::close_change_log(int log)
+{
+    if (log < 0 or log >= (int)change_logs.size())
+        return;
+    change_logs[log] = ChangeLog{};
+    logging_changes = std::any_of(change_logs.begin(), change_logs.end(), [](const auto &l){ return l.open; });
+}
+std::optional<std::vector<std::uint32_t>> Grid::take_changed_cells(int log)
+{
+    if (log < 0 or log >= (int)change_logs.size() or not change_logs[log].open)
+        return {};
+    auto &l = change_logs[log];
+    if (l.all)
+    {
+        l.all = false;
+        l.cells.clear();
+        return {};
+    }
+    std::vector<std::uint32_t> res;
+    std::swap(res, l.cells);
+    return res;
+}
 float Grid::percentage_changed()
 {
     return (flipped / updated);
@@ -384,12 +870,12 @@ void Grid::setVisited(const Key &k, bool visited)
     auto &&[success, v] = getCell(k);
     if(success)
     {
+        if(v.visited != visited)
+            note_snapshot(v.id);
 
         v.visited = visited;
-        if(visited)
-            v.tile->setBrush(QColor("Orange"));
-        else
-            v.tile->setBrush(QColor("White"));
+        if(v.tile != nullptr)
+            v.tile->setBrush(QColor(visited ? "Orange" : "White"));
     }
 }
 bool Grid::is_visited(const Key &k)
@@ -404,7 +890,11 @@ void Grid::setCost(const Key &k,float cost)
 {
     auto &&[success, v] = getCell(k);
     if(success)
+    {
+        if(v.cost != cost)
+            note_change(v.id);
         v.cost = cost;
+    }
 }
 float Grid::get_cost(const Eigen::Vector2f &p)
 {
@@ -419,6 +909,7 @@ void Grid::set_all_costs(float value)
 {
     for(auto &[key, cell] : fmap)
         cell.cost = value;
+    mark_all_changed();
 }
 int Grid::count_total() const
 {
@@ -444,33 +935,64 @@ void Grid::set_all_to_free()
 }
 void Grid::markAreaInGridAs(const QPolygonF &poly, bool free)
 {
-    const qreal step = TILE_SIZE / 4;
-    QRectF box = poly.boundingRect();
-    for (auto &&x : iter::range(box.x() - step / 2, box.x() + box.width() + step / 2, step))
-        for (auto &&y : iter::range(box.y() - step / 2, box.y() + box.height() + step / 2, step))
+    apply_area(Area{poly, free ? Area::Mark::FREE : Area::Mark::OCCUPIED}, polygon_raster().fill(poly));
+}
+void Grid::modifyCostInGrid(const QPolygonF &poly, float cost)
+{
+    apply_area(Area{poly, Area::Mark::COST, cost}, polygon_raster().fill(poly));
+}
+void Grid::mark_areas(const std::vector<Area> &areas, ThreadPool *pool)
+{
+    const auto raster = polygon_raster();
+    std::vector<std::vector<PolygonRaster::Span>> spans(areas.size());
+    if (pool != nullptr and areas.size() > 1)
+        pool->parallel_for(0, areas.size(), 1, [&](std::size_t i) { spans[i] = raster.fill(areas[i].polygon); });
+    else
+        for (std::size_t i = 0; i < areas.size(); i++)
+            spans[i] = raster.fill(areas[i].polygon);
+    for (std::size_t i = 0; i < areas.size(); i++)
+        apply_area(areas[i], spans[i]);
+}
+void Grid::apply_area(const Area &area, const std::vector<PolygonRaster::Span> &spans)
+{
+    const std::size_t cols = fmap.cols();
+    for (const auto &s : spans)
+        for (std::size_t idx = s.row * cols + s.first; idx <= s.row * cols + s.last; idx++)
         {
-            if (poly.containsPoint(QPointF(x, y), Qt::OddEvenFill))
+            if (not fmap.contains(idx))
+                continue;
+            auto &v = fmap.slot(idx).second;
+            switch (area.mark)
             {
-                if (free)
-                    setFree(pointToKey(x, y));
-                else
-                    setOccupied(pointToKey(x, y));
+                case Area::Mark::FREE:
+                    if (not v.free)
+                        note_flip(v);
+                    v.free = true;
+                    if (v.tile != nullptr)
+                        v.tile->setBrush(QBrush(QColor("white")));
+                    break;
+                case Area::Mark::OCCUPIED:
+                    if (v.free)
+                        note_flip(v);
+                    v.free = false;
+                    break;
+                case Area::Mark::COST:
+                    if (v.cost != area.cost)
+                        note_change(v.id);
+                    v.cost = area.cost;
+                    break;
             }
         }
 }
-void Grid::modifyCostInGrid(const QPolygonF &poly, float cost)
-{
-    const qreal step = TILE_SIZE / 4.f;
-    QRectF box = poly.boundingRect();
-    for (auto &&x : iter::range(box.x() - step / 2, box.x() + box.width() + step / 2, step))
-        for (auto &&y : iter::range(box.y() - step / 2, box.y() + box.height() + step / 2, step))
-            if (poly.containsPoint(QPointF(x, y), Qt::OddEvenFill))
-                setCost(pointToKey(x, y), cost);
-}
 
 ////////////////////////////////////// PATH //////////////////////////////////////////////////////////////
 std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &target_)
 {
+    return shortest_path(source_, target_, true);
+}
+std::list<QPointF> Grid::shortest_path(const QPointF &source_, const QPointF &target_, bool decimate)
+{
+    RC_TRACE_SCOPE("planner", "Grid::shortest_path");
     //qInfo() << __FUNCTION__  << " from nose pos: " << source_ << " to " << target_ ;
     Key source = pointToKey(source_.x(), source_.y());
     Key target = pointToKey(target_.x(), target_.y());
@@ -494,13 +1016,13 @@ std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &targ
     }
     // std::cout<<"NEIGHBOR SIZE "<<neighboors_16(target).size()<<std::endl;
 
-    if(neighboors_16(target).size()<16){
+    if(count_neighbours<neighbourhood::N16>(target) < 16){
         std::optional<QPointF> new_target = closest_free(target_);
         target = pointToKey(new_target->x(), new_target->y());
         std::cout<<"TARGET WAS IN OBSTACLE SO CHANGED TARGET TO NEAREST FREE CELL."<<std::endl;
     }
     //source in a non-free cell (red cell)
-    if(neighboors_8(source).empty())
+    if(count_neighbours<neighbourhood::N8>(source) == 0)
     {
         std::cout<<"Source on an occupied cell: "<<std::endl;
         qInfo() << __FUNCTION__ << "Source on an occupied cell: " << source.x << ", " << source.z << "Returning empty path";
@@ -516,11 +1038,11 @@ std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &targ
     }
 
     // vector de distancias inicializado a UINT_MAX
-    std::vector<uint32_t> min_distance(fmap.size(), std::numeric_limits<uint32_t>::max());
+    std::vector<uint32_t> min_distance(fmap.slots(), std::numeric_limits<uint32_t>::max());
     // initialize source position to 0
     min_distance[val.id] = 0;
     // vector de pares<std::uint32_t, Key> initialized to (-1, Key())
-    std::vector<std::pair<std::uint32_t, Key>> previous(fmap.size(), std::make_pair(-1, Key()));
+    std::vector<std::pair<std::uint32_t, Key>> previous(fmap.slots(), std::make_pair(-1, Key()));
     // lambda to compare two vertices: a < b if a.id<b.id or
     auto comp = [this](std::pair<std::uint32_t, Key> x, std::pair<std::uint32_t, Key> y){ return x.first <= y.first; };
 
@@ -533,34 +1055,111 @@ std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &targ
         if (where == target)  // target found
         {
             auto p = orderPath(previous, source, target);
-            p = decimate_path(p);  // reduce size of path to half
+            if (decimate)
+                p = decimate_path(p);  // reduce size of path to half
             return p;
         }
         active_vertices.erase(active_vertices.begin());
-        for (auto ed : neighboors_8(where))
+        const auto where_id = fmap.at(where).id;
+        for_each_neighbour<neighbourhood::N8>(where, [&](const Key &ek, const T &ev)
         {
-            //qInfo() << __FUNCTION__ << min_distance[ed.second.id] << ">" << min_distance[fmap.at(where).id] << "+" << ed.second.cost;
-            if (min_distance[ed.second.id] > min_distance[fmap.at(where).id] + ed.second.cost)
+            //qInfo() << __FUNCTION__ << min_distance[ev.id] << ">" << min_distance[where_id] << "+" << ev.cost;
+            if (min_distance[ev.id] > min_distance[where_id] + ev.cost)
             {
-                active_vertices.erase({min_distance[ed.second.id], ed.first});
-                min_distance[ed.second.id] = min_distance[fmap.at(where).id] + ed.second.cost;
-                previous[ed.second.id] = std::make_pair(fmap.at(where).id, where);
-                active_vertices.insert({min_distance[ed.second.id], ed.first}); // Djikstra
-                //active_vertices.insert( { min_distance[ed.second.id] + heuristicL2(ed.first, target), ed.first } ); //A*
+                active_vertices.erase({min_distance[ev.id], ek});
+                min_distance[ev.id] = min_distance[where_id] + ev.cost;
+                previous[ev.id] = std::make_pair(where_id, where);
+                active_vertices.insert({min_distance[ev.id], ek}); // Djikstra
+                //active_vertices.insert( { min_distance[ev.id] + heuristicL2(ek, target), ek } ); //A*
             }
-        }
+        });
     }
     qInfo() << __FUNCTION__ << "Path from (" << source.x << "," << source.z << ") to (" <<  target_.x() << "," << target_.y() << ") not  found. Returning empty path";
     return std::list<QPointF>();
 };
 std::vector<Eigen::Vector2f> Grid::compute_path(const QPointF &source_, const QPointF &target_)
 {
-    auto lpath = computePath(source_, target_);
+    const bool decimate = path_simplification.mode == PathSimplification::Mode::DECIMATE;
+    auto lpath = shortest_path(source_, target_, decimate);
     std::vector<Eigen::Vector2f> path(lpath.size());
     for(auto &&[i, p] : lpath | iter::enumerate)
         path[i] = Eigen::Vector2f(p.x(), p.y());
+    if (not decimate)
+        simplify_path(path);
     return  path;
 }
+void Grid::simplify_path(std::vector<Eigen::Vector2f> &path)
+{
+    if (path_simplification.mode != PathSimplification::Mode::RDP)
+        return;
+    simplifyPath().simplifyRDP(path, path_simplification.epsilon, path_kept);
+    // kept indices are increasing, so the path can be compacted in place
+    for (std::size_t i = 0; i < path_kept.size(); i++)
+        path[i] = path[path_kept[i]];
+    path.resize(path_kept.size());
+}
+std::optional<std::tuple<Grid::Key, Grid::Key>> Grid::admit_path_ends(const QPointF &source_, const QPointF &target_)
+{
+    Key source = pointToKey(source_.x(), source_.y());
+    Key target = pointToKey(target_.x(), target_.y());
+
+    // Admission rules
+    if (not dim.contains(target_))
+    {
+        qDebug() << __FUNCTION__ << "Target " << target_.x() << target_.y() << "out of limits " << dim << " Returning empty path";
+        return {};
+    }
+    if (not dim.contains(source_))
+    {
+        qDebug() << __FUNCTION__ << "Robot out of limits. Returning empty path";
+        return {};
+    }
+    if (source == target)
+    {
+        qDebug() << __FUNCTION__ << "Robot already at target. Returning empty path";
+        return {};
+    }
+    if (count_neighbours<neighbourhood::N16>(target) < 16)
+        if (auto new_target = closest_free(target_); new_target.has_value())
+            target = pointToKey(new_target->x(), new_target->y());
+    if (count_neighbours<neighbourhood::N8>(source) == 0)
+        if (auto new_source = closest_free(source_); new_source.has_value())
+            source = pointToKey(new_source->x(), new_source->y());
+    if (not fmap.contains(source) or not fmap.contains(target))
+        return {};
+    return std::make_tuple(source, target);
+}
+std::vector<Eigen::Vector2f> Grid::compute_path_astar(const QPointF &source_, const QPointF &target_, AStar::Expansion expansion)
+{
+    RC_TRACE_SCOPE("planner", "Grid::compute_path_astar");
+    const auto ends = admit_path_ends(source_, target_);
+    if (not ends.has_value())
+        return {};
+    const auto &[source, target] = ends.value();
+    const auto s = fmap.index_of(source);
+    const auto t = fmap.index_of(target);
+
+    // entering cost of a slot, negative if it can not be traversed
+    auto cost = [this](std::uint32_t idx){ return traversal_cost(idx); };
+    AStar::Params params;
+    params.expansion = expansion;
+    if (not astar.search(fmap.cols(), fmap.rows(), s, t, cost, astar_path, params))
+    {
+        qInfo() << __FUNCTION__ << "Path from (" << source.x << "," << source.z << ") to (" << target_.x() << "," << target_.y() << ") not  found. Returning empty path";
+        return {};
+    }
+    // keep one every two points as decimate_path does with computePath results, unless simplified otherwise
+    const std::size_t step = path_simplification.mode == PathSimplification::Mode::DECIMATE ? 2 : 1;
+    std::vector<Eigen::Vector2f> path;
+    path.reserve(astar_path.size() / step + 1);
+    for (std::size_t i = 0; i < astar_path.size(); i += step)
+    {
+        const auto k = fmap.key_of(astar_path[i]);
+        path.emplace_back(k.x, k.z);
+    }
+    simplify_path(path);
+    return path;
+}
 std::vector<std::pair<Grid::Key, Grid::T>> Grid::neighboors(const Grid::Key &k, const std::vector<int> &xincs,const std::vector<int> &zincs,
                                                             bool all)
 {
@@ -615,17 +1214,17 @@ std::vector<std::pair<Grid::Key, Grid::T>> Grid::neighboors(const Grid::Key &k,
 }
 std::vector<std::pair<Grid::Key, Grid::T>> Grid::neighboors_8(const Grid::Key &k, bool all)
 {
-    const int &I = TILE_SIZE;
-    static const std::vector<int> xincs = {I, I, I, 0, -I, -I, -I, 0};
-    static const std::vector<int> zincs = {I, 0, -I, -I, -I, 0, I, I};
-    return this->neighboors(k, xincs, zincs, all);
+    std::vector<std::pair<Key, T>> neigh;
+    neigh.reserve(neighbourhood::N8.size());
+    for_each_neighbour<neighbourhood::N8>(k, [&neigh](const Key &nk, const T &cell){ neigh.emplace_back(nk, cell); }, all);
+    return neigh;
 }
 std::vector<std::pair<Grid::Key, Grid::T>> Grid::neighboors_16(const Grid::Key &k, bool all)
 {
-    const int &I = TILE_SIZE;
-    static const std::vector<int> xincs = {0,   I,   2*I,  2*I, 2*I, 2*I, 2*I, I, 0, -I, -2*I, -2*I,-2*I,-2*I,-2*I, -I};
-    static const std::vector<int> zincs = {2*I, 2*I, 2*I,  I,   0 , -I , -2*I, -2*I,-2*I,-2*I,-2*I, -I, 0,I, 2*I, 2*I};
-    return this->neighboors(k, xincs, zincs, all);
+    std::vector<std::pair<Key, T>> neigh;
+    neigh.reserve(neighbourhood::N16.size());
+    for_each_neighbour<neighbourhood::N16>(k, [&neigh](const Key &nk, const T &cell){ neigh.emplace_back(nk, cell); }, all);
+    return neigh;
 }
 /**
  @brief Recovers the optimal path from the list of previous nodes
@@ -667,8 +1266,9 @@ void Grid::update_costs(bool wide)
 
     for(auto &&[k,v] : iter::filter([](auto v){ return std::get<1>(v).cost > 1;}, fmap))
     {
-        v.tile->setBrush(free_brush);
+        if (v.tile != nullptr) v.tile->setBrush(free_brush);
         v.cost = 1.f;
+        note_change(v.id);
     }
 
     //update grid values
@@ -677,57 +1277,189 @@ void Grid::update_costs(bool wide)
         for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
         {
             v.cost = 100;
-            v.tile->setBrush(occ_brush);
+            if (v.tile != nullptr) v.tile->setBrush(occ_brush);
+            note_change(v.id);
             // for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
             // {
             //     fmap.at(kk).cost = 100;
             //     fmap.at(kk).tile->setBrush(occ_brush);
             // }
         }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 100; }, fmap))
-            
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 100)
-                {
-                    fmap.at(kk).cost = 50;
-                    fmap.at(kk).tile->setBrush(orange_brush);
-                }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 50; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 50)
-                {
-                    // vv.free = true;
-                    fmap.at(kk).cost = 25;
-                    fmap.at(kk).tile->setBrush(yellow_brush);
-                }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 25; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &[kk, vv]: neighs)
-            {
-                if (vv.cost < 25)
+        auto ring = [this](float from, float to, const QBrush &brush)
+        {
+            for (auto &&[k, v]: iter::filter([from](auto v) { return std::get<1>(v).cost == from; }, fmap))
+                for_each_neighbour<neighbourhood::N8>(k, [&](const Key &, T &vv)
                 {
-                    // vv.free = true;
-                    fmap.at(kk).cost = 15;
-                    fmap.at(kk).tile->setBrush(gray_brush);
-                }
-            }
+                    if (vv.cost < from)
+                    {
+                        vv.cost = to;
+                        note_change(vv.id);
+                        if (vv.tile != nullptr) vv.tile->setBrush(brush);
+                    }
+                });
+        };
+        ring(100, 50, orange_brush);
+        ring(50, 25, yellow_brush);
+        ring(25, 15, gray_brush);
     }
     else
     {
         for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
         {
             v.cost = 100;
-            v.tile->setBrush(occ_brush);
+            if (v.tile != nullptr) v.tile->setBrush(occ_brush);
             fmap.at(k).cost = 100;
-            fmap.at(k).tile->setBrush(occ_brush);
+            if (fmap.at(k).tile != nullptr) fmap.at(k).tile->setBrush(occ_brush);
+            note_change(v.id);
         }
     }
 }
+void Grid::set_inflation(InflationFunction cost_of_distance, float max_distance)
+{
+    inflation = std::move(cost_of_distance);
+    inflation_max_distance = max_distance;
+    edt_valid = false;   // every free cell may change its cost
+}
+void Grid::update_costs_edt()
+{
+    static QBrush free_brush(QColor(params.free_color));
+    static QBrush occ_brush(QColor(params.occupied_color));
+    static QBrush orange_brush(QColor("Orange"));
+    static QBrush yellow_brush(QColor("Yellow"));
+    static QBrush gray_brush(QColor("LightGray"));
+
+    const long int cols = fmap.cols(), rows = fmap.rows();
+    if (cols == 0 or rows == 0)
+        return;
+    if (not inflation)
+        set_inflation([t = (float)TILE_SIZE](float d)
+                      {
+                          if (d <= 1.5f * t) return 50.f;
+                          if (d <= 2.9f * t) return 25.f;
+                          if (d <= 4.3f * t) return 15.f;
+                          return 1.f;
+                      }, 4.5f * TILE_SIZE);
+    const float max_d = inflation_max_distance / TILE_SIZE;
+    const float max_d2 = max_d * max_d;
+    const long int pad = static_cast<long int>(std::ceil(max_d));
+
+    // region to rewrite and window to transform. Cells in the region have their closest obstacle, if within
+    // max_distance, inside the window, so the windowed transform is exact for them
+    long int rx0 = 0, rz0 = 0, rx1 = cols - 1, rz1 = rows - 1;
+    long int wx0 = 0, wz0 = 0, wx1 = cols - 1, wz1 = rows - 1;
+    bool full = not edt_valid or edt_dist2.size() != fmap.slots();
+    if (not full)
+    {
+        if (edt_dirty_x1 < edt_dirty_x0)
+            return;
+        rx0 = std::max(0l, edt_dirty_x0 - pad); rx1 = std::min(cols - 1, edt_dirty_x1 + pad);
+        rz0 = std::max(0l, edt_dirty_z0 - pad); rz1 = std::min(rows - 1, edt_dirty_z1 + pad);
+        wx0 = std::max(0l, edt_dirty_x0 - 2 * pad); wx1 = std::min(cols - 1, edt_dirty_x1 + 2 * pad);
+        wz0 = std::max(0l, edt_dirty_z0 - 2 * pad); wz1 = std::min(rows - 1, edt_dirty_z1 + 2 * pad);
+        if ((wx1 - wx0 + 1) * (wz1 - wz0 + 1) * 4 > (long int)fmap.slots())
+            full = true;
+    }
+    if (full)
+    {
+        rx0 = wx0 = 0; rz0 = wz0 = 0; rx1 = wx1 = cols - 1; rz1 = wz1 = rows - 1;
+        edt_dist2.assign(fmap.slots(), max_d2);
+        edt_nearest.assign(fmap.slots(), -1);
+    }
+    const int ww = wx1 - wx0 + 1, wh = wz1 - wz0 + 1;
+    edt.compute(ww, wh, [this, wx0, wz0](int c, int r)
+                {
+                    const auto idx = fmap.index_of(wx0 + c, wz0 + r);
+                    return fmap.contains(idx) and not fmap.slot(idx).second.free;
+                }, edt_window_dist2, edt_window_nearest);
+
+    for (long int cz = rz0; cz <= rz1; cz++)
+        for (long int cx = rx0; cx <= rx1; cx++)
+        {
+            const std::size_t idx = cz * cols + cx;
+            const std::size_t w = (cz - wz0) * ww + (cx - wx0);
+            const float d2 = std::min(edt_window_dist2[w], max_d2);
+            const auto n = edt_window_nearest[w];
+            edt_dist2[idx] = d2;
+            edt_nearest[idx] = (n < 0 or edt_window_dist2[w] > max_d2) ? -1 : static_cast<std::int32_t>((wz0 + n / ww) * cols + wx0 + n % ww);
+            if (not fmap.contains(idx))
+                continue;
+            auto &v = fmap.slot(idx).second;
+            const float cost = v.free ? inflation(std::sqrt(d2) * TILE_SIZE) : 100.f;
+            if (cost == v.cost)
+                continue;
+            v.cost = cost;
+            note_change(v.id);
+            if (v.tile == nullptr)
+                continue;
+            if (cost >= 100) v.tile->setBrush(occ_brush);
+            else if (cost >= 50) v.tile->setBrush(orange_brush);
+            else if (cost >= 25) v.tile->setBrush(yellow_brush);
+            else if (cost > 1) v.tile->setBrush(gray_brush);
+            else v.tile->setBrush(free_brush);
+        }
+    edt_valid = true;
+    edt_dirty_x0 = edt_dirty_z0 = 0;
+    edt_dirty_x1 = edt_dirty_z1 = -1;
+}
+LayeredCostmap &Grid::enable_layered_costmap()
+{
+    if (costmap)
+        return *costmap;
+    costmap.emplace();
+    costmap->add_layer("static");
+    costmap->add_layer("sensor");
+    costmap->add_layer("semantic");
+    costmap->resize(fmap.cols(), fmap.rows());
+    costmap_log = open_change_log();   // starts as a bulk change, the first update mirrors every cell
+    update_costmap();
+    mark_all_changed();   // what planners read has changed everywhere
+    take_changed_cells(costmap_log);
+    return *costmap;
+}
+void Grid::disable_layered_costmap()
+{
+    if (not costmap)
+        return;
+    close_change_log(costmap_log);
+    costmap_log = -1;
+    costmap.reset();
+    mark_all_changed();
+}
+void Grid::update_costmap()
+{
+    if (not costmap)
+        return;
+    auto &sensor = *costmap->find("sensor");
+    const auto sensor_cost = [this](std::uint32_t idx)
+    {
+        if (not fmap.contains(idx)) return LayeredCostmap::NO_INFORMATION;
+        const auto &v = fmap.slot(idx).second;
+        return v.free ? v.cost : LayeredCostmap::LETHAL;
+    };
+    if (const auto changed = take_changed_cells(costmap_log); changed.has_value())
+        for (const auto idx : *changed)
+            sensor.set(idx, sensor_cost(idx));
+    else
+        sensor.assign(sensor_cost);
+    if (not costmap->dirty())
+        return;
+    costmap->update();
+    for (const auto idx : costmap->changed())
+        note_change(idx);
+    take_changed_cells(costmap_log);   // the changes just noted are ours
+}
+float Grid::distance_to_obstacle(const Eigen::Vector2f &p) const
+{
+    if (not edt_valid or edt_dist2.size() != fmap.slots() or not dim.contains(QPointF(p.x(), p.y())))
+        return -1.f;
+    const auto idx = fmap.index_of(pointToKey(p));
+    if (idx == FMap::npos)
+        return -1.f;
+    return std::sqrt(edt_dist2[idx]) * TILE_SIZE;
+}
 void Grid::update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range)
 {
+    RC_TRACE_SCOPE("grid", "Grid::update_map");
     for(const auto &point : points)
     {
         float length = (point-robot_in_grid).norm();
@@ -745,6 +1477,230 @@ void Grid::update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::
             add_hit(point);
     }
 }
+void Grid::update_map_dda(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                          ThreadPool *pool)
+{
+    RC_TRACE_SCOPE("grid", "Grid::update_map_dda");
+    if (fmap.slots() == 0 or points.empty())
+        return;
+    apply_scan_events(cast_scan(points, robot_in_grid, max_laser_range, pool));
+}
+void Grid::update_map_from_local_grid(const Local_Grid &local, const Eigen::Affine2f &robot_pose)
+{
+    RC_TRACE_SCOPE("grid", "Grid::update_map_from_local_grid");
+    if (fmap.slots() == 0)
+        return;
+    // centres of the cells with evidence, from the table of the local grid, in the robot frame
+    const auto &cells = local.cells();
+    fusion_local.resize(2, cells.size());
+    if (ray_events.empty())
+        ray_events.resize(1);
+    auto &events = ray_events[0];
+    events.clear();
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < cells.slots(); i++)
+        if (cells.contains(i))
+            if (const auto &v = cells.slot(i).second; v.hits > 0 or v.misses > 0 or v.log_odds != 0)
+            {
+                fusion_local.col(n++) = local.cell_centre(i);
+                events.push_back(not v.free);   // slot filled in below
+            }
+    if (n == 0)
+        return;
+    fusion_world.noalias() = robot_pose.linear() * fusion_local.leftCols(n);
+    fusion_world.colwise() += robot_pose.translation();
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < n; i++)
+        if (const auto idx = fmap.index_of(pointToKey(Eigen::Vector2f(fusion_world.col(i)))); fmap.contains(idx))
+            events[kept++] = static_cast<std::uint32_t>(idx) << 1 | events[i];
+    events.resize(kept);
+    apply_scan_events(1);
+}
+void Grid::apply_scan_events(std::size_t lists)
+{
+    if (scan_hits.size() != fmap.slots())
+    {
+        scan_hits.assign(fmap.slots(), 0);
+        scan_misses.assign(fmap.slots(), 0);
+    }
+    // merge all workers into per cell counters and apply them once
+    scan_touched.clear();
+    for (std::size_t w = 0; w < lists; w++)
+        for (const auto &e : ray_events[w])
+        {
+            const std::uint32_t idx = e >> 1;
+            if (scan_hits[idx] == 0 and scan_misses[idx] == 0)
+                scan_touched.push_back(idx);
+            if (e & 1u)
+                scan_hits[idx] = std::min<std::uint16_t>(scan_hits[idx] + 1, std::numeric_limits<std::uint16_t>::max() - 1);
+            else
+                scan_misses[idx] = std::min<std::uint16_t>(scan_misses[idx] + 1, std::numeric_limits<std::uint16_t>::max() - 1);
+        }
+    for (const auto &idx : scan_touched)
+    {
+        apply_scan_counts(idx, scan_hits[idx], scan_misses[idx]);
+        scan_hits[idx] = 0;
+        scan_misses[idx] = 0;
+    }
+}
+void Grid::update_map_log_odds(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                               ThreadPool *pool)
+{
+    RC_TRACE_SCOPE("grid", "Grid::update_map_log_odds");
+    if (fmap.slots() == 0 or points.empty())
+        return;
+    sync_log_odds_plane();
+    const std::size_t workers = cast_scan(points, robot_in_grid, max_laser_range, pool);
+
+    // one increment per touched cell, hits win over misses
+    const auto hit = log_odds_kernel.hit(), miss = log_odds_kernel.miss();
+    std::uint32_t first = std::numeric_limits<std::uint32_t>::max(), last = 0;
+    scan_touched.clear();
+    for (std::size_t w = 0; w < workers; w++)
+        for (const auto &e : ray_events[w])
+        {
+            const std::uint32_t idx = e >> 1;
+            auto &d = log_odds_delta[idx];
+            if (d == 0)
+            {
+                scan_touched.push_back(idx);
+                first = std::min(first, idx);
+                last = std::max(last, idx);
+            }
+            if (e & 1u)
+                d = hit;
+            else if (d != hit)
+                d = miss;
+            this->updated++;
+        }
+    if (scan_touched.empty())
+        return;
+
+    // occupancy bytes of touched cells may be stale after add_hit, setFree...
+    for (const auto &idx : scan_touched)
+        log_odds_occupied[idx] = not fmap.slot(idx).second.free;
+    const std::size_t n = last - first + 1;
+    log_odds_kernel.apply(log_odds_plane.data() + first, log_odds_delta.data() + first, n);
+    log_odds_kernel.classify(log_odds_plane.data() + first, log_odds_occupied.data() + first, n);
+    for (const auto &idx : scan_touched)
+    {
+        if (not fmap.contains(idx))
+            continue;
+        auto &v = fmap.slot(idx).second;
+        v.log_odds = LogOddsKernel::to_log_odds(log_odds_plane[idx]);
+        note_evidence(idx);
+        if (const bool free = not log_odds_occupied[idx]; free != v.free)
+        {
+            this->flipped++;
+            note_flip(v);
+            v.free = free;
+        }
+    }
+}
+void Grid::set_log_odds_params(const LogOddsKernel::Params &p)
+{
+    log_odds_kernel = LogOddsKernel(p);
+    log_odds_valid = false;   // clamping bounds may have changed
+}
+void Grid::sync_log_odds_plane()
+{
+    if (log_odds_valid and log_odds_plane.size() == fmap.slots())
+        return;
+    log_odds_plane.assign(fmap.slots(), 0);
+    log_odds_delta.assign(fmap.slots(), 0);
+    log_odds_occupied.assign(fmap.slots(), 0);
+    for (std::size_t i = 0; i < fmap.slots(); i++)
+        if (fmap.contains(i))
+            log_odds_plane[i] = LogOddsKernel::to_fixed(fmap.slot(i).second.log_odds);
+    log_odds_valid = true;
+}
+std::size_t Grid::cast_scan(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                            ThreadPool *pool)
+{
+    const std::size_t workers = (pool == nullptr) ? 1 : std::min<std::size_t>(std::thread::hardware_concurrency(), points.size());
+    if (ray_events.size() < workers)
+        ray_events.resize(workers);
+
+    // traverse beams, each worker over a contiguous block of them
+    auto cast_block = [this, &points, &robot_in_grid, max_laser_range](std::size_t begin, std::size_t end, std::vector<std::uint32_t> &events)
+    {
+        events.clear();
+        for (std::size_t i = begin; i < end; i++)
+            cast_ray(robot_in_grid, points[i], (points[i] - robot_in_grid).norm() <= max_laser_range, events);
+    };
+    const std::size_t block = (points.size() + workers - 1) / workers;
+    if (workers == 1)
+        cast_block(0, points.size(), ray_events[0]);
+    else
+        pool->parallel_for(0, workers, 1, [&cast_block, this, block, n = points.size()](std::size_t w)
+            { cast_block(std::min(n, w * block), std::min(n, (w + 1) * block), ray_events[w]); });
+    return workers;
+}
+void Grid::cast_ray(const Eigen::Vector2f &from, const Eigen::Vector2f &to, bool hit, std::vector<std::uint32_t> &events) const
+{
+    // continuous lattice coordinates: cell k spans [k, k+1) since pointToKey rounds to the closest tile centre
+    const float u0 = (from.x() - dim.left()) / TILE_SIZE + 0.5f, v0 = (from.y() - dim.top()) / TILE_SIZE + 0.5f;
+    const float u1 = (to.x() - dim.left()) / TILE_SIZE + 0.5f, v1 = (to.y() - dim.top()) / TILE_SIZE + 0.5f;
+    long int cx = static_cast<long int>(std::floor(u0)), cz = static_cast<long int>(std::floor(v0));
+    const long int ex = static_cast<long int>(std::floor(u1)), ez = static_cast<long int>(std::floor(v1));
+    const float du = u1 - u0, dv = v1 - v0;
+    const int step_x = (du > 0) - (du < 0), step_z = (dv > 0) - (dv < 0);
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    const float delta_x = step_x != 0 ? 1.f / std::abs(du) : inf;
+    const float delta_z = step_z != 0 ? 1.f / std::abs(dv) : inf;
+    float t_max_x = step_x > 0 ? (cx + 1 - u0) * delta_x : (step_x < 0 ? (u0 - cx) * delta_x : inf);
+    float t_max_z = step_z > 0 ? (cz + 1 - v0) * delta_z : (step_z < 0 ? (v0 - cz) * delta_z : inf);
+
+    long int remaining = std::abs(ex - cx) + std::abs(ez - cz);
+    while (remaining-- > 0 and not (cx == ex and cz == ez))
+    {
+        if (const auto idx = fmap.index_of(cx, cz); idx != FMap::npos)
+            events.push_back(static_cast<std::uint32_t>(idx) << 1);
+        if (t_max_x < t_max_z) { cx += step_x; t_max_x += delta_x; }
+        else { cz += step_z; t_max_z += delta_z; }
+    }
+    // tip: hit if the return is valid, free space otherwise
+    if (const auto idx = fmap.index_of(ex, ez); idx != FMap::npos)
+        events.push_back(static_cast<std::uint32_t>(idx) << 1 | (hit ? 1u : 0u));
+}
+void Grid::apply_scan_counts(std::uint32_t idx, std::uint16_t hits, std::uint16_t misses)
+{
+    if (not fmap.contains(idx))
+        return;
+    auto &v = fmap.slot(idx).second;
+    note_evidence(idx);
+    if (misses > 0)
+    {
+        v.misses += misses;
+        if((float)v.hits/(v.hits+v.misses) < params.occupancy_threshold)
+        {
+            if(not v.free)
+            {
+                this->flipped++;
+                note_flip(v);
+            }
+            v.free = true;
+        }
+        v.misses = std::clamp(v.misses, 0.f, 20.f);
+        this->updated += misses;
+    }
+    if (hits > 0)
+    {
+        v.hits += hits;
+        if((float)v.hits/(v.hits+v.misses) >= params.occupancy_threshold)
+        {
+            if(v.free)
+            {
+                this->flipped++;
+                note_flip(v);
+            }
+            v.free = false;
+        }
+        v.hits = std::clamp(v.hits, 0.f, 20.f);
+        this->updated += hits;
+    }
+}
 bool Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coordinates
 {
     for(const auto &p: path)
@@ -753,40 +1709,45 @@ bool Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coo
     return false;
 }
 ////////////////////////////// DRAW /////////////////////////////////////////////////////////
+QColor Grid::cell_color(const T &value) const
+{
+    static const QColor affordance("#FFFF00"), low_visited("#FFBF00"), medium_visited("#FF8000"), high_visited("#FF4000"),
+                        social("#BF00FF"), personal("#00BFFF"), affordance_max("#FF0000"), white("White"), red("Red");
+    if(value.free)
+    {
+        if (value.cost == 2.0) //affordance spaces
+            return affordance;
+        else if (value.cost == 3.0) //lowvisited spaces
+            return low_visited;
+        else if (value.cost == 4.0) //mediumvisited spaces
+            return medium_visited;
+        else if (value.cost == 5.0) //highVisited spaces
+            return high_visited;
+        else if (value.cost == 8.0) //zona social
+            return social;
+        else if (value.cost == 10.0) //zona personal
+            return personal;
+        else if (value.cost == 50.0) //Affordance maximum
+            return affordance_max;
+        else
+            return white;
+    }
+    else // occupied
+        return red;
+}
 void Grid::draw()
 {
+    if (scene == nullptr)
+        return;
     //clear previous points
     for (QGraphicsRectItem* item : scene_grid_points)
         scene->removeItem((QGraphicsItem*)item);
 
     scene_grid_points.clear();
     //create new representation
-    std::string color;
     for( const auto &[key,value] : fmap)
     {
-        if(value.free)
-        {
-            if (value.cost == 2.0) //affordance spaces
-                color = "#FFFF00";
-            else if (value.cost == 3.0) //lowvisited spaces
-                color = "#FFBF00";
-            else if (value.cost == 4.0) //mediumvisited spaces
-                color = "#FF8000";
-            else if (value.cost == 5.0) //highVisited spaces
-                color = "#FF4000";
-            else if (value.cost == 8.0) //zona social
-                color = "#BF00FF";
-            else if (value.cost == 10.0) //zona personal
-                color = "#00BFFF";
-            else if (value.cost == 50.0) //Affordance maximum
-                color = "#FF0000";
-            else
-                color = "White";
-        }
-        else // occupied
-            color = "Red";
-
-        QColor my_color = QColor(QString::fromStdString(color));
+        QColor my_color = cell_color(value);
         my_color.setAlpha(40);
         QGraphicsRectItem* aux = scene->addRect(-TILE_SIZE/2, -TILE_SIZE/2, TILE_SIZE, TILE_SIZE, QPen(my_color), QBrush(my_color));
         aux->setZValue(1);
@@ -794,11 +1755,113 @@ void Grid::draw()
         scene_grid_points.push_back(aux);
     }
 }
+void Grid::draw_texture()
+{
+    if (scene == nullptr or fmap.slots() == 0)
+        return;
+    if (texture == nullptr)
+    {
+        // texel (cx, cz) covers the tile centred at its key, placed and rotated as the tiles of initialize
+        const QRectF area(fmap.key_of(0).x - TILE_SIZE / 2.0, fmap.key_of(0).z - TILE_SIZE / 2.0,
+                          (double)fmap.cols() * TILE_SIZE, (double)fmap.rows() * TILE_SIZE);
+        texture = new GridTextureItem(area, fmap.cols(), fmap.rows());
+        texture->setPos(grid_center);
+        texture->setRotation(qRadiansToDegrees(grid_angle));
+        texture->setZValue(1);
+        scene->addItem(texture);
+        mark_texture_dirty();
+    }
+    for (const auto idx : texel_dirty_list)
+    {
+        texel_dirty[idx] = 0;
+        const int cx = idx % fmap.cols(), cz = idx / fmap.cols();
+        texture->set_texel(cx, cz, fmap.contains(idx) ? qPremultiply(cell_color(fmap.slot(idx).second).rgba()) : 0u);
+    }
+    texel_dirty_list.clear();
+    texture->flush();
+}
+void Grid::mark_texture_dirty()
+{
+    if (texture == nullptr)
+        return;
+    texel_dirty.assign(fmap.slots(), 1);
+    texel_dirty_list.resize(fmap.slots());
+    std::iota(texel_dirty_list.begin(), texel_dirty_list.end(), 0u);
+}
+void Grid::mark_all_changed()
+{
+    mark_texture_dirty();
+    log_odds_valid = false;
+    snapshot_all_dirty = true;
+    std::fill(cell_version.begin(), cell_version.end(), current_version);
+    for (auto &log : change_logs)
+        if (log.open)
+        {
+            log.all = true;
+            log.cells.clear();
+        }
+}
+std::shared_ptr<const GridSnapshot> Grid::publish_snapshot()
+{
+    using Chunk = GridSnapshot::Chunk;
+    constexpr int C = GridSnapshot::CHUNK;
+    const int cols = fmap.cols(), rows = fmap.rows();
+    const int ccols = (cols + C - 1) / C, crows = (rows + C - 1) / C;
+    const auto previous = published.ptr.load();
+    const bool full = snapshot_all_dirty or previous == nullptr or previous->cols_ != cols or previous->rows_ != rows
+                      or previous->dim != dim or previous->tile != TILE_SIZE;
+
+    auto snap = std::make_shared<GridSnapshot>();
+    snap->dim = dim;
+    snap->tile = TILE_SIZE;
+    snap->cols_ = cols; snap->rows_ = rows;
+    snap->ccols = ccols; snap->crows = crows;
+    if (cols > 0)
+    {
+        const auto k0 = fmap.key_of(0);
+        snap->left = k0.x; snap->top = k0.z;
+    }
+    snap->epoch_ = previous == nullptr ? 1 : previous->epoch_ + 1;
+    if (full)
+        snap->chunks.resize(static_cast<std::size_t>(ccols) * crows);
+    else
+        snap->chunks = previous->chunks;   // unchanged chunks are shared
+    for (int c = 0; c < ccols * crows; c++)
+    {
+        if (not full and not snapshot_dirty[c])
+            continue;
+        auto chunk = std::make_shared<Chunk>();
+        const int x0 = (c % ccols) * C, z0 = (c / ccols) * C;
+        for (int z = z0; z < std::min(z0 + C, rows); z++)
+            for (int x = x0; x < std::min(x0 + C, cols); x++)
+            {
+                const auto idx = fmap.index_of(x, z);
+                if (not fmap.contains(idx)) continue;
+                const auto &v = fmap.slot(idx).second;
+                auto &out = (*chunk)[(z - z0) * C + (x - x0)];
+                out.cost = v.cost;
+                out.flags = GridSnapshot::PRESENT | (v.free ? GridSnapshot::FREE : 0) | (v.visited ? GridSnapshot::VISITED : 0);
+            }
+        snap->chunks[c] = std::move(chunk);
+    }
+    snapshot_dirty.assign(static_cast<std::size_t>(ccols) * crows, 0);
+    snapshot_all_dirty = false;
+    std::shared_ptr<const GridSnapshot> res = std::move(snap);
+    published.ptr.store(res);
+    return res;
+}
+std::shared_ptr<const GridSnapshot> Grid::snapshot() const
+{
+    return published.ptr.load();
+}
 void Grid::clear()
 {
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
+    if (scene != nullptr)
+        for (const auto &[key, value]: fmap)
+            if (value.tile != nullptr)
+                scene->removeItem(value.tile);
     fmap.clear();
+    mark_all_changed();
 }
 
 ////////////////////////////// NEIGHS /////////////////////////////////////////////////////////
@@ -826,6 +1889,10 @@ std::optional<QPointF> Grid::closestMatching_spiralMove(const QPointF &p, std::f
 }
 std::optional<QPointF> Grid::closest_obstacle(const QPointF &p)
 {
+    // O(1) with an up to date distance field
+    if (edt_clean() and dim.contains(p))
+        if (const auto idx = fmap.index_of(pointToKey(p)); idx != FMap::npos and edt_nearest[idx] >= 0)
+            return fmap.key_of(edt_nearest[idx]).toQPointF();
     return this->closestMatching_spiralMove(p, [](auto cell){ return not cell.second.free; });
 }
 std::optional<QPointF> Grid::closest_free(const QPointF &p)
@@ -838,8 +1905,7 @@ std::optional<QPointF> Grid::closest_free_4x4(const QPointF &p)
         if (not cell.second.free)
             return false;
         Key key = pointToKey(QPointF(cell.first.x, cell.first.z));
-        std::vector<std::pair<Grid::Key, Grid::T>> L1 = neighboors_16(key, false);
-        return (L1.size() == 16);
+        return count_neighbours<neighbourhood::N16>(key) == 16;
     });
 }
 std::tuple<bool, QVector2D> Grid::vectorToClosestObstacle(QPointF center)
@@ -849,13 +1915,25 @@ std::tuple<bool, QVector2D> Grid::vectorToClosestObstacle(QPointF center)
     QVector2D closestVector;
     bool obstacleFound = false;
 
-    auto neigh = neighboors_8(k, true);
+    // the closest obstacle in the distance field is looked up instead of scanning the 8 and 16 rings
+    if (edt_clean() and inflation_max_distance >= 3 * TILE_SIZE)
+        if (const auto idx = fmap.index_of(k); fmap.contains(idx) and fmap.slot(idx).second.free)
+        {
+            if (const auto n = edt_nearest[idx]; n >= 0)
+            {
+                const auto nk = fmap.key_of(n);
+                if (std::max(std::abs(nk.x - k.x), std::abs(nk.z - k.z)) <= 2 * TILE_SIZE)
+                    return std::make_tuple(true, QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(nk.x, nk.z)));
+            }
+            return std::make_tuple(false, closestVector);
+        }
+
     float dist = std::numeric_limits<float>::max();
-    for (auto n : neigh)
+    for_each_neighbour<neighbourhood::N8>(k, [&](const Key &nk, const T &n)
     {
-        if (n.second.free == false)
+        if (n.free == false)
         {
-            QVector2D vec = QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(n.first.x,n.first.z)) ;
+            QVector2D vec = QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(nk.x, nk.z)) ;
             if (vec.length() < dist)
             {
                 dist = vec.length();
@@ -864,16 +1942,15 @@ std::tuple<bool, QVector2D> Grid::vectorToClosestObstacle(QPointF center)
             qDebug() << __FUNCTION__ << "Obstacle found";
             obstacleFound = true;
         }
-    }
+    }, true);
 
     if (!obstacleFound)
     {
-        auto DistNeigh = neighboors_16(k, true);
-        for (auto n : DistNeigh)
+        for_each_neighbour<neighbourhood::N16>(k, [&](const Key &nk, const T &n)
         {
-            if (n.second.free == false)
+            if (n.free == false)
             {
-                QVector2D vec = QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(n.first.x, n.first.z)) ;
+                QVector2D vec = QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(nk.x, nk.z)) ;
                 if (vec.length() < dist)
                 {
                     dist = vec.length();
@@ -881,7 +1958,7 @@ std::tuple<bool, QVector2D> Grid::vectorToClosestObstacle(QPointF center)
                 }
                 obstacleFound = true;
             }
-        }
+        }, true);
     }
     return std::make_tuple(obstacleFound,closestVector);
 }
@@ -29,6 +29,20 @@
 #include <Eigen/Dense>
 #include <QVector2D>
 #include <QColor>
+#include "dense_map.h"
+#include "astar.h"
+#include "distance_transform.h"
+#include "polygon_raster.h"
+#include "layered_costmap.h"
+#include "grid_texture.h"
+#include "neighbourhood.h"
+#include "grid_snapshot.h"
+#include "log_odds_kernel.h"
+#include <atomic>
+#include <memory>
+
+class ThreadPool;
+class Local_Grid;
 
 class Grid
 {
@@ -97,7 +111,7 @@ public:
         float cost = 1;
         float hits = 0;
         float misses = 0;
-        QGraphicsRectItem *tile;
+        QGraphicsRectItem *tile = nullptr;   // null for grids built by initialize_fast
         double log_odds = 0.0;  //log prior
 
         // method to save the value
@@ -108,7 +122,8 @@ public:
         { is >> free >> visited; };
     };
 
-    using FMap = std::unordered_map<Key, T, KeyHasher>;
+    // Cells live in a dense row-major array over dim (see dense_map.h). KeyHasher is kept for users hashing keys.
+    using FMap = DenseMap<Key, T>;
     Dimensions dim = QRectF();
 
     void initialize(QRectF dim_,
@@ -118,10 +133,48 @@ public:
                     const std::string &file_name = std::string(),
                     QPointF grid_center = QPointF(0,0),
                     float grid_angle = 0.f);
+    // Fast construction for large or headless maps: the storage is allocated once and the cells are filled in
+    // parallel on pool, if given, without a QGraphicsRectItem per tile. Draw it with draw_texture(); with
+    // scene == nullptr the grid is headless. A map read later with another geometry is rebuilt the same way
+    void initialize_fast(QRectF dim_,
+                         int tile_size,
+                         QGraphicsScene *scene = nullptr,
+                         ThreadPool *pool = nullptr,
+                         QPointF grid_center = QPointF(0,0),
+                         float grid_angle = 0.f);
     void clear();
     std::list<QPointF> computePath(const QPointF &source_, const QPointF &target_);
     std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
+    // How compute_path and compute_path_astar thin the cell path: one cell every two (default, as computePath does),
+    // Ramer-Douglas-Peucker with a tolerance of epsilon grid units (simplifyPath.h), or not at all
+    struct PathSimplification
+    {
+        enum class Mode { DECIMATE, RDP, NONE } mode = Mode::DECIMATE;
+        float epsilon = 0.f;
+    };
+    void set_path_simplification(const PathSimplification &p)
+    { path_simplification = p; };
+    // A* over the dense storage reusing its scratch state between calls. Same admission rules and output as compute_path
+    std::vector<Eigen::Vector2f> compute_path_astar(const QPointF &source_, const QPointF &target_,
+                                                    AStar::Expansion expansion = AStar::Expansion::OCTILE);
+    // Snaps source and target to cells, moving them to the closest free cell if needed. Empty if no path can be asked for
+    std::optional<std::tuple<Key, Key>> admit_path_ends(const QPointF &source_, const QPointF &target_);
     void update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range);
+    // Exact cell traversal (Amanatides-Woo) of every beam. Beams are split across pool workers when a pool is given.
+    // Each cell touched by the scan is updated once with its accumulated misses and hits, in that order,
+    // which gives the same clamping and flipping as calling add_miss/add_hit that many times
+    void update_map_dda(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                        ThreadPool *pool = nullptr);
+    // Same traversal with fixed-point log-odds occupancy (log_odds_kernel.h). Every cell touched by the scan gets one
+    // increment, hit() if any beam ends in it and miss() otherwise, applied to the whole span at once. T::log_odds and
+    // T::free of the touched cells are updated from the plane; hits and misses are left untouched
+    void update_map_log_odds(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                             ThreadPool *pool = nullptr);
+    void set_log_odds_params(const LogOddsKernel::Params &p);
+    // Fuses an egocentric Local_Grid given the robot pose in grid coordinates. Every local cell with evidence is moved
+    // to the grid with one batched transform of the cell centre table and counts as a hit if occupied or a miss if free.
+    // Counts are accumulated per grid cell and applied once, as in update_map_dda
+    void update_map_from_local_grid(const Local_Grid &local, const Eigen::Affine2f &robot_pose);
     bool is_path_blocked(const std::vector<Eigen::Vector2f> &path); // grid coordinates
 
 
@@ -143,10 +196,56 @@ public:
     size_t size() const
     { return fmap.size(); };
     void insert(const Key &key, const T &value);
+
+    // Dense storage access for planners and bulk kernels. T::id is the slot index of the cell
+    const FMap &cells() const
+    { return fmap; };
+    // cost of entering slot idx, negative if it can not be traversed
+    inline float traversal_cost(std::uint32_t idx) const
+    {
+        if (not fmap.contains(idx)) return -1.f;
+        if (costmap) return idx < costmap->size() ? costmap->cost(idx) : -1.f;
+        const auto &cell = fmap.slot(idx).second;
+        return cell.free ? cell.cost : -1.f;
+    };
+    // When enabled, slots whose free/occupied state flips are recorded until taken (used by incremental planners)
+    void track_flipped_cells(bool enable);
+    std::vector<std::uint32_t> take_flipped_cells();
+    // Change logs: every slot whose occupancy or cost changes through Grid is appended to each open log until taken.
+    // take_changed_cells returns nullopt after a bulk change (initialize, load, set_all_costs...) that touched every cell
+    int open_change_log();
+    void close_change_log(int log);
+    std::optional<std::vector<std::uint32_t>> take_changed_cells(int log);
     void saveToFile(const std::string &fich);
     void readFromFile(const std::string &fich);
     std::string saveToString() const;
     void readFromString(const std::string &cadena);
+    // Versioned binary format (grid_file.h), optionally LZ4 compressed. Files are memory mapped and their cell planes
+    // copied without parsing. If the stored geometry differs from the current one the grid is initialized again
+    bool saveToBinaryFile(const std::string &fich, bool compress = false) const;
+    bool readFromBinaryFile(const std::string &fich);
+    std::string saveToBinaryString(bool compress = true) const;
+    bool readFromBinaryString(const std::string &cadena);
+    // Map deltas (grid_delta.h) to synchronize robots mapping the same area. Every cell whose evidence or occupancy
+    // changes through Grid is stamped with the current map version; export_delta encodes the cells stamped after
+    // 'since', sets 'since' to the version to ask for next time and starts a new version. Keep one 'since' per peer:
+    //   std::uint32_t sent = 0;  ...  send(grid.export_delta(sent));
+    // apply_delta merges a delta from a grid of the same geometry into this one, cell by cell, with the given fusion.
+    // Merged cells are stamped too, so they reach the peers of this grid. Costs are left to update_costs
+    struct DeltaFusion
+    {
+        // REPLACE          the remote cell overwrites the local one
+        // MAX_CONFIDENCE   the cell with more evidence wins: larger |log odds|, more hits + misses
+        // AVERAGE          (1 - weight) * local + weight * remote
+        // SUM              local + remote evidence, clamped. Only for robots observing different cells: evidence
+        //                  echoed back by a peer is counted twice
+        enum class Mode { REPLACE, MAX_CONFIDENCE, AVERAGE, SUM } mode = Mode::MAX_CONFIDENCE;
+        float weight = 0.5f;
+    };
+    std::uint32_t map_version() const
+    { return current_version; };
+    std::string export_delta(std::uint32_t &since, bool compress = false);
+    bool apply_delta(const std::string &delta, const DeltaFusion &fusion = DeltaFusion());
     Key pointToKey(long int x, long int z) const;
     Key pointToKey(const QPointF &p) const;
     Key pointToKey(const Eigen::Vector2f &p) const;
@@ -175,30 +274,236 @@ public:
     float percentage_changed();
     int count_total() const;
     int count_total_visited() const;
+    // Polygons in grid coordinates are scanline filled (polygon_raster.h): a cell is in the area when one of its 4 x 4
+    // sub-cell centres is inside the polygon, and it is written once
     void markAreaInGridAs(const QPolygonF &poly, bool free);   // if true area becomes free
     void modifyCostInGrid(const QPolygonF &poly, float cost);
+    // Many polygons at once, e.g. the semantic zones of a map. Polygons are rasterized in parallel on pool, if given,
+    // and applied in order, so a later area overrides an earlier one as with successive calls
+    struct Area
+    {
+        enum class Mark { FREE, OCCUPIED, COST };
+        QPolygonF polygon;
+        Mark mark = Mark::OCCUPIED;
+        float cost = 0.f;   // for COST
+    };
+    void mark_areas(const std::vector<Area> &areas, ThreadPool *pool = nullptr);
+    std::vector<PolygonRaster::Span> rasterize(const QPolygonF &poly) const
+    { return polygon_raster().fill(poly); };
+
+    // Layered costmap (layered_costmap.h). Once enabled, traversal_cost and the planners read its master plane, folded
+    // from the layers "static", "sensor" and "semantic", in that order, all combined with MAX. The sensor layer mirrors
+    // the cells: update_costmap() copies into it the cost of the cells changed through Grid since the previous call
+    // (LETHAL for the occupied ones) and folds the layers inside their dirty boxes. The other layers are written by the
+    // caller, e.g. a person zone moving over the semantic layer:
+    //   auto &zones = *grid.enable_layered_costmap().find("semantic");
+    //   zones.fill(grid.rasterize(old_zone), LayeredCostmap::NO_INFORMATION);
+    //   zones.fill(grid.rasterize(new_zone), 50.f);
+    //   grid.update_costmap();   // planners see the two zones changed, through their change logs
+    // initialize() clears the static and semantic layers.
+    LayeredCostmap &enable_layered_costmap();
+    void disable_layered_costmap();
+    LayeredCostmap *layered_costmap()
+    { return costmap ? &*costmap : nullptr; };
+    void update_costmap();
     void update_costs(bool wide=true);
+
+    // Distance-based costs. The closest obstacle of every cell is found with an exact Euclidean distance transform and
+    // free cells get cost_of_distance(mm to that obstacle). Distances saturate at max_distance (mm), which also bounds
+    // the window recomputed when only a few cells flipped since the last call. Occupied cells get cost 100.
+    // Without set_inflation, the 50/25/15 rings of update_costs are reproduced
+    using InflationFunction = std::function<float(float distance)>;
+    void set_inflation(InflationFunction cost_of_distance, float max_distance);
+    void update_costs_edt();
+    float distance_to_obstacle(const Eigen::Vector2f &p) const;  // mm, saturated at max_distance. -1 if unknown
     std::optional<QPointF> closest_obstacle(const QPointF &p);
     std::optional<QPointF> closest_free(const QPointF &p);
     std::optional<QPointF> closest_free_4x4(const QPointF &p);
     std::tuple<bool, QVector2D> vectorToClosestObstacle(QPointF center);
+    // Neighbours of k over a constexpr offset table (neighbourhood.h), without allocating or copying cells.
+    // f(const Key &, T &) is called for every existing neighbour, only the free ones unless all is true
+    template<const auto &Offsets, typename F>
+    void for_each_neighbour(const Key &k, F &&f, bool all = false)
+    {
+        if (fmap.slots() == 0) return;
+        const auto [cx, cz] = fmap.lattice_of(pointToKey(k.x, k.z));
+        for (const auto &o : Offsets)
+            if (const auto idx = fmap.index_of(cx + o.dx, cz + o.dz); fmap.contains(idx))
+                if (auto &[nk, cell] = fmap.slot(idx); all or cell.free)
+                    f(static_cast<const Key &>(nk), cell);
+    };
+    // Same over slot indices, for code already working on the dense storage. f(std::uint32_t slot)
+    template<const auto &Offsets, typename F>
+    void for_each_neighbour_slot(std::uint32_t idx, F &&f) const
+    {
+        if (fmap.cols() == 0) return;
+        const long int cx = idx % fmap.cols(), cz = idx / fmap.cols();
+        for (const auto &o : Offsets)
+            if (const auto n = fmap.index_of(cx + o.dx, cz + o.dz); fmap.contains(n))
+                f(static_cast<std::uint32_t>(n));
+    };
+    template<const auto &Offsets>
+    int count_neighbours(const Key &k, bool all = false)
+    {
+        int n = 0;
+        for_each_neighbour<Offsets>(k, [&n](const Key &, const T &){ n++; }, all);
+        return n;
+    };
     std::vector<std::pair<Key, T>> neighboors(const Key &k, const std::vector<int> &xincs, const std::vector<int> &zincs, bool all = false);
     std::vector<std::pair<Key, T>> neighboors_8(const Key &k, bool all = false);
     std::vector<std::pair<Key, T>> neighboors_16(const Key &k, bool all = false);
     void draw();
+    // Texture rendering: the grid is one image item with a texel per cell, coloured as in draw().
+    // Cells modified through Grid since the previous call are tracked in a dirty list and only those texels
+    // are rewritten and repainted. Use mark_texture_dirty after editing cells directly through getCell
+    void draw_texture();
+    void mark_texture_dirty();
+    // Lock-free read snapshots. The thread updating the map calls publish_snapshot() when a consistent state is reached
+    // (e.g. after update_map); any thread can take snapshot() and read it while the grid keeps changing.
+    // Publishing copies only the chunks changed through Grid since the previous one
+    std::shared_ptr<const GridSnapshot> publish_snapshot();
+    std::shared_ptr<const GridSnapshot> snapshot() const;
+    // Notifies every consumer of changes (texture, change logs, snapshots) that all cells may have changed.
+    // Needed after editing cells directly through getCell
+    void mark_all_changed();
 
 private:
     FMap fmap;
-    QGraphicsScene *scene;
+    QGraphicsScene *scene = nullptr;
+    bool tile_items = true;   // false after initialize_fast
+    void reset_storage(QRectF dim_, int tile_size, QGraphicsScene *scene_, QPointF grid_center_, float grid_angle_);
+    void draw_bounding_box();
+    QPointF grid_center;
+    float grid_angle = 0.f;
     std::vector<QGraphicsRectItem *> scene_grid_points;
     double updated=0.0, flipped=0.0;
+    AStar astar;
+    std::vector<std::uint32_t> astar_path;
+    // update_map_dda scratch: per worker event lists (slot << 1 | hit) and per scan counters
+    std::vector<std::vector<std::uint32_t>> ray_events;
+    std::vector<std::uint16_t> scan_hits, scan_misses;
+    std::vector<std::uint32_t> scan_touched;
+    void cast_ray(const Eigen::Vector2f &from, const Eigen::Vector2f &to, bool hit, std::vector<std::uint32_t> &events) const;
+    void apply_scan_counts(std::uint32_t idx, std::uint16_t hits, std::uint16_t misses);
+    void apply_scan_events(std::size_t lists);   // merges ray_events[0, lists) into counters and applies them
+    Eigen::Matrix2Xf fusion_local, fusion_world;
+    std::size_t cast_scan(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range,
+                          ThreadPool *pool);   // fills ray_events, returns the number of lists used
+    // update_map_log_odds state: per slot fixed-point log odds, per scan increments and occupancy bytes.
+    // The plane is rebuilt from T::log_odds after bulk changes
+    LogOddsKernel log_odds_kernel;
+    std::vector<LogOddsKernel::Value> log_odds_plane, log_odds_delta;
+    std::vector<std::uint8_t> log_odds_occupied;
+    bool log_odds_valid = false;
+    void sync_log_odds_plane();
+    bool tracking_flips = false;
+    std::vector<std::uint32_t> flipped_cells;
+    // delta versions: version at which every slot last changed, 0 if never
+    std::uint32_t current_version = 1;
+    std::vector<std::uint32_t> cell_version;
+    inline void note_evidence(std::uint32_t idx)
+    {
+        if (idx < cell_version.size()) cell_version[idx] = current_version;
+    };
+    inline void note_flip(const T &v)
+    {
+        note_evidence(v.id);
+        if (tracking_flips) flipped_cells.push_back(v.id);
+        note_dirty(v.id);
+        note_change(v.id);
+    };
+
+    // draw_texture state: dirty bitmap plus the list of its set slots
+    GridTextureItem *texture = nullptr;
+    std::vector<std::uint8_t> texel_dirty;
+    std::vector<std::uint32_t> texel_dirty_list;
+    inline void note_texel(std::uint32_t idx)
+    {
+        if (texture == nullptr or idx >= texel_dirty.size() or texel_dirty[idx]) return;
+        texel_dirty[idx] = 1;
+        texel_dirty_list.push_back(idx);
+    };
+    QColor cell_color(const T &v) const;
+
+    struct ChangeLog
+    {
+        bool open = false;
+        bool all = false;
+        std::vector<std::uint32_t> cells;
+    };
+    std::vector<ChangeLog> change_logs;
+    bool logging_changes = false;
+    inline void note_change(std::uint32_t idx)
+    {
+        note_texel(idx);
+        note_snapshot(idx);
+        if (not logging_changes) return;
+        for (auto &log : change_logs)
+            if (log.open and not log.all)
+            {
+                log.cells.push_back(idx);
+                if (log.cells.size() > fmap.slots())   // cheaper to treat as a bulk change
+                { log.all = true; log.cells.clear(); }
+            }
+    };
+
+    // snapshots: published one plus the chunks changed after it
+    struct PublishedSnapshot
+    {
+        std::atomic<std::shared_ptr<const GridSnapshot>> ptr;
+        PublishedSnapshot() = default;
+        PublishedSnapshot(const PublishedSnapshot &other) : ptr(other.ptr.load()) {};
+        PublishedSnapshot &operator=(const PublishedSnapshot &other) { ptr.store(other.ptr.load()); return *this; };
+    };
+    PublishedSnapshot published;
+    std::vector<std::uint8_t> snapshot_dirty;   // per chunk, empty until the first publish
+    bool snapshot_all_dirty = true;
+    inline void note_snapshot(std::uint32_t idx)
+    {
+        if (snapshot_dirty.empty()) return;
+        const int ccols = (fmap.cols() + GridSnapshot::CHUNK - 1) / GridSnapshot::CHUNK;
+        snapshot_dirty[(idx / fmap.cols() / GridSnapshot::CHUNK) * ccols + (idx % fmap.cols()) / GridSnapshot::CHUNK] = 1;
+    };
+
+    // distance field of update_costs_edt. Squared distances are in tiles
+    DistanceTransform edt;
+    std::vector<float> edt_dist2, edt_window_dist2;
+    std::vector<std::int32_t> edt_nearest, edt_window_nearest;
+    InflationFunction inflation;
+    float inflation_max_distance = 0.f;
+    bool edt_valid = false;
+    long int edt_dirty_x0 = 0, edt_dirty_z0 = 0, edt_dirty_x1 = -1, edt_dirty_z1 = -1;   // lattice box of flipped cells
+    inline void note_dirty(std::uint32_t idx)
+    {
+        if (fmap.cols() == 0) return;
+        const long int cx = idx % fmap.cols(), cz = idx / fmap.cols();
+        if (edt_dirty_x1 < edt_dirty_x0)
+        { edt_dirty_x0 = edt_dirty_x1 = cx; edt_dirty_z0 = edt_dirty_z1 = cz; return; }
+        edt_dirty_x0 = std::min(edt_dirty_x0, cx); edt_dirty_x1 = std::max(edt_dirty_x1, cx);
+        edt_dirty_z0 = std::min(edt_dirty_z0, cz); edt_dirty_z1 = std::max(edt_dirty_z1, cz);
+    };
+    inline bool edt_clean() const
+    { return edt_valid and edt_dirty_x1 < edt_dirty_x0 and edt_nearest.size() == fmap.slots(); };
+
+
+    std::optional<LayeredCostmap> costmap;
+    int costmap_log = -1;
 
+    PolygonRaster polygon_raster() const
+    { return PolygonRaster(dim.left(), dim.top(), TILE_SIZE, fmap.cols(), fmap.rows()); };
+    void apply_area(const Area &area, const std::vector<PolygonRaster::Span> &spans);
 
     std::list<QPointF> orderPath(const std::vector<std::pair<std::uint32_t, Key>> &previous, const Key &source, const Key &target);
     inline double heuristicL2(const Key &a, const Key &b) const;
     std::list<QPointF> decimate_path(const std::list<QPointF> &path);
+    std::list<QPointF> shortest_path(const QPointF &source_, const QPointF &target_, bool decimate);
+    PathSimplification path_simplification;
+    std::vector<std::uint32_t> path_kept;
+    void simplify_path(std::vector<Eigen::Vector2f> &path);   // in place, for the modes other than DECIMATE
     std::optional<QPointF> closestMatching_spiralMove(const QPointF &p, std::function<bool(std::pair<Grid::Key, Grid::T>)> pred);
     void set_all_costs(float value);
+    std::string encode_binary(bool compress) const;
+    bool decode_binary(const std::uint8_t *data, std::size_t size);
 
     struct Params
     {
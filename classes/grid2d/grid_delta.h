@@ -0,0 +1,84 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef GRID_DELTA_H
+#define GRID_DELTA_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Binary Grid delta format (little endian), the cells changed between two versions of a map (Grid::export_delta).
+//   Header | payload
+// The payload describes header.cells cells and has four sections:
+//   runs      header.runs pairs of varints (gap from the end of the previous run, length) giving the slots, ascending
+//   occupied  one bit per cell, bit i of byte i/8
+//   counts    hits then misses of every cell, one byte each (Grid clamps them to 20)
+//   log odds  fixed point log odds (LogOddsKernel::Value) of every cell, as zigzag varints of the difference with the
+//             previous cell, so runs of similar evidence take a byte per cell
+// With FLAG_LZ4 set in flags the payload is a single LZ4 block of raw_size bytes.
+namespace grid_delta
+{
+    constexpr char MAGIC[8] = {'R', 'C', 'G', 'D', 'E', 'L', 'T', 'A'};
+    constexpr std::uint32_t VERSION = 1;
+    constexpr std::uint32_t FLAG_LZ4 = 1u;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t flags;
+        double left, top, width, height;   // Grid::dim, which the receiving grid must share
+        std::int32_t tile_size;
+        std::int32_t cols, rows;
+        std::uint32_t from_version;        // cells changed after from_version and up to to_version
+        std::uint32_t to_version;
+        std::uint32_t cells, runs;
+        std::uint64_t raw_size;            // uncompressed payload bytes
+        std::uint64_t payload_size;        // stored payload bytes
+    };
+    static_assert(sizeof(Header) % 8 == 0, "payload must start 8 byte aligned");
+
+    inline bool valid_header(const Header &h, std::size_t available)
+    {
+        return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 and h.version == VERSION and h.cols >= 0 and h.rows >= 0
+               and h.cells <= std::uint64_t(h.cols) * h.rows and sizeof(Header) + h.payload_size <= available;
+    };
+
+    inline void put_varint(std::string &out, std::uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    };
+    inline bool get_varint(const std::uint8_t *&p, const std::uint8_t *end, std::uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 and p < end; shift += 7)
+        {
+            const std::uint8_t b = *p++;
+            v |= std::uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return true;
+        }
+        return false;
+    };
+    inline std::uint64_t zigzag(std::int64_t v) { return (std::uint64_t(v) << 1) ^ std::uint64_t(v >> 63); };
+    inline std::int64_t unzigzag(std::uint64_t v) { return std::int64_t(v >> 1) ^ -std::int64_t(v & 1); };
+}
+
+#endif // GRID_DELTA_H
@@ -0,0 +1,110 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef GRID_FILE_H
+#define GRID_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Binary Grid map format (little endian).
+//   GridFileHeader | payload
+// The payload holds cols*rows cell planes, each starting at an 8 byte aligned offset:
+//   present (u8) | state (u8: bit0 free, bit1 visited) | cost (f32) | hits (f32) | misses (f32) | log_odds (f32)
+// With FLAG_LZ4 set in flags the payload is a single LZ4 block of raw_size bytes.
+namespace grid_file
+{
+    constexpr char MAGIC[8] = {'R', 'C', 'G', 'R', 'I', 'D', 0, 0};
+    constexpr std::uint32_t VERSION = 1;
+    constexpr std::uint32_t FLAG_LZ4 = 1u;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t flags;
+        double left, top, width, height;   // Grid::dim
+        std::int32_t tile_size;
+        std::int32_t cols, rows;
+        float grid_angle;
+        double center_x, center_y;
+        std::uint64_t raw_size;            // uncompressed payload bytes
+        std::uint64_t payload_size;        // stored payload bytes
+    };
+    static_assert(sizeof(Header) % 8 == 0, "payload must start 8 byte aligned");
+
+    inline std::size_t align8(std::size_t v) { return (v + 7) & ~std::size_t(7); };
+    struct Planes
+    {
+        std::size_t present, state, cost, hits, misses, log_odds, size;
+    };
+    inline Planes plane_offsets(std::size_t n)
+    {
+        Planes p;
+        p.present = 0;
+        p.state = align8(p.present + n);
+        p.cost = align8(p.state + n);
+        p.hits = align8(p.cost + n * sizeof(float));
+        p.misses = align8(p.hits + n * sizeof(float));
+        p.log_odds = align8(p.misses + n * sizeof(float));
+        p.size = align8(p.log_odds + n * sizeof(float));
+        return p;
+    };
+    inline bool valid_header(const Header &h, std::size_t available)
+    {
+        return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 and h.version == VERSION and h.cols >= 0 and h.rows >= 0
+               and h.raw_size == plane_offsets(std::size_t(h.cols) * h.rows).size and sizeof(Header) + h.payload_size <= available;
+    };
+
+    // Read only memory mapping of a map file. Planes are used in place when the payload is not compressed
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string &file)
+        {
+            fd = ::open(file.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat st{};
+            if (fstat(fd, &st) != 0 or st.st_size < (off_t)sizeof(Header)) return;
+            length = st.st_size;
+            void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { length = 0; return; }
+            data = static_cast<const std::uint8_t *>(p);
+            madvise(p, length, MADV_SEQUENTIAL);
+        };
+        ~MappedFile()
+        {
+            if (data != nullptr) munmap(const_cast<std::uint8_t *>(data), length);
+            if (fd >= 0) ::close(fd);
+        };
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        bool ok() const { return data != nullptr; };
+        const std::uint8_t *bytes() const { return data; };
+        std::size_t size() const { return length; };
+
+    private:
+        int fd = -1;
+        const std::uint8_t *data = nullptr;
+        std::size_t length = 0;
+    };
+}
+
+#endif // GRID_FILE_H
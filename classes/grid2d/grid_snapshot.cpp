@@ -0,0 +1,67 @@
+#include "grid_snapshot.h"
+#include <cmath>
+#include <QtCore>
+
+std::size_t GridSnapshot::index_of(const Eigen::Vector2f &p) const
+{
+    if (not dim.contains(QPointF(p.x(), p.y())))
+        return npos;
+    const long int cx = std::lrint((p.x() - dim.left()) / tile);
+    const long int cz = std::lrint((p.y() - dim.top()) / tile);
+    if (cx < 0 or cz < 0 or cx >= cols_ or cz >= rows_)
+        return npos;
+    return static_cast<std::size_t>(cz) * cols_ + cx;
+}
+Eigen::Vector2f GridSnapshot::key_of(std::size_t idx) const
+{
+    return Eigen::Vector2f(left + static_cast<long int>(idx % cols_) * tile, top + static_cast<long int>(idx / cols_) * tile);
+}
+bool GridSnapshot::is_occupied(const Eigen::Vector2f &p) const
+{
+    const auto c = cell(index_of(p));
+    return c == nullptr or not (c->flags & FREE);   // non existing cells are returned as occupied
+}
+float GridSnapshot::get_cost(const Eigen::Vector2f &p) const
+{
+    const auto c = cell(index_of(p));
+    return c == nullptr ? -1.f : c->cost;
+}
+std::vector<Eigen::Vector2f> GridSnapshot::compute_path(const QPointF &source, const QPointF &target, AStar &scratch,
+                                                        AStar::Expansion expansion) const
+{
+    const auto s = index_of(Eigen::Vector2f(source.x(), source.y()));
+    auto t = index_of(Eigen::Vector2f(target.x(), target.y()));
+    if (s == npos or t == npos or s == t)
+        return {};
+    if (traversal_cost(t) < 0.f)   // closest free cell in growing square rings
+    {
+        const int tx = t % cols_, tz = t / cols_;
+        bool found = false;
+        for (int r = 1; r <= 5 and not found; r++)
+            for (int dz = -r; dz <= r and not found; dz++)
+                for (int dx = -r; dx <= r and not found; dx++)
+                {
+                    if (std::max(std::abs(dx), std::abs(dz)) != r) continue;
+                    const int x = tx + dx, z = tz + dz;
+                    if (x < 0 or z < 0 or x >= cols_ or z >= rows_) continue;
+                    if (const std::size_t n = static_cast<std::size_t>(z) * cols_ + x; traversal_cost(n) >= 0.f)
+                    {
+                        t = n;
+                        found = true;
+                    }
+                }
+        if (not found)
+            return {};
+    }
+    std::vector<std::uint32_t> slots;
+    AStar::Params params;
+    params.expansion = expansion;
+    if (not scratch.search(cols_, rows_, s, t, [this](std::uint32_t idx){ return traversal_cost(idx); }, slots, params))
+        return {};
+    // keep one every two points as decimate_path does with Grid::computePath results
+    std::vector<Eigen::Vector2f> path;
+    path.reserve(slots.size() / 2 + 1);
+    for (std::size_t i = 0; i < slots.size(); i += 2)
+        path.emplace_back(key_of(slots[i]));
+    return path;
+}
@@ -0,0 +1,81 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef GRID_SNAPSHOT_H
+#define GRID_SNAPSHOT_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <QRectF>
+#include <QPointF>
+#include <Eigen/Dense>
+#include "astar.h"
+
+// Immutable view of the occupancy and costs of a Grid, published by Grid::publish_snapshot.
+// Cells are stored in CHUNK x CHUNK blocks shared between consecutive snapshots: publishing only copies the
+// blocks that changed since the previous one, so readers in other threads never lock and never see a
+// half updated map. Queries follow the conventions of Grid (world coordinates in mm, absent cells occupied).
+class GridSnapshot
+{
+public:
+    static constexpr int CHUNK = 64;
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+    enum : std::uint8_t { PRESENT = 1, FREE = 2, VISITED = 4 };
+    struct Cell
+    {
+        float cost = 1.f;
+        std::uint8_t flags = 0;
+    };
+    using Chunk = std::array<Cell, CHUNK * CHUNK>;
+
+    std::uint64_t epoch() const { return epoch_; };      // increases with every publish
+    int cols() const { return cols_; };
+    int rows() const { return rows_; };
+    const QRectF &dimensions() const { return dim; };
+
+    // slot of the cell holding p, npos outside the grid. Slots are the ones of Grid::cells()
+    std::size_t index_of(const Eigen::Vector2f &p) const;
+    Eigen::Vector2f key_of(std::size_t idx) const;
+    inline const Cell *cell(std::size_t idx) const
+    {
+        if (idx >= static_cast<std::size_t>(cols_) * rows_) return nullptr;
+        const int cx = idx % cols_, cz = idx / cols_;
+        const auto &c = (*chunks[(cz / CHUNK) * ccols + cx / CHUNK])[(cz % CHUNK) * CHUNK + cx % CHUNK];
+        return (c.flags & PRESENT) ? &c : nullptr;
+    };
+    inline float traversal_cost(std::uint32_t idx) const
+    {
+        const auto c = cell(idx);
+        return (c != nullptr and (c->flags & FREE)) ? c->cost : -1.f;
+    };
+    bool is_occupied(const Eigen::Vector2f &p) const;
+    float get_cost(const Eigen::Vector2f &p) const;   // -1 outside
+    // A* on the snapshot with caller owned scratch, so several readers can plan at once. A blocked target is
+    // moved to the closest free cell a few tiles around. Output as in Grid::compute_path
+    std::vector<Eigen::Vector2f> compute_path(const QPointF &source, const QPointF &target, AStar &scratch,
+                                              AStar::Expansion expansion = AStar::Expansion::OCTILE) const;
+
+private:
+    friend class Grid;
+    QRectF dim;
+    long int left = 0, top = 0;
+    int tile = 1, cols_ = 0, rows_ = 0, ccols = 0, crows = 0;
+    std::uint64_t epoch_ = 0;
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+};
+
+#endif // GRID_SNAPSHOT_H
@@ -0,0 +1,40 @@
+#include "grid_texture.h"
+#include <QStyleOptionGraphicsItem>
+#include <cmath>
+#include <algorithm>
+
+GridTextureItem::GridTextureItem(const QRectF &area_, int cols, int rows) : area(area_)
+{
+    image = QImage(std::max(cols, 1), std::max(rows, 1), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    // exposedRect is needed to draw only the repainted texels
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+}
+void GridTextureItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+    const double sx = area.width() / image.width();
+    const double sz = area.height() / image.height();
+    // texels under the exposed rect, one texel of margin for partially covered ones
+    QRectF exposed = option != nullptr ? option->exposedRect.intersected(area) : area;
+    const int x0 = std::max(0, (int)std::floor((exposed.left() - area.left()) / sx));
+    const int z0 = std::max(0, (int)std::floor((exposed.top() - area.top()) / sz));
+    const int x1 = std::min(image.width(), (int)std::ceil((exposed.right() - area.left()) / sx));
+    const int z1 = std::min(image.height(), (int)std::ceil((exposed.bottom() - area.top()) / sz));
+    if (x1 <= x0 or z1 <= z0)
+        return;
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, false);   // keep cells crisp
+    painter->drawImage(QRectF(area.left() + x0 * sx, area.top() + z0 * sz, (x1 - x0) * sx, (z1 - z0) * sz),
+                       image, QRectF(x0, z0, x1 - x0, z1 - z0));
+}
+void GridTextureItem::flush()
+{
+    if (dirty_x1 < dirty_x0)
+        return;
+    const double sx = area.width() / image.width();
+    const double sz = area.height() / image.height();
+    update(QRectF(area.left() + dirty_x0 * sx, area.top() + dirty_z0 * sz,
+                  (dirty_x1 - dirty_x0 + 1) * sx, (dirty_z1 - dirty_z0 + 1) * sz));
+    dirty_x0 = dirty_z0 = 0;
+    dirty_x1 = dirty_z1 = -1;
+}
@@ -0,0 +1,55 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef GRID_TEXTURE_H
+#define GRID_TEXTURE_H
+
+#include <QGraphicsItem>
+#include <QImage>
+#include <QPainter>
+#include <QRectF>
+#include <algorithm>
+
+// Whole grid as a single scene item: one texel per cell, scaled to the tile size when painted.
+// set_texel writes into the image and grows a dirty box; flush() asks the scene to repaint only that box,
+// and paint() only draws the texels under the exposed rect.
+class GridTextureItem : public QGraphicsItem
+{
+public:
+    // area: scene rect covered by the cols x rows image, in item coordinates
+    GridTextureItem(const QRectF &area_, int cols, int rows);
+
+    QRectF boundingRect() const override
+    { return area; };
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+    inline void set_texel(int cx, int cz, QRgb color)
+    {
+        reinterpret_cast<QRgb *>(image.scanLine(cz))[cx] = color;
+        if (dirty_x1 < dirty_x0)
+        { dirty_x0 = dirty_x1 = cx; dirty_z0 = dirty_z1 = cz; return; }
+        dirty_x0 = std::min(dirty_x0, cx); dirty_x1 = std::max(dirty_x1, cx);
+        dirty_z0 = std::min(dirty_z0, cz); dirty_z1 = std::max(dirty_z1, cz);
+    };
+    void flush();
+    int cols() const { return image.width(); };
+    int rows() const { return image.height(); };
+
+private:
+    QRectF area;
+    QImage image;
+    int dirty_x0 = 0, dirty_z0 = 0, dirty_x1 = -1, dirty_z1 = -1;
+};
+
+#endif // GRID_TEXTURE_H
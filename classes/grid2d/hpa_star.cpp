@@ -0,0 +1,339 @@
+#include "hpa_star.h"
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+HPAStar::HPAStar(Grid &grid_, int cluster_size_) : grid(grid_), cluster_size(std::max(cluster_size_, 2))
+{
+    change_log = grid.open_change_log();
+}
+HPAStar::~HPAStar()
+{
+    grid.close_change_log(change_log);
+}
+void HPAStar::reset()
+{
+    built = false;
+}
+std::vector<Eigen::Vector2f> HPAStar::compute_path(const QPointF &source_, const QPointF &target_)
+{
+    const auto ends = grid.admit_path_ends(source_, target_);
+    if (not ends.has_value())
+        return {};
+    const auto &[source_key, target_key] = ends.value();
+    const auto &cells = grid.cells();
+    const auto s = static_cast<std::uint32_t>(cells.index_of(source_key));
+    const auto t = static_cast<std::uint32_t>(cells.index_of(target_key));
+    update();
+
+    auto not_found = [&]()
+    {
+        qInfo() << __FUNCTION__ << "Path from (" << source_key.x << "," << source_key.z << ") to (" << target_.x() << "," << target_.y() << ") not  found. Returning empty path";
+        return std::vector<Eigen::Vector2f>{};
+    };
+    const int cs = cluster_of(s), ct = cluster_of(t);
+    if (not local_dijkstra(ct, t, true))
+        return not_found();
+    // entrances of the target cluster to target
+    const auto [tx0, tz0, tw, th] = box(ct);
+    std::vector<std::uint32_t> target_links;
+    for (const auto cell : cluster_nodes[ct])
+        if (const float d = local_dist[(row(cell) - tz0) * tw + col(cell) - tx0]; d < INF)
+        {
+            const auto node = node_of_cell[cell];
+            to_target[node] = d;
+            target_links.push_back(node);
+        }
+    float best = INF;
+    std::uint32_t best_parent = NONE;   // NONE: straight from source inside its cluster
+    if (cs == ct)
+        best = local_dist[(row(s) - tz0) * tw + col(s) - tx0];
+
+    // source to the entrances of its cluster
+    local_dijkstra(cs, s, false);
+    const auto [sx0, sz0, sw, sh] = box(cs);
+    const std::size_t n_nodes = node_cell.size();
+    g.assign(n_nodes, INF);
+    parent.assign(n_nodes, NONE);
+    open.clear();
+    auto greater = std::greater<std::pair<float, std::uint32_t>>();
+    auto push = [&](std::uint32_t u){ open.emplace_back(g[u] + octile(node_cell[u], t), u); std::push_heap(open.begin(), open.end(), greater); };
+    for (const auto cell : cluster_nodes[cs])
+        if (const float d = local_dist[(row(cell) - sz0) * sw + col(cell) - sx0]; d < INF)
+        {
+            const auto node = node_of_cell[cell];
+            g[node] = d;
+            push(node);
+        }
+    // abstract graph search
+    while (not open.empty())
+    {
+        std::pop_heap(open.begin(), open.end(), greater);
+        const auto [f, u] = open.back();
+        open.pop_back();
+        if (f >= best) break;
+        if (f != g[u] + octile(node_cell[u], t)) continue;   // stale entry
+        if (to_target[u] < INF and g[u] + to_target[u] < best)
+        {
+            best = g[u] + to_target[u];
+            best_parent = u;
+        }
+        for (std::uint32_t e = adj_begin[u]; e < adj_begin[u + 1]; e++)
+            if (const auto &[v, c] = adj[e]; g[u] + c < g[v])
+            {
+                g[v] = g[u] + c;
+                parent[v] = u;
+                push(v);
+            }
+    }
+    for (const auto node : target_links)
+        to_target[node] = INF;
+    if (best == INF)
+        return not_found();
+
+    // refinement of the abstract path
+    std::vector<std::uint32_t> waypoints{t};
+    for (auto u = best_parent; u != NONE; u = parent[u])
+        waypoints.push_back(node_cell[u]);
+    waypoints.push_back(s);
+    std::reverse(waypoints.begin(), waypoints.end());
+    std::vector<std::uint32_t> slots;
+    for (std::size_t i = 0; i + 1 < waypoints.size(); i++)
+        if (not refine(waypoints[i], waypoints[i + 1], slots))
+            return not_found();
+
+    // keep one every two points as decimate_path does with Grid::computePath results
+    std::vector<Eigen::Vector2f> path;
+    path.reserve(slots.size() / 2 + 1);
+    for (std::size_t i = 0; i < slots.size(); i += 2)
+    {
+        const auto k = cells.key_of(slots[i]);
+        path.emplace_back(k.x, k.z);
+    }
+    return path;
+}
+bool HPAStar::refine(std::uint32_t a, std::uint32_t b, std::vector<std::uint32_t> &path)
+{
+    if (a == b)
+        return true;
+    if (cluster_of(a) != cluster_of(b))   // entrance: adjacent cells across a border
+    {
+        path.push_back(b);
+        return true;
+    }
+    const auto [x0, z0, w, h] = box(cluster_of(a));
+    auto cost = [this, x0 = x0, z0 = z0, w = w, h = h](std::uint32_t idx)
+    {
+        const int c = col(idx), r = row(idx);
+        if (c < x0 or r < z0 or c >= x0 + w or r >= z0 + h)
+            return -1.f;
+        return grid.traversal_cost(idx);
+    };
+    if (not local.search(cols, rows, a, b, cost, local_path))
+        return false;
+    path.insert(path.end(), local_path.begin(), local_path.end());
+    return true;
+}
+
+/////////////////////////////// ABSTRACTION ////////////////////////////////////////////////////
+void HPAStar::update()
+{
+    const auto &cells = grid.cells();
+    auto changes = grid.take_changed_cells(change_log);
+    rebuilt_count = 0;
+    const int n_clusters = ccols * crows;
+    if (not built or cols != cells.cols() or rows != cells.rows() or not changes.has_value())
+    {
+        cols = cells.cols();
+        rows = cells.rows();
+        ccols = (cols + cluster_size - 1) / cluster_size;
+        crows = (rows + cluster_size - 1) / cluster_size;
+        const int n = ccols * crows;
+        border_entrances.assign(2 * n, {});
+        cluster_nodes.assign(n, {});
+        cluster_edges.assign(n, {});
+        for (int b = 0; b < 2 * n; b++)
+            build_border(b);
+        for (int c = 0; c < n; c++)
+            build_cluster(c);
+        rebuilt_count = n;
+        build_graph();
+        built = true;
+        return;
+    }
+    if (changes->empty())
+        return;
+
+    std::vector<std::uint8_t> dirty(n_clusters, 0);
+    for (const auto idx : changes.value())
+        if (idx < cells.slots())
+            dirty[cluster_of(idx)] = 1;
+    std::vector<std::uint8_t> rebuild(dirty);
+    for (int c = 0; c < n_clusters; c++)
+    {
+        if (not dirty[c]) continue;
+        const int cx = c % ccols, cz = c / ccols;
+        // border index and the cluster on its other side
+        const std::pair<int, int> borders[4] = {{2 * c, c + 1}, {2 * c + 1, c + ccols}, {2 * (c - 1), c - 1}, {2 * (c - ccols) + 1, c - ccols}};
+        const bool exists[4] = {cx < ccols - 1, cz < crows - 1, cx > 0, cz > 0};
+        for (int i = 0; i < 4; i++)
+        {
+            if (not exists[i]) continue;
+            const auto &[b, other] = borders[i];
+            const auto old = border_entrances[b];
+            build_border(b);
+            if (old != border_entrances[b])
+                rebuild[other] = 1;
+        }
+    }
+    for (int c = 0; c < n_clusters; c++)
+        if (rebuild[c])
+        {
+            build_cluster(c);
+            rebuilt_count++;
+        }
+    build_graph();
+}
+void HPAStar::build_border(int border)
+{
+    auto &out = border_entrances[border];
+    out.clear();
+    const int c = border / 2;
+    const bool east = border % 2 == 0;
+    const int cx = c % ccols, cz = c / ccols;
+    if ((east and cx == ccols - 1) or (not east and cz == crows - 1))
+        return;
+    const auto [x0, z0, w, h] = box(c);
+    const int length = east ? h : w;
+    auto cells_at = [&, x0 = x0, z0 = z0, w = w, h = h](int i) -> Entrance
+    {
+        if (east) return {at(x0 + w - 1, z0 + i), at(x0 + w, z0 + i)};
+        return {at(x0 + i, z0 + h - 1), at(x0 + i, z0 + h)};
+    };
+    auto flush = [&](int start, int len)
+    {
+        if (len <= 0) return;
+        if (len < MAX_ENTRANCE_WIDTH)
+            out.push_back(cells_at(start + len / 2));
+        else
+        {
+            out.push_back(cells_at(start));
+            out.push_back(cells_at(start + len - 1));
+        }
+    };
+    int start = 0, len = 0;
+    for (int i = 0; i < length; i++)
+    {
+        const auto [a, b] = cells_at(i);
+        if (grid.traversal_cost(a) >= 0.f and grid.traversal_cost(b) >= 0.f)
+        {
+            if (len == 0) start = i;
+            len++;
+        }
+        else
+        {
+            flush(start, len);
+            len = 0;
+        }
+    }
+    flush(start, len);
+}
+void HPAStar::build_cluster(int cluster)
+{
+    auto &nodes = cluster_nodes[cluster];
+    nodes.clear();
+    const int cx = cluster % ccols, cz = cluster / ccols;
+    for (const auto &e : border_entrances[2 * cluster]) nodes.push_back(e.first);
+    for (const auto &e : border_entrances[2 * cluster + 1]) nodes.push_back(e.first);
+    if (cx > 0) for (const auto &e : border_entrances[2 * (cluster - 1)]) nodes.push_back(e.second);
+    if (cz > 0) for (const auto &e : border_entrances[2 * (cluster - ccols) + 1]) nodes.push_back(e.second);
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+    auto &edges = cluster_edges[cluster];
+    edges.clear();
+    const auto [x0, z0, w, h] = box(cluster);
+    for (const auto a : nodes)
+    {
+        local_dijkstra(cluster, a, false);
+        for (const auto b : nodes)
+            if (const float d = local_dist[(row(b) - z0) * w + col(b) - x0]; b != a and d < INF)
+                edges.emplace_back(a, b, d);
+    }
+}
+void HPAStar::build_graph()
+{
+    const std::size_t n = static_cast<std::size_t>(cols) * rows;
+    if (node_of_cell.size() != n)
+        node_of_cell.assign(n, -1);
+    else
+        for (const auto cell : node_cell)
+            node_of_cell[cell] = -1;
+    node_cell.clear();
+    for (const auto &nodes : cluster_nodes)
+        for (const auto cell : nodes)
+        {
+            node_of_cell[cell] = static_cast<std::int32_t>(node_cell.size());
+            node_cell.push_back(cell);
+        }
+
+    std::vector<std::tuple<std::uint32_t, std::uint32_t, float>> edges;
+    for (const auto &cluster : cluster_edges)
+        for (const auto &[a, b, c] : cluster)
+            edges.emplace_back(node_of_cell[a], node_of_cell[b], c);
+    for (const auto &border : border_entrances)
+        for (const auto &[a, b] : border)
+        {
+            edges.emplace_back(node_of_cell[a], node_of_cell[b], grid.traversal_cost(b));
+            edges.emplace_back(node_of_cell[b], node_of_cell[a], grid.traversal_cost(a));
+        }
+    adj_begin.assign(node_cell.size() + 1, 0);
+    for (const auto &e : edges)
+        adj_begin[std::get<0>(e) + 1]++;
+    for (std::size_t i = 0; i < node_cell.size(); i++)
+        adj_begin[i + 1] += adj_begin[i];
+    adj.resize(edges.size());
+    std::vector<std::uint32_t> fill(adj_begin.begin(), adj_begin.end() - 1);
+    for (const auto &[a, b, c] : edges)
+        adj[fill[a]++] = Edge{b, c};
+    to_target.assign(node_cell.size(), INF);
+}
+bool HPAStar::local_dijkstra(int cluster, std::uint32_t from, bool reverse)
+{
+    const auto [x0, z0, w, h] = box(cluster);
+    local_dist.assign(static_cast<std::size_t>(w) * h, INF);
+    if (reverse and grid.traversal_cost(from) < 0.f)   // like AStar, only the target has to be walkable
+        return false;
+    auto greater = std::greater<std::pair<float, std::uint32_t>>();
+    const std::uint32_t lf = (row(from) - z0) * w + col(from) - x0;
+    local_dist[lf] = 0.f;
+    local_heap.assign(1, {0.f, lf});
+    while (not local_heap.empty())
+    {
+        std::pop_heap(local_heap.begin(), local_heap.end(), greater);
+        const auto [d, u] = local_heap.back();
+        local_heap.pop_back();
+        if (d > local_dist[u]) continue;
+        const int uc = x0 + u % w, ur = z0 + u / w;
+        const float ucost = grid.traversal_cost(at(uc, ur));
+        for (int k = 0; k < 8; k++)
+        {
+            const int nc = uc + DX[k], nr = ur + DZ[k];
+            if (nc < x0 or nr < z0 or nc >= x0 + w or nr >= z0 + h) continue;
+            const float vcost = grid.traversal_cost(at(nc, nr));
+            if (vcost < 0.f) continue;
+            const bool diagonal = DX[k] != 0 and DZ[k] != 0;
+            // no corner cutting, as in AStar
+            if (diagonal and (grid.traversal_cost(at(nc, ur)) < 0.f or grid.traversal_cost(at(uc, nr)) < 0.f)) continue;
+            const float nd = d + (reverse ? ucost : vcost) * (diagonal ? SQRT2 : 1.f);
+            const std::uint32_t v = (nr - z0) * w + nc - x0;
+            if (nd < local_dist[v])
+            {
+                local_dist[v] = nd;
+                local_heap.emplace_back(nd, v);
+                std::push_heap(local_heap.begin(), local_heap.end(), greater);
+            }
+        }
+    }
+    return true;
+}
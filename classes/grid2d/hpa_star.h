@@ -0,0 +1,114 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef HPA_STAR_H
+#define HPA_STAR_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include "grid.h"
+#include "astar.h"
+
+// Hierarchical path planner (HPA*, Botea, Müller & Schaeffer 2004) bound to a Grid.
+// The grid is split in clusters of cluster_size x cluster_size tiles. Walkable runs along the border of two
+// clusters become entrances (one in the middle of short runs, one at each end of long ones) and the cost
+// between the entrances of a cluster is precomputed with a search confined to it. Queries link source and
+// target to the entrances of their clusters, search the small abstract graph and refine every abstract edge
+// with AStar inside its cluster, so the result is near optimal.
+// Changes made through Grid are read from a change log on every query and only the clusters they touched,
+// plus the neighbours whose shared entrances moved, are rebuilt.
+class HPAStar
+{
+public:
+    explicit HPAStar(Grid &grid_, int cluster_size_ = 16);
+    ~HPAStar();
+    HPAStar(const HPAStar &) = delete;
+    HPAStar &operator=(const HPAStar &) = delete;
+
+    // Same admission rules and output format as Grid::compute_path
+    std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
+    void reset();                                                       // rebuild every cluster on the next query
+    int clusters_rebuilt() const { return rebuilt_count; };             // by the last query
+    std::size_t abstract_nodes() const { return node_cell.size(); };
+
+private:
+    using Entrance = std::pair<std::uint32_t, std::uint32_t>;           // adjacent cells, one on each side of a border
+    using IntraEdge = std::tuple<std::uint32_t, std::uint32_t, float>;  // from cell, to cell, cost
+    struct Edge
+    {
+        std::uint32_t to;
+        float cost;
+    };
+    static constexpr float INF = std::numeric_limits<float>::infinity();
+    static constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+    static constexpr float SQRT2 = 1.41421356f;
+    static constexpr int DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static constexpr int DZ[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    static constexpr int MAX_ENTRANCE_WIDTH = 6;
+
+    Grid &grid;
+    int change_log = -1;
+    int cluster_size;
+    int cols = 0, rows = 0, ccols = 0, crows = 0;
+    bool built = false;
+    int rebuilt_count = 0;
+
+    // per cluster c: east border is 2c, south border is 2c + 1
+    std::vector<std::vector<Entrance>> border_entrances;
+    std::vector<std::vector<std::uint32_t>> cluster_nodes;
+    std::vector<std::vector<IntraEdge>> cluster_edges;
+
+    // abstract graph in CSR form, rebuilt after cluster updates
+    std::vector<std::uint32_t> node_cell;
+    std::vector<std::int32_t> node_of_cell;     // per grid slot, -1 if not an entrance
+    std::vector<std::uint32_t> adj_begin;
+    std::vector<Edge> adj;
+
+    // query scratch
+    std::vector<float> local_dist;
+    std::vector<std::pair<float, std::uint32_t>> local_heap;
+    std::vector<float> g, to_target;
+    std::vector<std::uint32_t> parent;
+    std::vector<std::pair<float, std::uint32_t>> open;
+    AStar local;
+    std::vector<std::uint32_t> local_path;
+
+    void update();
+    void build_border(int border);
+    void build_cluster(int cluster);
+    void build_graph();
+    // costs from (or, reverse, to) cell within its cluster, indexed by cluster-local cell
+    bool local_dijkstra(int cluster, std::uint32_t from, bool reverse);
+    bool refine(std::uint32_t a, std::uint32_t b, std::vector<std::uint32_t> &path);
+
+    inline int col(std::uint32_t i) const { return static_cast<int>(i % cols); };
+    inline int row(std::uint32_t i) const { return static_cast<int>(i / cols); };
+    inline std::uint32_t at(int c, int r) const { return static_cast<std::uint32_t>(r) * cols + c; };
+    inline int cluster_of(std::uint32_t i) const { return (row(i) / cluster_size) * ccols + col(i) / cluster_size; };
+    inline std::tuple<int, int, int, int> box(int cluster) const   // x0, z0, width, height
+    {
+        const int x0 = (cluster % ccols) * cluster_size, z0 = (cluster / ccols) * cluster_size;
+        return {x0, z0, std::min(cluster_size, cols - x0), std::min(cluster_size, rows - z0)};
+    };
+    inline float octile(std::uint32_t a, std::uint32_t b) const
+    {
+        const float dx = std::abs(col(a) - col(b)), dz = std::abs(row(a) - row(b));
+        return (dx + dz) + (SQRT2 - 2.f) * std::min(dx, dz);   // cell costs are >= 1
+    };
+};
+
+#endif // HPA_STAR_H
@@ -0,0 +1,288 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef LAYERED_COSTMAP_H
+#define LAYERED_COSTMAP_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "polygon_raster.h"
+
+// Costs of a cols x rows row-major lattice kept as separate layers (a static map, the live sensor costs, semantic
+// zones...) that are folded into one master plane, the one planners read. Each layer is a dense float plane holding
+// NO_INFORMATION where it has nothing to say, a cost, or LETHAL. Writes to a layer only grow a few dirty boxes of
+// it, and update() folds the layers again inside the union of those boxes, so a person walking across the semantic
+// layer costs the cells around the person and not a pass over the map.
+// Layers are folded in the order they were added, each with its Combine rule. The master plane holds the cost of the
+// fold, default_cost where no layer has information and -1 where it is LETHAL, as Grid::traversal_cost.
+class LayeredCostmap
+{
+public:
+    static constexpr float NO_INFORMATION = std::numeric_limits<float>::quiet_NaN();
+    static constexpr float LETHAL = std::numeric_limits<float>::infinity();
+    enum class Combine
+    {
+        MAX,        // the largest cost so far wins, the usual rule for obstacles and inflation
+        OVERWRITE,  // where the layer has information it replaces the layers below, e.g. a zone declared free
+        ADD         // the cost is added to the layers below, e.g. a penalty for crossing a room
+    };
+    struct Box
+    {
+        int c0, r0, c1, r1;     // inclusive lattice box
+        std::size_t area() const
+        { return static_cast<std::size_t>(c1 - c0 + 1) * (r1 - r0 + 1); };
+    };
+
+    class Layer
+    {
+    public:
+        const std::string &name() const
+        { return layer_name; };
+        Combine combine() const
+        { return rule; };
+        bool enabled() const
+        { return on; };
+        float at(std::size_t idx) const
+        { return plane[idx]; };
+        const std::vector<Box> &dirty() const
+        { return boxes; };
+
+        void set(std::size_t idx, float value)
+        {
+            if (idx >= plane.size() or same(plane[idx], value)) return;
+            plane[idx] = value;
+            const int c = static_cast<int>(idx % cols), r = static_cast<int>(idx / cols);
+            add_box(Box{c, r, c, r});
+        };
+        void fill(Box box, float value)
+        {
+            box = Box{std::max(box.c0, 0), std::max(box.r0, 0), std::min(box.c1, cols - 1), std::min(box.r1, rows - 1)};
+            if (box.c1 < box.c0 or box.r1 < box.r0) return;
+            for (int r = box.r0; r <= box.r1; r++)
+                std::fill(plane.begin() + r * cols + box.c0, plane.begin() + r * cols + box.c1 + 1, value);
+            add_box(box);
+        };
+        // cells of the spans of PolygonRaster::fill, for zones given as polygons
+        void fill(const std::vector<PolygonRaster::Span> &spans, float value)
+        {
+            for (const auto &s : spans)
+                fill(Box{s.first, s.row, s.last, s.row}, value);
+        };
+        // value_of(idx) for every cell, e.g. to mirror another plane in one pass
+        template<typename F>
+        void assign(F &&value_of)
+        {
+            for (std::size_t idx = 0; idx < plane.size(); idx++)
+                plane[idx] = value_of(idx);
+            touch_all();
+        };
+        void clear()
+        {
+            std::fill(plane.begin(), plane.end(), NO_INFORMATION);
+            touch_all();
+        };
+        void set_combine(Combine c)
+        {
+            if (c == rule) return;
+            rule = c;
+            touch_all();
+        };
+        void set_enabled(bool enable)
+        {
+            if (enable == on) return;
+            on = enable;
+            touch_all();
+        };
+
+    private:
+        friend class LayeredCostmap;
+        static constexpr std::size_t MAX_BOXES = 4;
+        std::string layer_name;
+        Combine rule = Combine::MAX;
+        bool on = true;
+        int cols = 0, rows = 0;
+        std::vector<float> plane;
+        std::vector<Box> boxes;
+
+        static bool same(float a, float b)
+        { return a == b or (std::isnan(a) and std::isnan(b)); };
+        void touch_all()
+        {
+            boxes.clear();
+            if (cols > 0 and rows > 0)
+                boxes.push_back(Box{0, 0, cols - 1, rows - 1});
+        };
+        void add_box(Box box)
+        { LayeredCostmap::add_box(boxes, box, MAX_BOXES); };
+    };
+
+    explicit LayeredCostmap(float default_cost_ = 1.f) : default_cost(default_cost_)
+    {};
+
+    // Every layer is cleared to NO_INFORMATION and the master plane to default_cost
+    void resize(int cols_, int rows_)
+    {
+        cols = std::max(cols_, 0);
+        rows = std::max(rows_, 0);
+        for (auto &l : layers)
+        {
+            l.cols = cols;
+            l.rows = rows;
+            l.plane.assign(size(), NO_INFORMATION);
+            l.boxes.clear();
+        }
+        master.assign(size(), default_cost);
+        changed_cells.clear();
+    };
+    // Layers are folded in the order they are added. References stay valid while the costmap lives
+    Layer &add_layer(const std::string &name, Combine combine = Combine::MAX)
+    {
+        auto &l = layers.emplace_back();
+        l.layer_name = name;
+        l.rule = combine;
+        l.cols = cols;
+        l.rows = rows;
+        l.plane.assign(size(), NO_INFORMATION);
+        return l;
+    };
+    Layer *find(const std::string &name)
+    {
+        const auto it = std::find_if(layers.begin(), layers.end(), [&name](const auto &l) { return l.layer_name == name; });
+        return it == layers.end() ? nullptr : &*it;
+    };
+    Layer &layer(std::size_t i)
+    { return layers[i]; };
+    std::size_t layer_count() const
+    { return layers.size(); };
+
+    // Folds the layers again inside their dirty boxes and clears them. Cells whose master cost changed are left in
+    // changed(). Returns the number of cells folded
+    std::size_t update()
+    {
+        changed_cells.clear();
+        std::vector<Box> work;
+        for (auto &l : layers)
+        {
+            for (const auto &b : l.boxes)
+                add_box(work, b, MAX_WORK_BOXES);
+            l.boxes.clear();
+        }
+        std::size_t folded = 0;
+        for (const auto &b : work)
+        {
+            for (int r = b.r0; r <= b.r1; r++)
+                for (std::size_t idx = r * cols + b.c0; idx <= static_cast<std::size_t>(r * cols + b.c1); idx++)
+                {
+                    const float cost = fold(idx);
+                    if (master[idx] != cost)
+                    {
+                        master[idx] = cost;
+                        changed_cells.push_back(idx);
+                    }
+                }
+            folded += b.area();
+        }
+        return folded;
+    };
+    bool dirty() const
+    { return std::any_of(layers.begin(), layers.end(), [](const auto &l) { return not l.boxes.empty(); }); };
+    const std::vector<std::uint32_t> &changed() const
+    { return changed_cells; };
+
+    // master plane, -1 where a layer is LETHAL
+    float cost(std::size_t idx) const
+    { return master[idx]; };
+    const std::vector<float> &master_plane() const
+    { return master; };
+    std::size_t size() const
+    { return static_cast<std::size_t>(cols) * rows; };
+
+private:
+    static constexpr std::size_t MAX_WORK_BOXES = 16;
+    float default_cost;
+    int cols = 0, rows = 0;
+    std::deque<Layer> layers;
+    std::vector<float> master;
+    std::vector<std::uint32_t> changed_cells;
+
+    float fold(std::size_t idx) const
+    {
+        float acc = NO_INFORMATION;
+        for (const auto &l : layers)
+        {
+            const float v = l.plane[idx];
+            if (not l.on or std::isnan(v))
+                continue;
+            if (std::isnan(acc))
+                acc = v;
+            else
+                switch (l.rule)
+                {
+                    case Combine::MAX: acc = std::max(acc, v); break;
+                    case Combine::OVERWRITE: acc = v; break;
+                    case Combine::ADD: acc += v; break;
+                }
+        }
+        if (std::isnan(acc)) return default_cost;
+        return acc == LETHAL ? -1.f : acc;
+    };
+
+    // Adds box to a small set of boxes: boxes it overlaps or touches are merged into it, and past max_boxes the pair
+    // whose union wastes the fewest cells is merged, so the set stays short and covers every cell added
+    static void add_box(std::vector<Box> &boxes, Box box, std::size_t max_boxes)
+    {
+        const auto unite = [](const Box &a, const Box &b)
+        { return Box{std::min(a.c0, b.c0), std::min(a.r0, b.r0), std::max(a.c1, b.c1), std::max(a.r1, b.r1)}; };
+        const auto touch = [](const Box &a, const Box &b)
+        { return a.c0 <= b.c1 + 1 and b.c0 <= a.c1 + 1 and a.r0 <= b.r1 + 1 and b.r0 <= a.r1 + 1; };
+        for (bool merged = true; merged;)
+        {
+            merged = false;
+            for (std::size_t i = 0; i < boxes.size(); i++)
+                if (touch(boxes[i], box))
+                {
+                    box = unite(boxes[i], box);
+                    boxes[i] = boxes.back();
+                    boxes.pop_back();
+                    merged = true;
+                    break;
+                }
+        }
+        boxes.push_back(box);
+        while (boxes.size() > max_boxes)
+        {
+            std::size_t bi = 0, bj = 1, best = std::numeric_limits<std::size_t>::max();
+            for (std::size_t i = 0; i < boxes.size(); i++)
+                for (std::size_t j = i + 1; j < boxes.size(); j++)
+                    if (const auto waste = unite(boxes[i], boxes[j]).area() - boxes[i].area() - boxes[j].area(); waste < best)
+                    {
+                        best = waste;
+                        bi = i;
+                        bj = j;
+                    }
+            const Box u = unite(boxes[bi], boxes[bj]);
+            boxes[bj] = boxes.back();
+            boxes.pop_back();
+            boxes.erase(boxes.begin() + bi);
+            add_box(boxes, u, max_boxes);
+        }
+    };
+};
+
+#endif // LAYERED_COSTMAP_H
@@ -0,0 +1,166 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef LOG_ODDS_KERNEL_H
+#define LOG_ODDS_KERNEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Batched occupancy update over a contiguous plane of fixed-point log-odds (int16, 1/SCALE units).
+// Hit and miss increments, clamping bounds and free/occupied thresholds are converted once from
+// probabilities, so updating a whole scan is integer adds, mins and maxs: AVX2 or NEON when the
+// compiler targets them (-mavx2, aarch64) and a scalar loop otherwise, with identical results.
+// Typical use per scan: write hit() or miss() in delta for every cell touched by a beam, then apply()
+// and classify() over the span of slots containing them.
+class LogOddsKernel
+{
+public:
+    using Value = std::int16_t;
+    static constexpr float SCALE = 256.f;   // |log odds| up to 127
+
+    struct Params
+    {
+        float p_hit = 0.7f;
+        float p_miss = 0.4f;
+        float p_min = 0.12f;      // clamping bounds, so cells stay responsive to change
+        float p_max = 0.97f;
+        float p_free = 0.3f;      // thresholds with hysteresis in between
+        float p_occupied = 0.6f;
+    };
+
+    LogOddsKernel() : LogOddsKernel(Params{}) {};
+    explicit LogOddsKernel(const Params &p)
+        : hit_(to_fixed(log_odds(p.p_hit))), miss_(to_fixed(log_odds(p.p_miss))),
+          lo(to_fixed(log_odds(p.p_min))), hi(to_fixed(log_odds(p.p_max))),
+          free_(to_fixed(log_odds(p.p_free))), occupied_(to_fixed(log_odds(p.p_occupied)))
+    {};
+
+    Value hit() const { return hit_; };
+    Value miss() const { return miss_; };
+    Value free_threshold() const { return free_; };
+    Value occupied_threshold() const { return occupied_; };
+
+    static float log_odds(float p) { return std::log(p / (1.f - p)); };
+    static Value to_fixed(float l)
+    { return static_cast<Value>(std::lrint(std::clamp(l * SCALE, -32767.f, 32767.f))); };
+    static float to_log_odds(Value v) { return v / SCALE; };
+    static float probability(Value v) { return 1.f - 1.f / (1.f + std::exp(to_log_odds(v))); };
+
+    // plane[i] = clamp(plane[i] + delta[i]) with saturating adds. delta is zeroed for the next scan
+    void apply(Value *plane, Value *delta, std::size_t n) const
+    {
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        const __m256i vlo = _mm256_set1_epi16(lo), vhi = _mm256_set1_epi16(hi), zero = _mm256_setzero_si256();
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(delta + i));
+            if (_mm256_testz_si256(d, d)) continue;   // spans are mostly untouched
+            const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(plane + i));
+            const __m256i l = _mm256_min_epi16(_mm256_max_epi16(_mm256_adds_epi16(p, d), vlo), vhi);
+            // cells without increment keep their value, even outside the bounds
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(plane + i), _mm256_blendv_epi8(l, p, _mm256_cmpeq_epi16(d, zero)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(delta + i), zero);
+        }
+#elif defined(__ARM_NEON)
+        const int16x8_t vlo = vdupq_n_s16(lo), vhi = vdupq_n_s16(hi), zero = vdupq_n_s16(0);
+        for (; i + 8 <= n; i += 8)
+        {
+            const int16x8_t d = vld1q_s16(delta + i);
+            const int16x8_t p = vld1q_s16(plane + i);
+            const int16x8_t l = vminq_s16(vmaxq_s16(vqaddq_s16(p, d), vlo), vhi);
+            vst1q_s16(plane + i, vbslq_s16(vceqq_s16(d, zero), p, l));
+            vst1q_s16(delta + i, zero);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (delta[i] == 0) continue;
+            const int l = std::clamp<int>(plane[i] + delta[i], lo, hi);
+            plane[i] = static_cast<Value>(l);
+            delta[i] = 0;
+        }
+    };
+    Value add(Value l, Value inc) const { return static_cast<Value>(std::clamp<int>(l + inc, lo, hi)); };
+    // plane[i] = clamp(plane[i] + inc) over a run of cells, e.g. the free space of a beam
+    void add_span(Value *plane, std::size_t n, Value inc) const
+    {
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        const __m256i vlo = _mm256_set1_epi16(lo), vhi = _mm256_set1_epi16(hi), vinc = _mm256_set1_epi16(inc);
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(plane + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(plane + i),
+                                _mm256_min_epi16(_mm256_max_epi16(_mm256_adds_epi16(p, vinc), vlo), vhi));
+        }
+#elif defined(__ARM_NEON)
+        const int16x8_t vlo = vdupq_n_s16(lo), vhi = vdupq_n_s16(hi), vinc = vdupq_n_s16(inc);
+        for (; i + 8 <= n; i += 8)
+            vst1q_s16(plane + i, vminq_s16(vmaxq_s16(vqaddq_s16(vld1q_s16(plane + i), vinc), vlo), vhi));
+#endif
+        for (; i < n; i++)
+            plane[i] = add(plane[i], inc);
+    };
+    // occupied[i] becomes 1 above the occupied threshold, 0 below the free one and is kept in between
+    void classify(const Value *plane, std::uint8_t *occupied, std::size_t n) const
+    {
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        const __m256i vocc = _mm256_set1_epi16(occupied_), vfree = _mm256_set1_epi16(free_);
+        for (; i + 32 <= n; i += 32)
+        {
+            const __m256i l0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(plane + i));
+            const __m256i l1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(plane + i + 16));
+            // 16 bit masks packed to bytes, lane order fixed by the permute
+            const __m256i set = _mm256_permute4x64_epi64(_mm256_packs_epi16(_mm256_cmpgt_epi16(l0, vocc),
+                                                                            _mm256_cmpgt_epi16(l1, vocc)), 0xD8);
+            const __m256i clr = _mm256_permute4x64_epi64(_mm256_packs_epi16(_mm256_cmpgt_epi16(vfree, l0),
+                                                                            _mm256_cmpgt_epi16(vfree, l1)), 0xD8);
+            __m256i o = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(occupied + i));
+            o = _mm256_andnot_si256(clr, _mm256_or_si256(o, _mm256_and_si256(set, _mm256_set1_epi8(1))));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(occupied + i), o);
+        }
+#elif defined(__ARM_NEON)
+        const int16x8_t vocc = vdupq_n_s16(occupied_), vfree = vdupq_n_s16(free_);
+        for (; i + 8 <= n; i += 8)
+        {
+            const int16x8_t l = vld1q_s16(plane + i);
+            const uint8x8_t set = vmovn_u16(vcgtq_s16(l, vocc));
+            const uint8x8_t clr = vmovn_u16(vcltq_s16(l, vfree));
+            uint8x8_t o = vld1_u8(occupied + i);
+            o = vbic_u8(vorr_u8(o, vand_u8(set, vdup_n_u8(1))), clr);
+            vst1_u8(occupied + i, o);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (plane[i] > occupied_) occupied[i] = 1;
+            else if (plane[i] < free_) occupied[i] = 0;
+        }
+    };
+
+private:
+    Value hit_, miss_, lo, hi, free_, occupied_;
+};
+
+#endif // LOG_ODDS_KERNEL_H
@@ -0,0 +1,37 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef NEIGHBOURHOOD_H
+#define NEIGHBOURHOOD_H
+
+#include <array>
+
+// Compile-time neighbourhoods as tables of lattice offsets, in units of cells. They are used as template
+// arguments of Grid::for_each_neighbour and Local_Grid::for_each_neighbour, e.g.
+//     grid.for_each_neighbour<neighbourhood::N8>(key, [](const Grid::Key &k, Grid::T &cell){ ... });
+// The order is the one of the original neighboors_8 and neighboors_16 increments.
+namespace neighbourhood
+{
+    struct Offset
+    {
+        int dx, dz;
+    };
+    inline constexpr std::array<Offset, 4> N4 = {{{1, 0}, {0, -1}, {-1, 0}, {0, 1}}};
+    inline constexpr std::array<Offset, 8> N8 = {{{1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1}}};
+    // outer ring at distance 2
+    inline constexpr std::array<Offset, 16> N16 = {{{0, 2}, {1, 2}, {2, 2}, {2, 1}, {2, 0}, {2, -1}, {2, -2}, {1, -2},
+                                                    {0, -2}, {-1, -2}, {-2, -2}, {-2, -1}, {-2, 0}, {-2, 1}, {-2, 2}, {-1, 2}}};
+}
+
+#endif // NEIGHBOURHOOD_H
@@ -0,0 +1,340 @@
+#include "paged_grid.h"
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <QtCore>
+#include <cppitertools/range.hpp>
+
+PagedGrid::~PagedGrid()
+{
+    release_page_file();
+}
+bool PagedGrid::initialize(QRectF dim_, int tile_size, std::size_t max_resident_tiles, const std::string &page_file)
+{
+    clear();
+    release_page_file();
+    dim = dim_;
+    TILE_SIZE = tile_size;
+    cols = static_cast<long int>(std::ceil(dim.width() / TILE_SIZE)) + 1;
+    rows = static_cast<long int>(std::ceil(dim.height() / TILE_SIZE)) + 1;
+    tcols = (cols + PAGE - 1) / PAGE;
+    max_frames = std::max<std::size_t>(max_resident_tiles, 4);
+
+    if (page_file.empty())
+    {
+        const char *tmp = std::getenv("TMPDIR");
+        std::string name = std::string(tmp != nullptr ? tmp : "/tmp") + "/paged_grid_XXXXXX";
+        fd = mkstemp(name.data());
+        if (fd >= 0)
+            ::unlink(name.c_str());   // removed by the system when closed
+    }
+    else
+        fd = open(page_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        qWarning() << __FUNCTION__ << "Could not create page file" << QString::fromStdString(page_file) << strerror(errno);
+        return false;
+    }
+    qInfo() << __FUNCTION__ << "Paged grid of" << cols << "x" << rows << "cells," << max_frames << "resident tiles of" << PAGE << "x" << PAGE
+            << "(" << max_frames * sizeof(Tile) / (1024 * 1024) << "MB)";
+    return true;
+}
+void PagedGrid::clear()
+{
+    frames.clear();
+    frame_tile.clear();
+    frame_dirty.clear();
+    lru_prev.clear();
+    lru_next.clear();
+    lru_head = lru_tail = NONE;
+    resident.clear();
+    on_disk.clear();
+    allocated = faults = 0;
+    last_tile = NO_TILE;
+    last_frame = NONE;
+}
+
+////////////////////////////// KEYS ////////////////////////////////////////////////////////////
+PagedGrid::Key PagedGrid::pointToKey(long int x, long int z) const
+{
+    int kx = rint((x - dim.left()) / TILE_SIZE);
+    int kz = rint((z - dim.top()) / TILE_SIZE);
+    return Key(dim.left() + kx * TILE_SIZE, dim.top() + kz * TILE_SIZE);
+};
+PagedGrid::Key PagedGrid::pointToKey(const QPointF &p) const
+{
+    int kx = rint((p.x() - dim.left()) / TILE_SIZE);
+    int kz = rint((p.y() - dim.top()) / TILE_SIZE);
+    return Key(dim.left() + kx * TILE_SIZE, dim.top() + kz * TILE_SIZE);
+};
+PagedGrid::Key PagedGrid::pointToKey(const Eigen::Vector2f &p) const
+{
+    int kx = rint((p.x() - dim.left()) / TILE_SIZE);
+    int kz = rint((p.y() - dim.top()) / TILE_SIZE);
+    return Key(dim.left() + kx * TILE_SIZE, dim.top() + kz * TILE_SIZE);
+};
+bool PagedGrid::lattice(long int x, long int z, long int &cx, long int &cz) const
+{
+    if (fd < 0 or not dim.contains(QPointF(x, z)))
+        return false;
+    cx = std::lrint((x - dim.left()) / TILE_SIZE);
+    cz = std::lrint((z - dim.top()) / TILE_SIZE);
+    return cx >= 0 and cz >= 0 and cx < cols and cz < rows;
+}
+
+////////////////////////////// CELL ACCESS /////////////////////////////////////////////////////
+std::tuple<bool, PagedGrid::T &> PagedGrid::getCell(long int x, long int z)
+{
+    if (auto c = write(x, z); c != nullptr)
+        return std::forward_as_tuple(true, *c);
+    dummy = T();
+    return std::forward_as_tuple(false, dummy);
+}
+std::tuple<bool, PagedGrid::T &> PagedGrid::getCell(const Key &k)
+{
+    return getCell(k.x, k.z);
+}
+std::tuple<bool, PagedGrid::T &> PagedGrid::getCell(const Eigen::Vector2f &p)
+{
+    return getCell((long int)p.x(), (long int)p.y());
+}
+PagedGrid::T *PagedGrid::write(long int x, long int z)
+{
+    long int cx, cz;
+    if (not lattice(x, z, cx, cz))
+        return nullptr;
+    const auto frame = frame_of(cx, cz, true);
+    if (frame == NONE)
+        return nullptr;
+    frame_dirty[frame] = 1;
+    return &cell(frame, cx, cz);
+}
+const PagedGrid::T *PagedGrid::peek(long int x, long int z)
+{
+    long int cx, cz;
+    if (not lattice(x, z, cx, cz))
+        return nullptr;
+    if (const auto frame = frame_of(cx, cz, false); frame != NONE)
+        return &cell(frame, cx, cz);
+    unwritten = T();
+    return &unwritten;
+}
+bool PagedGrid::isFree(const Key &k)
+{
+    const auto c = peek(k.x, k.z);
+    return c != nullptr and c->free;
+}
+bool PagedGrid::is_occupied(const Eigen::Vector2f &p)
+{
+    const auto c = peek(p.x(), p.y());
+    return c == nullptr or not c->free;   // non existing cells are returned as occupied
+}
+float PagedGrid::get_cost(const Eigen::Vector2f &p)
+{
+    const auto c = peek(p.x(), p.y());
+    return c == nullptr ? -1.f : c->cost;
+}
+bool PagedGrid::is_visited(const Key &k)
+{
+    const auto c = peek(k.x, k.z);
+    return c != nullptr and c->visited;
+}
+void PagedGrid::setFree(const Key &k)
+{
+    if (auto c = write(k.x, k.z); c != nullptr)
+        c->free = true;
+}
+void PagedGrid::setOccupied(const Key &k)
+{
+    if (auto c = write(k.x, k.z); c != nullptr)
+        c->free = false;
+}
+void PagedGrid::setCost(const Key &k, float cost)
+{
+    if (auto c = write(k.x, k.z); c != nullptr)
+        c->cost = cost;
+}
+void PagedGrid::setVisited(const Key &k, bool visited)
+{
+    if (auto c = write(k.x, k.z); c != nullptr)
+        c->visited = visited;
+}
+
+/////////////////////////////// UPDATE /////////////////////////////////////////////////////////
+// same rules as Grid::add_miss / Grid::add_hit
+void PagedGrid::add_miss(const Eigen::Vector2f &p)
+{
+    if (auto v = write(p.x(), p.y()); v != nullptr)
+    {
+        v->misses++;
+        if (v->hits / (v->hits + v->misses) < occupancy_threshold)
+            v->free = true;
+        v->misses = std::clamp(v->misses, 0.f, 20.f);
+    }
+}
+void PagedGrid::add_hit(const Eigen::Vector2f &p)
+{
+    if (auto v = write(p.x(), p.y()); v != nullptr)
+    {
+        v->hits++;
+        if (v->hits / (v->hits + v->misses) >= occupancy_threshold)
+            v->free = false;
+        v->hits = std::clamp(v->hits, 0.f, 20.f);
+    }
+}
+void PagedGrid::update_map(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range)
+{
+    for (const auto &point : points)
+    {
+        const float length = (point - robot_in_grid).norm();
+        const int num_steps = ceil(length / TILE_SIZE);
+        Eigen::Vector2f p;
+        for (const auto &&step : iter::range(0.0, 1.0 - (1.0 / num_steps), 1.0 / num_steps))
+        {
+            p = robot_in_grid * (1 - step) + point * step;
+            add_miss(p);
+        }
+        if (length <= max_laser_range)
+            add_hit(point);
+        if ((p - point).norm() < TILE_SIZE)  // in case last miss overlaps tip
+            add_hit(point);
+    }
+}
+
+////////////////////////////// PAGING //////////////////////////////////////////////////////////
+std::uint32_t PagedGrid::frame_of(long int cx, long int cz, bool create)
+{
+    const std::uint64_t tile = static_cast<std::uint64_t>(cz / PAGE) * tcols + cx / PAGE;
+    if (tile == last_tile)
+        return last_frame;
+    if (auto it = resident.find(tile); it != resident.end())
+    {
+        touch(it->second);
+        last_tile = tile;
+        return last_frame = it->second;
+    }
+    const auto disk = on_disk.find(tile);
+    if (disk == on_disk.end() and not create)
+        return NONE;
+    const std::uint32_t slot = (disk == on_disk.end()) ? NONE : disk->second;   // the eviction below may rehash on_disk
+    const auto frame = take_frame();
+    if (frame == NONE)
+        return NONE;
+    if (slot != NONE)
+    {
+        std::memcpy(frames[frame]->data(), mapped + slot * sizeof(Tile), sizeof(Tile));
+        frame_dirty[frame] = 0;
+        faults++;
+    }
+    else
+    {
+        frames[frame]->fill(T());
+        frame_dirty[frame] = 1;
+        allocated++;
+    }
+    frame_tile[frame] = tile;
+    resident.emplace(tile, frame);
+    touch(frame);
+    last_tile = tile;
+    return last_frame = frame;
+}
+std::uint32_t PagedGrid::take_frame()
+{
+    if (frames.size() < max_frames)
+    {
+        frames.push_back(std::make_unique<Tile>());
+        frame_tile.push_back(NO_TILE);
+        frame_dirty.push_back(0);
+        lru_prev.push_back(NONE);
+        lru_next.push_back(NONE);
+        return frames.size() - 1;
+    }
+    // evict the least recently used tile
+    const auto frame = lru_tail;
+    if (not page_out(frame))
+        return NONE;
+    unlink(frame);
+    resident.erase(frame_tile[frame]);
+    if (last_frame == frame)
+    { last_tile = NO_TILE; last_frame = NONE; }
+    frame_tile[frame] = NO_TILE;
+    return frame;
+}
+bool PagedGrid::page_out(std::uint32_t frame)
+{
+    if (not frame_dirty[frame])
+        return true;
+    auto [it, inserted] = on_disk.try_emplace(frame_tile[frame], static_cast<std::uint32_t>(on_disk.size()));
+    if (it->second >= mapped_slots and not grow_page_file(std::max<std::size_t>(2 * mapped_slots, 64)))
+    {
+        if (inserted) on_disk.erase(it);
+        return false;
+    }
+    std::memcpy(mapped + it->second * sizeof(Tile), frames[frame]->data(), sizeof(Tile));
+    frame_dirty[frame] = 0;
+    return true;
+}
+void PagedGrid::flush()
+{
+    for (std::uint32_t f = 0; f < frames.size(); f++)
+        if (frame_tile[f] != NO_TILE)
+            page_out(f);
+    if (mapped != nullptr)
+        msync(mapped, mapped_slots * sizeof(Tile), MS_ASYNC);
+}
+bool PagedGrid::grow_page_file(std::size_t slots)
+{
+    if (fd < 0 or ftruncate(fd, slots * sizeof(Tile)) != 0)
+    {
+        qWarning() << __FUNCTION__ << "Could not grow page file to" << slots << "tiles:" << strerror(errno);
+        return false;
+    }
+    if (mapped != nullptr)
+        munmap(mapped, mapped_slots * sizeof(Tile));
+    void *m = mmap(nullptr, slots * sizeof(Tile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+    {
+        qWarning() << __FUNCTION__ << "Could not map page file:" << strerror(errno);
+        mapped = nullptr;
+        mapped_slots = 0;
+        return false;
+    }
+    mapped = static_cast<std::uint8_t *>(m);
+    mapped_slots = slots;
+    return true;
+}
+void PagedGrid::release_page_file()
+{
+    if (mapped != nullptr)
+        munmap(mapped, mapped_slots * sizeof(Tile));
+    mapped = nullptr;
+    mapped_slots = 0;
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+void PagedGrid::touch(std::uint32_t frame)
+{
+    if (lru_head == frame)
+        return;
+    unlink(frame);
+    lru_prev[frame] = NONE;
+    lru_next[frame] = lru_head;
+    if (lru_head != NONE)
+        lru_prev[lru_head] = frame;
+    lru_head = frame;
+    if (lru_tail == NONE)
+        lru_tail = frame;
+}
+void PagedGrid::unlink(std::uint32_t frame)
+{
+    const auto p = lru_prev[frame], n = lru_next[frame];
+    if (p != NONE) lru_next[p] = n;
+    else if (lru_head == frame) lru_head = n;
+    if (n != NONE) lru_prev[n] = p;
+    else if (lru_tail == frame) lru_tail = p;
+    lru_prev[frame] = lru_next[frame] = NONE;
+}
@@ -0,0 +1,129 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef PAGED_GRID_H
+#define PAGED_GRID_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <QRectF>
+#include <Eigen/Dense>
+#include "grid.h"
+
+// Occupancy grid for maps larger than RAM. Cells live in PAGE x PAGE tiles that are allocated on the first write.
+// At most max_resident_tiles tiles are kept in memory; when another one is needed the least recently used is
+// copied to a memory-mapped page file and its frame reused, and it is read back from there when touched again.
+// Keys and cell access follow Grid, so code written against getCell/pointToKey works unchanged. Tiles never
+// written read as free cells of cost 1. References returned by getCell are valid until max_resident_tiles - 1
+// other tiles have been touched.
+class PagedGrid
+{
+public:
+    static constexpr int PAGE = 64;
+    using Key = Grid::Key;
+    using Dimensions = QRectF;
+    int TILE_SIZE = 100;
+    Dimensions dim;
+
+    // Grid::T without the scene item, so tiles can be copied to disk as they are
+    struct T
+    {
+        bool free = true;
+        bool visited = false;
+        float cost = 1;
+        float hits = 0;
+        float misses = 0;
+        float log_odds = 0.f;
+    };
+
+    PagedGrid() = default;
+    ~PagedGrid();
+    PagedGrid(const PagedGrid &) = delete;
+    PagedGrid &operator=(const PagedGrid &) = delete;
+
+    // page_file is created (truncated) to hold evicted tiles. An empty name uses an anonymous temporary file
+    bool initialize(QRectF dim_, int tile_size, std::size_t max_resident_tiles = 256, const std::string &page_file = std::string());
+    void clear();
+
+    std::tuple<bool, T &> getCell(long int x, long int z);
+    std::tuple<bool, T &> getCell(const Key &k);
+    std::tuple<bool, T &> getCell(const Eigen::Vector2f &p);
+    Key pointToKey(long int x, long int z) const;
+    Key pointToKey(const QPointF &p) const;
+    Key pointToKey(const Eigen::Vector2f &p) const;
+
+    // Read only queries do not allocate tiles
+    bool isFree(const Key &k);
+    bool is_occupied(const Eigen::Vector2f &p);
+    float get_cost(const Eigen::Vector2f &p);
+    bool is_visited(const Key &k);
+    void setFree(const Key &k);
+    void setOccupied(const Key &k);
+    void setCost(const Key &k, float cost);
+    void setVisited(const Key &k, bool visited);
+    void add_miss(const Eigen::Vector2f &p);
+    void add_hit(const Eigen::Vector2f &p);
+    void update_map(const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range);
+
+    void flush();                                                    // write every modified resident tile to the page file
+    std::size_t resident_tiles() const { return frame_tile.size(); };
+    std::size_t allocated_tiles() const { return allocated; };
+    std::size_t paged_out_tiles() const { return on_disk.size(); };
+    std::size_t page_faults() const { return faults; };              // tiles read back from the page file
+
+private:
+    using Tile = std::array<T, PAGE * PAGE>;
+    static constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint64_t NO_TILE = std::numeric_limits<std::uint64_t>::max();
+
+    long int cols = 0, rows = 0, tcols = 0;
+    std::size_t max_frames = 0;
+    std::vector<std::unique_ptr<Tile>> frames;
+    std::vector<std::uint64_t> frame_tile;
+    std::vector<std::uint8_t> frame_dirty;
+    std::vector<std::uint32_t> lru_prev, lru_next;                   // most recently used at lru_head
+    std::uint32_t lru_head = NONE, lru_tail = NONE;
+    std::unordered_map<std::uint64_t, std::uint32_t> resident;      // tile -> frame
+    std::unordered_map<std::uint64_t, std::uint32_t> on_disk;       // tile -> slot in the page file
+    std::size_t allocated = 0, faults = 0;
+    std::uint64_t last_tile = NO_TILE;                              // one entry cache, rays stay in a tile for a while
+    std::uint32_t last_frame = NONE;
+    T dummy, unwritten;
+    const float occupancy_threshold = 0.5f;   // as Grid::Params
+
+    int fd = -1;
+    std::uint8_t *mapped = nullptr;
+    std::size_t mapped_slots = 0;
+
+    // lattice coordinates of x, z. False outside dim
+    bool lattice(long int x, long int z, long int &cx, long int &cz) const;
+    // frame holding the tile of cx, cz, paging it in (or allocating it if create) when needed. NONE if not created
+    std::uint32_t frame_of(long int cx, long int cz, bool create);
+    T &cell(std::uint32_t frame, long int cx, long int cz) { return (*frames[frame])[(cz % PAGE) * PAGE + cx % PAGE]; };
+    const T *peek(long int x, long int z);
+    T *write(long int x, long int z);
+    void touch(std::uint32_t frame);
+    void unlink(std::uint32_t frame);
+    std::uint32_t take_frame();
+    bool page_out(std::uint32_t frame);
+    bool grow_page_file(std::size_t slots);
+    void release_page_file();
+};
+
+#endif // PAGED_GRID_H
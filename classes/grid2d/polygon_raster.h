@@ -0,0 +1,126 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef POLYGON_RASTER_H
+#define POLYGON_RASTER_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Scanline fill of polygons over a cols x rows lattice whose cell (c, r) is centred at (left + c*tile, top + r*tile),
+// the lattice of Grid::pointToKey. Every cell is sampled at the centres of its samples x samples sub-cells and belongs
+// to the polygon when one of its samples is inside (odd-even rule): samples = 1 fills the cells whose centre is inside,
+// 4 the cells covered by a sixteenth of them or more, as the sampling markAreaInGridAs did.
+// For every row of samples the crossings of the edges are computed once, the intervals between them become spans of
+// cells, and the spans of the rows of samples of a cell row are merged, so each cell is reported once. O(edges) per
+// row of samples, with the edges kept in an active list sorted by their lowest vertex.
+class PolygonRaster
+{
+public:
+    struct Span
+    {
+        int row, first, last;   // cells first..last of the lattice row
+    };
+
+    PolygonRaster(double left_, double top_, double tile_, int cols_, int rows_, int samples_ = 4)
+        : left(left_), top(top_), tile(tile_), cols(cols_), rows(rows_), samples(std::max(1, samples_))
+    {};
+
+    // Disjoint spans of the polygon, ascending by row and then by column. Any sequence of points with x() and y()
+    // (QPolygonF, std::vector<Eigen::Vector2f>), closed implicitly
+    template<typename Polygon>
+    std::vector<Span> fill(const Polygon &polygon) const
+    {
+        std::vector<Span> spans;
+        struct Edge { double y0, y1, x0, slope; };
+        std::vector<Edge> edges;
+        const std::size_t n = std::size(polygon);
+        if (n < 3 or cols <= 0 or rows <= 0 or tile <= 0)
+            return spans;
+        double ymin = polygon[0].y(), ymax = ymin;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const auto &a = polygon[i], &b = polygon[(i + 1) % n];
+            ymin = std::min<double>(ymin, a.y());
+            ymax = std::max<double>(ymax, a.y());
+            if (a.y() == b.y())
+                continue;   // horizontal edges never cross a row of samples
+            const bool up = a.y() < b.y();
+            const double x0 = up ? a.x() : b.x(), y0 = up ? a.y() : b.y(), y1 = up ? b.y() : a.y();
+            edges.push_back(Edge{y0, y1, x0, ((up ? b.x() : a.x()) - x0) / (y1 - y0)});
+        }
+        std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) { return a.y0 < b.y0; });
+
+        // rows of samples v, at sample_y(v), within the polygon and the lattice
+        const int total_rows = rows * samples;
+        const int v0 = std::max(0, static_cast<int>(std::ceil(sample_index(ymin, top))));
+        const int v1 = std::min(total_rows - 1, static_cast<int>(std::ceil(sample_index(ymax, top))) - 1);
+        std::vector<const Edge *> active;
+        std::vector<double> crossings;
+        std::vector<std::pair<int, int>> row_spans;
+        std::size_t next_edge = 0;
+        int row = v0 < 0 ? 0 : v0 / samples;
+        for (int v = v0; v <= v1; v++)
+        {
+            const double y = top + ((v + 0.5) / samples - 0.5) * tile;
+            // an edge crosses y when y0 <= y < y1, so a vertex on the row counts once
+            while (next_edge < edges.size() and edges[next_edge].y0 <= y)
+                active.push_back(&edges[next_edge++]);
+            std::erase_if(active, [y](const Edge *e) { return e->y1 <= y; });
+            crossings.clear();
+            for (const Edge *e : active)
+                crossings.push_back(e->x0 + (y - e->y0) * e->slope);
+            std::sort(crossings.begin(), crossings.end());
+            for (std::size_t i = 0; i + 1 < crossings.size(); i += 2)
+            {
+                // samples u with crossings[i] <= sample_x(u) < crossings[i + 1]
+                const double u0 = std::ceil(sample_index(crossings[i], left));
+                const double u1 = std::ceil(sample_index(crossings[i + 1], left)) - 1;
+                if (u1 < u0 or u1 < 0 or u0 >= static_cast<double>(cols) * samples)
+                    continue;
+                const int c0 = std::max(0, static_cast<int>(u0) / samples);
+                const int c1 = std::min(cols - 1, static_cast<int>(u1) / samples);
+                row_spans.emplace_back(c0, c1);
+            }
+            if ((v + 1) % samples == 0 or v == v1)
+            {
+                merge(row, row_spans, spans);
+                row++;
+            }
+        }
+        return spans;
+    };
+
+private:
+    double left, top, tile;
+    int cols, rows, samples;
+
+    // fractional index of the sample at coordinate p, along an axis starting at origin
+    double sample_index(double p, double origin) const
+    { return ((p - origin) / tile + 0.5) * samples - 0.5; };
+
+    static void merge(int row, std::vector<std::pair<int, int>> &row_spans, std::vector<Span> &spans)
+    {
+        std::sort(row_spans.begin(), row_spans.end());
+        for (const auto &[c0, c1] : row_spans)
+            if (not spans.empty() and spans.back().row == row and c0 <= spans.back().last + 1)
+                spans.back().last = std::max(spans.back().last, c1);
+            else
+                spans.push_back(Span{row, c0, c1});
+        row_spans.clear();
+    };
+};
+
+#endif // POLYGON_RASTER_H
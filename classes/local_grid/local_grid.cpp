@@ -1,5 +1,6 @@
 #include "local_grid.h"
 #include "qgraphicscellitem.h"
+#include <threadpool/threadpool.h>
 #include <cppitertools/zip.hpp>
 #include <cppitertools/range.hpp>
 #include <cppitertools/slice.hpp>
@@ -24,28 +25,37 @@ void Local_Grid::initialize(  Ranges angle_dim_,
     // clean existing map
     for (const auto &[key, value]: fmap)
         scene->removeItem(value.tile);
-    fmap.clear();
 
-    int id = 0;
-    for (int ang = angle_dim.init; ang < angle_dim.end; ang += angle_dim.step)
-        for (int rad = radius_dim.init; rad < radius_dim.end; rad += radius_dim.step)
+    // dense [ang_bin][rad_bin] storage, with the sines and cosines of the bins computed once
+    angle_bins = angle_dim.size();
+    radius_bins = radius_dim.size();
+    fmap.reset(radius_dim.init, angle_dim.init, radius_bins, angle_bins, radius_dim.step, angle_dim.step);
+    bin_sin.resize(angle_bins);
+    bin_cos.resize(angle_bins);
+    for (int a = 0; a < angle_bins; a++)
+    {
+        const int ang = angle_dim.init + a * angle_dim.step;
+        bin_sin[a] = sin(qDegreesToRadians((float)ang));
+        bin_cos[a] = cos(qDegreesToRadians((float)ang));
+    }
+    centres.resize(fmap.slots());
+    for (int a = 0; a < angle_bins; a++)
+        for (int r = 0; r < radius_bins; r++)
         {
+            const int ang = angle_dim.init + a * angle_dim.step, rad = radius_dim.init + r * radius_dim.step;
             T aux;
-            aux.id = id++;
+            aux.id = a * radius_bins + r;
             aux.free = true;
             aux.visited = false;
-            aux.cost = 1.0;
+            centres[aux.id] = Eigen::Vector2f(rad * bin_sin[a], rad * bin_cos[a]);
             QGraphicsCellItem *tile = new QGraphicsCellItem(qDegreesToRadians((float)ang), rad, qDegreesToRadians((float)angle_dim.step), radius_dim.step);
-            tile->setPos(rad*sin(qDegreesToRadians((float)ang)), rad*cos(qDegreesToRadians((float)ang)));
+            tile->setPos(centres[aux.id].x(), centres[aux.id].y());
             tile->setRotation(-ang);
             scene->addItem(tile);
             aux.tile = tile;
-            fmap.insert(std::make_pair(Key(ang, rad), aux));
+            fmap.emplace(Key(ang, rad), aux);
         }
-
-    //auto kv = std::views::keys(fmap);
-    //keys_vector.assign(kv.begin(), kv.end());
-    //std::ranges::sort(keys_vector, [](auto a, auto b){return (a.ang*a.ang)+(a.rad*a.rad) < (b.ang*b.ang)+(b.rad*b.rad);});
+    log_odds_valid = false;
 
     // draw outlines
    for(auto &e : lines)
@@ -53,8 +63,8 @@ void Local_Grid::initialize(  Ranges angle_dim_,
    for(auto &c : circles)
        scene->removeItem(c);
    QColor outline_color("lightblue");
-   for (float ang = 0; ang < angle_dim.end; ang += angle_dim.step)
-       lines.push_back(scene->addLine(0, 0, radius_dim.end*sin(qDegreesToRadians((float)ang)), radius_dim.end*cos(qDegreesToRadians((float)ang)), QPen(outline_color, 30)));
+   for (int a = 0; a < angle_bins; a++)
+       lines.push_back(scene->addLine(0, 0, radius_dim.end*bin_sin[a], radius_dim.end*bin_cos[a], QPen(outline_color, 30)));
    for (float rad = radius_dim.init; rad < radius_dim.end; rad += radius_dim.step)
    {
        auto s = scene->addEllipse(0, 0, rad*2, rad*2, QPen(outline_color, 20));
@@ -62,8 +72,10 @@ void Local_Grid::initialize(  Ranges angle_dim_,
        circles.push_back(s);
    }
 
-   // create cost matrix
-   costs = cv::Mat::ones(angle_dim.size(), radius_dim.size(), CV_8UC1);   // rows, cols
+   // cost plane, rows are angle bins
+   costs = cv::Mat::ones(angle_bins, radius_bins, CV_32FC1);
+   if (rollout.size() > 0)
+       rollout.build(rollout_lattice(), rollout.arcs(), rollout.parameters());
 
    // human png
     human_image.load("human.png");
@@ -80,36 +92,21 @@ void Local_Grid::insert(const Key &key, const T &value)
 }
 inline std::tuple<bool, Local_Grid::T&> Local_Grid::getCell(int ang, int rad)
 {
-    //qInfo() << __FUNCTION__ << ((ang<angle_dim.init) or ang>=angle_dim.end or rad<radius_dim.init or rad>=radius_dim.end);
     if(ang<angle_dim.init or ang>=angle_dim.end or rad<radius_dim.init or rad>=radius_dim.end)
         return std::forward_as_tuple(false, T());
-    else
-    {
-        Key key = pointToKey(ang, rad);
-        //qInfo() << __FUNCTION__ << key.ang << key.rad;
-        try
-        { return std::forward_as_tuple(true, fmap.at(key)); }
-        catch (const std::exception &e)
-        {
-            //qWarning() << __FUNCTION__ << " No key found in grid: (" << key.ang << key.rad << ")";
-            return std::forward_as_tuple(false, T());
-        }
-    }
+    if (auto cell = fmap.find_cell(pointToKey(ang, rad)); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    //qWarning() << __FUNCTION__ << " No key found in grid: (" << ang << rad << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Local_Grid::T&> Local_Grid::getCell(const Key &k)
 {
     if(k.ang<angle_dim.init or k.ang>=angle_dim.end or k.rad<radius_dim.init or k.rad>=radius_dim.end)
         return std::forward_as_tuple(false, T());
-    else
-      try
-      {
-          return std::forward_as_tuple(true, fmap.at(pointToKey(k.ang, k.rad)));
-      }
-      catch(const std::exception &e)
-      {
-          qWarning() << __FUNCTION__ << " No key found in grid: (" << k.ang << k.rad << ")";
-          return std::forward_as_tuple(false, T());
-      }
+    if (auto cell = fmap.find_cell(pointToKey(k.ang, k.rad)); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    qWarning() << __FUNCTION__ << " No key found in grid: (" << k.ang << k.rad << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Local_Grid::T&> Local_Grid::getCell(const Eigen::Vector2f &p)  //polar coordinates
 {
@@ -139,6 +136,14 @@ Local_Grid::Key Local_Grid::pointToKey(const Eigen::Vector2f &p) const
     return Key(dim.left() + ka * TILE_SIZE, dim.top() + kr * TILE_SIZE);
 };
 
+Eigen::Vector2f Local_Grid::polar_to_cartesian(const Key &k) const
+{
+    if (angle_bins == 0)
+        return Eigen::Vector2f::Zero();
+    const int a = std::clamp<int>(rint((k.ang - angle_dim.init) / angle_dim.step), 0, angle_bins - 1);
+    return Eigen::Vector2f(k.rad * bin_sin[a], k.rad * bin_cos[a]);
+}
+
 //////////////////////////////// STATUS //////////////////////////////////////////
 bool Local_Grid::is_occupied(const Eigen::Vector2f &p)
 {
@@ -212,24 +217,60 @@ void Local_Grid::add_hit(const Eigen::Vector2f &p)
         this->updated++;
     }
 }
+void Local_Grid::log_update(const Eigen::Vector2f &p, float prob)
+{
+    static const double TRESHOLD_L_FREE = log_odds(0.3);
+    static const double TRESHOLD_L_OCC = log_odds(0.6);
+
+    auto pd = radians_to_degrees(p.x());
+    auto &&[success, v] = getCell(pd, p.y());
+    if(success)
+    {
+        v.log_odds += log_odds(prob);
+        if (log_odds_valid and v.id < log_odds_plane.size())
+            log_odds_plane[v.id] = LogOddsKernel::to_fixed(v.log_odds);
+        if (v.log_odds < TRESHOLD_L_FREE)
+        {
+            v.free = true;
+            if(v.tile != nullptr)
+                v.tile->setFreeColor();
+        }
+        else if (v.log_odds > TRESHOLD_L_OCC)
+        {
+            v.free = false;
+            if(v.tile != nullptr)
+                v.tile->setOccupiedColor(0);
+        }
+        this->updated++;
+    }
+}
+double Local_Grid::log_odds(double prob)
+{
+    // l(x) = log(p(x) / (1 - p(x)))
+    return log(prob / (1 - prob));
+}
+double Local_Grid::retrieve_p(double l)
+{
+    // p(x) = 1 - 1 / (1 + exp(l(x)))
+    return 1 - 1 / (1 + exp(l));
+}
 void Local_Grid::setCost(const Key &k,float cost)
 {
     auto &&[success, v] = getCell(k);
     if(success)
-        v.cost = cost;
+        cost_of(v) = cost;
 }
 float Local_Grid::get_cost(const Eigen::Vector2f &p)
 {
     auto &&[success, v] = getCell(p.x(), p.y());
     if(success)
-        return v.cost;
+        return cost_of(v);
     else
         return -1;
 }
 void Local_Grid::set_all_costs(float value)
 {
-    for(auto &[key, cell] : fmap)
-        cell.cost = value;
+    costs.setTo(value);
 }
 int Local_Grid::count_total() const
 {
@@ -371,19 +412,17 @@ std::vector<std::pair<Local_Grid::Key, Local_Grid::T>> Local_Grid::neighboors(co
 }
 std::vector<std::pair<Local_Grid::Key, Local_Grid::T>> Local_Grid::neighboors_8(const Local_Grid::Key &k, bool all)
 {
-    const int &I = angle_dim.step;
-    const int &J = radius_dim.step;
-    static const std::vector<int> ang_incs = {I, I, I, 0, -I, -I, -I, 0};
-    static const std::vector<int> rad_incs = {J, 0, -J, -J, -J, 0, J, J};
-    return this->neighboors(k, ang_incs, rad_incs, all);
+    std::vector<std::pair<Key, T>> neigh;
+    neigh.reserve(neighbourhood::N8.size());
+    for_each_neighbour<neighbourhood::N8>(k, [&neigh](const Key &nk, const T &cell){ neigh.emplace_back(nk, cell); }, all);
+    return neigh;
 }
 std::vector<std::pair<Local_Grid::Key, Local_Grid::T>> Local_Grid::neighboors_16(const Local_Grid::Key &k, bool all)
 {
-    const int &I = angle_dim.step;
-    const int &J = radius_dim.step;
-    static const std::vector<int> ang_incs = {0,   I,   2*I,  2*I, 2*I, 2*I, 2*I, I, 0, -I, -2*I, -2*I,-2*I,-2*I,-2*I, -I};
-    static const std::vector<int> rad_incs = {2*J, 2*J, 2*J,  J,   0 , -J , -2*J, -2*J,-2*J,-2*J,-2*J, -J, 0,J, 2*J, 2*J};
-    return this->neighboors(k, ang_incs, rad_incs, all);
+    std::vector<std::pair<Key, T>> neigh;
+    neigh.reserve(neighbourhood::N16.size());
+    for_each_neighbour<neighbourhood::N16>(k, [&neigh](const Key &nk, const T &cell){ neigh.emplace_back(nk, cell); }, all);
+    return neigh;
 }
 /**
  @brief Recovers the optimal path from the list of previous nodes
@@ -418,10 +457,10 @@ inline double Local_Grid::heuristicL2(const Key &a, const Key &b) const
 /////////////////////////////// COSTS /////////////////////////////////////////////////////////
 void Local_Grid::update_costs(bool wide)
 {
-    for(auto &&[k,v] : iter::filter([](auto v){ return std::get<1>(v).cost > 1;}, fmap))
+    for(auto &&[k,v] : iter::filter([this](auto v){ return cost_of(std::get<1>(v)) > 1;}, fmap))
     {
         v.tile->setFreeColor();
-        v.cost = 1.f;
+        cost_of(v) = 1.f;
     }
 
     //update grid values
@@ -429,50 +468,36 @@ void Local_Grid::update_costs(bool wide)
     {
         for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
         {
-            v.cost = 100;
+            cost_of(v) = 100;
             v.tile->setOccupiedColor(0);
-            for (auto neighs = neighboors_16(k); auto &&[kk, vv]: neighs)
+            for_each_neighbour<neighbourhood::N16>(k, [this](const Key &, T &vv)
             {
-                fmap.at(kk).cost = 100;
-                fmap.at(kk).tile->setOccupiedColor(0);
-            }
+                cost_of(vv) = 100;
+                vv.tile->setOccupiedColor(0);
+            });
         }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 100; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 100)
-                {
-                    fmap.at(kk).cost = 50;
-                    fmap.at(kk).tile->setOccupiedColor(1);
-                }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 50; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 50)
-                {
-                    fmap.at(kk).cost = 25;
-                    fmap.at(kk).tile->setOccupiedColor(2);
-                }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 25; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &[kk, vv]: neighs)
-            {
-                if (vv.cost < 25)
+        auto ring = [this](float from, float to, int color)
+        {
+            for (auto &&[k, v]: iter::filter([this, from](auto v) { return cost_of(std::get<1>(v)) == from; }, fmap))
+                for_each_neighbour<neighbourhood::N8>(k, [&](const Key &, T &vv)
                 {
-                    fmap.at(kk).cost = 15;
-                    fmap.at(kk).tile->setOccupiedColor(3);
-                }
-            }
+                    if (cost_of(vv) < from)
+                    {
+                        cost_of(vv) = to;
+                        vv.tile->setOccupiedColor(color);
+                    }
+                });
+        };
+        ring(100, 50, 1);
+        ring(50, 25, 2);
+        ring(25, 15, 3);
     }
     else  // not wide
     {
         for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
         {
-            v.cost = 100;
+            cost_of(v) = 100;
             v.tile->setOccupiedColor(0);
-            fmap.at(k).cost = 100;
-            fmap.at(k).tile->setOccupiedColor(0);
         }
     }
 }
@@ -501,10 +526,200 @@ void Local_Grid::update_map_from_polar_data( const std::vector<Eigen::Vector2f>
     }
     //update_costs(true);
 }
-void Local_Grid::update_map_from_3D_points( const std::vector<std::tuple<float, float, float>> &points)
+void Local_Grid::update_map_from_polar_data_log_odds(const std::vector<Eigen::Vector2f> &points, float max_laser_range,
+                                                     ThreadPool *pool)
+{
+    if (fmap.slots() == 0 or radius_bins == 0)
+        return;
+    sync_log_odds_plane();
+    scan_run.assign(angle_bins, -1);
+    scan_tips.clear();
+    for(const auto &point : points) // point.x() = angle; point.y() = radius
+    {
+        const float deg = radians_to_degrees(point.x());
+        if (deg < angle_dim.init or deg >= angle_dim.end)
+            continue;
+        const int a = rint((deg - angle_dim.init) / angle_dim.step);
+        if (a >= angle_bins)
+            continue;
+        // same bins as add_miss/add_hit: misses from the centre up to the cell before the tip
+        const int tip = rint((point.y() - radius_dim.init) / radius_dim.step);
+        scan_run[a] = std::max(scan_run[a], std::clamp(tip, 0, radius_bins));
+        if (point.y() < max_laser_range and point.y() >= radius_dim.init and point.y() < radius_dim.end and tip < radius_bins)
+            scan_tips.push_back(a * radius_bins + tip);
+    }
+    apply_polar_spans(pool);
+}
+void Local_Grid::apply_polar_spans(ThreadPool *pool)
 {
+    std::sort(scan_tips.begin(), scan_tips.end());
+    scan_tips.erase(std::unique(scan_tips.begin(), scan_tips.end()), scan_tips.end());
+    const std::size_t workers = (pool == nullptr) ? 1 : std::min<std::size_t>(std::thread::hardware_concurrency(), angle_bins);
+    if (scan_flips.size() < workers)
+        scan_flips.resize(workers);
 
+    // sectors of whole angular bins, so workers never share a cell
+    const int block = (angle_bins + workers - 1) / workers;
+    if (workers == 1)
+        apply_polar_rows(0, angle_bins, scan_flips[0]);
+    else
+        pool->parallel_for(0, workers, 1, [this, block](std::size_t w)
+            { apply_polar_rows(std::min<int>(angle_bins, w * block), std::min<int>(angle_bins, (w + 1) * block), scan_flips[w]); });
+    // scene items are only touched from the calling thread
+    for (std::size_t w = 0; w < workers; w++)
+        for (const auto &id : scan_flips[w])
+            if (auto &v = fmap.slot(id).second; v.tile != nullptr)
+            {
+                if (v.free) v.tile->setFreeColor();
+                else v.tile->setOccupiedColor(0);
+            }
+}
+void Local_Grid::apply_polar_rows(int a0, int a1, std::vector<std::uint32_t> &flips)
+{
+    flips.clear();
+    const int first = std::max<int>(0, rint(-radius_dim.init / radius_dim.step));   // bin of radius 0
+    const auto hit = log_odds_kernel.hit(), miss = log_odds_kernel.miss();
+    auto tip = std::lower_bound(scan_tips.begin(), scan_tips.end(), static_cast<std::uint32_t>(a0 * radius_bins));
+    for (int a = a0; a < a1; a++)
+    {
+        const std::uint32_t row = a * radius_bins;
+        const auto tips_end = std::lower_bound(tip, scan_tips.end(), row + radius_bins);
+        const int run = scan_run[a];
+        if (run < 0 and tip == tips_end)
+            continue;
+        // free run split around the tips inside it, so a tip gets only its hit
+        int r = first, end = std::max(first, run);
+        for (auto t = tip; t != tips_end; ++t)
+        {
+            const int tr = *t - row;
+            if (tr > r and r < end)
+                log_odds_kernel.add_span(log_odds_plane.data() + row + r, std::min(tr, end) - r, miss);
+            r = std::max(r, tr + 1);
+            log_odds_plane[*t] = log_odds_kernel.add(log_odds_plane[*t], hit);
+        }
+        if (r < end)
+            log_odds_kernel.add_span(log_odds_plane.data() + row + r, end - r, miss);
 
+        // threshold the touched part of the row and write it back to the cells
+        const int last = std::max(end, tip != tips_end ? static_cast<int>(*(tips_end - 1) - row) + 1 : 0);
+        const int lo = std::min(first, tip != tips_end ? static_cast<int>(*tip - row) : first);
+        for (int c = lo; c < last; c++)
+            log_odds_occupied[row + c] = not fmap.slot(row + c).second.free;
+        log_odds_kernel.classify(log_odds_plane.data() + row + lo, log_odds_occupied.data() + row + lo, last - lo);
+        for (int c = lo; c < last; c++)
+        {
+            auto &v = fmap.slot(row + c).second;
+            v.log_odds = LogOddsKernel::to_log_odds(log_odds_plane[row + c]);
+            if (const bool free = not log_odds_occupied[row + c]; free != v.free)
+            {
+                v.free = free;
+                flips.push_back(row + c);
+            }
+        }
+        tip = tips_end;
+    }
+}
+void Local_Grid::set_log_odds_params(const LogOddsKernel::Params &p)
+{
+    log_odds_kernel = LogOddsKernel(p);
+    log_odds_valid = false;
+}
+void Local_Grid::sync_log_odds_plane()
+{
+    if (log_odds_valid and log_odds_plane.size() == fmap.slots())
+        return;
+    log_odds_plane.assign(fmap.slots(), 0);
+    log_odds_occupied.assign(fmap.slots(), 0);
+    for (std::size_t i = 0; i < fmap.slots(); i++)
+        if (fmap.contains(i))
+            log_odds_plane[i] = LogOddsKernel::to_fixed(fmap.slot(i).second.log_odds);
+    log_odds_valid = true;
+}
+void Local_Grid::set_cloud_params(const CloudParams &p)
+{
+    cloud_params = p;
+}
+void Local_Grid::update_map_from_3D_points(const std::vector<std::tuple<float, float, float>> &points, ThreadPool *pool)
+{
+    bin_cloud(points.size(), [&points](std::size_t i)
+        { const auto &[x, y, z] = points[i]; return Eigen::Vector3f(x, y, z); }, pool);
+}
+void Local_Grid::update_map_from_3D_points(const float *xyz, std::size_t count, std::size_t stride, ThreadPool *pool)
+{
+    if (xyz == nullptr or stride < 3)
+        return;
+    bin_cloud(count, [xyz, stride](std::size_t i)
+        { return Eigen::Vector3f(Eigen::Map<const Eigen::Vector3f>(xyz + i * stride)); }, pool);
+}
+template<typename PointAt>
+void Local_Grid::bin_cloud(std::size_t count, PointAt &&point_at, ThreadPool *pool)
+{
+    if (fmap.slots() == 0 or radius_bins == 0 or count == 0)
+        return;
+    const float max_range = cloud_params.max_range > 0.f ? std::min(cloud_params.max_range, radius_dim.end) : radius_dim.end;
+    const float voxel = std::max(cloud_params.voxel_size, 1.f);
+    const std::size_t workers = (pool == nullptr) ? 1 : std::min<std::size_t>(std::thread::hardware_concurrency(), (count + 4095) / 4096);
+    if (cloud_voxels.size() < workers)
+    {
+        cloud_voxels.resize(workers);
+        cloud_min_range.resize(workers);
+    }
+    const std::size_t block = (count + workers - 1) / workers;
+
+    // filter, downsample and keep the closest range of every angle bin
+    auto bin_block = [&, this](std::size_t begin, std::size_t end, std::vector<std::uint64_t> &voxels, std::vector<float> &min_range)
+    {
+        min_range.assign(angle_bins, std::numeric_limits<float>::max());
+        std::size_t capacity = 64;
+        while (capacity < 2 * (end - begin)) capacity <<= 1;
+        voxels.assign(capacity, 0);   // 0 is the empty slot: keys are xor'ed with a constant below
+        const std::size_t mask = capacity - 1;
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const Eigen::Vector3f p = point_at(i);
+            if (not (p.z() >= cloud_params.min_height and p.z() <= cloud_params.max_height))   // also drops NaN
+                continue;
+            const float rad = std::hypot(p.x(), p.y());
+            if (rad >= max_range or rad < radius_dim.init)
+                continue;
+            const std::uint64_t key = ((static_cast<std::uint64_t>(static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(p.x() / voxel)))) << 32)
+                                       | static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(p.y() / voxel)))) ^ 0x8000000080000000ull;
+            std::size_t h = (key * 0x9E3779B97F4A7C15ull) >> 20 & mask;
+            while (voxels[h] != 0 and voxels[h] != key)
+                h = (h + 1) & mask;
+            if (voxels[h] == key)
+                continue;
+            voxels[h] = key;
+            const float deg = radians_to_degrees(std::atan2(p.x(), p.y()));
+            if (deg < angle_dim.init or deg >= angle_dim.end)
+                continue;
+            if (const int a = rint((deg - angle_dim.init) / angle_dim.step); a < angle_bins)
+                min_range[a] = std::min(min_range[a], rad);
+        }
+    };
+    if (workers == 1)
+        bin_block(0, count, cloud_voxels[0], cloud_min_range[0]);
+    else
+        pool->parallel_for(0, workers, 1, [&bin_block, this, block, count](std::size_t w)
+            { bin_block(std::min(count, w * block), std::min(count, (w + 1) * block), cloud_voxels[w], cloud_min_range[w]); });
+
+    // min over workers, then the same span update as the polar scans
+    sync_log_odds_plane();
+    scan_run.assign(angle_bins, -1);
+    scan_tips.clear();
+    for (int a = 0; a < angle_bins; a++)
+    {
+        float range = cloud_min_range[0][a];
+        for (std::size_t w = 1; w < workers; w++)
+            range = std::min(range, cloud_min_range[w][a]);
+        if (range == std::numeric_limits<float>::max())
+            continue;
+        const int tip = rint((range - radius_dim.init) / radius_dim.step);
+        scan_run[a] = std::clamp(tip, 0, radius_bins);
+        if (tip < radius_bins)
+            scan_tips.push_back(a * radius_bins + tip);
+    }
+    apply_polar_spans(pool);
 }
 void Local_Grid::update_semantic_layer(float ang, float dist, int object, int type)  // ang: -PI, PI is translated to 0-360 with 0,360 at front. dist mm
 {
@@ -512,54 +727,129 @@ void Local_Grid::update_semantic_layer(float ang, float dist, int object, int ty
     auto &&[success, v] = getCell(int(ang), int(dist));
     if(success)
     {
-        if(not semantic_map.contains(object))
+        const auto now = rc::Timer<>::now();
+        auto it = semantic_map.find(object);
+        if(it == semantic_map.end())
         {
-            float x = dist * sin(qDegreesToRadians(ang));
-            float y= -dist * cos(qDegreesToRadians(ang));
-            semantic_map.insert(std::make_pair(object, Object{.id=object,
-                    .ang=ang,
-                    .dist=dist,
-                    //.bbox=scene->addRect(- 250, - 250, 500, 500, QPen(QColor("green"), 40)),
-                    //.bbox=scene->addPixmap(human_image),
-                    .timestamp=rc::Timer<>::now()}));
-            if(type==0)  //human
-            {
-                semantic_map[object].bbox=scene->addPixmap(human_image);
-                semantic_map[object].bbox->setPos(x-human_image.width()/2, y-human_image.height()/2);
-            }
-            else if(type==56)  //chair
+            it = semantic_map.emplace(object, Object{.id=object, .ang=ang, .dist=dist, .timestamp=now, .type=type}).first;
+            semantic_bins[semantic_bin(ang)].push_back(object);
+            pending_created.push_back(object);
+        }
+        else //update only position and timealive
+        {
+            auto &o = it->second;
+            if (const int from = semantic_bin(o.ang), to = semantic_bin(ang); from != to)
             {
-                semantic_map[object].bbox=scene->addPixmap(chair_image);
-                semantic_map[object].bbox->setPos(x-chair_image.width()/2, y-chair_image.height()/2);
-
+                std::erase(semantic_bins[from], object);
+                semantic_bins[to].push_back(object);
             }
-            else if(type==58)  //plant
+            o.ang = ang;
+            o.dist = dist;
+            o.timestamp = now;
+            if (not o.moved and o.bbox != nullptr)
             {
-                semantic_map[object].bbox = scene->addPixmap(plant_image);
-                semantic_map[object].bbox->setPos(x-chair_image.width()/2, y-chair_image.height()/2);
+                o.moved = true;
+                pending_moved.push_back(object);
             }
+        }
+        // reschedule in the wheel slot of its new deadline
+        if (expiry_wheel.empty())
+            expiry_wheel.resize(params.max_object_unseen_timelife / WHEEL_TICK + 2);
+        auto &o = it->second;
+        if (const std::int64_t tick = (now + params.max_object_unseen_timelife) / WHEEL_TICK + 1; tick != o.deadline_tick)
+        {
+            o.deadline_tick = tick;
+            expiry_wheel[tick % expiry_wheel.size()].push_back(object);
+        }
+        expire_semantic_objects();
+    }
+}
+void Local_Grid::expire_semantic_objects()
+{
+    if (expiry_wheel.empty())
+        return;
+    const std::int64_t now_tick = rc::Timer<>::now() / WHEEL_TICK;
+    if (wheel_tick < 0)
+        wheel_tick = now_tick;
+    // every slot at most once, even after a long pause
+    const std::int64_t size = expiry_wheel.size();
+    for (std::int64_t t = std::max(wheel_tick + 1, now_tick - size + 1); t <= now_tick; t++)
+    {
+        auto &slot = expiry_wheel[t % size];
+        for (const auto id : slot)
+            if (auto it = semantic_map.find(id); it != semantic_map.end() and it->second.deadline_tick <= now_tick)
+                remove_semantic_object(it);
+        slot.clear();   // entries of objects seen again are stale, they have a later slot
+    }
+    wheel_tick = now_tick;
+}
+void Local_Grid::remove_semantic_object(std::map<int, Object>::iterator it)
+{
+    std::erase(semantic_bins[semantic_bin(it->second.ang)], it->first);
+    if (it->second.bbox != nullptr)
+        pending_removed.push_back(it->second.bbox);
+    semantic_map.erase(it);
+}
+void Local_Grid::flush_semantic_items()
+{
+    auto place = [this](Object &o)
+    {
+        const float x = o.dist * sin(qDegreesToRadians(o.ang)), y = -o.dist * cos(qDegreesToRadians(o.ang));
+        if (o.type == 0)
+            o.bbox->setPos(x - human_image.width() / 2, y - human_image.height() / 2);
+        else if (o.type == 56 or o.type == 58)
+            o.bbox->setPos(x - chair_image.width() / 2, y - chair_image.height() / 2);
+        else
+            o.bbox->setPos(x, y);
+    };
+    for (auto item : pending_removed)
+    {
+        scene->removeItem(item);
+        delete item;
+    }
+    for (const auto id : pending_created)
+        if (auto it = semantic_map.find(id); it != semantic_map.end() and it->second.bbox == nullptr)
+        {
+            auto &o = it->second;
+            if (o.type == 0)  //human
+                o.bbox = scene->addPixmap(human_image);
+            else if (o.type == 56)  //chair
+                o.bbox = scene->addPixmap(chair_image);
+            else if (o.type == 58)  //plant
+                o.bbox = scene->addPixmap(plant_image);
             else
-            {
-                semantic_map[object].bbox = scene->addRect(-250, -250, 500, 500, QPen(QColor("green"), 40), QBrush(QColor("green")));
-                semantic_map[object].bbox->setPos(dist * sin(qDegreesToRadians(ang)), -dist * cos(qDegreesToRadians(ang)));
-            }
+                o.bbox = scene->addRect(-250, -250, 500, 500, QPen(QColor("green"), 40), QBrush(QColor("green")));
+            place(o);
         }
-        else //update only position and timealive
+    for (const auto id : pending_moved)
+        if (auto it = semantic_map.find(id); it != semantic_map.end() and it->second.bbox != nullptr)
         {
-            semantic_map[object].ang = ang;
-            semantic_map[object].dist = dist;
-            semantic_map[object].bbox->setPos(dist*sin(qDegreesToRadians(ang)), -dist*cos(qDegreesToRadians(ang)));
-            semantic_map[object].timestamp = rc::Timer<>::now();
+            it->second.moved = false;
+            place(it->second);
         }
-        // get list of removable objects
-        auto removable = semantic_map | std::views::values | std::views::filter([p = params](auto o) { return (rc::Timer<>::now() - o.timestamp) > p.max_object_unseen_timelife; });
-        for(const auto &r : removable)
+    pending_removed.clear();
+    pending_created.clear();
+    pending_moved.clear();
+}
+std::optional<int> Local_Grid::nearest_object(float ang, float dist, float max_distance) const
+{
+    ang = 180 - qRadiansToDegrees(ang);
+    const Eigen::Vector2f p(dist * sin(qDegreesToRadians(ang)), -dist * cos(qDegreesToRadians(ang)));
+    const int bin = semantic_bin(ang);
+    std::optional<int> best;
+    float best_d = max_distance;
+    for (int b = bin - 1; b <= bin + 1; b++)
+        for (const auto id : semantic_bins[(b + SEMANTIC_BINS) % SEMANTIC_BINS])
         {
-            scene->removeItem(r.bbox);
-            delete r.bbox;
-            semantic_map.erase(r.id);
+            const auto &o = semantic_map.at(id);
+            const Eigen::Vector2f q(o.dist * sin(qDegreesToRadians(o.ang)), -o.dist * cos(qDegreesToRadians(o.ang)));
+            if (const float d = (p - q).norm(); d <= best_d)
+            {
+                best_d = d;
+                best = id;
+            }
         }
-    }
+    return best;
 }
 /////////////////////////////// AUX /////////////////////////////////////////////////////////
 bool Local_Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coordinates
@@ -569,11 +859,35 @@ bool Local_Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // gr
            return true;
     return false;
 }
+void Local_Grid::set_rollout_arcs(const std::vector<RolloutKernel::Arc> &arcs, const RolloutKernel::Params &params)
+{
+    rollout.build(rollout_lattice(), arcs, params);
+}
+void Local_Grid::evaluate_rollouts(std::vector<RolloutKernel::Score> &scores, ThreadPool *pool)
+{
+    scores.resize(rollout.size());
+    if (rollout.size() == 0)
+        return;
+    rollout.set_plane(costs.ptr<float>(), [this](std::size_t id)
+    { return not fmap.contains(id) or not fmap.slot(id).second.free; });
+    if (pool != nullptr and rollout.size() > 64)
+        pool->parallel_for(0, rollout.size(), 32, [this, &scores](std::size_t i) { scores[i] = rollout.evaluate(i); });
+    else
+        for (std::size_t i = 0; i < rollout.size(); i++)
+            scores[i] = rollout.evaluate(i);
+}
+std::vector<RolloutKernel::Score> Local_Grid::evaluate_rollouts(ThreadPool *pool)
+{
+    std::vector<RolloutKernel::Score> scores;
+    evaluate_rollouts(scores, pool);
+    return scores;
+}
 void Local_Grid::clear()
 {
     for (const auto &[key, value]: fmap)
         scene->removeItem(value.tile);
     fmap.clear();
+    log_odds_valid = false;
 }
 ////////////////////////////// NEIGHS /////////////////////////////////////////////////////////
 std::optional<QPointF> Local_Grid::closestMatching_spiralMove(const QPointF &p, std::function<bool(std::pair<Local_Grid::Key, Local_Grid::T>)> pred)
@@ -16,10 +16,14 @@
 #define LOCAL_GRID_H
 
 #include <unordered_map>
+#include <array>
+#include <map>
+#include <optional>
 #include <boost/functional/hash.hpp>
 #include <iostream>
 #include <fstream>
 #include <limits>
+#include <cmath>
 #include <tuple>
 #include <QGraphicsScene>
 #include <QGraphicsRectItem>
@@ -34,8 +38,14 @@
 #include "qgraphicscellitem.h"
 #include <ranges>
 #include <timer/timer.h>
+#include <grid2d/neighbourhood.h>
+#include <grid2d/log_odds_kernel.h>
+#include <grid2d/dense_map.h>
+#include "rollout_kernel.h"
 
 
+class ThreadPool;
+
 class Local_Grid
 {
     using Myclock = std::chrono::system_clock;
@@ -61,6 +71,13 @@ public:
             { is >> ang >> rad; };                       //method to read the keys
             //float operator-(const Key &other) const { return (ang-other.ang)*(ang-other.ang)+(rad-other.rad)*(rad-other.rad);}
     };
+    // dense layout [ang_bin][rad_bin]: radius along the rows of the lattice, angle across them
+    struct PolarKeyTraits
+    {
+        static long int x(const Key &k) { return k.rad; };
+        static long int z(const Key &k) { return k.ang; };
+        static Key make(long int x, long int z) { return Key(z, x); };
+    };
     struct KeyHasher
     {
         std::size_t operator()(const Key &k) const
@@ -76,13 +93,12 @@ public:
         };
     };
 
-    // Cell data structure
+    // Cell data structure. Costs are kept in the cost plane (see cost_plane)
     struct T
     {
-        std::uint32_t id;
+        std::uint32_t id;       // slot, ang_bin * radius bins + rad_bin
         bool free = true;
         bool visited = false;
-        float cost = 1;
         float hits = 0;
         float misses = 0;
         QGraphicsCellItem *tile;
@@ -98,23 +114,27 @@ public:
         { is >> free >> visited; };
     };
 
-    // Object data structure
+    // Object data structure. bbox stays null until flush_semantic_items creates it
     struct Object
     {
         int id;
         float ang;
         float dist;
-        QGraphicsItem *bbox;
+        QGraphicsItem *bbox = nullptr;
         std::int64_t timestamp;
+        int type = -1;
+        std::int64_t deadline_tick = 0;     // expiry wheel slot
+        bool moved = false;
     };
     std::map<int, Object> semantic_map;
 
-    using FMap = std::unordered_map<Key, T, KeyHasher>;
-    std::vector<Key> keys_vector;
+    // Dense storage over the angle_dim x radius_dim rectangle. KeyHasher is kept for users hashing keys
+    using FMap = DenseMap<Key, T, PolarKeyTraits>;
     struct Ranges
     {
         float init = 0, end = 0, step = 0;
-        std::size_t size() const { return init * end * step;}
+        std::size_t size() const    // number of bins
+        { return step > 0 and end > init ? static_cast<std::size_t>(std::ceil((end - init) / step)) : 0; };
     };
     int TILE_SIZE = 50;
     QRectF dim;
@@ -127,9 +147,50 @@ public:
     std::list<QPointF> computePath(const QPointF &source_, const QPointF &target_);
     std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
     void update_map_from_polar_data( const std::vector<Eigen::Vector2f> &points, float max_laser_range);
-    void update_map_from_3D_points(const std::vector<std::tuple<float, float, float>> &points);
+    // Fixed-point log-odds version (grid2d/log_odds_kernel.h). Each cell gets one increment per scan: hit() if a beam
+    // ends in it, else miss() if a beam crosses it. The free space of an angular bin is one contiguous run of radial
+    // bins updated with a single span operation, and bins are split in sectors across pool workers when a pool is given
+    void update_map_from_polar_data_log_odds(const std::vector<Eigen::Vector2f> &points, float max_laser_range,
+                                             ThreadPool *pool = nullptr);
+    void set_log_odds_params(const LogOddsKernel::Params &p);
+    // 3D clouds in the robot frame (mm, x right, y forward, z up). Points outside the height band or the range are
+    // dropped, the rest downsampled to one per voxel column and projected to polar bins. The closest point of every
+    // angular bin is a hit and the space before it free, applied as in update_map_from_polar_data_log_odds.
+    // Binning is split across pool workers when a pool is given
+    struct CloudParams
+    {
+        float min_height = 50.f;      // mm, floor and ceiling returns are ignored
+        float max_height = 1800.f;
+        float voxel_size = 50.f;      // mm
+        float max_range = 0.f;        // mm, 0 for radius_dim.end
+    };
+    void set_cloud_params(const CloudParams &p);
+    void update_map_from_3D_points(const std::vector<std::tuple<float, float, float>> &points, ThreadPool *pool = nullptr);
+    // Flat buffers, e.g. an Eigen::Map over a Matrix3Xf or a PCL cloud: point i is xyz[i*stride], xyz[i*stride+1],
+    // xyz[i*stride+2]
+    void update_map_from_3D_points(const float *xyz, std::size_t count, std::size_t stride = 3, ThreadPool *pool = nullptr);
+    // Semantic objects expire after max_object_unseen_timelife through a timing wheel, in O(1) per object.
+    // Scene items are not touched here: creations, moves and removals are queued until flush_semantic_items,
+    // to be called once per frame from the thread owning the scene
     void update_semantic_layer(float ang, float dist, int object, int type);
+    void expire_semantic_objects();
+    void flush_semantic_items();
+    // closest tracked object to (ang, dist), same convention as update_semantic_layer, within max_distance mm.
+    // Only the objects of the neighbouring angular bins are looked at
+    std::optional<int> nearest_object(float ang, float dist, float max_distance) const;
     bool is_path_blocked(const std::vector<Eigen::Vector2f> &path); // grid coordinates
+    // Trajectory rollouts for reactive control (rollout_kernel.h). set_rollout_arcs turns the candidate (v, w) arcs
+    // into the ids of the cells they enter, once, e.g. at startup; initialize() keeps them for the new geometry.
+    // evaluate_rollouts scores all of them against the current cells and costs in one call, scores[i] for arcs[i]:
+    // clearance, the mm of arc free before the first occupied cell or cell costing blocked_cost or more, and the sum
+    // of the costs before it. Candidates are split across pool workers when a pool is given
+    void set_rollout_arcs(const std::vector<RolloutKernel::Arc> &arcs, const RolloutKernel::Params &params);
+    void set_rollout_arcs(const std::vector<RolloutKernel::Arc> &arcs)
+    { set_rollout_arcs(arcs, RolloutKernel::Params()); };
+    void evaluate_rollouts(std::vector<RolloutKernel::Score> &scores, ThreadPool *pool = nullptr);
+    std::vector<RolloutKernel::Score> evaluate_rollouts(ThreadPool *pool = nullptr);
+    const RolloutKernel &rollouts() const
+    { return rollout; };
 
     // Cell access
     inline std::tuple<bool, T &> getCell(int ang, int rad);  // deg, mm
@@ -147,6 +208,16 @@ public:
     { return fmap.begin(); };
     size_t size() const
     { return fmap.size(); };
+    const FMap &cells() const
+    { return fmap; };
+    // CV_32FC1 plane of cell costs, angle bins x radius bins. Row-major in T::id order
+    const cv::Mat &cost_plane() const
+    { return costs; };
+    // Cartesian centre of a cell (x = rad * sin(ang), y = rad * cos(ang), as the tiles are drawn), from a table built
+    // by initialize
+    inline const Eigen::Vector2f &cell_centre(std::uint32_t id) const
+    { return centres[id]; };
+    Eigen::Vector2f polar_to_cartesian(const Key &k) const;   // any radius, angle snapped to its bin
 
     // Access to content
     void insert(const Key &key, const T &value);
@@ -183,6 +254,21 @@ public:
     std::optional<QPointF> closest_free(const QPointF &p);
     std::optional<QPointF> closest_free_4x4(const QPointF &p);
     std::tuple<bool, QVector2D> vectorToClosestObstacle(QPointF center);
+    // Neighbours of k over a constexpr offset table (grid2d/neighbourhood.h), dx in angle steps and dz in radius steps.
+    // f(const Key &, T &) is called for every existing neighbour, only the free ones unless all is true. No allocation or copies
+    template<const auto &Offsets, typename F>
+    void for_each_neighbour(const Key &k, F &&f, bool all = false)
+    {
+        const int I = angle_dim.step, J = radius_dim.step;
+        for (const auto &o : Offsets)
+        {
+            const Key nk = pointToKey(k.ang + o.dx * I, k.rad + o.dz * J);
+            if (nk.ang < angle_dim.init or nk.ang >= angle_dim.end or nk.rad < radius_dim.init or nk.rad >= radius_dim.end)
+                continue;
+            if (auto it = fmap.find(nk); it != fmap.end() and (all or it->second.free))
+                f(static_cast<const Key &>(it->first), it->second);
+        }
+    };
     std::vector<std::pair<Key, T>> neighboors(const Key &k, const std::vector<int> &xincs, const std::vector<int> &zincs, bool all = false);
     std::vector<std::pair<Key, T>> neighboors_8(const Key &k, bool all = false);
     std::vector<std::pair<Key, T>> neighboors_16(const Key &k, bool all = false);
@@ -194,6 +280,37 @@ private:
     std::vector<QGraphicsRectItem *> scene_grid_points;
     double updated=0.0, flipped=0.0;
     cv::Mat costs;
+    inline float &cost_of(const T &v)
+    { return costs.ptr<float>()[v.id]; };
+
+    // bins of the dense layout, angle bin sines and cosines and cell centres
+    int angle_bins = 0, radius_bins = 0;
+    std::vector<float> bin_sin, bin_cos;
+    std::vector<Eigen::Vector2f> centres;
+
+    // log-odds plane indexed by T::id plus the scan being applied: per angle bin, end of the free run (-1 if no beam)
+    // and sorted ids of the cells holding a beam tip
+    LogOddsKernel log_odds_kernel;
+    std::vector<LogOddsKernel::Value> log_odds_plane;
+    std::vector<std::uint8_t> log_odds_occupied;
+    std::vector<std::int32_t> scan_run;
+    std::vector<std::uint32_t> scan_tips;
+    std::vector<std::vector<std::uint32_t>> scan_flips;   // per worker
+    bool log_odds_valid = false;
+    void sync_log_odds_plane();
+    void apply_polar_spans(ThreadPool *pool);
+    void apply_polar_rows(int a0, int a1, std::vector<std::uint32_t> &flips);
+
+    RolloutKernel rollout;
+    RolloutKernel::Lattice rollout_lattice() const
+    { return RolloutKernel::Lattice{angle_dim.init, angle_dim.step, angle_bins, radius_dim.init, radius_dim.step, radius_bins}; };
+
+    // update_map_from_3D_points state: per worker voxel hash set and closest range per angle bin
+    CloudParams cloud_params;
+    std::vector<std::vector<std::uint64_t>> cloud_voxels;
+    std::vector<std::vector<float>> cloud_min_range;
+    template<typename PointAt>
+    void bin_cloud(std::size_t count, PointAt &&point_at, ThreadPool *pool);
 
     std::list<QPointF> orderPath(const std::vector<std::pair<std::uint32_t, Key>> &previous, const Key &source, const Key &target);
     inline double heuristicL2(const Key &a, const Key &b) const;
@@ -212,5 +329,17 @@ private:
     Params params;
 
     QPixmap human_image, plant_image, chair_image;
+
+    // semantic layer: hashed timing wheel of object ids, angular bins of object ids and pending scene work
+    static constexpr std::int64_t WHEEL_TICK = 50;   // ms
+    static constexpr int SEMANTIC_BINS = 36;
+    std::vector<std::vector<int>> expiry_wheel;
+    std::int64_t wheel_tick = -1;
+    std::array<std::vector<int>, SEMANTIC_BINS> semantic_bins;
+    std::vector<int> pending_created, pending_moved;
+    std::vector<QGraphicsItem *> pending_removed;
+    static inline int semantic_bin(float ang)   // degrees, 0-360
+    { return std::clamp(static_cast<int>(ang / (360.f / SEMANTIC_BINS)), 0, SEMANTIC_BINS - 1); };
+    void remove_semantic_object(std::map<int, Object>::iterator it);
 };
 #endif // LOCAL_GRID_H
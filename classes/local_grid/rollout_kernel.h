@@ -0,0 +1,236 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef ROLLOUT_KERNEL_H
+#define ROLLOUT_KERNEL_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Scoring of constant (v, w) arcs over a polar lattice of angle_bins x radius_bins cells, row-major by angle bin as the
+// cells of Local_Grid. build() walks every arc once and keeps the ids of the cells it enters, in order, with the arc
+// length at which it enters each of them, so a cycle of the controller is gathers over one plane and no key lookups.
+// set_plane() takes the cell costs of the cycle, LETHAL for the occupied cells, and evaluate() reduces each arc: the
+// clearance is the minimum arc length of its cells costing blocked_cost or more, and the cost the sum of the costs of
+// the cells before it. The reductions run 8 samples at a time, with AVX2 gathers when the compiler targets them
+// (-mavx2) and a scalar loop over 8 lanes otherwise, summed in the same order so both give identical results.
+class RolloutKernel
+{
+public:
+    static constexpr float LETHAL = std::numeric_limits<float>::infinity();
+    static constexpr std::size_t LANES = 8;
+
+    struct Lattice
+    {
+        float angle_init = 0.f, angle_step = 1.f;     // degrees, bin a centred at angle_init + a * angle_step
+        int angle_bins = 0;
+        float radius_init = 0.f, radius_step = 1.f;   // mm
+        int radius_bins = 0;
+        std::size_t cells() const
+        { return static_cast<std::size_t>(std::max(angle_bins, 0)) * std::max(radius_bins, 0); };
+    };
+    // Robot frame as Local_Grid: x right, y forward, a cell at (rad * sin(ang), rad * cos(ang)). w > 0 turns left
+    struct Arc
+    {
+        float v = 0.f;      // mm/s, negative backwards
+        float w = 0.f;      // rad/s
+    };
+    struct Params
+    {
+        float horizon = 2.f;        // s simulated along every arc
+        float step = 0.f;           // mm of arc between samples, 0 for half the radius step
+        float blocked_cost = 50.f;  // cells costing this or more block the arc, as in Local_Grid::is_path_blocked
+    };
+    struct Score
+    {
+        float clearance = 0.f;      // mm of arc before its first blocked cell, length if there is none
+        float cost = 0.f;           // sum of the costs of the cells entered before the clearance
+        float length = 0.f;         // mm of arc inside the lattice
+        std::uint32_t cells = 0;    // cells entered before the clearance
+        bool blocked = false;
+    };
+
+    void build(const Lattice &lattice_, const std::vector<Arc> &arcs_)
+    { build(lattice_, arcs_, Params()); };
+    void build(const Lattice &lattice_, const std::vector<Arc> &arcs_, const Params &params_)
+    {
+        lattice = lattice_;
+        arc_list = arcs_;
+        params = params_;
+        const std::size_t n = lattice.cells();
+        offsets.assign(1, 0);
+        ids.clear();
+        entry.clear();
+        lengths.clear();
+        plane.assign(n + 1, 0.f);   // the last one is the sentinel of the padding
+        const float step = params.step > 0 ? params.step : std::max(lattice.radius_step / 2, 1.f);
+        const bool full_turn = lattice.angle_bins * lattice.angle_step >= 360.f - 1e-3f;
+        for (const auto &arc : arc_list)
+        {
+            const float path = std::fabs(arc.v) * params.horizon;
+            const int samples = static_cast<int>(std::floor(path / step));
+            std::int64_t last = -1;
+            float length = 0.f;
+            for (int k = 0; k <= samples and n > 0; k++)
+            {
+                const float s = k * step;
+                const float t = arc.v != 0 ? s / std::fabs(arc.v) : 0.f;
+                float x = 0.f, y = arc.v * t;
+                if (std::fabs(arc.w) > 1e-6f)
+                {
+                    x = arc.v / arc.w * (std::cos(arc.w * t) - 1.f);
+                    y = arc.v / arc.w * std::sin(arc.w * t);
+                }
+                const int r = static_cast<int>(std::rint((std::hypot(x, y) - lattice.radius_init) / lattice.radius_step));
+                if (r >= lattice.radius_bins)
+                    break;      // the arc leaves the lattice
+                if (r < 0)
+                    continue;   // inside the innermost ring
+                float ang = std::atan2(x, y) * 180.f / static_cast<float>(M_PI);
+                while (ang < lattice.angle_init - lattice.angle_step / 2) ang += 360.f;
+                while (ang >= lattice.angle_init + 360.f - lattice.angle_step / 2) ang -= 360.f;
+                int a = static_cast<int>(std::rint((ang - lattice.angle_init) / lattice.angle_step));
+                if (full_turn and a >= lattice.angle_bins)
+                    a -= lattice.angle_bins;
+                if (a < 0 or a >= lattice.angle_bins)
+                    break;      // out of the field of view
+                length = s;
+                const std::int64_t id = static_cast<std::int64_t>(a) * lattice.radius_bins + r;
+                if (id == last)
+                    continue;
+                last = id;
+                ids.push_back(static_cast<std::int32_t>(id));
+                entry.push_back(s);
+            }
+            // pad to whole lanes with the sentinel, which costs 0 and is entered at infinity
+            while ((ids.size() - offsets.back()) % LANES != 0)
+            {
+                ids.push_back(static_cast<std::int32_t>(n));
+                entry.push_back(std::numeric_limits<float>::infinity());
+            }
+            offsets.push_back(ids.size());
+            lengths.push_back(length);
+        }
+    };
+
+    // Costs of the cycle: LETHAL where occupied(id), cost[id] elsewhere
+    template<typename Occupied>
+    void set_plane(const float *cost, Occupied &&occupied)
+    {
+        const std::size_t n = lattice.cells();
+        for (std::size_t i = 0; i < n; i++)
+            plane[i] = occupied(i) ? LETHAL : cost[i];
+        plane[n] = 0.f;
+    };
+
+    Score evaluate(std::size_t arc) const
+    {
+        const std::size_t begin = offsets[arc], end = offsets[arc + 1];
+        const float inf = std::numeric_limits<float>::infinity();
+        // clearance: min over the blocked samples of their entry length
+        float clearance = inf;
+#if defined(__AVX2__)
+        {
+            const __m256 vblocked = _mm256_set1_ps(params.blocked_cost), vinf = _mm256_set1_ps(inf);
+            __m256 vmin = vinf;
+            for (std::size_t i = begin; i < end; i += LANES)
+            {
+                const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ids.data() + i));
+                const __m256 c = _mm256_i32gather_ps(plane.data(), idx, 4);
+                const __m256 d = _mm256_loadu_ps(entry.data() + i);
+                vmin = _mm256_min_ps(vmin, _mm256_blendv_ps(vinf, d, _mm256_cmp_ps(c, vblocked, _CMP_GE_OQ)));
+            }
+            alignas(32) float lanes[LANES];
+            _mm256_store_ps(lanes, vmin);
+            for (const float l : lanes)
+                clearance = std::min(clearance, l);
+        }
+#else
+        for (std::size_t i = begin; i < end; i++)
+            if (plane[ids[i]] >= params.blocked_cost)
+                clearance = std::min(clearance, entry[i]);
+#endif
+        // cells before the clearance are a prefix, entry lengths grow along the arc
+        const std::size_t before = std::lower_bound(entry.begin() + begin, entry.begin() + end, clearance) - entry.begin();
+        float sum = 0.f;
+#if defined(__AVX2__)
+        {
+            const __m256 vclear = _mm256_set1_ps(clearance);
+            __m256 vsum = _mm256_setzero_ps();
+            for (std::size_t i = begin; i < before; i += LANES)
+            {
+                const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ids.data() + i));
+                const __m256 c = _mm256_i32gather_ps(plane.data(), idx, 4);
+                const __m256 d = _mm256_loadu_ps(entry.data() + i);
+                vsum = _mm256_add_ps(vsum, _mm256_and_ps(c, _mm256_cmp_ps(d, vclear, _CMP_LT_OQ)));
+            }
+            alignas(32) float lanes[LANES];
+            _mm256_store_ps(lanes, vsum);
+            for (const float l : lanes)
+                sum += l;
+        }
+#else
+        {
+            float lanes[LANES] = {};
+            for (std::size_t i = begin; i < before; i++)
+                lanes[(i - begin) % LANES] += plane[ids[i]];
+            for (const float l : lanes)
+                sum += l;
+        }
+#endif
+        Score score;
+        score.blocked = clearance != inf;
+        score.length = lengths[arc];
+        score.clearance = score.blocked ? clearance : score.length;
+        score.cost = sum;
+        score.cells = static_cast<std::uint32_t>(before - begin);
+        return score;
+    };
+
+    std::size_t size() const
+    { return arc_list.size(); };
+    const std::vector<Arc> &arcs() const
+    { return arc_list; };
+    const Lattice &geometry() const
+    { return lattice; };
+    const Params &parameters() const
+    { return params; };
+    // cell ids entered by an arc, in order, e.g. to draw it
+    std::vector<std::uint32_t> cells_of(std::size_t arc) const
+    {
+        std::vector<std::uint32_t> res;
+        for (std::size_t i = offsets[arc]; i < offsets[arc + 1] and entry[i] != std::numeric_limits<float>::infinity(); i++)
+            res.push_back(static_cast<std::uint32_t>(ids[i]));
+        return res;
+    };
+
+private:
+    Lattice lattice;
+    Params params;
+    std::vector<Arc> arc_list;
+    std::vector<std::size_t> offsets;        // samples of arc i are [offsets[i], offsets[i + 1]), whole lanes
+    std::vector<std::int32_t> ids;           // cell entered, or the sentinel cells()
+    std::vector<float> entry;                // arc length at which it is entered
+    std::vector<float> lengths;
+    std::vector<float> plane;                // cells() costs plus the sentinel
+};
+
+#endif // ROLLOUT_KERNEL_H
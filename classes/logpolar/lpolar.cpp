@@ -17,6 +17,12 @@
  *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "lpolar.h"
+#include <string.h>
+#include <algorithm>
+#include <threadpool/threadpool.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 LPolar::LPolar()
 {
@@ -56,75 +62,268 @@ void LPolar::initLPolar(int _ecc, int _ang, int _w, int _h)
 	else s= h;
 
 	//Tables for short conversion
-	TX = new int*[ecc];
-	for(int i=0;i<ecc;i++)
-  		TX[i] = new int[ang];
-	TY = new int*[ecc];
-	for(int i=0;i<ecc;i++)
-  		TY[i] = new int[ang];
-
-	//Tables for conversion using the mean of region
-	LX = new int**[ecc];
-	for(int i=0;i<ecc;i++)
-		LX[i] = new int*[ang];
-	LY = new int**[ecc];
-	for(int i=0;i<ecc;i++)
-  		LY[i] = new int*[ang];
-
-	//Initialize 2D array of TData for dense inverse
-	for(int i=0; i<s; i++)
-	{
-		QVector<TDato> cols(s);
-		DILP.push_back(cols);
-	}
+	TX.assign(ecc*ang, 0);
+	TY.assign(ecc*ang, 0);
+	gather = Gather();
 
 	initData();
 	initDataCompleto();
 	initDataDILP(ecc,ang,s);
+	buildGather(gather, s, 1);
 }
 	
+/**
+ * Byte offsets of TX/TY for an image with rows of 'step' bytes and 'channels' bytes per pixel. g is left as it is if
+ * it already holds that layout
+ */
+void LPolar::buildGather(Gather &g, size_t step, int channels) const
+{
+	if (g.step == step and g.channels == channels)
+		return;
+	g.step = step;
+	g.channels = channels;
+	g.offset.resize(ecc*ang);
+	g.wide.assign(ecc, 0);
+	const size_t extent = (s-1)*step + (size_t)s*channels;
+	for (int i=1;i<ecc;i++)
+	{
+		size_t last = 0;
+		for (int j=0;j<ang;j++)
+		{
+			const int k = i*ang+j;
+			g.offset[k] = TY[k]*step + TX[k]*channels;
+			last = std::max(last, (size_t)g.offset[k]);
+		}
+		g.wide[i] = last + 4 <= extent;
+	}
+}
+
+/**
+ * Table for a layout: the one built by initLPolar, which is never modified afterwards, or 'local' built for it, so
+ * conversions from several threads or of alternating layouts do not share a table that changes under them
+ */
+const LPolar::Gather &LPolar::gatherFor(size_t step, int channels, Gather &local) const
+{
+	if (gather.step == step and gather.channels == channels)
+		return gather;
+	buildGather(local, step, channels);
+	return local;
+}
+
+template <typename Row>
+void LPolar::forRows(int begin, int end, int grain, Row &&row)
+{
+	if (pool != nullptr)
+		pool->parallel_for(begin, end, grain, [&row](size_t i) { row(i); });
+	else
+		for (int i=begin;i<end;i++)
+			row(i);
+}
+
+namespace
+{
+	//out[j] = pixel at in + offset[j], n pixels of 'channels' bytes. 'wide' when 4 bytes can be read at every offset
+	void gatherRing(const unsigned char *in, const int32_t *offset, unsigned char *out, int n, int channels, bool wide)
+	{
+		int j=0;
+#if defined(__AVX2__)
+		if (wide and channels != 2)
+		{
+			//first byte (channels 1) or first three bytes (channels 3) of every 32 bit lane, packed to the bottom
+			const __m256i pick1 = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+			const __m256i pick3 = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1, 0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+			const __m256i join1 = _mm256_setr_epi32(0,4,1,1,1,1,1,1), join3 = _mm256_setr_epi32(0,1,2,4,5,6,3,7);
+			for (; j+8<=n; j+=8)
+			{
+				const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(offset+j));
+				__m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(in), idx, 1);
+				if (channels == 4)
+					_mm256_storeu_si256(reinterpret_cast<__m256i *>(out+4*j), v);
+				else if (channels == 1)
+				{
+					v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pick1), join1);
+					_mm_storel_epi64(reinterpret_cast<__m128i *>(out+j), _mm256_castsi256_si128(v));
+				}
+				else
+				{
+					v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pick3), join3);
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*j), _mm256_castsi256_si128(v));
+					_mm_storel_epi64(reinterpret_cast<__m128i *>(out+3*j+16), _mm256_extracti128_si256(v, 1));
+				}
+			}
+		}
+#endif
+		for (; j<n; j++)
+			for (int c=0;c<channels;c++)
+				out[j*channels+c] = in[offset[j]+c];
+	}
+}
+
 void LPolar::convert(unsigned char *in, unsigned char *out )
 {
-	int i,j;
-		
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
- 			 *(out+(i*ang+j))= in[TY[i][j]*s+TX[i][j]];
+	const Gather &g = gather;
+	forRows(1, ecc, 8, [&](int i)
+	{
+		gatherRing(in, &g.offset[i*ang], out+i*ang, ang, 1, g.wide[i]);
+	});
+}
+/**
+ * Receptive field means of the s x s image at 'square', rows of 'step' bytes and 'channels' bytes per pixel, to the
+ * cortical rows 1..ecc-1 of 'out'. Spans are read directly, or from the row prefix sums in the rings marked in LPrefix
+ */
+void LPolar::average(const unsigned char *square, size_t step, int c, unsigned char *out, size_t outStep)
+{
+	const size_t rowLen = (size_t)(s+1)*c;
+	if (std::find(LPrefix.begin(), LPrefix.end(), 1) != LPrefix.end())
+	{
+		prefix.resize(s*rowLen);
+		forRows(0, s, 32, [&](int y)
+		{
+			const unsigned char *p = square + y*step;
+			int32_t *P = &prefix[y*rowLen];
+			for (int ch=0;ch<c;ch++)
+				P[ch] = 0;
+			for (int x=0;x<s*c;x++)
+				P[x+c] = P[x] + p[x];
+		});
 	}
+	forRows(1, ecc, 8, [&](int i)
+	{
+		unsigned char *o = out + i*outStep;
+		const bool fromPrefix = LPrefix[i];
+		for (int j=0;j<ang;j++)
+		{
+			const int k=i*ang+j;
+			int sum[4] = {0,0,0,0};
+			for (int l=LStart[k];l<LStart[k+1];l++)
+			{
+				const Span &sp = LSpan[l];
+				if (fromPrefix)
+				{
+					const int32_t *P = &prefix[sp.y*rowLen];
+					for (int ch=0;ch<c;ch++)
+						sum[ch] += sp.w*(P[(sp.x1+1)*c+ch] - P[sp.x0*c+ch]);
+				}
+				else
+				{
+					const unsigned char *p = square + sp.y*step;
+					int run[4] = {0,0,0,0};
+					for (int x=sp.x0*c;x<(sp.x1+1)*c;x+=c)
+						for (int ch=0;ch<c;ch++)
+							run[ch] += p[x+ch];
+					for (int ch=0;ch<c;ch++)
+						sum[ch] += sp.w*run[ch];
+				}
+			}
+			for (int ch=0;ch<c;ch++)
+				o[j*c+ch] = sum[ch]/LTam[k];
+		}
+	});
+}
+
+/**
+ * Dense inverse of the cortical image at 'cortex', contiguous with 'channels' bytes per cell, to the s x s image 'out'
+ */
+void LPolar::denseInverse(const unsigned char *cortex, int c, unsigned char *out, size_t outStep)
+{
+	forRows(0, s, 32, [&](int i)
+	{
+		const int32_t *d = &DILP[i*s];
+		unsigned char *o = out + i*outStep;
+		if (c == 1)
+			for (int j=0;j<s;j++)
+				o[j] = cortex[d[j]];
+		else
+			for (int j=0;j<s;j++)
+				for (int ch=0;ch<c;ch++)
+					o[j*c+ch] = cortex[d[j]*c+ch];
+	});
 }
+
 void LPolar::convertPromedio(unsigned char *in, unsigned char *out )
 {
-	int i,j,k,tam,sum;
-	
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
-  	  	tam=LX[i][j][0];
-  	  	sum=0;
-  	  	for(k=1;k<tam+1;k++)
-  	  		sum += in[LY[i][j][k]*s+LX[i][j][k]];
- 			 	*(out+(i*ang+j))= sum/tam;
- 			}
+	average(in, s, 1, out, ang);
 }
 void LPolar::inverse(unsigned char *in, unsigned char *out )
 {
-	int i,j;
-	
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
-			out[TY[i][j]*s+TX[i][j]]= in[i*ang+j];
+	//serial: cells of the fovea share pixels
+	for (int k=ang;k<ecc*ang;k++)
+		out[TY[k]*s+TX[k]]= in[k];
+}
+
+void LPolar::convert(const cv::Mat &in, cv::Mat &out)
+{
+	Gather local;
+	convert(in, out, local);
+}
+void LPolar::convert(const cv::Mat &in, cv::Mat &out, Gather &local)
+{
+	CV_Assert(in.depth() == CV_8U and in.channels() <= 4 and in.cols >= s and in.rows >= s);
+	const int c = in.channels();
+	const unsigned char *square = in.ptr((in.rows-s)/2) + (in.cols-s)/2*c;
+	const Gather &g = gatherFor(in.step, c, local);
+	out.create(ecc, ang, in.type());
+	out.row(0).setTo(0);
+	forRows(1, ecc, 8, [&](int i)
+	{
+		gatherRing(square, &g.offset[i*ang], out.ptr(i), ang, c, g.wide[i]);
+	});
+}
+void LPolar::convertPromedio(const cv::Mat &in, cv::Mat &out)
+{
+	CV_Assert(in.depth() == CV_8U and in.channels() <= 4 and in.cols >= s and in.rows >= s);
+	const int c = in.channels();
+	const size_t step = in.step;
+	const unsigned char *square = in.ptr((in.rows-s)/2) + (in.cols-s)/2*c;
+	out.create(ecc, ang, in.type());
+	out.row(0).setTo(0);
+	average(square, step, c, out.ptr(0), out.step);
+}
+void LPolar::inverse(const cv::Mat &in, cv::Mat &out)
+{
+	CV_Assert(in.depth() == CV_8U and in.rows == ecc and in.cols == ang);
+	const int c = in.channels();
+	out.create(s, s, in.type());
+	out.setTo(0);
+	for (int i=1;i<ecc;i++)
+	{
+		const unsigned char *p = in.ptr(i);
+		for (int j=0;j<ang;j++)
+			memcpy(out.ptr(TY[i*ang+j]) + TX[i*ang+j]*c, p + j*c, c);
 	}
 }
+void LPolar::inverseComplete(const cv::Mat &in, cv::Mat &out)
+{
+	CV_Assert(in.depth() == CV_8U and in.channels() <= 4 and in.rows == ecc and in.cols == ang);
+	const cv::Mat cortex = in.isContinuous() ? in : in.clone();
+	out.create(s, s, in.type());
+	denseInverse(cortex.ptr(0), in.channels(), out.ptr(0), out.step);
+}
+
+void LPolar::convert(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out)
+{
+	Gather local;   //rebuilt only when the layout of the frames changes
+	out.resize(in.size());
+	for (size_t f=0;f<in.size();f++)
+		convert(in[f], out[f], local);
+}
+void LPolar::convertPromedio(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out)
+{
+	out.resize(in.size());
+	for (size_t f=0;f<in.size();f++)
+		convertPromedio(in[f], out[f]);
+}
+void LPolar::inverseComplete(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out)
+{
+	out.resize(in.size());
+	for (size_t f=0;f<in.size();f++)
+		inverseComplete(in[f], out[f]);
+}
 // Inverse conversion with interpolation to fill the whole cartesian image
 void LPolar::inverseComplete(unsigned char *in, unsigned char *out, int width )
 {
-	int i,j;
-	
-	width=width;
-	for (i=0;i<s;i++)
-  	  for (j=0;j<s;j++)
-		{
- 			*(out++)= in[DILP[j][i].ecc*ang+DILP[j][i].ang];
-		}
+	(void)width;
+	denseInverse(in, 1, out, s);
 }
 void LPolar::initData( )
 {
@@ -142,8 +341,8 @@ void LPolar::initData( )
         		y = (int)round(p*sin(alfa)+radius+1);
         		if (x >= s) x=s-1;
         		if (y >= s) y=s-1;
-        		TX[i][j]=x; 
-        		TY[i][j]=y;
+        		TX[i*ang+j]=x; 
+        		TY[i*ang+j]=y;
    			}
 
 }
@@ -153,13 +352,22 @@ void LPolar::initData( )
 void LPolar::initDataCompleto( )
 {
   float p,alfa;
-  int x,y,tamx=0,tamy=0,k,l,tam,radio,xL,yL;
+  int x,y,k,l,tam,radio,xL,yL;
   
 	if (w < h) s = w; 
 	else s= h; 
 	
 	base = exp(log((float)s/2.)/((float)ecc));
+	//ring 0 cells are empty ranges
+	LStart.assign(ecc*ang+1, 0);
+	LTam.assign(ecc*ang, 1);
+	LSpan.clear();
+	LPrefix.assign(ecc, 0);
+	std::vector<std::pair<int,int> > pts;
+	long saved = 0;
 	for (int i=1;i<ecc;i++){
+		const size_t ringStart = LSpan.size();
+		long ringPixels = 0;
 		p = pow(base,i);	
 	  	radio = (int)round((M_PI / (float)ang ) * p);
 	//  	radio += radio * 0.25;
@@ -176,22 +384,12 @@ void LPolar::initDataCompleto( )
         		   if(sqrt(((k-x)*(k-x))+((l-y)*(l-y))) <= radio) {
          			 tam++;
         			}
-        	//hago sitio y relleno
+        	//relleno
+        	pts.clear();
         	if(tam==0){
-        		LX[i][j]=new int[2];
-        		LX[i][j][0]=1;
-        		LX[i][j][1]=x;
-        		LY[i][j]=new int[2];
-        		LY[i][j][0]=1;
-        		LY[i][j][1]=y;
+        		pts.push_back(std::make_pair(std::min(y,s-1),std::min(x,s-1)));
         	}
         	else{
-        		tamx=1;
-        		tamy=1;
-        		LX[i][j]=new int[tam+1];
-        		LX[i][j][0]=tam;
-        		LY[i][j]=new int[tam+1];
-        		LY[i][j][0]=tam;
         		for(k=x-radio;k<x+radio;k++)
         			for(l=y-radio;l<y+radio;l++)
         		   		if(sqrt(((k-x)*(k-x))+((l-y)*(l-y))) <= radio)
@@ -202,13 +400,40 @@ void LPolar::initDataCompleto( )
         		    		if(yL>(s-1)) yL=(s-1); 
          			  		if(xL<0) xL=0;
          					if(yL<0) yL=0;
-         			  		LX[i][j][tamx++]=xL;
-         			  		LY[i][j][tamy++]=yL;
+         			  		pts.push_back(std::make_pair(yL,xL));
         				}
         	}
+        	//los pixels repetidos por el recorte en los bordes llevan peso, los consecutivos con igual peso forman un tramo
+        	std::sort(pts.begin(), pts.end());
+        	const int cell=i*ang+j;
+        	LStart[cell]=LSpan.size();
+        	LTam[cell]=pts.size();
+        	ringPixels += pts.size();
+        	for (size_t a=0;a<pts.size();)
+        	{
+        		size_t b=a;
+        		while (b<pts.size() and pts[b]==pts[a]) b++;
+        		const int wgt=b-a, yy=pts[a].first, xx=pts[a].second;
+        		if ((int)LSpan.size()>LStart[cell] and LSpan.back().y==yy and LSpan.back().x1+1==xx and LSpan.back().w==wgt)
+        			LSpan.back().x1=xx;
+        		else
+        			LSpan.push_back(Span{yy,xx,xx,wgt});
+        		a=b;
+        	}
          // printf("n campo %d",tam);
         }
+		//large fields: two reads per span instead of one per pixel
+		const long spans = LSpan.size() - ringStart;
+		if (ringPixels > 4*spans)
+		{
+			LPrefix[i] = 1;
+			saved += ringPixels - 2*spans;
+		}
    }
+	LStart[ecc*ang]=LSpan.size();
+	//the prefix sums cost a pass over the image per frame
+	if (saved < (long)s*s)
+		LPrefix.assign(ecc, 0);
 }
 
 /**
@@ -222,6 +447,7 @@ void LPolar::initDataDILP(int ecc, int ang, int s)
 	float radius= (float)s/2.;
 	  		
 	base = exp(log(radius)/((float)ecc));  //Such that pow(base,ecc) = radius
+	DILP.assign(s*s, 0);
 
 	for(int i=0; i<s; i++)
 		for(int j=0; j<s; j++)
@@ -231,15 +457,17 @@ void LPolar::initDataDILP(int ecc, int ang, int s)
 			//Compute mod
 			mod = sqrt(x*x +y*y);
 			if(mod  >= radius) mod = radius-1;
+			if(mod < 1) mod = 1;
 			//Compute log-mod from base using log-base conversion. Result in 0..ecc range as computed in base
 			lmod = log(mod)/log(base);
 			//compute angle from atan2. Result in -Pi and Pi range
 			alfa = atan2(y,x);
 			//take alfa to 0..ang range
 			lalfa = alfa*(float)ang/(2.* M_PI) + (ang/2);
-			//closest ecc to lmod is (int)lmod.
-			DILP[i][j].ecc = (int)rintf(lmod);
-			DILP[i][j].ang = (int)rintf(lalfa);
+			//closest ecc to lmod is (int)lmod. Stored in the row order of the inverse image, pixel (i,j) is shown at row j
+			const int e = std::min((int)rintf(lmod), ecc-1);
+			const int a = ((int)rintf(lalfa) % ang + ang) % ang;
+			DILP[j*s+i] = e*ang + a;
 			
 		}
 		
@@ -254,8 +482,8 @@ void LPolar::initDataDILP(int ecc, int ang, int s)
  */
 void LPolar::convertPointLPtoC( int e, int a, int * x, int * y )
 {
-  *x = TX[e][a];
-  *y = TY[e][a];
+  *x = TX[e*ang+a];
+  *y = TY[e*ang+a];
 }
 
 
@@ -22,18 +22,46 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+class ThreadPool;
 
 /**
 @author Pablo Bustos
+
+Cortical images are ecc x ang, row i holding the angular divisions of eccentricity i (row 0 is not used). The tables are
+flat arrays in that order, so convert is a single gather pass. Averaged conversion and dense inverse are sparse matrices
+in CSR form: a receptive field is a list of weighted row spans of the Cartesian image, and rings of large fields sum
+their spans from the row prefix sums of the frame, two reads per span. The cv::Mat versions take 8 bit images with 1 to 4
+channels of any size of at least s x s and convert its central s x s square; cortical rows are split among the threads
+of the pool given with setThreadPool, and the gather uses AVX2 when the compiler targets it.
 */
 class LPolar{
 private:
     int ecc,ang,w,h,s;
-    int **TX,***LX;
-    int **TY,***LY;	   
+    std::vector<int32_t> TX,TY;             //Pixel sampled by cortical cell i*ang+j
+    //Receptive field of cell k: spans LSpan[LStart[k]] .. LSpan[LStart[k+1]-1], pixels x0..x1 of row y counted w times,
+    //divided by its LTam[k] pixels
+    struct Span { int32_t y, x0, x1, w; };
+    std::vector<int32_t> LStart,LTam;
+    std::vector<Span> LSpan;
+    std::vector<uint8_t> LPrefix;           //Rings summed from the row prefix sums
+    std::vector<int32_t> prefix;            //Row prefix sums of the frame, s+1 per row and channel
     float base;
-	struct TDato { int ang; int ecc; };
-	QVector<QVector<TDato > > DILP; //Tabla para reconstruccion inversa densa
+	std::vector<int32_t> DILP; //Tabla para reconstruccion inversa densa: celda cortical de cada pixel, por filas
+	//TX/TY as byte offsets in an image with a given row step and channels. Rings whose 4 byte reads stay within the
+	//square can use the vector gather
+	struct Gather { size_t step = 0; int channels = 0; std::vector<int32_t> offset; std::vector<uint8_t> wide; };
+	Gather gather;                          //Layout of the raw pointer convert, s x s grey, built by initLPolar
+	ThreadPool *pool = nullptr;
+	void buildGather(Gather &g, size_t step, int channels) const;
+	const Gather &gatherFor(size_t step, int channels, Gather &local) const;
+	void convert(const cv::Mat &in, cv::Mat &out, Gather &local);
+	template <typename Row> void forRows(int begin, int end, int grain, Row &&row);
+	void average(const unsigned char *square, size_t step, int channels, unsigned char *out, size_t outStep);
+	void denseInverse(const unsigned char *cortex, int channels, unsigned char *out, size_t outStep);
 	
 public:
 	LPolar();
@@ -48,6 +76,18 @@ public:
 	void initDataDILP(int ecc, int ang, int s);
 	void convertPromedio(unsigned char *in, unsigned char *out );
 	void convertPointLPtoC(int e, int a, int *x, int*y);
+	//cv::Mat versions, out is resized to ecc x ang (s x s for inverse) with the type of in
+	void convert(const cv::Mat &in, cv::Mat &out);
+	void convertPromedio(const cv::Mat &in, cv::Mat &out);
+	void inverse(const cv::Mat &in, cv::Mat &out);
+	void inverseComplete(const cv::Mat &in, cv::Mat &out);
+	//Sequences of frames, converted with the same tables and scratch buffers. out is resized to the number of frames
+	//and its images are reused when they already have the right size
+	void convert(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out);
+	void convertPromedio(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out);
+	void inverseComplete(const std::vector<cv::Mat> &in, std::vector<cv::Mat> &out);
+	//Rings are converted in parallel on pool, which must outlive the conversions. nullptr to convert in the calling thread
+	void setThreadPool(ThreadPool *pool_) { pool = pool_; }
 };
 
 #endif
@@ -89,6 +89,35 @@ class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>>
                                   });
         }
 
+        /// Producer puts input data with a transformation that writes into the storage of a recycled slot, so outputs such
+        /// as vectors or images keep their capacity across frames instead of being allocated and destroyed on every put.
+        /// The slot holds whatever an older element left in it: the transformation must overwrite all of it.
+        void put(std::tuple<InputTypes...> &&inputs, std::function<void(std::tuple<InputTypes...> &&, std::tuple<OutputTypes...> &)> transform)
+        {
+            threadPool.spawn_task([this, inputs = std::move(inputs), transform = std::move(transform)]() mutable
+                                  {
+                                      std::tuple<OutputTypes...> slot;
+                                      {
+                                          std::unique_lock<std::mutex> lock(mtx);
+                                          if (not spares.empty())
+                                          {
+                                              slot = std::move(spares.back());
+                                              spares.pop_back();
+                                          }
+                                      }
+                                      transform(std::move(inputs), slot);
+                                      auto timestamp = std::chrono::steady_clock::now();
+                                      std::unique_lock<std::mutex> lock(mtx);
+                                      buffer[head].timestamp = timestamp;
+                                      std::swap(buffer[head].data, slot);
+                                      spares.push_back(std::move(slot));      // the evicted element, reused by a later put
+                                      head = (head + 1) % bufferSize;
+                                      if (count < bufferSize)
+                                          ++count;
+                                      cv.notify_all();
+                                  });
+        }
+
         /// Consumer requests data closest to the given timestamp (or the most recent if timestamp is zero)
         std::tuple<OutputTypes...> get(const std::chrono::steady_clock::time_point &targetTime = std::chrono::steady_clock::time_point::min())
         {
@@ -133,6 +162,18 @@ class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>>
                 return {};
         }
 
+        /// Consumer waits up to timeout for an element newer than lastTime, the timestamp of its latest read, and returns the most
+        /// recent one with its timestamp to pass in the next call. Empty if nothing newer was put in time
+        template <typename Rep, typename Period>
+        std::optional<DataElement> wait_newer(const std::chrono::steady_clock::time_point &lastTime, std::chrono::duration<Rep, Period> timeout)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (not cv.wait_for(lock, timeout, [this, &lastTime]()
+                { return count > 0 and buffer[(head + bufferSize - 1) % bufferSize].timestamp > lastTime; }))
+                return {};
+            return buffer[(head + bufferSize - 1) % bufferSize];
+        }
+
         /// Consumer requests all data newer the timestamp of its latest read
         std::vector<std::tuple<OutputTypes...>> get_all_new(const std::chrono::steady_clock::time_point &lastTime)
         {
@@ -173,6 +214,7 @@ class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>>
         mutable std::mutex mtx;
         std::condition_variable cv;
         bool stopWorker;
+        std::vector<std::tuple<OutputTypes...>> spares;    // storage of evicted elements for the in place put
         ThreadPool threadPool;
 
         template <std::size_t Index = 0>
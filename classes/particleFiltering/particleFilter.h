@@ -4,9 +4,22 @@
 #include <QMutex>
 #include <QVector>
 
-#include <biasedRandomSelector.h>
-
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <particleFiltering/resampling.h>
+#include <threadpool/threadpool.h>
+
+#ifdef _OPENMP
 #include <omp.h>
+#endif
 
 /**
 ========================================
@@ -55,6 +68,39 @@ while (XXX)
 	std::cout << pf.getBest();
 	
 }
+
+Resampling is systematic by default, in O(N) and on indices (see resampling.h): a step copies only the extra children
+of the particles drawn more than once, over the particles that are not drawn. The copy is deferred to the next step,
+so particles() keeps returning the weighted particles of the last step.
+	pf.setResamplingScheme(RCResampler::Stratified);
+
+With KLD-sampling the number of particles follows the uncertainty: few when the state is well known, up to maxParticles
+when the particles spread over many bins, e.g. after a kidnapping. The discretizer maps a particle to its bin:
+	c.kld = true; c.minParticles = 300; c.maxParticles = 10000;
+	pf.setKLDDiscretizer([](const ExampleParticle &p) { return RCParticleFilter<...>::binKey(p.x / 500., p.y / 500., p.angle / 0.175); });
+
+Weights are kept in the log domain and normalized with log-sum-exp, so peaky likelihoods do not underflow. With
+c.logWeights set, computeWeight gives the log-likelihood in logWeight instead of the likelihood in weight:
+	void computeWeight(const image &data) { logWeight = -0.5 * squared_mahalanobis(data); }
+With c.essResampling set the filter only resamples when the effective sample size falls below essThreshold times the
+number of particles; in between, the weights of every particle accumulate across steps:
+	c.essResampling = true; c.essThreshold = 0.5;
+	pf.step(data, control);  if (pf.resampled()) ...;  pf.effectiveSampleSize();
+
+Without virtual calls: derive from RCParticleFilter_StaticParticle (CRTP) instead, with the same methods. A particle may
+also weight a whole batch, e.g. to vectorize the ray casting across particles, and adapt with the random stream given
+by the filter:
+	class FastParticle : public RCParticleFilter_StaticParticle < FastParticle, image, force >
+	{
+	public:
+		void initialize(const image &data, const force &control, const RCParticleFilter_Config *cfg);
+		void adapt(const force &controlBack, const force &controlNew, bool noValidCandidates, std::mt19937_64 &rng);
+		static void computeWeights(std::span<FastParticle> batch, const image &data);
+	};
+With a ThreadPool adapt and weighting run on its workers in chunks of RCParticleFilter::CHUNK particles, each chunk with
+its own random stream, so results do not depend on the scheduling. Without one they run serially, or with OpenMP when
+it is enabled. Particles whose adapt takes no stream are adapted serially, as their random state may not be thread safe:
+	pf.setThreadPool(&pool);
 **/	
 
 
@@ -62,21 +108,43 @@ while (XXX)
  *    R C P F P a r t i c l e
  *
  */
-template < typename RCPFInputData, typename RCPFControl, typename RCPFConfig >
-class RCParticleFilter_Particle
+class RCParticleFilter_Weight
 {
 public:
-	virtual void initialize(const RCPFInputData &data, const RCPFControl &control, const RCPFConfig *cfg) = 0;
-	virtual void adapt(const RCPFControl &controlBack, const RCPFControl &controlNew, const bool noValidCandidates) = 0;
-	virtual void computeWeight(const RCPFInputData &data) = 0;
-
 	double getWeight() const
 	{
 		return weight;
 	}
+	double getLogWeight() const
+	{
+		return logWeight;
+	}
 
 protected:
 	double weight;
+	double logWeight = 0.;     // log-likelihood, set by computeWeight instead of weight with RCParticleFilter_Config::logWeights
+};
+
+template < typename RCPFInputData, typename RCPFControl, typename RCPFConfig >
+class RCParticleFilter_Particle : public RCParticleFilter_Weight
+{
+public:
+	virtual void initialize(const RCPFInputData &data, const RCPFControl &control, const RCPFConfig *cfg) = 0;
+	virtual void adapt(const RCPFControl &controlBack, const RCPFControl &controlNew, const bool noValidCandidates) = 0;
+	virtual void computeWeight(const RCPFInputData &data) = 0;
+};
+
+// Same interface without virtual functions: the filter calls the methods of Derived directly. computeWeights may be
+// hidden by a batched version in Derived
+template < typename Derived, typename RCPFInputData, typename RCPFControl >
+class RCParticleFilter_StaticParticle : public RCParticleFilter_Weight
+{
+public:
+	static void computeWeights(std::span<Derived> batch, const RCPFInputData &data)
+	{
+		for (auto &p : batch)
+			p.computeWeight(data);
+	}
 };
 
 /**
@@ -87,6 +155,19 @@ class RCParticleFilter_Config
 {
 public:
 	uint32_t particles;
+	// KLD-sampling: with kld set, the number of particles is adapted every step within [minParticles, maxParticles]
+	// to the number of state bins they occupy (see RCResampler::resampleKLD). 'particles' is the initial number.
+	// Bins are given by the discretizer passed to RCParticleFilter::setKLDDiscretizer
+	bool kld = false;
+	uint32_t minParticles = 300;
+	uint32_t maxParticles = 10000;
+	double kldError = 0.05;          // epsilon, bound of the Kullback-Leibler distance
+	double kldQuantile = 2.326;      // upper 1 - delta quantile of the standard normal, 2.326 for delta = 0.01
+	// computeWeight sets the log-likelihood (logWeight) instead of the likelihood (weight)
+	bool logWeights = false;
+	// resample only when the effective sample size is below essThreshold times the number of particles
+	bool essResampling = false;
+	double essThreshold = 0.5;
 };
 
 
@@ -103,20 +184,20 @@ public:
 	{
 		config = conf;
 		lastControl = control;
-		selector = new BiasedSelector(config->particles);
 		for (int32_t i=0; i<(int32_t)config->particles; ++i)
 		{
 			RCPFParticle p;
 			p.initialize(data, control, config);
-			resampledParticles.push_back(p);
 			weightedParticles.push_back(p);
 		}
+		best = weightedParticles[0];
 	}
 
 	void step(const RCPFInputData &data, const RCPFControl &control, bool includeBest=false, uint32_t maxThreads=-1)
 	{
+		resampledStep = false;
 		/// Particle Filter Step #1
-		adaptParticles(lastControl, control);
+		adaptParticles(lastControl, control, maxThreads);
 		/// Particle Filter Step #2
 		calculateWeights(data, maxThreads);
 		/// Particle Filter Step #3
@@ -131,31 +212,80 @@ public:
 
 	RCPFParticle getBest() const { return best; }
 
+	void setResamplingScheme(RCResampler::Scheme s) { resampler.setScheme(s); }
 
+	// Bin of a particle for KLD-sampling. Any value identifying the cell of a regular grid of the state space
+	void setKLDDiscretizer(std::function<uint64_t(const RCPFParticle &)> d) { discretizer = std::move(d); }
+	// Key of the cell of up to three coordinates already divided by the cell size, for discretizers
+	static uint64_t binKey(double a, double b=0., double c=0.)
+	{
+		const auto q = [](double v) { return static_cast<uint64_t>(static_cast<int64_t>(std::floor(v)) & 0x1FFFFF); };
+		return q(a) | q(b) << 21 | q(c) << 42;
+	}
+	// Runs adapt and the weights on the workers of pool, nullptr to go back to OpenMP or serial runs
+	void setThreadPool(ThreadPool *p) { pool = p; }
+	// seed of the random streams given to adapt, one per chunk
+	void seed(uint64_t s) { streamSeed = s; streams.clear(); resampler.seed(s); }
+	static constexpr uint32_t CHUNK = 256;
+
+	// current number of particles, which changes with KLD-sampling once the next step starts
+	uint32_t size() const { return weightedParticles.size(); }
+	// 1 / sum(w^2) of the normalized weights of the last step, from 1 (a single particle counts) to the number of particles
+	double effectiveSampleSize() const { return ess; }
+	// whether the last step resampled, false when the effective sample size did not require it
+	bool resampled() const { return resampledStep; }
+	// normalized weight of particle i of particles(), accumulated since the last resampling: 1/N for all of them once
+	// the resampled set is in particles(), after forceIncludeParticle
+	double normalizedWeight(uint32_t i) const { return weights[i]; }
+
+	// Replaces the particle 'index' of the resampled set, the one the next step starts from
 	void forceIncludeParticle(RCPFParticle p, uint32_t index)
 	{
+		applyResampling();
 		weightedParticles[index] = p;
 	}
 
 	const QVector<RCPFParticle> &particles() const { return weightedParticles; }
 
+	// p-th particle by decreasing weight. The order is computed on the first call after a step
 	RCPFParticle getOrderedParticle(uint32_t p) const
 	{
-		return weightedParticles[selector->getNumber(p)];
+		if (not orderValid)
+		{
+			order.resize(weightedParticles.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return weights[a] > weights[b]; });
+			orderValid = true;
+		}
+		return weightedParticles[order[p]];
 	}
 
 	RCPFParticle getResampledParticle(uint32_t p) const
 	{
-		return resampledParticles[p];
+		return weightedParticles[resamplingPending ? resampler.ancestor(p) : p];
 	}
 protected:
 	QMutex mutex;
 	RCParticleFilterConfig *config;
 	RCPFParticle best;
 	bool noCandidates;
-	BiasedSelector *selector;
 	RCPFControl lastControl;
-	QVector < RCPFParticle > resampledParticles, weightedParticles;
+	// the weighted particles of the last step. Until the next step, the resampled set is given by the ancestors of resampler
+	QVector < RCPFParticle > weightedParticles;
+	RCResampler resampler;
+	bool resamplingPending = false;
+	bool resampledStep = false;     // the last step drew a resampled set, even if it is already applied
+	// normalized weights, and log weights accumulated since the last resampling
+	std::vector<double> weights, logWeights;
+	double ess = 0.;
+	std::function<uint64_t(const RCPFParticle &)> discretizer;
+	std::unordered_map<uint64_t, uint32_t> binIds;
+	std::vector<uint32_t> bins;
+	ThreadPool *pool = nullptr;
+	uint64_t streamSeed = std::random_device()();
+	std::vector<std::mt19937_64> streams;      // one per chunk
+	mutable std::vector<uint32_t> order;
+	mutable bool orderValid = false;
 
 	void lock()
 	{
@@ -169,92 +299,138 @@ protected:
 	void initialize(const RCPFInputData &data, const RCPFControl &control, const RCParticleFilterConfig *cfg)
 	{
 		lastControl = control;
+		resamplingPending = false;
+		resampledStep = false;
+		orderValid = false;
+		weightedParticles.resize(config->particles);
 		for (int32_t i=0; i<(int32_t)config->particles; ++i)
-		{
-			RCPFParticle *p = &resampledParticles.operator[](i);
-			p->initialize(data, control, cfg);
-			weightedParticles[i] = *p;
-		}
+			weightedParticles[i].initialize(data, control, cfg);
+		logWeights.clear();
 	}
 
-
-	void adaptParticles(const RCPFControl &controlBack, const RCPFControl &controlNew)
+	// turns the weighted particles into the resampled set, copying only the particles drawn more than once
+	void applyResampling()
 	{
-		RCPFParticle *p = &resampledParticles[0];
-		for (int32_t i=0; i<(int32_t)config->particles; ++i)
-		{
-			p[i].adapt(controlBack, controlNew, false);
-			weightedParticles[i] = p[i];
-		}
+		if (not resamplingPending)
+			return;
+		resampler.apply(weightedParticles);
+		logWeights.clear();        // resampled particles are equally weighted
+		weights.assign(weightedParticles.size(), weightedParticles.empty() ? 0. : 1. / weightedParticles.size());
+		resamplingPending = false;
+		orderValid = false;
 	}
 
-	void calculateWeights(const RCPFInputData &data, int32_t maxThreads)
+	// f(begin, end, stream) over chunks of CHUNK particles, in parallel unless maxThreads is 0
+	template <typename F>
+	void forChunks(uint32_t n, int32_t maxThreads, F &&f)
 	{
-		RCPFParticle *p = &weightedParticles[0];
-
-		if (maxThreads==0)
+		const uint32_t chunks = (n + CHUNK - 1) / CHUNK;
+		while (streams.size() < chunks)
 		{
-			for (uint i=0; i<config->particles; ++i)
-			{
-				p[i].computeWeight(data);
-			}
+			std::seed_seq seq{streamSeed, static_cast<uint64_t>(streams.size())};
+			streams.emplace_back(seq);
 		}
+		const auto chunk = [&](uint32_t c) { f(c * CHUNK, std::min(n, (c + 1) * CHUNK), streams[c]); };
+		if (maxThreads == 0 or chunks < 2)
+		{
+			for (uint32_t c=0; c<chunks; ++c)
+				chunk(c);
+		}
+		else if (pool != nullptr)
+			pool->parallel_for(0, chunks, 1, [&chunk](std::size_t c) { chunk(c); });
 		else
 		{
-			omp_set_num_threads(maxThreads<0?omp_get_max_threads():maxThreads);
-			#pragma omp parallel for
-			for (uint i=0; i<config->particles; ++i)
-			{
-				p[i].computeWeight(data);
-			}
+#ifdef _OPENMP
+			#pragma omp parallel for num_threads(maxThreads<0?omp_get_max_threads():maxThreads)
+#endif
+			for (uint32_t c=0; c<chunks; ++c)
+				chunk(c);
 		}
+	}
+
+	void adaptParticles(const RCPFControl &controlBack, const RCPFControl &controlNew, int32_t maxThreads=0)
+	{
+		applyResampling();
+		RCPFParticle *p = weightedParticles.data();
+		if constexpr (requires(RCPFParticle &q, std::mt19937_64 &g) { q.adapt(controlBack, controlNew, false, g); })
+			forChunks(weightedParticles.size(), maxThreads, [&](uint32_t b, uint32_t e, std::mt19937_64 &rng)
+			{
+				for (uint32_t i=b; i<e; ++i)
+					p[i].adapt(controlBack, controlNew, false, rng);
+			});
+		else
+			for (int32_t i=0; i<(int32_t)weightedParticles.size(); ++i)
+				p[i].adapt(controlBack, controlNew, false);
+	}
+
+	void calculateWeights(const RCPFInputData &data, int32_t maxThreads)
+	{
+		RCPFParticle *p = weightedParticles.data();
+		const uint n = weightedParticles.size();
 
-		for (uint i=0; i<config->particles; ++i)
+		forChunks(n, maxThreads, [&](uint32_t b, uint32_t e, std::mt19937_64 &)
+		{
+			if constexpr (requires(std::span<RCPFParticle> batch) { RCPFParticle::computeWeights(batch, data); })
+				RCPFParticle::computeWeights(std::span<RCPFParticle>(p + b, e - b), data);
+			else
+				for (uint32_t i=b; i<e; ++i)
+					p[i].computeWeight(data);
+		});
+
+		// log-sum-exp normalization of the accumulated log weights
+		logWeights.resize(n, 0.);
+		double maxLog = -std::numeric_limits<double>::infinity();
+		for (uint i=0; i<n; ++i)
 		{
-			selector->setWeight(i, (1000.0*p[i].getWeight())*1000.0, true);
+			const double l = config->logWeights ? p[i].getLogWeight() : std::log(std::max(p[i].getWeight(), 0.));
+			logWeights[i] = std::isnan(l) ? -std::numeric_limits<double>::infinity() : logWeights[i] + l;
+			maxLog = std::max(maxLog, logWeights[i]);
 		}
-
-		try
+		weights.resize(n);
+		double sum = 0., sum2 = 0.;
+		if (std::isfinite(maxLog))
+			for (uint i=0; i<n; ++i)
+				sum += (weights[i] = std::exp(logWeights[i] - maxLog));
+		if (sum > 0.)
 		{
-			selector->sort();
+			for (uint i=0; i<n; ++i)
+				sum2 += (weights[i] /= sum) * weights[i];
+			ess = 1. / sum2;
 		}
-		catch (std::string s)
+		else
 		{
-			printf("catch %s\n", s.c_str());
+			// no particle explains the data: the set is kept, equally weighted
+			std::fill(weights.begin(), weights.end(), 0.);
+			logWeights.assign(n, 0.);
+			ess = 0.;
 		}
-
+		orderValid = false;
 	}
 	
+	// Keeps the best particle and draws the ancestors of the resampled set. Without any probable particle the set is kept
 	void clone(const RCPFControl &control)
 	{
-		// Check if there is any considerably probable particle...
-		int selected;
-		try
+		best = weightedParticles[std::max_element(weights.begin(), weights.end()) - weights.begin()];
+		if (config->essResampling and ess >= config->essThreshold * weightedParticles.size())
 		{
 			noCandidates = false;
-			selected = selector->get();
-		}
-		catch (...)
-		{
-			noCandidates = true;
+			resamplingPending = false;
+			return;
 		}
-		// Clone
-		try
+		if (config->kld and discretizer)
 		{
-			best = weightedParticles.operator[](selector->getFirst());
-			// If there was, perform a regular clone process
-			for (uint i=0; i<config->particles; ++i)
-			{
-				selected = noCandidates?i:selector->get();
-				RCPFParticle p = weightedParticles.operator[](selected);
-// 				p.adapt(lastControl, control, noCandidates);
-				resampledParticles.operator[](i) = p;
-			}
-		}
-		catch (...)
-		{
-			qFatal("THIS SHOULD NEVER HAPPEN! selector->get\n");
+			const uint32_t n = weightedParticles.size();
+			binIds.clear();
+			bins.resize(n);
+			for (uint32_t i=0; i<n; ++i)
+				bins[i] = binIds.try_emplace(discretizer(weightedParticles[i]), binIds.size()).first->second;
+			noCandidates = not resampler.resampleKLD(weights.data(), n, bins.data(), binIds.size(), n,
+			                                         config->minParticles, config->maxParticles, config->kldError, config->kldQuantile);
 		}
+		else
+			noCandidates = not resampler.resample(weights.data(), weightedParticles.size());
+		resamplingPending = not noCandidates;
+		resampledStep = resamplingPending;
 	}
 };
 
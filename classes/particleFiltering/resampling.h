@@ -0,0 +1,234 @@
+#ifndef ROBOCOMPPARTICLEFILTER_RESAMPLING_H
+#define ROBOCOMPPARTICLEFILTER_RESAMPLING_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ *    R C R e s a m p l e r
+ *
+ * O(N) resampling on indices. 'resample' draws, from the weights, the ancestor of every slot of the new set of particles:
+ * - Systematic: a single random offset, slot i takes the particle holding the cumulative weight (offset + i) / M.
+ * - Stratified: one random number per slot, (i + u_i) / M.
+ * Both walk the cumulative weights once, without sorting.
+ *
+ * The ancestors are ordered so that every surviving particle keeps its own slot, so 'apply' leaves the survivors where
+ * they are and only copies the extra children of the particles drawn several times over the slots of the ones that died:
+ *
+ *	RCResampler resampler;
+ *	if (resampler.resample(weights.data(), particles.size()))
+ *		resampler.apply(particles);        // any std::vector or QVector
+ */
+class RCResampler
+{
+public:
+	enum Scheme { Systematic, Stratified };
+
+	RCResampler(Scheme s=Systematic, uint64_t seed=std::random_device()()) : scheme(s), rng(seed)
+	{
+	}
+
+	void setScheme(Scheme s) { scheme = s; }
+	void seed(uint64_t s) { rng.seed(s); }
+
+	// Draws 'm' ancestors (n if m is 0) among the 'n' weights, which must not be negative. When the weights do not add up
+	// to a positive finite value nothing can be drawn: the ancestors are the identity and false is returned
+	bool resample(const double *weights, uint32_t n, uint32_t m=0)
+	{
+		if (m == 0) m = n;
+		total = 0.;
+		for (uint32_t i=0; i<n; ++i)
+			total += weights[i];
+		ancestorsV.resize(m);
+		if (n == 0 or not (total > 0.) or not std::isfinite(total))
+		{
+			for (uint32_t i=0; i<m; ++i)
+				ancestorsV[i] = i % (n ? n : 1);
+			keepSurvivorsInPlace(n);
+			return false;
+		}
+
+		std::uniform_real_distribution<double> uniform(0., 1.);
+		const double step = total / m;
+		double u = uniform(rng) * step, accum = weights[0];
+		uint32_t j = 0;
+		for (uint32_t i=0; i<m; ++i)
+		{
+			if (scheme == Stratified)
+				u = (i + uniform(rng)) * step;
+			while (u > accum and j+1 < n)
+				accum += weights[++j];
+			ancestorsV[i] = j;
+			if (scheme == Systematic)
+				u += step;
+		}
+		keepSurvivorsInPlace(n);
+		return true;
+	}
+
+	/**
+	 * KLD-sampling (Fox, 2003): the number of slots is the smallest one that bounds, with probability 1 - delta, the
+	 * Kullback-Leibler distance between the resampled set and the weighted one by 'epsilon', given the number k of state
+	 * bins holding resampled particles:
+	 *	m = (k-1) / (2 epsilon) * (1 - 2/(9(k-1)) + sqrt(2/(9(k-1))) z)^3,   z the upper 1 - delta quantile of N(0, 1)
+	 * 'bins' holds the bin of every weighted particle, numbered from 0 to binCount-1. The draw is started with
+	 * 'previous' slots and repeated with the bound found, which settles in a few draws of O(m) each.
+	 * m stays within [minM, maxM]. Returns false, with the identity as ancestors, as 'resample'
+	 */
+	bool resampleKLD(const double *weights, uint32_t n, const uint32_t *bins, uint32_t binCount, uint32_t previous,
+	                 uint32_t minM, uint32_t maxM, double epsilon=0.05, double z=2.326)
+	{
+		minM = std::max<uint32_t>(minM, 1);
+		maxM = std::max(maxM, minM);
+		uint32_t m = std::clamp(previous, minM, maxM);
+		for (int attempt=0; attempt<8; ++attempt)
+		{
+			if (not resample(weights, n, m))
+				return false;
+			binSeen.assign(binCount, 0);
+			uint32_t k = 0;
+			for (auto a : ancestorsV)
+				if (not binSeen[bins[a]])
+				{
+					binSeen[bins[a]] = 1;
+					k++;
+				}
+			const uint32_t target = std::clamp(kldBound(k, epsilon, z), minM, maxM);
+			if (target == m)
+				break;
+			// fewer samples can only occupy fewer bins: shrinking once is final
+			const bool shrink = target < m;
+			m = target;
+			if (shrink)
+				return resample(weights, n, m);
+		}
+		return true;
+	}
+
+	static uint32_t kldBound(uint32_t k, double epsilon, double z)
+	{
+		if (k <= 1)
+			return 1;
+		const double a = 2. / (9. * (k - 1));
+		const double b = 1. - a + std::sqrt(a) * z;
+		return static_cast<uint32_t>(std::ceil((k - 1) / (2. * epsilon) * b * b * b));
+	}
+
+	// ancestors()[i] is the particle taken for slot i, in the order used by 'apply'
+	const std::vector<uint32_t> &ancestors() const { return ancestorsV; }
+	uint32_t ancestor(uint32_t i) const { return ancestorsV[i]; }
+	// weight added up by the last resample
+	double totalWeight() const { return total; }
+
+	// Turns 'particles' into the resampled set in place, resized to the number of slots drawn. Survivors are not touched,
+	// other slots are assigned from their ancestor, which is never overwritten before it is read
+	template <typename Container>
+	void apply(Container &particles) const
+	{
+		const uint32_t n = particles.size(), m = ancestorsV.size();
+		if (m > n)
+			particles.resize(m);
+		for (uint32_t i=0; i<m; ++i)
+		{
+			const uint32_t a = ancestorsV[i];
+			if (a == i)
+				continue;
+			if (a >= m and lastChild[a] == i)
+				particles[i] = std::move(particles[a]);     // slot dropped by the resize, its last child can take it
+			else
+				particles[i] = particles[a];
+		}
+		if (m < n)
+			particles.resize(m);
+	}
+
+private:
+	Scheme scheme;
+	std::mt19937_64 rng;
+	double total = 0.;
+	std::vector<uint32_t> ancestorsV, children, lastChild, reordered;
+	std::vector<uint8_t> binSeen;
+
+	// First copy of every ancestor to its own slot when the slot exists, the remaining copies to the free slots
+	void keepSurvivorsInPlace(uint32_t n)
+	{
+		const uint32_t m = ancestorsV.size();
+		children.assign(n, 0);
+		for (auto a : ancestorsV)
+			children[a]++;
+		reordered.resize(m);
+		uint32_t freeSlot = 0;
+		auto nextFree = [&]()
+		{
+			while (freeSlot < m and freeSlot < n and children[freeSlot] != 0)
+				freeSlot++;
+			return freeSlot++;
+		};
+		// the free slots are those of the particles not drawn and those beyond n
+		for (uint32_t a=0; a<n and a<m; ++a)
+			if (children[a] != 0)
+				reordered[a] = a;
+		for (uint32_t a=0; a<n; ++a)
+			for (uint32_t c=(a < m and children[a] != 0) ? children[a]-1 : children[a]; c>0; --c)
+				reordered[nextFree()] = a;
+		ancestorsV.swap(reordered);
+		// last slot taken from every ancestor beyond m, to move it instead of copying
+		lastChild.assign(n, m);
+		for (uint32_t i=0; i<m; ++i)
+			if (ancestorsV[i] >= m)
+				lastChild[ancestorsV[i]] = i;
+	}
+};
+
+
+/**
+ *    R C P a r t i c l e S o A
+ *
+ * Struct of arrays storage for particles made of plain values, e.g. RCParticleSoA<float, float, float> for x, y and angle:
+ * one contiguous column per member, plus the weights. Loops over one member vectorize, and resampling with an
+ * RCResampler assigns a few scalars per slot instead of whole particles.
+ *
+ *	RCParticleSoA<float, float, float> p(5000);
+ *	for (uint32_t i=0; i<p.size(); ++i) p.weight(i) = likelihood(p.column<0>()[i], p.column<1>()[i]);
+ *	if (resampler.resample(p.weights().data(), p.size())) p.resample(resampler);
+ */
+template <typename... Columns>
+class RCParticleSoA
+{
+	static_assert((std::is_trivially_copyable_v<Columns> and ...), "RCParticleSoA columns must be trivially copyable");
+public:
+	explicit RCParticleSoA(uint32_t n=0) { resize(n); }
+
+	uint32_t size() const { return weightsV.size(); }
+	void resize(uint32_t n)
+	{
+		std::apply([n](auto &...c) { (c.resize(n), ...); }, columns);
+		weightsV.resize(n, 0.);
+	}
+
+	template <size_t k> auto &column() { return std::get<k>(columns); }
+	template <size_t k> const auto &column() const { return std::get<k>(columns); }
+	std::vector<double> &weights() { return weightsV; }
+	const std::vector<double> &weights() const { return weightsV; }
+	double &weight(uint32_t i) { return weightsV[i]; }
+
+	// every column and the weights are resampled with the ancestors drawn by 'r'
+	void resample(const RCResampler &r)
+	{
+		std::apply([&r](auto &...c) { (r.apply(c), ...); }, columns);
+		r.apply(weightsV);
+	}
+
+private:
+	std::tuple<std::vector<Columns>...> columns;
+	std::vector<double> weightsV;
+};
+
+#endif
@@ -0,0 +1,206 @@
+/////////////////////////////////////////////////
+// Python extension module: Grid and Local_Grid with NumPy views of their cells
+/////////////////////////////////////////////////
+//
+//   import numpy as np, rc_grids
+//   g = rc_grids.Grid()
+//   g.initialize(-5000, -5000, 10000, 10000, 100)
+//   cost = g.cost                      # (rows, cols) float32 view, no copy: cost[...] = learned_costmap(g.free)
+//   g.mark_all_changed()               # after writing cells from Python
+//   g.update_map_dda(points, (0, 0), 4000)              # points (N, 2) float32, GIL released while it runs
+//   path = g.compute_path((-4000, -4000), (4000, 4000))  # (M, 2) float32
+//
+// Grid is headless (Grid::initialize_fast without a scene). LocalGrid draws into a QGraphicsScene of its own, hence
+// the offscreen QApplication created with the first of them when the interpreter has none.
+//
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <QApplication>
+#include <grid2d/grid.h>
+#include <local_grid/local_grid.h>
+#include "numpy_views.h"
+#include <cstring>
+#include <memory>
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace
+{
+	void ensure_application()
+	{
+		if (QCoreApplication::instance() != nullptr)
+			return;
+		if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+			qputenv("QT_QPA_PLATFORM", "offscreen");
+		static int argc = 1;
+		static char name[] = "rc_grids";
+		static char *argv[] = {name, nullptr};
+		static QApplication app(argc, argv);
+	}
+
+	struct PyGrid
+	{
+		Grid grid;
+	};
+	struct PyLocalGrid
+	{
+		PyLocalGrid() { ensure_application(); scene = std::make_unique<QGraphicsScene>(); }
+		std::unique_ptr<QGraphicsScene> scene;
+		Local_Grid grid;
+	};
+
+	using Points = py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+	// (N, 2) array to the point vectors of the C++ API. One memcpy, Eigen::Vector2f is two packed floats
+	std::vector<Eigen::Vector2f> to_points(const Points &a)
+	{
+		if (a.ndim() != 2 or a.shape(1) != 2)
+			throw std::invalid_argument("points must be an (N, 2) array");
+		std::vector<Eigen::Vector2f> points(a.shape(0));
+		if (not points.empty())
+			std::memcpy(points.data(), a.data(), points.size() * sizeof(Eigen::Vector2f));
+		return points;
+	}
+
+	template<typename Wrapper, typename Field, typename Cell>
+	auto plane_property(Field Cell::*member)
+	{
+		return [member](py::object self) { return rc::numpy::plane(self.cast<Wrapper &>().grid.cells(), member, self); };
+	}
+	template<typename Wrapper>
+	py::array presence_property(py::object self)
+	{
+		return rc::numpy::presence(self.cast<Wrapper &>().grid.cells(), self);
+	}
+}
+
+PYBIND11_MODULE(rc_grids, m)
+{
+	m.doc() = "Grid and Local_Grid with zero-copy NumPy views of their cell planes";
+
+	py::enum_<Grid::DeltaFusion::Mode>(m, "DeltaFusion")
+		.value("REPLACE", Grid::DeltaFusion::Mode::REPLACE)
+		.value("MAX_CONFIDENCE", Grid::DeltaFusion::Mode::MAX_CONFIDENCE)
+		.value("AVERAGE", Grid::DeltaFusion::Mode::AVERAGE)
+		.value("SUM", Grid::DeltaFusion::Mode::SUM);
+
+	py::class_<PyGrid>(m, "Grid")
+		.def(py::init<>())
+		.def("initialize", [](PyGrid &g, float left, float top, float width, float height, int tile_size)
+			{
+				py::gil_scoped_release release;
+				g.grid.initialize_fast(QRectF(left, top, width, height), tile_size);
+			},
+			"left"_a, "top"_a, "width"_a, "height"_a, "tile_size"_a,
+			"Allocates the cells. Views taken before are stale afterwards")
+		.def_property_readonly("tile_size", [](const PyGrid &g) { return g.grid.TILE_SIZE; })
+		.def_property_readonly("dim", [](const PyGrid &g)
+			{ return py::make_tuple(g.grid.dim.left(), g.grid.dim.top(), g.grid.dim.width(), g.grid.dim.height()); })
+		.def_property_readonly("free", plane_property<PyGrid>(&Grid::T::free))
+		.def_property_readonly("visited", plane_property<PyGrid>(&Grid::T::visited))
+		.def_property_readonly("cost", plane_property<PyGrid>(&Grid::T::cost))
+		.def_property_readonly("hits", plane_property<PyGrid>(&Grid::T::hits))
+		.def_property_readonly("misses", plane_property<PyGrid>(&Grid::T::misses))
+		.def_property_readonly("log_odds", plane_property<PyGrid>(&Grid::T::log_odds))
+		.def_property_readonly("present", &presence_property<PyGrid>)
+		.def("mark_all_changed", [](PyGrid &g) { g.grid.mark_all_changed(); })
+		.def("compute_path", [](PyGrid &g, std::pair<float, float> source, std::pair<float, float> target)
+			{
+				std::vector<Eigen::Vector2f> path;
+				{
+					py::gil_scoped_release release;
+					path = g.grid.compute_path(QPointF(source.first, source.second), QPointF(target.first, target.second));
+				}
+				return rc::numpy::owned(std::move(path));
+			}, "source"_a, "target"_a)
+		.def("compute_path_astar", [](PyGrid &g, std::pair<float, float> source, std::pair<float, float> target)
+			{
+				std::vector<Eigen::Vector2f> path;
+				{
+					py::gil_scoped_release release;
+					path = g.grid.compute_path_astar(QPointF(source.first, source.second), QPointF(target.first, target.second));
+				}
+				return rc::numpy::owned(std::move(path));
+			}, "source"_a, "target"_a)
+		.def("update_map", [](PyGrid &g, const Points &points, std::pair<float, float> robot, float max_range)
+			{
+				const auto p = to_points(points);
+				py::gil_scoped_release release;
+				g.grid.update_map(p, Eigen::Vector2f(robot.first, robot.second), max_range);
+			}, "points"_a, "robot"_a, "max_laser_range"_a)
+		.def("update_map_dda", [](PyGrid &g, const Points &points, std::pair<float, float> robot, float max_range)
+			{
+				const auto p = to_points(points);
+				py::gil_scoped_release release;
+				g.grid.update_map_dda(p, Eigen::Vector2f(robot.first, robot.second), max_range);
+			}, "points"_a, "robot"_a, "max_laser_range"_a)
+		.def("update_map_log_odds", [](PyGrid &g, const Points &points, std::pair<float, float> robot, float max_range)
+			{
+				const auto p = to_points(points);
+				py::gil_scoped_release release;
+				g.grid.update_map_log_odds(p, Eigen::Vector2f(robot.first, robot.second), max_range);
+			}, "points"_a, "robot"_a, "max_laser_range"_a)
+		.def("update_map_from_local_grid", [](PyGrid &g, const PyLocalGrid &local, float x, float y, float angle)
+			{
+				py::gil_scoped_release release;
+				Eigen::Affine2f pose = Eigen::Translation2f(x, y) * Eigen::Rotation2Df(angle);
+				g.grid.update_map_from_local_grid(local.grid, pose);
+			}, "local"_a, "x"_a, "y"_a, "angle"_a)
+		.def("save_to_binary_string", [](const PyGrid &g, bool compress) { return py::bytes(g.grid.saveToBinaryString(compress)); },
+			"compress"_a = true)
+		.def("read_from_binary_string", [](PyGrid &g, const py::bytes &data) { return g.grid.readFromBinaryString(std::string(data)); })
+		// (delta, since to pass next time)
+		.def("export_delta", [](PyGrid &g, std::uint32_t since, bool compress)
+			{
+				auto delta = g.grid.export_delta(since, compress);
+				return py::make_tuple(py::bytes(delta), since);
+			}, "since"_a = 0, "compress"_a = false)
+		.def("apply_delta", [](PyGrid &g, const py::bytes &data, Grid::DeltaFusion::Mode mode, float weight)
+			{
+				const std::string delta(data);
+				py::gil_scoped_release release;
+				return g.grid.apply_delta(delta, Grid::DeltaFusion{mode, weight});
+			}, "delta"_a, "mode"_a = Grid::DeltaFusion::Mode::MAX_CONFIDENCE, "weight"_a = 0.5f)
+		.def_property_readonly("map_version", [](const PyGrid &g) { return g.grid.map_version(); });
+
+	py::class_<PyLocalGrid>(m, "LocalGrid")
+		.def(py::init<>())
+		.def("initialize", [](PyLocalGrid &g, std::tuple<float, float, float> angle, std::tuple<float, float, float> radius)
+			{
+				const auto [a0, a1, as] = angle;
+				const auto [r0, r1, rs] = radius;
+				g.grid.initialize(Local_Grid::Ranges{a0, a1, as}, Local_Grid::Ranges{r0, r1, rs}, g.scene.get());
+			}, "angle"_a, "radius"_a, "Ranges as (init, end, step). Views taken before are stale afterwards")
+		// planes are angle bins x radius bins
+		.def_property_readonly("free", plane_property<PyLocalGrid>(&Local_Grid::T::free))
+		.def_property_readonly("visited", plane_property<PyLocalGrid>(&Local_Grid::T::visited))
+		.def_property_readonly("hits", plane_property<PyLocalGrid>(&Local_Grid::T::hits))
+		.def_property_readonly("misses", plane_property<PyLocalGrid>(&Local_Grid::T::misses))
+		.def_property_readonly("log_odds", plane_property<PyLocalGrid>(&Local_Grid::T::log_odds))
+		.def_property_readonly("semantic_id", plane_property<PyLocalGrid>(&Local_Grid::T::semantic_id))
+		.def_property_readonly("present", &presence_property<PyLocalGrid>)
+		.def_property_readonly("cost", [](py::object self) { return rc::numpy::mat(self.cast<PyLocalGrid &>().grid.cost_plane(), self); })
+		.def("update_map_from_polar_data", [](PyLocalGrid &g, const Points &points, float max_range)
+			{
+				const auto p = to_points(points);
+				py::gil_scoped_release release;
+				g.grid.update_map_from_polar_data(p, max_range);
+			}, "points"_a, "max_laser_range"_a)
+		.def("update_map_from_polar_data_log_odds", [](PyLocalGrid &g, const Points &points, float max_range)
+			{
+				const auto p = to_points(points);
+				py::gil_scoped_release release;
+				g.grid.update_map_from_polar_data_log_odds(p, max_range);
+			}, "points"_a, "max_laser_range"_a)
+		// (N, 3) or wider rows of x, y, z in mm, read in place
+		.def("update_map_from_3D_points", [](PyLocalGrid &g, const Points &xyz)
+			{
+				if (xyz.ndim() != 2 or xyz.shape(1) < 3)
+					throw std::invalid_argument("points must be an (N, 3) array");
+				py::gil_scoped_release release;
+				g.grid.update_map_from_3D_points(xyz.data(), xyz.shape(0), xyz.shape(1));
+			}, "xyz"_a);
+}
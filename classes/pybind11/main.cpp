@@ -7,6 +7,7 @@
 #include <pybind11/stl.h>
 #include <cppitertools/range.hpp>
 #include <cppitertools/enumerate.hpp>
+#include "numpy_views.h"
 
 namespace py = pybind11;
 using namespace pybind11::literals; // to bring in the `_a` literal
@@ -25,15 +26,13 @@ int main()
 	// create a numpy array
 	py::array_t<float> python_x = np.attr("arange")(0, 2.f*M_PI + M_PI/4.f, 2.f*M_PI/8.f);
 	
-	// create an Eigen::VectorXf and fill it from an std::vector
+	// hand an std::vector over to numpy without copying it (numpy_views.h)
 	std::vector<float> kk;
 	for(auto i : iter::range(0.0, 2.f*M_PI + M_PI/4.f, 2.f*M_PI/8.f))
 		kk.push_back(i);
-	Eigen::VectorXf x(kk.size());
-	for(auto [l,i]: iter::enumerate(kk))
-		x[l] = i;
+	py::array x = rc::numpy::owned(std::move(kk));
 	
-	// call functions form numpy passing directly the Eigen::VectorXf
+	// call functions form numpy passing directly the array
 	py::array_t<float> y = np.attr("sin")(x);
 	
 	// create a python tuple
@@ -0,0 +1,157 @@
+/////////////////////////////////////////////////
+// NumPy arrays over C++ memory, without copies
+/////////////////////////////////////////////////
+//
+// Every array keeps its owner alive through its base object, so it stays valid as long as Python holds it:
+//
+//   rc::numpy::plane(grid.cells(), &Grid::T::cost, owner)    -> (rows, cols) float32 view of a field of the dense cells,
+//                                                              strided over the cell structs. owner is the Python object
+//                                                              wrapping the grid
+//   rc::numpy::mat(cost_plane, owner)                        -> view of a cv::Mat, (rows, cols) or (rows, cols, channels)
+//   rc::numpy::shared(buffer.read_last_shared<0>())           -> view of a BufferSync/DoubleBuffer element; the array holds
+//                                                              the SlotPool handle, so the slot is not recycled under it
+//   rc::numpy::owned(std::move(path))                        -> array taking over a std::vector, e.g. a path returned by
+//                                                              a planner
+//
+// Views of the grids are writable. Cells written from Python bypass the change tracking of Grid, call mark_all_changed()
+// once done. A view is over the storage of the moment: initialize() reallocates it and views taken before are stale.
+//
+
+#ifndef RC_NUMPY_VIEWS_H
+#define RC_NUMPY_VIEWS_H
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <Eigen/Dense>
+#include <opencv2/core.hpp>
+#include <doublebuffer/slot_pool.h>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace rc::numpy
+{
+	namespace py = pybind11;
+
+	// (rows, cols) view of 'member' in the cells of a DenseMap, strided by the size of a slot
+	template<typename Map, typename Field, typename Cell>
+	py::array plane(const Map &map, Field Cell::*member, py::handle owner)
+	{
+		if (map.slots() == 0)
+			return py::array_t<Field>(std::vector<py::ssize_t>{0, 0});
+		// the map belongs to the Python owner, which is not const
+		auto &first = const_cast<typename Map::value_type &>(map.slot(0));
+		const auto stride = static_cast<py::ssize_t>(sizeof(typename Map::value_type));
+		return py::array(py::dtype::of<Field>(),
+						 {static_cast<py::ssize_t>(map.rows()), static_cast<py::ssize_t>(map.cols())},
+						 {stride * map.cols(), stride},
+						 &(first.second.*member), owner);
+	}
+
+	// read only (rows, cols) uint8 plane, 1 where the map holds a cell
+	template<typename Map>
+	py::array presence(const Map &map, py::handle owner)
+	{
+		py::array a(py::dtype::of<std::uint8_t>(),
+					{static_cast<py::ssize_t>(map.rows()), static_cast<py::ssize_t>(map.cols())},
+					{static_cast<py::ssize_t>(map.cols()), py::ssize_t(1)},
+					map.presence(), owner);
+		a.attr("flags").attr("writeable") = false;
+		return a;
+	}
+
+	inline py::dtype mat_dtype(int depth)
+	{
+		switch (depth)
+		{
+			case CV_8U: return py::dtype::of<std::uint8_t>();
+			case CV_8S: return py::dtype::of<std::int8_t>();
+			case CV_16U: return py::dtype::of<std::uint16_t>();
+			case CV_16S: return py::dtype::of<std::int16_t>();
+			case CV_32S: return py::dtype::of<std::int32_t>();
+			case CV_32F: return py::dtype::of<float>();
+			case CV_64F: return py::dtype::of<double>();
+			default: throw std::invalid_argument("rc::numpy::mat: unsupported cv::Mat depth");
+		}
+	}
+
+	// view of a 2D cv::Mat, with a third axis for the channels if it has more than one
+	inline py::array mat(const cv::Mat &m, py::handle owner)
+	{
+		if (m.dims != 2)
+			throw std::invalid_argument("rc::numpy::mat: only 2D matrices");
+		const auto elem = static_cast<py::ssize_t>(m.elemSize1());
+		std::vector<py::ssize_t> shape{m.rows, m.cols}, strides{static_cast<py::ssize_t>(m.step[0]), static_cast<py::ssize_t>(m.step[1])};
+		if (m.channels() > 1)
+		{
+			shape.push_back(m.channels());
+			strides.push_back(elem);
+		}
+		return py::array(mat_dtype(m.depth()), shape, strides, const_cast<uchar *>(m.data), owner);
+	}
+
+	template<typename T> struct is_eigen_vector : std::false_type {};
+	template<typename S, int R, int O, int MR, int MC>
+	struct is_eigen_vector<Eigen::Matrix<S, R, 1, O, MR, MC>> : std::bool_constant<(R > 0)> {};
+
+	// array over the data of a vector or matrix that 'owner' keeps alive
+	template<typename O>
+	py::array data_of(const O &value, py::handle owner)
+	{
+		if constexpr (std::is_same_v<O, cv::Mat>)
+			return mat(value, owner);
+		else
+		{
+			using E = typename O::value_type;
+			if constexpr (std::is_arithmetic_v<E>)
+				return py::array_t<E>({static_cast<py::ssize_t>(value.size())}, {py::ssize_t(sizeof(E))}, value.data(), owner);
+			else if constexpr (is_eigen_vector<E>::value)
+			{
+				using S = typename E::Scalar;
+				static_assert(sizeof(E) == sizeof(S) * E::RowsAtCompileTime, "padded Eigen vectors can not be viewed");
+				return py::array_t<S>({static_cast<py::ssize_t>(value.size()), static_cast<py::ssize_t>(E::RowsAtCompileTime)},
+									  {static_cast<py::ssize_t>(sizeof(E)), static_cast<py::ssize_t>(sizeof(S))},
+									  reinterpret_cast<const S *>(value.data()), owner);
+			}
+			else
+				static_assert(std::is_arithmetic_v<E>, "rc::numpy: vectors of arithmetic types, fixed Eigen vectors or cv::Mat");
+		}
+	}
+
+	// read only view of a shared element, None for an empty handle
+	template<typename O>
+	py::object shared(typename SlotPool<O>::Handle handle)
+	{
+		if (not handle)
+			return py::none();
+		auto *held = new typename SlotPool<O>::Handle(std::move(handle));
+		py::capsule owner(held, [](void *p) { delete static_cast<typename SlotPool<O>::Handle *>(p); });
+		py::array a = data_of(**held, owner);
+		a.attr("flags").attr("writeable") = false;
+		return std::move(a);
+	}
+	template<typename H>
+	py::object shared(H handle) requires requires { typename H::element_type; }
+	{
+		return shared<typename H::element_type>(std::move(handle));
+	}
+
+	// array that takes over a vector
+	template<typename V>
+	py::array owned(V &&value)
+	{
+		auto *held = new std::remove_cvref_t<V>(std::forward<V>(value));
+		py::capsule owner(held, [](void *p) { delete static_cast<std::remove_cvref_t<V> *>(p); });
+		return data_of(*held, owner);
+	}
+
+	// tuple of shared views, for buffer.read_last_shared() and the other shared reads that return tuples of handles
+	template<typename... H>
+	py::tuple shared(std::tuple<H...> handles)
+	{
+		return std::apply([](auto &&... h) { return py::make_tuple(shared(std::move(h))...); }, std::move(handles));
+	}
+}
+
+#endif // RC_NUMPY_VIEWS_H
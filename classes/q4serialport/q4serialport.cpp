@@ -18,12 +18,16 @@
  */
 #include "q4serialport.h"
 
-QSerialPort::QSerialPort() : portOpen(false)
+#include <string.h>
+#include <algorithm>
+
+QSerialPort::QSerialPort() : portOpen(false), reader(NULL)
 {
 }
 
 QSerialPort::~QSerialPort()
 {
+	stopReader();
 }
 
 bool QSerialPort::open(const QString& name)
@@ -83,6 +87,7 @@ void QSerialPort::close()
 {
 	if(!portOpen)
 		return;
+	stopReader();
 	//portFile.close();
 	::close(portDesc);
 	portOpen=false;
@@ -545,3 +550,165 @@ int QSerialPort::getStatusBits() const
 	return statusBits;
 }
 
+
+bool QSerialPort::startReader(SerialReader::Framer framer, SerialReader::FrameHandler onFrame, qint64 bufferSize)
+{
+	if(!portOpen)
+		return false;
+	stopReader();
+	reader = new SerialReader(portDesc, bufferSize);
+	if (reader->start(framer, onFrame))
+		return true;
+	stopReader();
+	return false;
+}
+
+void QSerialPort::stopReader()
+{
+	if (reader == NULL)
+		return;
+	reader->stop();
+	delete reader;
+	reader = NULL;
+}
+
+
+SerialReader::SerialReader(int _fd, qint64 bufferSize) : fd(_fd), epollFd(-1), wakeFd(-1), buffer(bufferSize), filled(0), running(false), discarded(0)
+{
+}
+
+SerialReader::~SerialReader()
+{
+	stop();
+}
+
+bool SerialReader::start(Framer _framer, FrameHandler _onFrame)
+{
+	if (running.load() or buffer.empty())
+		return false;
+	framer = _framer;
+	onFrame = _onFrame;
+	filled = 0;
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct epoll_event port, wake;
+	port.events = EPOLLIN;
+	port.data.fd = fd;
+	wake.events = EPOLLIN;
+	wake.data.fd = wakeFd;
+	if (epollFd < 0 or wakeFd < 0 or epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &port) < 0 or epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wake) < 0)
+	{
+		printf("SerialReader::start() ERROR: %s\n", strerror(errno));
+		if (epollFd >= 0) ::close(epollFd);
+		if (wakeFd >= 0) ::close(wakeFd);
+		epollFd = wakeFd = -1;
+		return false;
+	}
+	running = true;
+	thread = std::thread(&SerialReader::run, this);
+	return true;
+}
+
+// Not to be called from the frame callback
+void SerialReader::stop()
+{
+	if (thread.joinable())
+	{
+		running = false;
+		const uint64_t one = 1;
+		if (::write(wakeFd, &one, sizeof(one)) < 0)
+			printf("SerialReader::stop() ERROR: %s\n", strerror(errno));
+		thread.join();
+	}
+	if (epollFd >= 0) ::close(epollFd);
+	if (wakeFd >= 0) ::close(wakeFd);
+	epollFd = wakeFd = -1;
+}
+
+void SerialReader::run()
+{
+	struct epoll_event events[2];
+	while (running.load())
+	{
+		const int n = epoll_wait(epollFd, events, 2, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("SerialReader::run() ERROR: %s\n", strerror(errno));
+			break;
+		}
+		for (int i=0; i<n; i++)
+		{
+			if (events[i].data.fd == wakeFd)
+			{
+				running = false;
+				return;
+			}
+			// a frame longer than the whole buffer can never be completed
+			if (filled == (qint64)buffer.size())
+			{
+				discarded += filled;
+				filled = 0;
+			}
+			// level triggered: one read per wake up never blocks, and epoll reports what is left
+			const ssize_t r = ::read(fd, buffer.data() + filled, buffer.size() - filled);
+			if (r > 0)
+			{
+				filled += r;
+				parse();
+			}
+			else if (r == 0 or (errno != EAGAIN and errno != EINTR) or (events[i].events & (EPOLLHUP | EPOLLERR)))
+			{
+				printf("SerialReader::run() ERROR: the port was closed or failed\n");
+				running = false;
+				return;
+			}
+		}
+	}
+	running = false;
+}
+
+void SerialReader::parse()
+{
+	qint64 pos = 0;
+	while (pos < filled)
+	{
+		const qint64 left = filled - pos;
+		const qint64 len = framer(buffer.data() + pos, left);
+		if (len == 0 or len > left)
+			break;
+		if (len < 0)
+		{
+			const qint64 skip = std::min(-len, left);
+			discarded += skip;
+			pos += skip;
+			continue;
+		}
+		onFrame(buffer.data() + pos, len);
+		pos += len;
+	}
+	if (pos > 0)
+	{
+		memmove(buffer.data(), buffer.data() + pos, filled - pos);
+		filled -= pos;
+	}
+}
+
+SerialReader::Framer SerialReader::byDelimiter(char delimiter)
+{
+	return [delimiter](const char *data, qint64 len) -> qint64
+	{
+		const char *end = (const char *)memchr(data, delimiter, len);
+		return end ? end - data + 1 : 0;
+	};
+}
+
+SerialReader::Framer SerialReader::byLength(qint64 length)
+{
+	return [length](const char *data, qint64 len) -> qint64
+	{
+		(void)data;
+		return len >= length ? length : 0;
+	};
+}
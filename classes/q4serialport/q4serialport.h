@@ -31,6 +31,14 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
 #include <QIODevice>
 #include <QtCore>
 
@@ -44,20 +52,50 @@
 extern int errno;
 
 
-class Lector: public QThread
+/**
+ * Receive thread for a serial port descriptor. It sleeps in epoll until the port has data, reads everything available
+ * into a buffer allocated once and cuts it into frames with a framer. Every complete frame is passed to the frame
+ * callback as a pointer into that buffer, without copies; the view is only valid during the call. The bytes of an
+ * incomplete frame are moved to the front of the buffer before the next read.
+ *
+ * The framer gets the unparsed bytes and returns the length of the frame at their start, 0 if more bytes are needed,
+ * or a negative count of bytes to discard to resynchronize. byDelimiter and byLength build the usual ones.
+ * stop() wakes the thread through an eventfd and joins it.
+ *
+ *	SerialReader reader(port.portDesc, 4096);
+ *	reader.start(SerialReader::byDelimiter('\n'), [](const char *frame, qint64 len) { parse(frame, len); });
+ */
+class SerialReader
 {
-
 public:
-	Lector(QFile *_f){f=_f;};
-	~Lector(){};
-	QFile *f;
-	void run()
-	{
-		for(;;)
-		{
-			f->waitForReadyRead(-1);
-		}
-	};
+	typedef std::function<qint64(const char *data, qint64 len)> Framer;
+	typedef std::function<void(const char *frame, qint64 len)> FrameHandler;
+
+	SerialReader(int fd, qint64 bufferSize=4096);
+	~SerialReader();
+
+	bool start(Framer framer, FrameHandler onFrame);
+	void stop();
+	bool isRunning() const { return running.load(); }
+
+	static Framer byDelimiter(char delimiter);
+	static Framer byLength(qint64 length);
+
+	// bytes thrown away by the framer or because a frame did not fit in the buffer
+	quint64 discardedBytes() const { return discarded.load(); }
+
+private:
+	int fd, epollFd, wakeFd;
+	std::vector<char> buffer;
+	qint64 filled;
+	Framer framer;
+	FrameHandler onFrame;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<quint64> discarded;
+
+	void run();
+	void parse();
 };
 
 
@@ -145,7 +183,11 @@ protected:
 public:
 	QFile portFile;
 	int portDesc;
-	Lector *lector;
+	SerialReader *reader;
+
+	// Event driven reception of frames, see SerialReader. read, readLine and getch must not be used while it runs
+	bool startReader(SerialReader::Framer framer, SerialReader::FrameHandler onFrame, qint64 bufferSize=4096);
+	void stopReader();
 	
 protected slots:
 	void slotNotifierActivated();
@@ -0,0 +1,388 @@
+/***************************************************************************
+**                                                                        **
+**  Streaming graph for QCustomPlot: a fixed-capacity ring of samples     **
+**  with monotonically increasing keys and a min/max pyramid over them.   **
+**                                                                        **
+****************************************************************************/
+
+#include "qcpstreaminggraph.h"
+
+#include <cmath>
+#include <limits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPRingDataContainer
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*!
+  Creates an empty container for \a capacity samples, rounded up to a power of two.
+*/
+QCPRingDataContainer::QCPRingDataContainer(int capacity) :
+  mMask(0),
+  mHead(0),
+  mSize(0)
+{
+  int slots = 2;
+  while (slots < capacity && slots < (1<<30))
+    slots <<= 1;
+  mMask = slots-1;
+  mKeys.resize(slots);
+  mValues.resize(slots);
+  for (int size = slots/2; size >= 1; size /= 2)
+    mLevels.append(QVector<Bounds>(size));
+  clear();
+}
+
+/*!
+  Appends a sample, evicting the oldest one if the container is full. A \a key smaller than the
+  last one is refused, since the lookups rely on sorted keys.
+*/
+void QCPRingDataContainer::add(double key, double value)
+{
+  if (mSize > 0 && key < keyAt(mSize-1))
+  {
+    qDebug() << Q_FUNC_INFO << "key" << key << "is smaller than the last one, ignored";
+    return;
+  }
+  int slot;
+  if (mSize <= mMask)
+  {
+    slot = (mHead+mSize) & mMask;
+    ++mSize;
+  } else
+  {
+    slot = mHead;
+    mHead = (mHead+1) & mMask;
+  }
+  mKeys[slot] = key;
+  mValues[slot] = value;
+  // only the ancestors of the slot change
+  for (int level = 1; level <= mLevels.size(); ++level)
+  {
+    slot >>= 1;
+    const Bounds left = slotBounds(level-1, 2*slot), right = slotBounds(level-1, 2*slot+1);
+    Bounds &b = mLevels[level-1][slot];
+    b.lower = qMin(left.lower, right.lower);
+    b.upper = qMax(left.upper, right.upper);
+  }
+}
+
+/*! \overload */
+void QCPRingDataContainer::add(const QVector<double> &keys, const QVector<double> &values)
+{
+  const int n = qMin(keys.size(), values.size());
+  for (int i=0; i<n; ++i)
+    add(keys.at(i), values.at(i));
+}
+
+void QCPRingDataContainer::clear()
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  mValues.fill(nan);
+  mKeys.fill(nan);
+  const Bounds empty = {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+  for (int level=0; level<mLevels.size(); ++level)
+    mLevels[level].fill(empty);
+  mHead = 0;
+  mSize = 0;
+}
+
+/*!
+  Index of the first sample whose key is not smaller than \a key, \ref size() if there is none.
+*/
+int QCPRingDataContainer::findBegin(double key) const
+{
+  int lo = 0, hi = mSize;
+  while (lo < hi)
+  {
+    const int mid = lo + (hi-lo)/2;
+    if (keyAt(mid) < key) lo = mid+1; else hi = mid;
+  }
+  return lo;
+}
+
+/*!
+  Index after the last sample whose key is not greater than \a key.
+*/
+int QCPRingDataContainer::findEnd(double key) const
+{
+  int lo = 0, hi = mSize;
+  while (lo < hi)
+  {
+    const int mid = lo + (hi-lo)/2;
+    if (keyAt(mid) <= key) lo = mid+1; else hi = mid;
+  }
+  return lo;
+}
+
+/*!
+  Smallest and largest value of the samples with index in [\a begin, \a end). Returns false if
+  there are none, or all of them are NaN.
+*/
+bool QCPRingDataContainer::valueBounds(int begin, int end, double &lower, double &upper) const
+{
+  begin = qMax(begin, 0);
+  end = qMin(end, mSize);
+  Bounds b = {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+  if (begin < end)
+  {
+    // the logical range is one or two runs of physical slots
+    const int first = (mHead+begin) & mMask;
+    const int count = end-begin;
+    if (first+count <= mMask+1)
+      physicalBounds(first, first+count, b);
+    else
+    {
+      physicalBounds(first, mMask+1, b);
+      physicalBounds(0, count-(mMask+1-first), b);
+    }
+  }
+  lower = b.lower;
+  upper = b.upper;
+  return b.lower <= b.upper;
+}
+
+/*! \internal */
+QCPRingDataContainer::Bounds QCPRingDataContainer::slotBounds(int level, int slot) const
+{
+  if (level > 0)
+    return mLevels.at(level-1).at(slot);
+  const double v = mValues.at(slot);
+  if (qIsNaN(v))
+  {
+    const Bounds empty = {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+    return empty;
+  }
+  const Bounds b = {v, v};
+  return b;
+}
+
+/*! \internal
+
+  Bounds of the physical slots [\a begin, \a end), merged into \a bounds: the fewest aligned
+  blocks that cover the range, climbing one level per step.
+*/
+void QCPRingDataContainer::physicalBounds(int begin, int end, Bounds &bounds) const
+{
+  for (int level = 0; begin < end; ++level, begin >>= 1, end >>= 1)
+  {
+    if (begin & 1)
+    {
+      const Bounds b = slotBounds(level, begin++);
+      bounds.lower = qMin(bounds.lower, b.lower);
+      bounds.upper = qMax(bounds.upper, b.upper);
+    }
+    if (end & 1)
+    {
+      const Bounds b = slotBounds(level, --end);
+      bounds.lower = qMin(bounds.lower, b.lower);
+      bounds.upper = qMax(bounds.upper, b.upper);
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPStreamingGraph
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*!
+  Creates a graph on \a keyAxis and \a valueAxis that keeps the last \a capacity samples (rounded
+  up to a power of two). Like other plottables, it is owned by the parent plot of the axes.
+*/
+QCPStreamingGraph::QCPStreamingGraph(QCPAxis *keyAxis, QCPAxis *valueAxis, int capacity) :
+  QCPAbstractPlottable(keyAxis, valueAxis),
+  mData(capacity)
+{
+  setPen(QPen(Qt::blue, 0));
+  setBrush(Qt::NoBrush);
+}
+
+QCPStreamingGraph::~QCPStreamingGraph()
+{
+}
+
+/* inherits documentation from base class */
+double QCPStreamingGraph::selectTest(const QPointF &pos, bool onlySelectable, QVariant *details) const
+{
+  if ((onlySelectable && mSelectable == QCP::stNone) || mData.isEmpty())
+    return -1;
+  if (!mKeyAxis || !mValueAxis)
+    return -1;
+  if (!mKeyAxis.data()->axisRect()->rect().contains(pos.toPoint()) && !mParentPlot->interactions().testFlag(QCP::iSelectPlottablesBeyondAxisRect))
+    return -1;
+
+  // samples under the cursor, within the selection tolerance along the key axis
+  const double tolerance = mParentPlot->selectionTolerance();
+  const double k0 = mKeyAxis.data()->pixelToCoord(keyPixel(pos)-tolerance);
+  const double k1 = mKeyAxis.data()->pixelToCoord(keyPixel(pos)+tolerance);
+  int begin = mData.findBegin(qMin(k0, k1));
+  int end = mData.findEnd(qMax(k0, k1));
+  if (begin >= end)
+  {
+    // none: the closest one
+    const double key = mKeyAxis.data()->pixelToCoord(keyPixel(pos));
+    begin = qMin(mData.findBegin(key), mData.size()-1);
+    if (begin > 0 && qAbs(mData.keyAt(begin-1)-key) < qAbs(mData.keyAt(begin)-key))
+      --begin;
+    end = begin+1;
+  }
+  double lower, upper;
+  if (!mData.valueBounds(begin, end, lower, upper))
+    return -1;
+  if (details)
+  {
+    const int index = begin + (end-begin)/2;
+    details->setValue(QCPDataSelection(QCPDataRange(index, index+1)));
+  }
+  // distance to the vertical (or horizontal) segment covering the bounds
+  const double key = mData.keyAt(begin + (end-begin)/2);
+  return qSqrt(QCPVector2D(pos).distanceSquaredToLine(QCPVector2D(coordsToPixels(key, lower)), QCPVector2D(coordsToPixels(key, upper))));
+}
+
+/* inherits documentation from base class */
+QCPRange QCPStreamingGraph::getKeyRange(bool &foundRange, QCP::SignDomain inSignDomain) const
+{
+  int begin = 0, end = mData.size();
+  if (inSignDomain == QCP::sdPositive)
+    begin = mData.findEnd(0);
+  else if (inSignDomain == QCP::sdNegative)
+    end = mData.findBegin(0);
+  foundRange = begin < end;
+  return foundRange ? QCPRange(mData.keyAt(begin), mData.keyAt(end-1)) : QCPRange();
+}
+
+/* inherits documentation from base class */
+QCPRange QCPStreamingGraph::getValueRange(bool &foundRange, QCP::SignDomain inSignDomain, const QCPRange &inKeyRange) const
+{
+  int begin = 0, end = mData.size();
+  if (inKeyRange != QCPRange())
+  {
+    begin = mData.findBegin(inKeyRange.lower);
+    end = mData.findEnd(inKeyRange.upper);
+  }
+  double lower, upper;
+  foundRange = mData.valueBounds(begin, end, lower, upper);
+  if (foundRange && inSignDomain != QCP::sdBoth)
+  {
+    // the pyramid only knows the extremes; the smallest value of one sign needs a pass over the samples
+    if ((inSignDomain == QCP::sdPositive && lower <= 0) || (inSignDomain == QCP::sdNegative && upper >= 0))
+    {
+      foundRange = false;
+      for (int i=begin; i<end; ++i)
+      {
+        const double v = mData.valueAt(i);
+        if ((inSignDomain == QCP::sdPositive && v > 0) || (inSignDomain == QCP::sdNegative && v < 0))
+        {
+          if (!foundRange) { lower = upper = v; foundRange = true; }
+          lower = qMin(lower, v);
+          upper = qMax(upper, v);
+        }
+      }
+    }
+  }
+  return foundRange ? QCPRange(lower, upper) : QCPRange();
+}
+
+/* inherits documentation from base class */
+void QCPStreamingGraph::draw(QCPPainter *painter)
+{
+  if (!mKeyAxis || !mValueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  if (mKeyAxis.data()->range().size() <= 0 || mData.isEmpty()) return;
+
+  QVector<QPointF> lines;
+  getLines(&lines);
+  if (lines.size() < 2)
+    return;
+  if (selected() && mSelectionDecorator)
+    mSelectionDecorator->applyPen(painter);
+  else
+    painter->setPen(mPen);
+  painter->setBrush(Qt::NoBrush);
+  applyDefaultAntialiasingHint(painter);
+  painter->drawPolyline(lines.constData(), lines.size());
+}
+
+/* inherits documentation from base class */
+void QCPStreamingGraph::drawLegendIcon(QCPPainter *painter, const QRectF &rect) const
+{
+  applyDefaultAntialiasingHint(painter);
+  painter->setPen(mPen);
+  painter->drawLine(QLineF(rect.left(), rect.top()+rect.height()/2.0, rect.right()+5, rect.top()+rect.height()/2.0)); // +5 on x2 else last segment is missing from dashed/dotted pens
+}
+
+/*! \internal
+
+  Pixel points of the polyline over the visible key range, plus one sample on each side so the
+  line leaves the axis rect. While there are fewer than two samples per pixel column they are all
+  drawn; above that every column becomes its first, lowest, highest and last value.
+*/
+void QCPStreamingGraph::getLines(QVector<QPointF> *lines) const
+{
+  lines->clear();
+  QCPAxis *keyAxis = mKeyAxis.data();
+  const QCPRange range = keyAxis->range();
+  const int begin = qMax(mData.findBegin(range.lower)-1, 0);
+  const int end = qMin(mData.findEnd(range.upper)+1, mData.size());
+  if (begin >= end)
+    return;
+
+  const double p0 = keyAxis->coordToPixel(range.lower), p1 = keyAxis->coordToPixel(range.upper);
+  const int columns = qMax(1, int(std::ceil(qAbs(p1-p0))));
+  if (end-begin <= 2*columns)
+  {
+    lines->reserve(end-begin);
+    for (int i=begin; i<end; ++i)
+      if (!qIsNaN(mData.valueAt(i)))
+        lines->append(coordsToPixels(mData.keyAt(i), mData.valueAt(i)));
+    return;
+  }
+
+  lines->reserve(4*columns+2);
+  int first = begin;
+  if (mData.keyAt(first) < range.lower)
+  {
+    if (!qIsNaN(mData.valueAt(first)))
+      lines->append(coordsToPixels(mData.keyAt(first), mData.valueAt(first)));
+    ++first;
+  }
+  for (int c=0; c<columns && first<end; ++c)
+  {
+    // column boundaries through the axis, so that logarithmic and reversed axes work too
+    const int last = c+1 < columns ? qMin(mData.findBegin(keyAxis->pixelToCoord(p0+(p1-p0)*(c+1)/columns)), end) : mData.findEnd(range.upper);
+    if (last <= first)
+      continue;
+    if (last-first <= 2)
+    {
+      for (int i=first; i<last; ++i)
+        if (!qIsNaN(mData.valueAt(i)))
+          lines->append(coordsToPixels(mData.keyAt(i), mData.valueAt(i)));
+    } else
+    {
+      double lower, upper;
+      if (mData.valueBounds(first, last, lower, upper))
+      {
+        const double key = mData.keyAt(first+(last-first)/2);
+        if (!qIsNaN(mData.valueAt(first)))
+          lines->append(coordsToPixels(mData.keyAt(first), mData.valueAt(first)));
+        lines->append(coordsToPixels(key, lower));
+        lines->append(coordsToPixels(key, upper));
+        if (!qIsNaN(mData.valueAt(last-1)))
+          lines->append(coordsToPixels(mData.keyAt(last-1), mData.valueAt(last-1)));
+      }
+    }
+    first = last;
+  }
+  for (int i=first; i<end; ++i)
+    if (!qIsNaN(mData.valueAt(i)))
+      lines->append(coordsToPixels(mData.keyAt(i), mData.valueAt(i)));
+}
+
+/*! \internal
+
+  Coordinate of \a pixelPoint along the key axis.
+*/
+double QCPStreamingGraph::keyPixel(const QPointF &pixelPoint) const
+{
+  return mKeyAxis.data()->orientation() == Qt::Horizontal ? pixelPoint.x() : pixelPoint.y();
+}
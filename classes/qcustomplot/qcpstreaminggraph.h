@@ -0,0 +1,109 @@
+/***************************************************************************
+**                                                                        **
+**  Streaming graph for QCustomPlot: a fixed-capacity ring of samples     **
+**  with monotonically increasing keys and a min/max pyramid over them.   **
+**                                                                        **
+****************************************************************************/
+
+#ifndef QCPSTREAMINGGRAPH_H
+#define QCPSTREAMINGGRAPH_H
+
+#include "qcustomplot.h"
+
+/*!
+  \brief Fixed-capacity ring of (key, value) samples for telemetry.
+
+  Keys must not decrease. \ref add is O(log capacity) and never moves memory: when the ring is full
+  the oldest sample is overwritten. Besides the samples, the container keeps a pyramid of value
+  bounds over aligned blocks of 2, 4, 8... slots, updated on every add, so \ref valueBounds of any
+  index range costs O(log capacity) whatever its length.
+
+  Indexes go from 0, the oldest sample, to \ref size()-1, the newest. NaN values are kept but are
+  left out of the bounds.
+*/
+class QCP_LIB_DECL QCPRingDataContainer
+{
+public:
+  explicit QCPRingDataContainer(int capacity=1<<20);
+
+  // getters:
+  int size() const { return mSize; }
+  int capacity() const { return mMask+1; }
+  bool isEmpty() const { return mSize == 0; }
+  double keyAt(int index) const { return mKeys.at((mHead+index) & mMask); }
+  double valueAt(int index) const { return mValues.at((mHead+index) & mMask); }
+
+  // non-property methods:
+  void add(double key, double value);
+  void add(const QVector<double> &keys, const QVector<double> &values);
+  void clear();
+  int findBegin(double key) const;
+  int findEnd(double key) const;
+  bool valueBounds(int begin, int end, double &lower, double &upper) const;
+
+protected:
+  struct Bounds { double lower, upper; };
+
+  int mMask, mHead, mSize;
+  QVector<double> mKeys, mValues;
+  QVector<QVector<Bounds> > mLevels; // mLevels[k-1][i]: bounds of the slots [i*2^k, (i+1)*2^k)
+
+  Bounds slotBounds(int level, int slot) const;
+  void physicalBounds(int begin, int end, Bounds &bounds) const;
+};
+
+
+/*!
+  \brief A line graph drawn from a \ref QCPRingDataContainer.
+
+  Meant for signals sampled at high rate and plotted as a scrolling window, e.g. joint currents at
+  1 kHz: appending never reallocates nor shifts data, and a replot walks the pixel columns of the
+  key axis, not the samples. Columns with more samples than fit are drawn as their first, minimum,
+  maximum and last values, the bounds coming from the pyramid, so drawing a window of millions of
+  samples costs O(pixels * log(capacity)).
+
+  \code
+  QCPStreamingGraph *current = new QCPStreamingGraph(plot->xAxis, plot->yAxis, 1<<21);
+  current->setPen(QPen(Qt::red));
+  ...
+  current->addData(t, amps);                       // every sample
+  plot->xAxis->setRange(t, 10, Qt::AlignRight);    // last 10 s
+  plot->replot(QCustomPlot::rpQueuedReplot);       // at display rate
+  \endcode
+*/
+class QCP_LIB_DECL QCPStreamingGraph : public QCPAbstractPlottable
+{
+  Q_OBJECT
+public:
+  explicit QCPStreamingGraph(QCPAxis *keyAxis, QCPAxis *valueAxis, int capacity=1<<20);
+  virtual ~QCPStreamingGraph() Q_DECL_OVERRIDE;
+
+  // getters:
+  QCPRingDataContainer *data() { return &mData; }
+  const QCPRingDataContainer *data() const { return &mData; }
+
+  // non-property methods:
+  void addData(double key, double value) { mData.add(key, value); }
+  void addData(const QVector<double> &keys, const QVector<double> &values) { mData.add(keys, values); }
+
+  // reimplemented virtual methods:
+  virtual double selectTest(const QPointF &pos, bool onlySelectable, QVariant *details=nullptr) const Q_DECL_OVERRIDE;
+  virtual QCPRange getKeyRange(bool &foundRange, QCP::SignDomain inSignDomain=QCP::sdBoth) const Q_DECL_OVERRIDE;
+  virtual QCPRange getValueRange(bool &foundRange, QCP::SignDomain inSignDomain=QCP::sdBoth, const QCPRange &inKeyRange=QCPRange()) const Q_DECL_OVERRIDE;
+
+protected:
+  QCPRingDataContainer mData;
+
+  // reimplemented virtual methods:
+  virtual void draw(QCPPainter *painter) Q_DECL_OVERRIDE;
+  virtual void drawLegendIcon(QCPPainter *painter, const QRectF &rect) const Q_DECL_OVERRIDE;
+
+  // non-virtual methods:
+  void getLines(QVector<QPointF> *lines) const;
+  double keyPixel(const QPointF &pixelPoint) const;
+
+private:
+  Q_DISABLE_COPY(QCPStreamingGraph)
+};
+
+#endif // QCPSTREAMINGGRAPH_H
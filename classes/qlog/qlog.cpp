@@ -18,8 +18,14 @@
  */
 #include "qlog.h"
 
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <memory>
+
 
 qLog* qLog::logger = NULL;
+std::atomic<bool> qLog::async(false);
 
 
 qLog::qLog()
@@ -34,8 +40,8 @@ qLog::~qLog()
 
 qLog* qLog::getInstance()
 {
-	if (logger == NULL)
-		logger = new qLog();
+	static std::once_flag created;
+	std::call_once(created, []() { if (logger == NULL) logger = new qLog(); });
 	return logger;
 }
 
@@ -79,6 +85,12 @@ void qLog::setProxy(std::string endpoint, RoboCompLogger::LoggerPrx _prx)
 
 void qLog::send(std::string _file, int line, std::string func, std::string strng, std::string _type)
 {
+	deliver(_file, line, func, strng, _type, QDateTime::currentDateTime());
+}
+
+void qLog::deliver(std::string _file, int line, std::string func, std::string strng, std::string _type, const QDateTime &time)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
 //	printf("send: %s %s\n", log.toStdString().c_str(), strng.c_str());
 	if (log == "none")
 		return;
@@ -92,7 +104,7 @@ void qLog::send(std::string _file, int line, std::string func, std::string strng
 		file = list1[list1.size()-1].toStdString();
 		method = func;
 		nLine = line;
-		timeStamp = QDateTime::currentDateTime().toString("yyyy.MM.dd hh:mm:ss:zzz").toStdString();
+		timeStamp = time.toString("yyyy.MM.dd hh:mm:ss:zzz").toStdString();
 		message = strng;
 		type = _type;
 		fullpath = _file;
@@ -121,3 +133,283 @@ void qLog::send(std::string file, int line,std::string func, const char* strng,s
 }
 
 
+
+
+/// ASYNCHRONOUS BACKEND
+
+namespace
+{
+	// records of one thread: it is the only producer, the background thread of qLog the only consumer
+	struct qLogRing
+	{
+		explicit qLogRing(size_t capacity)
+		{
+			size_t c = 1;
+			while (c < capacity)
+				c <<= 1;
+			slots.resize(c);
+			mask = c - 1;
+		}
+		std::vector<qLogRecord> slots;
+		size_t mask;
+		alignas(64) std::atomic<size_t> head{0};
+		alignas(64) std::atomic<size_t> tail{0};
+		std::atomic<bool> alive{true};		// false once its thread is gone
+	};
+
+	struct qLogRingOwner
+	{
+		std::shared_ptr<qLogRing> ring;
+		unsigned generation = 0;
+		~qLogRingOwner() { if (ring) ring->alive = false; }
+	};
+
+	std::mutex ringsMutex;
+	std::vector<std::shared_ptr<qLogRing> > rings;
+	std::atomic<unsigned> ringGeneration(0);
+	size_t ringRecords = 1024;
+	std::thread worker;
+	std::atomic<bool> workerRunning(false);
+	std::atomic<uint64_t> dropped(0);
+	uint64_t droppedReported = 0;		// by the worker, and by stopAsync once it has been joined
+	thread_local qLogRingOwner ringOwner;
+
+	void appendf(std::string &out, const char *fmt, ...)
+	{
+		char small[128];
+		va_list ap;
+		va_start(ap, fmt);
+		const int n = vsnprintf(small, sizeof(small), fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if (n < (int)sizeof(small))
+		{
+			out.append(small, n);
+			return;
+		}
+		const size_t at = out.size();
+		out.resize(at + n + 1);
+		va_start(ap, fmt);
+		vsnprintf(&out[at], n + 1, fmt, ap);
+		va_end(ap);
+		out.resize(at + n);
+	}
+}
+
+void qLog::startAsync(size_t recordsPerThread)
+{
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	if (workerRunning.load())
+		return;
+	ringRecords = std::max<size_t>(recordsPerThread, 2);
+	ringGeneration++;
+	workerRunning = true;
+	worker = std::thread(&qLog::consumer);
+	static std::once_flag atExit;
+	std::call_once(atExit, []() { atexit(&qLog::stopAsync); });
+	async = true;
+}
+
+void qLog::stopAsync()
+{
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		if (not workerRunning.load())
+			return;
+		async = false;
+		workerRunning = false;
+	}
+	worker.join();		// the last pass ships what is left
+	reportDrops();		// drops counted after the last pass read the counter
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	rings.clear();
+}
+
+uint64_t qLog::droppedMessages()
+{
+	return dropped.load();
+}
+
+qLogRecord *qLog::reserve()
+{
+	qLogRingOwner &owner = ringOwner;
+	const unsigned generation = ringGeneration.load(std::memory_order_relaxed);
+	if (not owner.ring or owner.generation != generation)
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		if (not workerRunning.load())
+			return NULL;
+		owner.ring = std::make_shared<qLogRing>(ringRecords);
+		owner.generation = generation;
+		rings.push_back(owner.ring);
+	}
+	qLogRing &r = *owner.ring;
+	const size_t h = r.head.load(std::memory_order_relaxed);
+	if (h - r.tail.load(std::memory_order_acquire) > r.mask)
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &r.slots[h & r.mask];
+}
+
+void qLog::publish()
+{
+	qLogRing &r = *ringOwner.ring;
+	r.head.store(r.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void qLog::ship(const qLogSite *site, int64_t time, const char *args, size_t size)
+{
+	static const char *types[] = {"Debug", "Info", "Error"};
+	getInstance()->deliver(site->file, site->line, site->func, format(site->format, args, size), types[std::clamp(site->level, 0, 2)],
+	                       QDateTime::fromMSecsSinceEpoch(time / 1000000));
+}
+
+void qLog::consumer()
+{
+	std::vector<qLogRecord> batch;
+	std::vector<std::shared_ptr<qLogRing> > current;
+	for (;;)
+	{
+		// read before the pass, so that the pass after stopAsync still drains everything written until then
+		const bool running = workerRunning.load();
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			current = rings;
+		}
+		for (auto &ring : current)
+		{
+			size_t t = ring->tail.load(std::memory_order_relaxed);
+			const size_t h = ring->head.load(std::memory_order_acquire);
+			for (; t != h; t++)
+				batch.push_back(ring->slots[t & ring->mask]);
+			ring->tail.store(t, std::memory_order_release);
+		}
+		{
+			// rings of finished threads, once empty
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<qLogRing> &r)
+				{ return not r->alive.load() and r->tail.load() == r->head.load(); }), rings.end());
+		}
+		std::stable_sort(batch.begin(), batch.end(), [](const qLogRecord &a, const qLogRecord &b) { return a.time < b.time; });
+		for (const qLogRecord &r : batch)
+			ship(r.site, r.time, r.args, r.size);
+		reportDrops();
+		if (not running)
+			break;
+		if (batch.empty())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		batch.clear();
+	}
+}
+
+void qLog::reportDrops()
+{
+	const uint64_t d = dropped.load();
+	if (d == droppedReported)
+		return;
+	static const qLogSite site = {__FILE__, __func__, "qLog: %llu messages dropped, the rings were full", __LINE__, QLOG_LEVEL_ERROR};
+	const uint64_t lost = d - droppedReported;
+	char args[16];
+	ship(&site, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+	     args, qlog_detail::encode(args, lost) - args);
+	droppedReported = d;
+}
+
+std::string qLog::format(const char *format, const char *args, size_t size)
+{
+	std::string out;
+	const char *a = args, *end = args + size;
+	for (const char *f = format; *f; )
+	{
+		if (*f != '%')
+		{
+			const char *next = strchr(f, '%');
+			if (next == NULL)
+				next = f + strlen(f);
+			out.append(f, next - f);
+			f = next;
+			continue;
+		}
+		if (f[1] == '%')
+		{
+			out += '%';
+			f += 2;
+			continue;
+		}
+		// flags, width and precision are kept, the length modifier is the one of the stored argument
+		std::string spec = "%";
+		const char *s = f + 1;
+		while (*s and strchr("-+ #0", *s))
+			spec += *s++;
+		while (isdigit((unsigned char)*s))
+			spec += *s++;
+		if (*s == '.')
+		{
+			spec += *s++;
+			while (isdigit((unsigned char)*s))
+				spec += *s++;
+		}
+		while (*s and strchr("hlLqjzt", *s))
+			s++;
+		const char conv = *s ? *s++ : 's';
+		f = s;
+		if (a >= end)
+		{
+			out += "(missing)";
+			continue;
+		}
+		const char tag = *a++;
+		const bool integer = strchr("diouxXc", conv) != NULL, real = strchr("fFeEgGaA", conv) != NULL;
+		switch (tag)
+		{
+			case qlog_detail::INT:
+			case qlog_detail::UINT:
+			{
+				int64_t i;
+				memcpy(&i, a, sizeof(i));
+				a += sizeof(i);
+				if (conv == 'c')
+					appendf(out, (spec + 'c').c_str(), (int)i);
+				else if (real)
+					appendf(out, (spec + conv).c_str(), tag == qlog_detail::INT ? (double)i : (double)(uint64_t)i);
+				else if (integer)
+					appendf(out, (spec + "ll" + conv).c_str(), (long long)i);
+				else
+					appendf(out, tag == qlog_detail::INT ? "%lld" : "%llu", (long long)i);
+				break;
+			}
+			case qlog_detail::DOUBLE:
+			{
+				double d;
+				memcpy(&d, a, sizeof(d));
+				a += sizeof(d);
+				appendf(out, (spec + (real ? conv : 'g')).c_str(), d);
+				break;
+			}
+			case qlog_detail::STRING:
+			{
+				uint16_t len;
+				memcpy(&len, a, sizeof(len));
+				a += sizeof(len);
+				const std::string str(a, len);
+				a += len;
+				appendf(out, (conv == 's' ? spec + 's' : std::string("%s")).c_str(), str.c_str());
+				break;
+			}
+			case qlog_detail::POINTER:
+			{
+				uint64_t p;
+				memcpy(&p, a, sizeof(p));
+				a += sizeof(p);
+				appendf(out, "%p", (void *)(uintptr_t)p);
+				break;
+			}
+			default:
+				return out + "(corrupt record)";
+		}
+	}
+	return out;
+}
@@ -22,6 +22,16 @@
 #include "config.h"
 #include <QtCore>
 #include <iostream>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #if COMPILE_LOGGERCOMP==1
 	#include <Logger.h>
@@ -32,11 +42,132 @@
 #endif
 
 
+// Levels under QLOG_MIN_LEVEL are compiled out, arguments included: -DQLOG_MIN_LEVEL=1 drops every debug message
+#define QLOG_LEVEL_DEBUG 0
+#define QLOG_LEVEL_INFO 1
+#define QLOG_LEVEL_ERROR 2
+#ifndef QLOG_MIN_LEVEL
+	#define QLOG_MIN_LEVEL QLOG_LEVEL_DEBUG
+#endif
+
+// One static site per call: file, function, format and line are never copied, records point to it
+#define QLOG_RECORD(level, fmt, ...) do { static const qLogSite qlog_site_ = {__FILE__, __func__, fmt, __LINE__, level}; qLog::record(&qlog_site_, ##__VA_ARGS__); } while (0)
+
 #define SetLoggerInstance(x) loggerInstance = x
-#define rDebug2(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),boost::str(boost::format strng ),std::string("Debug"))
-#define rDebug(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Debug"))
-#define rInfo(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Info"))
-#define rError(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Error"))
+#if QLOG_MIN_LEVEL <= QLOG_LEVEL_DEBUG
+	#define rDebug2(strng) QLOG_RECORD(QLOG_LEVEL_DEBUG, "%s", boost::str(boost::format strng ))
+	#define rDebug(strng) QLOG_RECORD(QLOG_LEVEL_DEBUG, "%s", strng)
+	#define rDebugf(...) QLOG_RECORD(QLOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+	#define rDebug2(strng) do {} while (0)
+	#define rDebug(strng) do {} while (0)
+	#define rDebugf(...) do {} while (0)
+#endif
+#if QLOG_MIN_LEVEL <= QLOG_LEVEL_INFO
+	#define rInfo(strng) QLOG_RECORD(QLOG_LEVEL_INFO, "%s", strng)
+	#define rInfof(...) QLOG_RECORD(QLOG_LEVEL_INFO, __VA_ARGS__)
+#else
+	#define rInfo(strng) do {} while (0)
+	#define rInfof(...) do {} while (0)
+#endif
+#define rError(strng) QLOG_RECORD(QLOG_LEVEL_ERROR, "%s", strng)
+#define rErrorf(...) QLOG_RECORD(QLOG_LEVEL_ERROR, __VA_ARGS__)
+
+struct qLogSite
+{
+	const char *file;
+	const char *func;
+	const char *format;
+	int line;
+	int level;
+};
+
+// Compact binary message: the site, the time and the arguments, each one a type tag and its raw bytes (strings with
+// their length). It is formatted with the printf format of the site by whoever ships it
+struct qLogRecord
+{
+	enum { ARGS_SIZE = 232 };
+	const qLogSite *site;
+	int64_t time;		// ns since the epoch
+	uint16_t size;
+	char args[ARGS_SIZE];
+};
+
+namespace qlog_detail
+{
+	enum Tag : char { INT = 'i', UINT = 'u', DOUBLE = 'd', STRING = 's', POINTER = 'p' };
+
+	// QString, and whatever converts to it, is stored as its std::string; numbers, pointers and strings as they come
+	template <typename T>
+	inline decltype(auto) plain(const T &v)
+	{
+		if constexpr (std::is_arithmetic_v<T> or std::is_enum_v<T> or std::is_pointer_v<T> or std::is_array_v<T> or std::is_same_v<T, std::string>)
+			return (v);
+		else
+			return QString(v).toStdString();
+	}
+
+	inline const char *nonNull(const char *s) { return s ? s : "(null)"; }
+
+	template <typename T>
+	inline size_t encodedSize(const T &v)
+	{
+		if constexpr (std::is_convertible_v<T, const char *>)
+			return 1 + sizeof(uint16_t) + strlen(nonNull(v));
+		else if constexpr (std::is_same_v<T, std::string>)
+			return 1 + sizeof(uint16_t) + std::min<size_t>(v.size(), UINT16_MAX);
+		else
+			return 1 + 8;
+	}
+
+	inline char *put(char *p, Tag tag, const void *data, size_t n)
+	{
+		*p = tag;
+		memcpy(p + 1, data, n);
+		return p + 1 + n;
+	}
+	inline char *putString(char *p, const char *s, size_t n)
+	{
+		const uint16_t len = std::min<size_t>(n, UINT16_MAX);
+		*p++ = STRING;
+		memcpy(p, &len, sizeof(len));
+		memcpy(p + sizeof(len), s, len);
+		return p + sizeof(len) + len;
+	}
+
+	template <typename T>
+	inline char *encode(char *p, const T &v)
+	{
+		if constexpr (std::is_convertible_v<T, const char *>)
+		{
+			const char *s = nonNull(v);
+			return putString(p, s, strlen(s));
+		}
+		else if constexpr (std::is_same_v<T, std::string>)
+			return putString(p, v.data(), v.size());
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			const double d = v;
+			return put(p, DOUBLE, &d, sizeof(d));
+		}
+		else if constexpr (std::is_pointer_v<T>)
+		{
+			const uint64_t a = (uintptr_t)(const void *)v;
+			return put(p, POINTER, &a, sizeof(a));
+		}
+		else if constexpr (std::is_unsigned_v<T>)
+		{
+			const uint64_t u = v;
+			return put(p, UINT, &u, sizeof(u));
+		}
+		else
+		{
+			static_assert(std::is_integral_v<T> or std::is_enum_v<T>, "qLog: argument type can not be logged");
+			const int64_t i = (int64_t)v;
+			return put(p, INT, &i, sizeof(i));
+		}
+	}
+}
 
 class qLog
 {
@@ -61,7 +192,17 @@ private:
 	 
 	QString log;
 	static qLog *logger;
+	std::mutex sendMutex;
 	void showConsole();
+	void deliver(std::string file, int line, std::string func, std::string strng, std::string type, const QDateTime &time);
+
+	// asynchronous backend, see startAsync
+	static std::atomic<bool> async;
+	static qLogRecord *reserve();
+	static void publish();
+	static void ship(const qLogSite *site, int64_t time, const char *args, size_t size);
+	static void consumer();
+	static void reportDrops();
   public:
 	~qLog();
 	qLog();
@@ -69,6 +210,56 @@ private:
 	void send(std::string file, int line,std::string func, std::string strng,std::string type);
 	void send(std::string file, int line,std::string func, const char* strng,std::string type);
 	void send(std::string file, int line,std::string func, QString strng,std::string type);
+
+	// Asynchronous mode: every thread logs into its own lock free ring of 'recordsPerThread' compact records and a
+	// background thread formats them, in time order, and ships them to the console or the logger. A full ring drops
+	// the message instead of blocking, the drops are reported. Without it, records are formatted and sent on the spot.
+	// stopAsync ships what is left; it is also called at exit
+	static void startAsync(size_t recordsPerThread=1024);
+	static void stopAsync();
+	static uint64_t droppedMessages();
+	// printf style 'format' applied to encoded arguments; a conversion that does not match the type of its argument
+	// prints that argument its own way
+	static std::string format(const char *format, const char *args, size_t size);
+
+	template <typename... Args>
+	static void record(const qLogSite *site, const Args &...args)
+	{
+		recordPlain(site, qlog_detail::plain(args)...);
+	}
+
+  private:
+	template <typename... Args>
+	static void recordPlain(const qLogSite *site, const Args &...args)
+	{
+		const size_t size = (size_t(0) + ... + qlog_detail::encodedSize(args));
+		const int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		if (size <= qLogRecord::ARGS_SIZE)
+		{
+			qLogRecord local, *r = &local;
+			if (async.load(std::memory_order_relaxed) and not (r = reserve()))
+				return;		// full ring: dropped and counted
+			r->site = site;
+			r->time = time;
+			r->size = size;
+			char *p = r->args;
+			((p = qlog_detail::encode(p, args)), ...);
+			(void)p;
+			if (r == &local)
+				ship(site, time, r->args, size);
+			else
+				publish();
+		}
+		else
+		{
+			// too large for a record, even in asynchronous mode: on the spot
+			std::vector<char> buffer(size);
+			char *p = buffer.data();
+			((p = qlog_detail::encode(p, args)), ...);
+			(void)p;
+			ship(site, time, buffer.data(), size);
+		}
+	}
 };
 
 #endif
@@ -4,7 +4,26 @@
 //
 // random_selector<> selector{};
 // selector(source_container);
+//
+// batches, without replacement and without copying the elements: iterators to the chosen ones are returned
+//
+// auto picks = selector.sample_k(path.begin(), path.end(), 10);                       // std::list too, in one pass
+// auto cells = selector.sample_k_if(grid.begin(), grid.end(), 100,
+//                                   [](const auto &cell) { return cell.second.free; });   // free cells of a Grid
+// auto heavy = selector.weighted_sample_k(v.begin(), v.end(), 5, [](const auto &x) { return x.weight; });
 
+#ifndef RANDOM_SELECTOR_H
+#define RANDOM_SELECTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <queue>
+#include <random>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 template <typename RandomGenerator = std::default_random_engine>
 struct RandomSelector
@@ -13,10 +32,11 @@ struct RandomSelector
     RandomSelector(RandomGenerator g = RandomGenerator(std::random_device()()))
             : gen(g) {}
 
+    //O(1) for random access iterators, O(n) otherwise
     template <typename Iter>
     Iter select(Iter start, Iter end) {
-        std::uniform_int_distribution<> dis(0, std::distance(start, end) - 1);
-        std::advance(start, dis(gen));
+        const auto n = std::distance(start, end);
+        std::advance(start, index(n));
         return start;
     }
 
@@ -32,6 +52,115 @@ struct RandomSelector
         return *select(begin(c), end(c));
     }
 
+    //k distinct elements, all of them if there are fewer. Random access ranges use Floyd's algorithm, O(k);
+    //other ranges reservoir sampling, a single pass. The order of the result is not specified
+    template <typename Iter>
+    std::vector<Iter> sample_k(Iter start, Iter end, std::size_t k) {
+        if constexpr (std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::iterator_category>)
+        {
+            const std::size_t n = end - start;
+            std::vector<Iter> out;
+            if (k >= n)
+            {
+                for (auto it = start; it != end; ++it) out.push_back(it);
+                return out;
+            }
+            //Floyd: for j in [n-k, n), take a random t in [0, j], or j if t was already taken. Membership is a bitmap
+            //of n bits when that is not much larger than k entries of a hash set, the hash set otherwise
+            out.reserve(k);
+            if (n <= 64 * k)
+            {
+                std::vector<bool> taken(n);
+                for (std::size_t j = n - k; j < n; j++)
+                {
+                    std::size_t t = index(j + 1);
+                    if (taken[t]) t = j;
+                    taken[t] = true;
+                    out.push_back(start + t);
+                }
+            }
+            else
+            {
+                std::unordered_set<std::size_t> taken;
+                taken.reserve(k);
+                for (std::size_t j = n - k; j < n; j++)
+                {
+                    std::size_t t = index(j + 1);
+                    if (not taken.insert(t).second)
+                    {
+                        t = j;
+                        taken.insert(t);
+                    }
+                    out.push_back(start + t);
+                }
+            }
+            return out;
+        }
+        else
+            return sample_k_if(start, end, k, [](const auto &) { return true; });
+    }
+
+    //k distinct elements among those satisfying pred, in a single pass over the range (reservoir sampling)
+    template <typename Iter, typename Pred>
+    std::vector<Iter> sample_k_if(Iter start, Iter end, std::size_t k, Pred &&pred) {
+        std::vector<Iter> out;
+        if (k == 0) return out;
+        out.reserve(k);
+        std::size_t seen = 0;
+        for (auto it = start; it != end; ++it)
+        {
+            if (not pred(*it)) continue;
+            if (seen < k) out.push_back(it);
+            else if (const std::size_t r = index(seen + 1); r < k) out[r] = it;
+            seen++;
+        }
+        return out;
+    }
+
+    //k distinct elements, chosen with probability proportional to weight(element) without replacement (Efraimidis and
+    //Spirakis): every element gets the key log(u) / w and the k largest keys win. Single pass, elements of weight <= 0
+    //are never chosen
+    template <typename Iter, typename Weight>
+    std::vector<Iter> weighted_sample_k(Iter start, Iter end, std::size_t k, Weight &&weight) {
+        using Keyed = std::pair<double, Iter>;
+        const auto greater = [](const Keyed &a, const Keyed &b) { return a.first > b.first; };
+        std::priority_queue<Keyed, std::vector<Keyed>, decltype(greater)> heap(greater);    //k largest keys, smallest on top
+        std::uniform_real_distribution<double> uniform(0., 1.);
+        if (k == 0) return {};
+        for (auto it = start; it != end; ++it)
+        {
+            const double w = weight(*it);
+            if (not (w > 0.)) continue;
+            const double key = std::log(1. - uniform(gen)) / w;
+            if (heap.size() < k) heap.emplace(key, it);
+            else if (key > heap.top().first)
+            {
+                heap.pop();
+                heap.emplace(key, it);
+            }
+        }
+        std::vector<Iter> out;
+        out.reserve(heap.size());
+        for (; not heap.empty(); heap.pop()) out.push_back(heap.top().second);
+        return out;
+    }
+
+    //convenience functions over containers
+    template <typename Container>
+    auto sample_k(Container &c, std::size_t k) { return sample_k(std::begin(c), std::end(c), k); }
+    template <typename Container, typename Pred>
+    auto sample_k_if(Container &c, std::size_t k, Pred &&pred) { return sample_k_if(std::begin(c), std::end(c), k, std::forward<Pred>(pred)); }
+    template <typename Container, typename Weight>
+    auto weighted_sample_k(Container &c, std::size_t k, Weight &&weight) { return weighted_sample_k(std::begin(c), std::end(c), k, std::forward<Weight>(weight)); }
+
 private:
     RandomGenerator gen;
+    std::uniform_int_distribution<std::size_t> dis;
+
+    //uniform in [0, n), the distribution is reused with new bounds
+    std::size_t index(std::size_t n) {
+        return dis(gen, typename std::uniform_int_distribution<std::size_t>::param_type(0, n - 1));
+    }
 };
+
+#endif
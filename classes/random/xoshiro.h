@@ -0,0 +1,90 @@
+// xoshiro256** by David Blackman and Sebastiano Vigna (https://prng.di.unimi.it), seeded with splitmix64.
+// A fast generator with 256 bits of state for sampling loops, usable with the <random> distributions.
+
+// use example
+//
+// Xoshiro256 rng{seed};
+// double u = rng.uniform();           // [0, 1)
+// uint32_t i = rng.below(n);          // [0, n)
+// Xoshiro256 other = rng; other.jump();   // independent stream, 2^128 draws apart
+
+#ifndef XOSHIRO_H
+#define XOSHIRO_H
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+struct Xoshiro256
+{
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed = std::random_device()()) { this->seed(seed); }
+
+    void seed(uint64_t seed)
+    {
+        for (auto &w : s)
+        {
+            // splitmix64, so that close seeds give unrelated states
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            w = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // uniform in [0, 1) with 53 random bits
+    double uniform() { return ((*this)() >> 11) * 0x1.0p-53; }
+
+    // uniform in [0, n) without modulo bias (Lemire, 2019), n > 0
+    uint32_t below(uint32_t n)
+    {
+        uint64_t m = (((*this)() >> 32) * n);
+        if (static_cast<uint32_t>(m) < n)
+        {
+            const uint32_t threshold = static_cast<uint32_t>(-n) % n;
+            while (static_cast<uint32_t>(m) < threshold)
+                m = ((*this)() >> 32) * n;
+        }
+        return static_cast<uint32_t>(m >> 32);
+    }
+
+    // advances the state by 2^128 draws, to split a seed into non overlapping streams
+    void jump()
+    {
+        static constexpr uint64_t JUMP[] = {0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull};
+        uint64_t t[4] = {0, 0, 0, 0};
+        for (uint64_t j : JUMP)
+            for (int b = 0; b < 64; b++)
+            {
+                if (j & (uint64_t(1) << b))
+                    for (int i = 0; i < 4; i++)
+                        t[i] ^= s[i];
+                (*this)();
+            }
+        for (int i = 0; i < 4; i++)
+            s[i] = t[i];
+    }
+
+private:
+    uint64_t s[4];
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+#endif
@@ -16,9 +16,21 @@
  *    You should have received a copy of the GNU General Public License
  *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
 
 #include "rcdraw.h"
+#include <QGLFunctions>
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
 
 RCDraw::RCDraw( int _width, int _height, uchar *img, QWidget *parent) : QGLWidget(parent), width(_width), height(_height)
 {
@@ -114,6 +126,7 @@ RCDraw::RCDraw(const QRect &win_, QWidget *parent) : QGLWidget(parent)
 
 RCDraw::~RCDraw()
 {
+	setRetainedMode(false);
 }
 
 bool RCDraw::autoResize(bool ignoreAspectRatio)
@@ -144,6 +157,7 @@ bool RCDraw::autoResize(bool ignoreAspectRatio)
 void RCDraw::init( )
 {
 	zoomMul = 0.5;
+	retained = NULL;
 	invertedVerticalAxis=false;
 	visibleCenter = QVec(2,0);
 	DRAW_AXIS = false;
@@ -192,6 +206,12 @@ void RCDraw::setImage(QImage* img)
 
 void RCDraw::paintEvent ( QPaintEvent * )
 {
+	if (retained != NULL)
+	{
+		paintRetained();
+		return;
+	}
+
 	QString s;
 	QPainter painter ( this );
 	painter.setRenderHint(QPainter::HighQualityAntialiasing);
@@ -217,8 +237,7 @@ void RCDraw::paintEvent ( QPaintEvent * )
 	while ( !lineQueue.isEmpty() )
 	{
 		TLine l = lineQueue.dequeue();
-		if (invertedVerticalAxis) l.line = QLineF(l.line.x1()-visibleCenter(0), -l.line.y1()+visibleCenter(1), l.line.x2()-visibleCenter(0), -l.line.y2()+visibleCenter(1));
-		else l.line.translate(-visibleCenter(0), -visibleCenter(1));
+		l.line = placeLine(l.line);
 		painter.setPen ( QPen ( QBrush ( l.color ),l.width ) );
 		painter.drawLine ( l.line );
 	}
@@ -240,8 +259,7 @@ void RCDraw::paintEvent ( QPaintEvent * )
 	while ( !ellipseQueue.isEmpty() )
 	{
 		TEllipse e = ellipseQueue.dequeue();
-		if (invertedVerticalAxis) e.center.setY(-(e.center.y()-visibleCenter(1)));
-		else e.center = QPointF(e.center.x()-visibleCenter(0), e.center.y()-visibleCenter(1));
+		e.center = placeEllipseCenter(e.center);
 		if ( e.fill == true )
 			painter.setBrush ( e.color );
 		else
@@ -267,8 +285,7 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		while ( !squareQueue.isEmpty() )
 		{
 			TRect r = squareQueue.dequeue();
-			if (invertedVerticalAxis) r.rect = QRect(r.rect.x()-visibleCenter(0), -r.rect.y()+visibleCenter(1)-r.rect.height(), r.rect.width(), r.rect.height());
-			else r.rect.translate(-visibleCenter(0),-visibleCenter(1));
+			r.rect = placeRect(r.rect);
 			if ( r.fill == true )
 				painter.setBrush ( r.color );
 			else
@@ -301,7 +318,32 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		painter.drawLine ( l.line );
 	}
 
+	paintTexts(painter);
+}
+
+QLineF RCDraw::placeLine(const QLineF &line) const
+{
+	if (invertedVerticalAxis)
+		return QLineF(line.x1()-visibleCenter(0), -line.y1()+visibleCenter(1), line.x2()-visibleCenter(0), -line.y2()+visibleCenter(1));
+	return line.translated(-visibleCenter(0), -visibleCenter(1));
+}
+
+QPointF RCDraw::placeEllipseCenter(const QPointF &center) const
+{
+	if (invertedVerticalAxis)
+		return QPointF(center.x(), -(center.y()-visibleCenter(1)));
+	return QPointF(center.x()-visibleCenter(0), center.y()-visibleCenter(1));
+}
+
+QRectF RCDraw::placeRect(const QRectF &rect) const
+{
+	if (invertedVerticalAxis)
+		return QRect(rect.x()-visibleCenter(0), -rect.y()+visibleCenter(1)-rect.height(), rect.width(), rect.height());
+	return rect.translated(-visibleCenter(0), -visibleCenter(1));
+}
 
+void RCDraw::paintTexts(QPainter &painter)
+{
 	//Draw text
 	while ( !textQueue.isEmpty() )
 	{
@@ -335,8 +377,6 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		painter.setFont ( ant );
 		painter.setWindow ( effWin.toRect() );
 	}
-
-
 }
 
 
@@ -501,6 +541,9 @@ void RCDraw::drawEllipse ( const QRectF & rect, const QColor &col, bool fill, in
 {
 	TEllipse e;
 	e.rect = rect;
+	e.center = rect.center();
+	e.rx = rect.width()/2.;
+	e.ry = rect.height()/2.;
 	e.color= col;
 	e.id = id;
 	e.fill = fill;
@@ -792,3 +835,305 @@ void RCDraw::wheelEvent(QWheelEvent *event)
 }
 
 
+
+///Retained mode
+
+struct RCDraw::RetainedRenderer : public QGLFunctions
+{
+	struct Vertex
+	{
+		GLfloat x, y;
+		GLubyte rgba[4];
+	};
+	// the queues are drawn in this order, as QPainter does
+	enum Layer { LINES, ELLIPSES, SQUARES, ON_TOP, LAYERS };
+	struct Batch
+	{
+		std::vector<Vertex> vertices, uploaded;
+		GLuint vbo;
+		Batch() : vbo(0) {}
+	};
+	Batch triangles[LAYERS], thinLines[LAYERS];
+	GLuint texture, pbo;
+	int textureWidth, textureHeight;
+	GLenum textureFormat;
+	float pixelsPerUnit;
+	bool initialized;
+
+	RetainedRenderer() : texture(0), pbo(0), textureWidth(0), textureHeight(0), textureFormat(0), pixelsPerUnit(1), initialized(false) {}
+
+	void release()
+	{
+		if (not initialized)
+			return;
+		for (int l = 0; l < LAYERS; l++)
+		{
+			glDeleteBuffers(1, &triangles[l].vbo);
+			glDeleteBuffers(1, &thinLines[l].vbo);
+		}
+		glDeleteBuffers(1, &pbo);
+		glDeleteTextures(1, &texture);
+	}
+
+	void begin(const QGLContext *context, float pixelsPerUnit_)
+	{
+		if (not initialized)
+		{
+			initializeGLFunctions(context);
+			for (int l = 0; l < LAYERS; l++)
+			{
+				glGenBuffers(1, &triangles[l].vbo);
+				glGenBuffers(1, &thinLines[l].vbo);
+			}
+			glGenBuffers(1, &pbo);
+			glGenTextures(1, &texture);
+			initialized = true;
+		}
+		pixelsPerUnit = pixelsPerUnit_;
+		for (int l = 0; l < LAYERS; l++)
+		{
+			triangles[l].vertices.clear();
+			thinLines[l].vertices.clear();
+		}
+	}
+
+	static Vertex vertex(const QPointF &p, const QColor &c)
+	{
+		Vertex v = {GLfloat(p.x()), GLfloat(p.y()), {GLubyte(c.red()), GLubyte(c.green()), GLubyte(c.blue()), GLubyte(c.alpha())}};
+		return v;
+	}
+
+	void triangle(Layer layer, const QPointF &a, const QPointF &b, const QPointF &c, const QColor &color)
+	{
+		std::vector<Vertex> &v = triangles[layer].vertices;
+		v.push_back(vertex(a, color));
+		v.push_back(vertex(b, color));
+		v.push_back(vertex(c, color));
+	}
+
+	// QPen semantics: width in window units, 0 for one pixel, square caps; wide lines become two triangles
+	void line(Layer layer, const QLineF &l, const QColor &c0, const QColor &c1, float width)
+	{
+		if (width * pixelsPerUnit <= 1.5f or l.length() == 0)
+		{
+			thinLines[layer].vertices.push_back(vertex(l.p1(), c0));
+			thinLines[layer].vertices.push_back(vertex(l.p2(), c1));
+			return;
+		}
+		const QPointF d = (l.p2() - l.p1()) / l.length() * (width / 2.);
+		const QPointF n(-d.y(), d.x());
+		const QPointF a = l.p1() - d, b = l.p2() + d;
+		std::vector<Vertex> &v = triangles[layer].vertices;
+		v.push_back(vertex(a + n, c0)); v.push_back(vertex(a - n, c0)); v.push_back(vertex(b + n, c1));
+		v.push_back(vertex(b + n, c1)); v.push_back(vertex(a - n, c0)); v.push_back(vertex(b - n, c1));
+	}
+
+	void polygon(Layer layer, const std::vector<QPointF> &corners, const QColor &color, bool fill, float width)
+	{
+		if (fill)
+			for (size_t i = 2; i < corners.size(); i++)
+				triangle(layer, corners[0], corners[i-1], corners[i], color);
+		for (size_t i = 0; i < corners.size(); i++)
+			line(layer, QLineF(corners[i], corners[(i+1) % corners.size()]), color, color, width);
+	}
+
+	static std::vector<QPointF> rotated(std::vector<QPointF> points, const QPointF &center, float degrees)
+	{
+		const double c = cos(degrees*M_PI/180.), s = sin(degrees*M_PI/180.);
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			const QPointF p = points[i] - center;
+			points[i] = center + QPointF(c*p.x() - s*p.y(), s*p.x() + c*p.y());
+		}
+		return points;
+	}
+
+	void rect(Layer layer, const QRectF &r, float degrees, const QColor &color, bool fill, float width)
+	{
+		std::vector<QPointF> corners;
+		corners.push_back(r.topLeft());
+		corners.push_back(r.topRight());
+		corners.push_back(r.bottomRight());
+		corners.push_back(r.bottomLeft());
+		polygon(layer, fabs(degrees) > 0.01 ? rotated(corners, r.center(), degrees) : corners, color, fill, width);
+	}
+
+	// about 4 pixels per segment
+	void ellipse(Layer layer, const QPointF &center, float rx, float ry, float degrees, const QColor &color, bool fill)
+	{
+		const int segments = std::max(12, std::min(128, int(2.*M_PI*std::max(fabs(rx), fabs(ry))*pixelsPerUnit/4.)));
+		std::vector<QPointF> points(segments);
+		for (int i = 0; i < segments; i++)
+			points[i] = center + QPointF(rx*cos(2.*M_PI*i/segments), ry*sin(2.*M_PI*i/segments));
+		polygon(layer, fabs(degrees) > 0.1 ? rotated(points, center, degrees) : points, color, fill, 1);
+	}
+
+	// uploads the batch only if it changed since the last frame, then draws it
+	void draw(Batch &batch, GLenum mode)
+	{
+		if (batch.vertices.size() != batch.uploaded.size() or
+			(not batch.vertices.empty() and memcmp(&batch.vertices[0], &batch.uploaded[0], batch.vertices.size()*sizeof(Vertex)) != 0))
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+			glBufferData(GL_ARRAY_BUFFER, batch.vertices.size()*sizeof(Vertex), batch.vertices.empty() ? NULL : &batch.vertices[0], GL_DYNAMIC_DRAW);
+			batch.uploaded.swap(batch.vertices);
+		}
+		if (batch.uploaded.empty())
+			return;
+		glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+		glVertexPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid *)0);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (const GLvoid *)offsetof(Vertex, rgba));
+		glDrawArrays(mode, 0, GLsizei(batch.uploaded.size()));
+	}
+
+	// the image is copied into a pixel buffer orphaned every frame, so the texture update does not wait for the
+	// previous one. Gray 8 bit images go as they are, the others as 32 bit BGRA
+	void background(const QImage &image, const QRectF &target, const QRectF &source)
+	{
+		bool gray = image.format() == QImage::Format_Indexed8;
+		if (gray)
+		{
+			const QVector<QRgb> table = image.colorTable();
+			for (int i = 0; i < table.size() and gray; i++)
+				gray = table[i] == qRgb(i, i, i);
+		}
+		const QImage converted = gray ? image : image.convertToFormat(QImage::Format_ARGB32);
+		const GLenum format = gray ? GL_LUMINANCE : GL_BGRA;
+		const int bytes = converted.bytesPerLine()*converted.height();
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		if (textureWidth != converted.width() or textureHeight != converted.height() or textureFormat != format)
+		{
+			textureWidth = converted.width();
+			textureHeight = converted.height();
+			textureFormat = format;
+			glTexImage2D(GL_TEXTURE_2D, 0, gray ? GL_LUMINANCE : GL_RGBA, textureWidth, textureHeight, 0, format, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes, converted.constBits());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, converted.bytesPerLine() / (gray ? 1 : 4));
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, textureWidth, textureHeight, format, GL_UNSIGNED_BYTE, (const GLvoid *)0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		const GLfloat u0 = source.left()/textureWidth, u1 = source.right()/textureWidth;
+		const GLfloat v0 = source.top()/textureHeight, v1 = source.bottom()/textureHeight;
+		const GLfloat quad[] = {GLfloat(target.left()), GLfloat(target.top()), GLfloat(target.right()), GLfloat(target.top()),
+		                        GLfloat(target.right()), GLfloat(target.bottom()), GLfloat(target.left()), GLfloat(target.bottom())};
+		const GLfloat uv[] = {u0, v0, u1, v0, u1, v1, u0, v1};
+		glEnable(GL_TEXTURE_2D);
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glVertexPointer(2, GL_FLOAT, 0, quad);
+		glTexCoordPointer(2, GL_FLOAT, 0, uv);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	void drawBatches()
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glEnable(GL_LINE_SMOOTH);
+		glLineWidth(1);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		for (int l = 0; l < LAYERS; l++)
+		{
+			draw(triangles[l], GL_TRIANGLES);
+			draw(thinLines[l], GL_LINES);
+		}
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDisable(GL_LINE_SMOOTH);
+	}
+};
+
+void RCDraw::setRetainedMode(bool on)
+{
+	if (on == (retained != NULL))
+		return;
+	if (on)
+		retained = new RetainedRenderer();
+	else
+	{
+		makeCurrent();
+		retained->release();
+		delete retained;
+		retained = NULL;
+	}
+	update();
+}
+
+void RCDraw::paintRetained()
+{
+	QPainter painter(this);
+	const int ww = ((QWidget*)this)->width(), wh = ((QWidget*)this)->height();
+	const QRect window = effWin.toRect();
+	retained->begin(context(), window.width() != 0 ? fabs(float(ww)/window.width()) : 1.f);
+
+	if ( DRAW_PERIMETER )
+		retained->rect(RetainedRenderer::LINES, QRectF(0, 0, width-1, height-1), 0, Qt::blue, false, 0);
+	if ( DRAW_AXIS )
+		drawAxis(Qt::blue, 2);
+
+	while ( !lineQueue.isEmpty() )
+	{
+		const TLine l = lineQueue.dequeue();
+		retained->line(RetainedRenderer::LINES, placeLine(l.line), l.color, l.color, l.width);
+	}
+	// the gradient goes along the line
+	while ( !gradQueue.isEmpty() )
+	{
+		const TGrad g = gradQueue.dequeue();
+		retained->line(RetainedRenderer::LINES, placeLine(QLineF(g.line)), g.color, g.color1, 2);
+	}
+	while ( !ellipseQueue.isEmpty() )
+	{
+		const TEllipse e = ellipseQueue.dequeue();
+		retained->ellipse(RetainedRenderer::ELLIPSES, placeEllipseCenter(e.center), e.rx, e.ry, e.ang, e.color, e.fill);
+	}
+	while ( !squareQueue.isEmpty() )
+	{
+		const TRect r = squareQueue.dequeue();
+		retained->rect(RetainedRenderer::SQUARES, placeRect(r.rect), r.ang, r.color, r.fill, r.width);
+	}
+	while ( !lineOnTopQueue.isEmpty() )
+	{
+		const TLine l = lineOnTopQueue.dequeue();
+		retained->line(RetainedRenderer::ON_TOP, l.line.translated(-visibleCenter(0), -visibleCenter(1)), l.color, l.color, l.width);
+	}
+
+	painter.beginNativePainting();
+	retained->glUseProgram(0);
+	glDisable(GL_DEPTH_TEST);
+	glViewport(0, 0, ww*devicePixelRatio(), wh*devicePixelRatio());
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, ww, wh, 0, -1, 1);
+	if ( qimg != NULL )
+		retained->background(*qimg, QRectF(0., 0., imageScale*width, imageScale*height), QRectF(0, 0, width, height));
+	// the window of QPainter::setWindow: its top left corner at the top left of the widget
+	glLoadIdentity();
+	glOrtho(window.left(), window.left() + window.width(), window.top() + window.height(), window.top(), -1, 1);
+	retained->drawBatches();
+	painter.endNativePainting();
+
+	painter.setRenderHint(QPainter::HighQualityAntialiasing);
+	painter.setWindow(window);
+	paintTexts(painter);
+}
@@ -87,6 +87,15 @@ public:
 
 	void setZoomMultiplier (float mul) { zoomMul = mul; }
 
+	/**
+	 * Retained mode: the queued squares, lines and ellipses are tessellated into vertex buffers, one per layer and
+	 * kind (triangles, thin lines), and drawn in a few draw calls; a buffer is uploaded again only when its contents
+	 * changed since the last frame. The background image is streamed into a persistent texture through a pixel
+	 * buffer. Text still goes through QPainter, on top. Off by default: the drawing API is the same in both modes.
+	 */
+	void setRetainedMode(bool on);
+	bool retainedMode() const { return retained != NULL; }
+
 protected:
 	float imageScale;
 	bool invertedVerticalAxis;
@@ -159,6 +168,16 @@ protected:
 
 	QVec visibleCenter;
 
+	struct RetainedRenderer;
+	RetainedRenderer *retained;
+
+	// primitives moved to the visible window, as each queue has always been drawn
+	QLineF placeLine(const QLineF &line) const;
+	QPointF placeEllipseCenter(const QPointF &center) const;
+	QRectF placeRect(const QRectF &rect) const;
+	void paintTexts(QPainter &painter);
+	void paintRetained();
+
 signals:
 	void iniMouseCoor(QPoint p);
 	void endMouseCoor(QPoint p);
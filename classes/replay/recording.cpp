@@ -0,0 +1,169 @@
+#include "recording.h"
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace recording
+{
+    namespace
+    {
+        std::size_t align8(std::size_t v) { return (v + 7) & ~std::size_t(7); };
+    }
+
+    const char *kind_name(Kind k)
+    {
+        switch (k)
+        {
+            case Kind::LASER: return "laser";
+            case Kind::ODOMETRY: return "odometry";
+            case Kind::POINTS: return "points";
+            default: return "none";
+        }
+    }
+
+    Odometry Record::odometry() const
+    {
+        Odometry o;
+        if (bytes >= sizeof(o))
+            std::memcpy(&o, data, sizeof(o));
+        return o;
+    }
+
+    //////////////////////////////// WRITER //////////////////////////////////////////
+    Writer::Writer(const std::string &file, std::uint64_t stamp_ns, std::size_t reserve_) : reserve(align8(reserve_ < 4096 ? 4096 : reserve_))
+    {
+        fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            std::cerr << __FUNCTION__ << " Could not open " << file << std::endl;
+            return;
+        }
+        if (not grow(sizeof(FileHeader)))
+            return;
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.stamp_ns = stamp_ns;
+        std::memcpy(data, &header, sizeof(header));
+        used = sizeof(header);
+    }
+    Writer::~Writer()
+    {
+        close();
+    }
+    bool Writer::grow(std::size_t needed)
+    {
+        if (used + needed <= capacity)
+            return true;
+        const std::size_t new_capacity = capacity + std::max(reserve, align8(needed));
+        if (::ftruncate(fd, static_cast<off_t>(new_capacity)) != 0)
+            return false;
+        void *p = data == nullptr ? mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                  : mremap(data, capacity, new_capacity, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED)
+        {
+            std::cerr << __FUNCTION__ << " Could not map " << new_capacity << " bytes" << std::endl;
+            return false;
+        }
+        data = static_cast<std::uint8_t *>(p);
+        capacity = new_capacity;
+        return true;
+    }
+    bool Writer::write(Kind kind, std::uint64_t stamp, const void *payload, std::size_t bytes)
+    {
+        if (kind == Kind::NONE or bytes > UINT32_MAX)
+            return false;
+        const std::size_t total = sizeof(RecordHeader) + align8(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (data == nullptr or not grow(total))
+            return false;
+        // payload before header: until the kind is written the record reads as the end of the file
+        std::uint8_t *record = data + used;
+        if (bytes > 0)
+            std::memcpy(record + sizeof(RecordHeader), payload, bytes);
+        const RecordHeader header{kind, static_cast<std::uint32_t>(bytes), stamp};
+        std::memcpy(record, &header, sizeof(header));
+        used += total;
+        return true;
+    }
+    bool Writer::write(std::uint64_t stamp, const std::vector<std::tuple<float, float, float>> &points)
+    {
+        std::vector<float> xyz;
+        xyz.reserve(3 * points.size());
+        for (const auto &[x, y, z] : points)
+        {
+            xyz.push_back(x);
+            xyz.push_back(y);
+            xyz.push_back(z);
+        }
+        return write(Kind::POINTS, stamp, xyz.data(), xyz.size() * sizeof(float));
+    }
+    void Writer::sync()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (data != nullptr)
+            msync(data, used, MS_ASYNC);
+    }
+    void Writer::close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (data != nullptr)
+        {
+            munmap(data, capacity);
+            data = nullptr;
+        }
+        if (fd >= 0)
+        {
+            if (::ftruncate(fd, static_cast<off_t>(used)) != 0)
+                std::cerr << __FUNCTION__ << " Could not cut the recording to " << used << " bytes" << std::endl;
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    //////////////////////////////// READER //////////////////////////////////////////
+    Reader::Reader(const std::string &file)
+    {
+        fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 or st.st_size < (off_t)sizeof(FileHeader)) return;
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return;
+        std::memcpy(&header, p, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 or header.version != VERSION)
+        {
+            std::cerr << __FUNCTION__ << " Not a recording or unsupported version: " << file << std::endl;
+            munmap(p, st.st_size);
+            return;
+        }
+        length = st.st_size;
+        data = static_cast<const std::uint8_t *>(p);
+        offset = sizeof(FileHeader);
+        madvise(p, length, MADV_SEQUENTIAL);
+    }
+    Reader::~Reader()
+    {
+        if (data != nullptr) munmap(const_cast<std::uint8_t *>(data), length);
+        if (fd >= 0) ::close(fd);
+    }
+    bool Reader::next(Record &record)
+    {
+        if (data == nullptr or offset + sizeof(RecordHeader) > length)
+            return false;
+        RecordHeader h;
+        std::memcpy(&h, data + offset, sizeof(h));
+        if (h.kind == Kind::NONE or static_cast<std::size_t>(h.kind) >= KINDS
+            or offset + sizeof(RecordHeader) + h.bytes > length)
+            return false;
+        record.kind = h.kind;
+        record.stamp = h.stamp;
+        record.bytes = h.bytes;
+        record.data = data + offset + sizeof(RecordHeader);
+        offset += sizeof(RecordHeader) + align8(h.bytes);
+        return true;
+    }
+}
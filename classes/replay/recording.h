@@ -0,0 +1,143 @@
+/* Copyright 2018 <copyright holder> <email>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.*/
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <Eigen/Dense>
+
+// Binary sensor recording format (little endian).
+//   FileHeader | Record | Record | ...
+// Every record is a RecordHeader followed by its payload, padded to 8 bytes so the next header stays aligned:
+//   LASER     (angle rad, range mm) float pairs, in the frame of the sensor
+//   ODOMETRY  one Odometry, the pose of the robot in the world
+//   POINTS    x, y, z float triples in mm, in the frame of the robot
+// Stamps are the ones of the recorded source (e.g. the timestamps of a BufferSync), FileHeader::stamp_ns nanoseconds
+// each. The file ends at the first record of kind 0, where a writer that did not close left the zeros of its reserve.
+namespace recording
+{
+    constexpr char MAGIC[8] = {'R', 'C', 'R', 'E', 'C', 0, 0, 0};
+    constexpr std::uint32_t VERSION = 1;
+
+    enum class Kind : std::uint32_t { NONE = 0, LASER = 1, ODOMETRY = 2, POINTS = 3 };
+    constexpr std::size_t KINDS = 4;
+    const char *kind_name(Kind k);
+
+    struct FileHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t flags;            // 0, none defined
+        std::uint64_t stamp_ns;         // nanoseconds of a stamp unit
+    };
+    struct RecordHeader
+    {
+        Kind kind;
+        std::uint32_t bytes;            // payload, without the padding
+        std::uint64_t stamp;
+    };
+    static_assert(sizeof(FileHeader) % 8 == 0 and sizeof(RecordHeader) % 8 == 0, "records must stay 8 byte aligned");
+
+    struct Odometry
+    {
+        double x = 0, y = 0, angle = 0;     // mm, mm, rad
+    };
+
+    // A record of a mapped recording. The payload points into the mapping of the Reader it comes from
+    struct Record
+    {
+        Kind kind = Kind::NONE;
+        std::uint64_t stamp = 0;
+        const std::uint8_t *data = nullptr;
+        std::uint32_t bytes = 0;
+
+        std::span<const Eigen::Vector2f> laser() const
+        { return {reinterpret_cast<const Eigen::Vector2f *>(data), bytes / sizeof(Eigen::Vector2f)}; };
+        Odometry odometry() const;
+        const float *points() const { return reinterpret_cast<const float *>(data); };   // x, y, z triples
+        std::size_t point_count() const { return bytes / (3 * sizeof(float)); };
+    };
+
+    // Append-only writer over a memory mapped file. The file grows by 'reserve' bytes at a time and is cut to its
+    // records on close, so a write is a bounds check and a memcpy. Writes from several threads are serialized
+    class Writer
+    {
+    public:
+        explicit Writer(const std::string &file, std::uint64_t stamp_ns = 1000000, std::size_t reserve = std::size_t(64) << 20);
+        ~Writer();
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        bool ok() const { return data != nullptr; };
+        bool write(Kind kind, std::uint64_t stamp, const void *payload, std::size_t bytes);
+        bool write(std::uint64_t stamp, const std::vector<Eigen::Vector2f> &laser)
+        { return write(Kind::LASER, stamp, laser.data(), laser.size() * sizeof(Eigen::Vector2f)); };
+        bool write(std::uint64_t stamp, const Odometry &odometry)
+        { return write(Kind::ODOMETRY, stamp, &odometry, sizeof(odometry)); };
+        bool write(std::uint64_t stamp, const std::vector<Eigen::Vector3f> &points)
+        { return write(Kind::POINTS, stamp, points.data(), points.size() * sizeof(Eigen::Vector3f)); };
+        bool write(std::uint64_t stamp, const std::vector<std::tuple<float, float, float>> &points);
+        // flushes the records written so far to the file, without closing it
+        void sync();
+        void close();
+        std::size_t size() const { return used; };
+
+    private:
+        bool grow(std::size_t needed);
+        std::mutex mutex;
+        int fd = -1;
+        std::uint8_t *data = nullptr;
+        std::size_t used = 0, capacity = 0, reserve;
+    };
+
+    // Callback for BufferSync::subscribe that records every element put to a queue holding laser scans
+    // (std::vector<Eigen::Vector2f>), Odometry or 3D points:
+    //   Writer writer("run.rcrec");
+    //   buffer.subscribe<0>(0, recording::tap(writer));
+    // It runs in the thread publishing the put, and only copies the element into the mapping
+    inline auto tap(Writer &writer)
+    {
+        return [&writer](auto &&element) { writer.write(element.second, element.first); };
+    }
+
+    // Read only mapping of a recording
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string &file);
+        ~Reader();
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        bool ok() const { return data != nullptr; };
+        std::uint64_t stamp_ns() const { return header.stamp_ns; };
+        // next record, false at the end of the recording or at a truncated record
+        bool next(Record &record);
+        void rewind() { offset = sizeof(FileHeader); };
+
+    private:
+        int fd = -1;
+        const std::uint8_t *data = nullptr;
+        std::size_t length = 0, offset = 0;
+        FileHeader header{};
+    };
+}
+
+#endif // RECORDING_H
@@ -0,0 +1,136 @@
+#include "replay.h"
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <thread>
+
+Replay::Replay(const std::string &file) : reader(file)
+{
+}
+
+void Replay::add_stage(const std::string &name, recording::Kind kind, std::function<void(const recording::Record &)> fn)
+{
+    stages.push_back(Stage{name, kind, std::move(fn)});
+}
+
+namespace
+{
+    // percentile q of sorted durations, in microseconds
+    double percentile(const std::vector<float> &sorted, double q)
+    {
+        if (sorted.empty())
+            return 0;
+        const auto i = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+    Replay::Stats summary(const std::string &name, recording::Kind kind, std::vector<float> &us, double lag_us)
+    {
+        Replay::Stats s;
+        s.name = name;
+        s.kind = kind;
+        s.count = us.size();
+        double sum = 0;
+        for (const float v : us)
+            sum += v;
+        std::sort(us.begin(), us.end());
+        s.busy_s = sum * 1e-6;
+        s.throughput = sum > 0 ? static_cast<double>(us.size()) / s.busy_s : 0;
+        s.mean_us = us.empty() ? 0 : sum / static_cast<double>(us.size());
+        s.p50_us = percentile(us, 0.5);
+        s.p90_us = percentile(us, 0.9);
+        s.p99_us = percentile(us, 0.99);
+        s.p999_us = percentile(us, 0.999);
+        s.max_us = us.empty() ? 0 : us.back();
+        s.max_lag_us = lag_us;
+        return s;
+    }
+}
+
+std::vector<Replay::Stats> Replay::run(Pace pace, double speed)
+{
+    using clock = std::chrono::steady_clock;
+    std::vector<std::vector<float>> durations(stages.size());
+    std::vector<double> lag(stages.size(), 0.);
+    if (not reader.ok())
+        return {};
+    reader.rewind();
+
+    const double ns_per_stamp = static_cast<double>(reader.stamp_ns()) / (speed > 0 ? speed : 1.0);
+    recording::Record record;
+    bool first = true;
+    std::uint64_t first_stamp = 0;
+    std::size_t records = 0;
+    const auto start = clock::now();
+    while (reader.next(record))
+    {
+        records++;
+        clock::time_point due = clock::now();
+        if (pace == Pace::REALTIME)
+        {
+            if (first)
+                first_stamp = record.stamp;
+            first = false;
+            const auto offset = static_cast<double>(record.stamp - std::min(record.stamp, first_stamp)) * ns_per_stamp;
+            due = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>(offset));
+            std::this_thread::sleep_until(due);
+        }
+        for (std::size_t i = 0; i < stages.size(); i++)
+        {
+            if (stages[i].kind != record.kind)
+                continue;
+            const auto t0 = clock::now();
+            stages[i].fn(record);
+            const auto t1 = clock::now();
+            durations[i].push_back(std::chrono::duration<float, std::micro>(t1 - t0).count());
+            if (pace == Pace::REALTIME)
+                lag[i] = std::max(lag[i], std::chrono::duration<double, std::micro>(t0 - due).count());
+        }
+    }
+    const double wall_s = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<Stats> stats;
+    for (std::size_t i = 0; i < stages.size(); i++)
+        stats.push_back(summary(stages[i].name, stages[i].kind, durations[i], lag[i]));
+    Stats total;
+    total.name = "total";
+    total.kind = recording::Kind::NONE;
+    total.count = records;
+    total.busy_s = wall_s;
+    total.throughput = wall_s > 0 ? static_cast<double>(records) / wall_s : 0;
+    stats.push_back(total);
+    return stats;
+}
+
+void Replay::print(std::ostream &os, const std::vector<Stats> &stats)
+{
+    const auto flags = os.flags();
+    const auto precision = os.precision(1);
+    os.setf(std::ios::fixed);
+    for (const auto &s : stats)
+    {
+        os << s.name << " (" << recording::kind_name(s.kind) << "): " << s.count << " records, " << s.throughput << " /s";
+        if (s.kind != recording::Kind::NONE)
+            os << ", us mean " << s.mean_us << " p50 " << s.p50_us << " p90 " << s.p90_us << " p99 " << s.p99_us
+               << " p99.9 " << s.p999_us << " max " << s.max_us << ", max lag " << s.max_lag_us;
+        os << '\n';
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Replay::print_json(std::ostream &os, const std::vector<Stats> &stats)
+{
+    const auto precision = os.precision(9);
+    os << "{\"stages\": [";
+    for (std::size_t i = 0; i < stats.size(); i++)
+    {
+        const auto &s = stats[i];
+        os << (i ? ", " : "") << "{\"name\": \"" << s.name << "\", \"kind\": \"" << recording::kind_name(s.kind)
+           << "\", \"count\": " << s.count << ", \"busy_s\": " << s.busy_s << ", \"throughput\": " << s.throughput
+           << ", \"mean_us\": " << s.mean_us << ", \"p50_us\": " << s.p50_us << ", \"p90_us\": " << s.p90_us
+           << ", \"p99_us\": " << s.p99_us << ", \"p999_us\": " << s.p999_us << ", \"max_us\": " << s.max_us
+           << ", \"max_lag_us\": " << s.max_lag_us << "}";
+    }
+    os << "]}\n";
+    os.precision(precision);
+}
@@ -0,0 +1,53 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "recording.h"
+
+// Feeds a recording to processing stages and measures them. Every stage declares the kind of record it takes and is
+// called, in the order stages were added, with each record of that kind, in the thread calling run. Stages see the same
+// records in the same order on every run, so two runs differ only in the code they measure.
+//   Replay replay("warehouse.rcrec");
+//   replay.add_stage("odometry", recording::Kind::ODOMETRY, [&](const recording::Record &r) { pose = r.odometry(); });
+//   replay.add_stage("grid.update_map", recording::Kind::LASER, [&](const recording::Record &r) { ... });
+//   Replay::print(std::cout, replay.run(Replay::Pace::REALTIME));
+// FAST calls the stages back to back. REALTIME waits for the stamp of every record, scaled by 1/speed, and
+// measures how late each record is handed over because of the stages before it.
+class Replay
+{
+public:
+    enum class Pace { FAST, REALTIME };
+    struct Stats
+    {
+        std::string name;
+        recording::Kind kind;
+        std::size_t count = 0;
+        double busy_s = 0;                  // time spent in the stage
+        double throughput = 0;              // records per second of busy time
+        double mean_us = 0, p50_us = 0, p90_us = 0, p99_us = 0, p999_us = 0, max_us = 0;
+        double max_lag_us = 0;              // REALTIME: worst delay of a record over its stamp, when the stage started
+    };
+
+    explicit Replay(const std::string &file);
+    bool ok() const { return reader.ok(); };
+    void add_stage(const std::string &name, recording::Kind kind, std::function<void(const recording::Record &)> fn);
+    // Replays the whole recording once. Stats of every stage, plus a last one named "total" with the whole replay
+    std::vector<Stats> run(Pace pace = Pace::FAST, double speed = 1.0);
+    static void print(std::ostream &os, const std::vector<Stats> &stats);
+    static void print_json(std::ostream &os, const std::vector<Stats> &stats);
+
+private:
+    struct Stage
+    {
+        std::string name;
+        recording::Kind kind;
+        std::function<void(const recording::Record &)> fn;
+    };
+    recording::Reader reader;
+    std::vector<Stage> stages;
+};
+
+#endif // REPLAY_H
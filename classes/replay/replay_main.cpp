@@ -0,0 +1,210 @@
+//
+// rc_replay: replays a recording into Grid::update_map, Local_Grid::update_map_from_polar_data (and
+// update_map_from_3D_points) and RCParticleFilter::step, and prints per stage throughput and latency percentiles.
+//   rc_replay warehouse.rcrec [--realtime] [--speed 2] [--particles 2000] [--tile 100] [--max-range 10000]
+//             [--stages grid,local,pf] [--json]
+// The grid covers the odometry of the recording plus max-range. The particle filter localizes against the grid being
+// built, weighting each particle by the beam ends that fall on occupied cells.
+//
+
+#include "replay.h"
+#include <grid2d/grid.h>
+#include <local_grid/local_grid.h>
+#include <particleFiltering/particleFilter.h>
+#include <QApplication>
+#include <QGraphicsScene>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+namespace
+{
+    struct Options
+    {
+        std::string file;
+        bool realtime = false, json = false;
+        double speed = 1.0;
+        uint32_t particles = 1000;
+        int tile = 100;
+        float max_range = 10000.f;
+        bool grid = true, local = true, pf = true;
+    };
+
+    bool parse(int argc, char **argv, Options &o)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string a = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (a == "--realtime") o.realtime = true;
+            else if (a == "--json") o.json = true;
+            else if (a == "--speed" and has_value) o.speed = std::stod(argv[++i]);
+            else if (a == "--particles" and has_value) o.particles = std::stoul(argv[++i]);
+            else if (a == "--tile" and has_value) o.tile = std::stoi(argv[++i]);
+            else if (a == "--max-range" and has_value) o.max_range = std::stof(argv[++i]);
+            else if (a == "--stages" and has_value)
+            {
+                const std::string s = argv[++i];
+                o.grid = s.find("grid") != std::string::npos;
+                o.local = s.find("local") != std::string::npos;
+                o.pf = s.find("pf") != std::string::npos;
+            }
+            else if (a[0] != '-' and o.file.empty()) o.file = a;
+            else return false;
+        }
+        return not o.file.empty();
+    }
+
+    // Laser scan of the PF, in the frame of the robot, with the grid it is compared against
+    struct Scan
+    {
+        std::vector<Eigen::Vector2f> ends;
+        Grid *grid = nullptr;
+    };
+
+    class Pose : public RCParticleFilter_StaticParticle<Pose, Scan, recording::Odometry>
+    {
+    public:
+        void initialize(const Scan &, const recording::Odometry &o, const RCParticleFilter_Config *)
+        {
+            thread_local std::mt19937_64 rng(7);
+            std::normal_distribution<double> n(0., 200.), a(0., 0.05);
+            x = o.x + n(rng);
+            y = o.y + n(rng);
+            angle = o.angle + a(rng);
+        }
+        void adapt(const recording::Odometry &back, const recording::Odometry &now, bool, std::mt19937_64 &rng)
+        {
+            // odometry increment in the frame of the robot, applied to the particle with noise
+            const double dx = now.x - back.x, dy = now.y - back.y;
+            const double c = std::cos(back.angle), s = std::sin(back.angle);
+            const double fwd = c * dx + s * dy, side = -s * dx + c * dy;
+            std::normal_distribution<double> n(0., 10. + 0.05 * std::hypot(dx, dy)), a(0., 0.01 + 0.1 * std::fabs(now.angle - back.angle));
+            const double pc = std::cos(angle), ps = std::sin(angle);
+            x += pc * fwd - ps * side + n(rng);
+            y += ps * fwd + pc * side + n(rng);
+            angle += now.angle - back.angle + a(rng);
+        }
+        void computeWeight(const Scan &scan)
+        {
+            const float c = static_cast<float>(std::cos(angle)), s = static_cast<float>(std::sin(angle));
+            std::size_t hits = 0;
+            for (const auto &e : scan.ends)
+                hits += scan.grid->is_occupied(Eigen::Vector2f(x + c * e.x() - s * e.y(), y + s * e.x() + c * e.y()));
+            weight = 1e-3 + static_cast<double>(hits) / static_cast<double>(std::max<std::size_t>(1, scan.ends.size()));
+        }
+        double x = 0, y = 0, angle = 0;
+    };
+
+    // extent of the odometry of the recording
+    QRectF odometry_bounds(const std::string &file, float margin)
+    {
+        recording::Reader reader(file);
+        recording::Record r;
+        double x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+        bool first = true;
+        while (reader.next(r))
+            if (r.kind == recording::Kind::ODOMETRY)
+            {
+                const auto o = r.odometry();
+                x0 = first ? o.x : std::min(x0, o.x); x1 = first ? o.x : std::max(x1, o.x);
+                y0 = first ? o.y : std::min(y0, o.y); y1 = first ? o.y : std::max(y1, o.y);
+                first = false;
+            }
+        return QRectF(x0 - margin, y0 - margin, x1 - x0 + 2 * margin, y1 - y0 + 2 * margin);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (not parse(argc, argv, o))
+    {
+        std::cerr << "usage: " << argv[0] << " recording [--realtime] [--speed s] [--particles n] [--tile mm] "
+                     "[--max-range mm] [--stages grid,local,pf] [--json]" << std::endl;
+        return 1;
+    }
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    QGraphicsScene scene;
+
+    Replay replay(o.file);
+    if (not replay.ok())
+    {
+        std::cerr << "Could not read " << o.file << std::endl;
+        return 1;
+    }
+
+    recording::Odometry pose;
+    replay.add_stage("odometry", recording::Kind::ODOMETRY, [&](const recording::Record &r) { pose = r.odometry(); });
+
+    Grid grid;
+    grid.initialize_fast(odometry_bounds(o.file, o.max_range), o.tile);   // headless, the scene is for Local_Grid
+    std::vector<Eigen::Vector2f> world;
+    if (o.grid or o.pf)
+        replay.add_stage("grid.update_map", recording::Kind::LASER, [&](const recording::Record &r)
+        {
+            const auto scan = r.laser();
+            const float c = static_cast<float>(std::cos(pose.angle)), s = static_cast<float>(std::sin(pose.angle));
+            const Eigen::Vector2f robot(static_cast<float>(pose.x), static_cast<float>(pose.y));
+            world.resize(scan.size());
+            for (std::size_t i = 0; i < scan.size(); i++)
+            {
+                const float a = scan[i].x(), d = scan[i].y();
+                world[i] = robot + Eigen::Vector2f(c * d * std::cos(a) - s * d * std::sin(a), s * d * std::cos(a) + c * d * std::sin(a));
+            }
+            grid.update_map(world, robot, o.max_range);
+        });
+
+    Local_Grid local;
+    std::vector<Eigen::Vector2f> polar;
+    if (o.local)
+    {
+        local.initialize(Local_Grid::Ranges{-180.f, 180.f, 2.f}, Local_Grid::Ranges{0.f, o.max_range, 100.f}, &scene);
+        replay.add_stage("local_grid.update_map_from_polar_data", recording::Kind::LASER, [&](const recording::Record &r)
+        {
+            // Local_Grid bins are in degrees
+            const auto scan = r.laser();
+            polar.resize(scan.size());
+            for (std::size_t i = 0; i < scan.size(); i++)
+                polar[i] = Eigen::Vector2f(scan[i].x() * 180.f / static_cast<float>(M_PI), scan[i].y());
+            local.update_map_from_polar_data(polar, o.max_range);
+        });
+        replay.add_stage("local_grid.update_map_from_3D_points", recording::Kind::POINTS, [&](const recording::Record &r)
+        {
+            local.update_map_from_3D_points(r.points(), r.point_count(), 3);
+        });
+    }
+
+    RCParticleFilter_Config config;
+    config.particles = o.particles;
+    std::unique_ptr<RCParticleFilter<Scan, recording::Odometry, Pose>> pf;
+    Scan pf_scan;
+    pf_scan.grid = &grid;
+    if (o.pf)
+        replay.add_stage("particle_filter.step", recording::Kind::LASER, [&](const recording::Record &r)
+        {
+            // 1 beam every 8 is enough to weight the particles
+            const auto scan = r.laser();
+            pf_scan.ends.clear();
+            for (std::size_t i = 0; i < scan.size(); i += 8)
+                pf_scan.ends.emplace_back(scan[i].y() * std::cos(scan[i].x()), scan[i].y() * std::sin(scan[i].x()));
+            if (not pf)
+            {
+                pf = std::make_unique<RCParticleFilter<Scan, recording::Odometry, Pose>>(&config, pf_scan, pose);
+                pf->seed(1234);
+            }
+            else
+                pf->step(pf_scan, pose);
+        });
+
+    const auto stats = replay.run(o.realtime ? Replay::Pace::REALTIME : Replay::Pace::FAST, o.speed);
+    if (o.json)
+        Replay::print_json(std::cout, stats);
+    else
+        Replay::print(std::cout, stats);
+    return 0;
+}
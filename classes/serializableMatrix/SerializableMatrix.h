@@ -19,56 +19,225 @@
 #ifndef SerializableMatrix_H
 #define SerializableMatrix_H
 
+//
+// File format, version 1: a 64 byte header followed by width*height*depth elements of T, x fastest.
+// The header tells the element type (size and kind) and the byte order, and has a checksum of the payload, so a
+// file written for another T or machine is refused instead of read as garbage. Files of the old format (three
+// unsigned ints: height, width, depth) are still loaded.
+//
+//   SerializableMatrix<float> table;
+//   table.resize(w, h, d);  ...  table.save("table.bin");        // or saveAsync, that returns at once
+//
+//   SerializableMatrixView<float> view;                         // read-only, backed by the file itself
+//   if (view.open("table.bin", SerializableMatrixView<float>::Prefetch::Random))
+//       float v = view.get3D(x, y, z);                          // pages are read from disk when first touched
+//
+// A multi-GB table is usable right after open(): nothing is copied, the kernel pages it in on demand and shares it
+// between the processes that map it. save() writes a temporary file and renames it over the old one, so views of
+// the previous version stay valid.
+//
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <future>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+namespace serializable_matrix
+{
+	static const char MAGIC[8] = {'R', 'C', 'S', 'M', 'A', 'T', 'R', 'X'};
+	static const uint32_t VERSION = 1;
+	static const uint32_t BYTE_ORDER_TAG = 0x01020304;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerBytes;
+		uint32_t byteOrder;
+		uint32_t elementSize;
+		uint32_t elementKind;                  // 'f' floating point, 'i' signed, 'u' unsigned, 'o' other
+		uint32_t width, height, depth;
+		uint64_t payloadBytes;
+		uint64_t checksum;
+		uint64_t padding;
+	};
+	static_assert(sizeof(Header) == 64, "the payload must start 64 byte aligned");
+
+	template <typename T>
+	constexpr uint32_t kind()
+	{
+		if (std::is_floating_point<T>::value) return 'f';
+		if (std::is_integral<T>::value) return std::is_signed<T>::value ? 'i' : 'u';
+		return 'o';
+	}
+
+	// 64 bit multiply-rotate hash, a word at a time: a few GB/s, fast enough to check a table on every load
+	inline uint64_t checksum(const void *bytes, uint64_t size)
+	{
+		const unsigned char *p = static_cast<const unsigned char *>(bytes);
+		uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+		uint64_t w;
+		for (; size >= 8; p += 8, size -= 8)
+		{
+			memcpy(&w, p, 8);
+			h = (h ^ (w * 0xBF58476D1CE4E5B9ull)) * 0x94D049BB133111EBull;
+			h ^= h >> 29;
+		}
+		w = 0;
+		if (size != 0)
+			memcpy(&w, p, size);
+		h = (h ^ (w * 0xBF58476D1CE4E5B9ull)) * 0x94D049BB133111EBull;
+		return h ^ (h >> 32);
+	}
+
+	template <typename T>
+	Header makeHeader(unsigned int width, unsigned int height, unsigned int depth, const T *data)
+	{
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, MAGIC, sizeof(MAGIC));
+		h.version = VERSION;
+		h.headerBytes = sizeof(Header);
+		h.byteOrder = BYTE_ORDER_TAG;
+		h.elementSize = sizeof(T);
+		h.elementKind = kind<T>();
+		h.width = width;
+		h.height = height;
+		h.depth = depth;
+		h.payloadBytes = uint64_t(width) * height * depth * sizeof(T);
+		h.checksum = checksum(data, h.payloadBytes);
+		return h;
+	}
+
+	// Empty if the header can be read as T, the reason otherwise
+	template <typename T>
+	std::string check(const Header &h)
+	{
+		if (h.byteOrder != BYTE_ORDER_TAG) return "written on a machine of another byte order";
+		if (h.version != VERSION or h.headerBytes != sizeof(Header)) return "unknown version " + std::to_string(h.version);
+		if (h.elementSize != sizeof(T) or h.elementKind != kind<T>())
+			return "holds " + std::to_string(h.elementSize) + " byte elements of kind '" + char(h.elementKind) + "'";
+		if (h.payloadBytes != uint64_t(h.width) * h.height * h.depth * sizeof(T)) return "inconsistent shape";
+		return "";
+	}
+
+	// The whole buffer in a temporary file renamed over 'path' at the end
+	inline bool write(const std::string &path, const Header &header, const void *data)
+	{
+		const std::string tmp = path + ".tmp";
+		FILE *fd = fopen(tmp.c_str(), "w");
+		if (fd == NULL)
+		{
+			printf ("Can't open %s for writting\n", tmp.c_str());
+			return false;
+		}
+		const bool written = fwrite(&header, sizeof(Header), 1, fd) == 1 and
+			(header.payloadBytes == 0 or fwrite(data, header.payloadBytes, 1, fd) == 1);
+		if (fclose(fd) != 0 or not written or rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			printf ("Can't write %s\n", path.c_str());
+			unlink(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
 
 template <typename T>
 class SerializableMatrix
 {
 public:
 
+	// Reads the whole file into memory; files of the old format too. On failure the matrix is left as it was
 	bool load(std::string path)
 	{
+		static_assert(std::is_trivially_copyable<T>::value, "SerializableMatrix files hold raw copies of T");
 		FILE *fd = fopen(path.c_str(), "r");
-		if (fd != NULL) {
-			unsigned int rows, columns, depth;
-			fread(&rows, 1, sizeof(unsigned int), fd);
-			fread(&columns, 1, sizeof(unsigned int), fd);
-			fread(&depth, 1, sizeof(unsigned int), fd);
-			resize(rows, columns, depth);
-			fread(&data[0], rows*columns*depth, sizeof(T), fd);
-			fclose(fd);
-			return true;
-		}
-		else
+		if (fd == NULL)
 		{
 			printf ("Can't open %s for reading\n", path.c_str());
-			fflush(stdout);
-			exit(-3);
 			return false;
 		}
-	}
+		struct stat st;
+		fstat(fileno(fd), &st);
 
-	void save(std::string path)
-	{
-		FILE *fd = fopen(path.c_str(), "w");
-		if (fd != NULL)
+		serializable_matrix::Header h;
+		std::string error;
+		std::vector<T> loaded;
+		if (fread(&h, 1, sizeof(h), fd) == sizeof(h) and memcmp(h.magic, serializable_matrix::MAGIC, sizeof(h.magic)) == 0)
 		{
-			fwrite(&height,  1,                  sizeof(unsigned int), fd);
-			fwrite(&width,   1,                  sizeof(unsigned int), fd);
-			fwrite(&depth,   1,                  sizeof(unsigned int), fd);
-			fwrite(&data[0], height*width*depth, sizeof(T),            fd);
-			fclose(fd);
+			error = serializable_matrix::check<T>(h);
+			if (error.empty() and uint64_t(st.st_size) != sizeof(h) + h.payloadBytes)
+				error = "truncated";
+			if (error.empty())
+			{
+				loaded.resize(h.payloadBytes / sizeof(T));
+				if (h.payloadBytes != 0 and fread(loaded.data(), h.payloadBytes, 1, fd) != 1)
+					error = "read failed";
+				else if (serializable_matrix::checksum(loaded.data(), h.payloadBytes) != h.checksum)
+					error = "checksum mismatch";
+			}
 		}
 		else
 		{
-			printf ("Can't open %s for writting\n", path.c_str());
-			fflush(stdout);
-			exit(-1);
+			// old format: height, width and depth, then the elements
+			unsigned int shape[3];
+			if (fseek(fd, 0, SEEK_SET) != 0 or fread(shape, sizeof(unsigned int), 3, fd) != 3 or
+				uint64_t(st.st_size) != sizeof(shape) + uint64_t(shape[0]) * shape[1] * shape[2] * sizeof(T))
+				error = "not a SerializableMatrix of this type";
+			else
+			{
+				h.height = shape[0];
+				h.width = shape[1];
+				h.depth = shape[2];
+				loaded.resize(uint64_t(h.width) * h.height * h.depth);
+				if (not loaded.empty() and fread(loaded.data(), loaded.size() * sizeof(T), 1, fd) != 1)
+					error = "read failed";
+			}
+		}
+		fclose(fd);
+		if (not error.empty())
+		{
+			printf ("Can't load %s: %s\n", path.c_str(), error.c_str());
+			return false;
 		}
+		width = h.width;
+		height = h.height;
+		depth = h.depth;
+		data = std::move(loaded);
+		if (data.empty())
+			data.resize(1);
+		return true;
+	}
+
+	bool save(std::string path) const
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "SerializableMatrix files hold raw copies of T");
+		return serializable_matrix::write(path, serializable_matrix::makeHeader(width, height, depth, data.data()), data.data());
+	}
+
+	// Saves a copy of the matrix in a thread of its own; the matrix can be changed or destroyed right away
+	std::future<bool> saveAsync(std::string path) const
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "SerializableMatrix files hold raw copies of T");
+		auto snapshot = std::make_shared<std::vector<T>>(data.begin(), data.begin() + size_t(width) * height * depth);
+		const unsigned int w = width, h = height, d = depth;
+		return std::async(std::launch::async, [snapshot, path, w, h, d]()
+		{
+			return serializable_matrix::write(path, serializable_matrix::makeHeader(w, h, d, snapshot->data()), snapshot->data());
+		});
 	}
 
 	SerializableMatrix()
@@ -212,4 +381,150 @@ private:
 	std::vector<T> data;
 };
 
+
+// Read-only matrix backed by a mapping of its file. Moveable, not copyable; the mapping lives as long as the view
+template <typename T>
+class SerializableMatrixView
+{
+public:
+	enum class Prefetch
+	{
+		None,           // pages read on first touch, with the kernel default read-ahead
+		Sequential,     // aggressive read-ahead, for a pass over the whole table
+		Random,         // no read-ahead, for sparse lookups
+		WillNeed,       // start reading everything in the background
+		Populate        // read everything before open() returns (MAP_POPULATE)
+	};
+
+	SerializableMatrixView() = default;
+	SerializableMatrixView(const SerializableMatrixView &) = delete;
+	SerializableMatrixView &operator=(const SerializableMatrixView &) = delete;
+	SerializableMatrixView(SerializableMatrixView &&other) { *this = std::move(other); }
+	SerializableMatrixView &operator=(SerializableMatrixView &&other)
+	{
+		if (this != &other)
+		{
+			close();
+			base = other.base; bytes = other.bytes; elements = other.elements; header = other.header;
+			other.base = nullptr; other.bytes = 0; other.elements = nullptr;
+		}
+		return *this;
+	}
+	~SerializableMatrixView() { close(); }
+
+	// Maps a file written by SerializableMatrix::save; the old format can only be load()ed
+	bool open(const std::string &path, Prefetch prefetch = Prefetch::None)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "SerializableMatrix files hold raw copies of T");
+		close();
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			printf ("Can't open %s for reading\n", path.c_str());
+			return false;
+		}
+		struct stat st;
+		std::string error;
+		if (fstat(fd, &st) != 0 or uint64_t(st.st_size) < sizeof(serializable_matrix::Header))
+			error = "not a SerializableMatrix file";
+		else
+		{
+			void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | (prefetch == Prefetch::Populate ? MAP_POPULATE : 0), fd, 0);
+			if (m == MAP_FAILED)
+				error = std::string("mmap failed: ") + strerror(errno);
+			else
+			{
+				base = m;
+				bytes = st.st_size;
+			}
+		}
+		::close(fd);
+
+		if (error.empty())
+		{
+			memcpy(&header, base, sizeof(header));
+			if (memcmp(header.magic, serializable_matrix::MAGIC, sizeof(header.magic)) != 0)
+				error = "not a SerializableMatrix file of version 1 or later";
+			else if ((error = serializable_matrix::check<T>(header)).empty() and bytes != sizeof(header) + header.payloadBytes)
+				error = "truncated";
+		}
+		if (not error.empty())
+		{
+			printf ("Can't map %s: %s\n", path.c_str(), error.c_str());
+			close();
+			return false;
+		}
+		elements = reinterpret_cast<const T *>(static_cast<const char *>(base) + sizeof(header));
+		switch (prefetch)
+		{
+			case Prefetch::Sequential: madvise(base, bytes, MADV_SEQUENTIAL); break;
+			case Prefetch::Random: madvise(base, bytes, MADV_RANDOM); break;
+			case Prefetch::WillNeed: madvise(base, bytes, MADV_WILLNEED); break;
+			default: break;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (base != nullptr)
+			munmap(base, bytes);
+		base = nullptr;
+		bytes = 0;
+		elements = nullptr;
+		memset(&header, 0, sizeof(header));
+	}
+
+	// Asks the kernel to read elements [first, first+count) in the background, e.g. the next region to be used
+	void prefetch(size_t first, size_t count) const
+	{
+		if (elements == nullptr or first >= getSize())
+			return;
+		count = std::min(count, getSize() - first);
+		const long page = sysconf(_SC_PAGESIZE);
+		const uintptr_t from = reinterpret_cast<uintptr_t>(elements + first) & ~uintptr_t(page - 1);
+		const uintptr_t to = reinterpret_cast<uintptr_t>(elements + first + count);
+		madvise(reinterpret_cast<void *>(from), to - from, MADV_WILLNEED);
+	}
+
+	// Reads the whole payload, so it is only checked on request
+	bool verify() const
+	{
+		return elements != nullptr and serializable_matrix::checksum(elements, header.payloadBytes) == header.checksum;
+	}
+
+	bool isOpen() const { return elements != nullptr; }
+	inline unsigned int getWidth() const { return header.width; }
+	inline unsigned int getHeight() const { return header.height; }
+	inline unsigned int getDepth() const { return header.depth; }
+	inline size_t getSize() const { return size_t(header.width) * header.height * header.depth; }
+	inline const T *getDataPointer() const { return elements; }
+
+	inline T get1D(unsigned int x) const
+	{
+		if (getSize() > x) return elements[x];
+		else throw std::string("SerializableMatrixView::get1D() out of bounds.");
+	}
+
+	inline T get2D(unsigned int x, unsigned int y) const
+	{
+		const size_t i = x + size_t(y)*header.width;
+		if (getSize() > i) return elements[i];
+		else throw std::string("SerializableMatrixView::get2D() out of bounds.");
+	}
+
+	inline T get3D(unsigned int x, unsigned int y, unsigned int z) const
+	{
+		const size_t i = x + size_t(y)*header.width + size_t(z)*header.height*header.width;
+		if (getSize() > i) return elements[i];
+		else throw std::string("SerializableMatrixView::get3D() out of bounds.");
+	}
+
+private:
+	void *base = nullptr;
+	size_t bytes = 0;
+	const T *elements = nullptr;
+	serializable_matrix::Header header{};
+};
+
 #endif
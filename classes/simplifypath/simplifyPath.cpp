@@ -29,38 +29,11 @@ const std::pair<int, double> simplifyPath::findMaximumDistance(const vector<Poin
 
 vector<Point> simplifyPath::simplifyWithRDP(vector<Point> &Points, double epsilon) const
 {
-	if (Points.size() < 3)
-	{  //base case 1
-		return Points;
-	}
-	std::pair<int, double> maxDistance = findMaximumDistance(Points);
-	if (maxDistance.second >= epsilon)
-	{
-		int index = maxDistance.first;
-		vector<Point>::iterator it = Points.begin();
-		vector<Point> path1(Points.begin(), it + index + 1); //new path l1 from 0 to index
-		vector<Point> path2(it + index, Points.end()); // new path l2 from index to last
-
-		vector<Point> r1 = simplifyWithRDP(path1, epsilon);
-		vector<Point> r2 = simplifyWithRDP(path2, epsilon);
-
-		//Concat simplified path1 and path2 together
-		vector<Point> rs(r1);
-		rs.pop_back();
-		rs.insert(rs.end(), r2.begin(), r2.end());
-		return rs;
-	}
-	else
-	{ //base case 2, all points between are to be removed.
-		vector<Point> r(1, Points[0]);
-		r.push_back(Points[Points.size() - 1]);
-		return r;
-	}
+	thread_local vector<std::uint32_t> kept;
+	simplifyRDP(Points, epsilon, kept);
+	vector<Point> rs;
+	rs.reserve(kept.size());
+	for (auto i : kept)
+		rs.push_back(Points[i]);
+	return rs;
 }
-
-
-
-
-
-
-
@@ -14,6 +14,9 @@
 #include <cstdlib>
 #include <vector>
 #include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <utility>
 
 //"Point" struct stand for each GPS coordinates(x,y). Methods related are used only for simplification of calculation in implementation.
 
@@ -45,6 +48,20 @@ typedef struct Point
 
 } Point;
 
+//Coordinates of the point types the templates below accept: members x, y (Point) or accessors x(), y() (Eigen, QPointF)
+namespace simplify_detail
+{
+	template <typename P> double x(const P &p) { if constexpr (requires { p.x(); }) return p.x(); else return p.x; }
+	template <typename P> double y(const P &p) { if constexpr (requires { p.y(); }) return p.y(); else return p.y; }
+	//distance from p to the line through a and b, or to a if both are the same point
+	template <typename P> double distance(const P &p, const P &a, const P &b)
+	{
+		const double dx = x(b) - x(a), dy = y(b) - y(a), px = x(p) - x(a), py = y(p) - y(a);
+		const double norm = std::sqrt(dx * dx + dy * dy);
+		return norm > 0 ? std::fabs(px * dy - dx * py) / norm : std::sqrt(px * px + py * py);
+	}
+}
+
 class simplifyPath
 {
 	//"findMaximumDistance" used as part of implementation for RDP algorithm.
@@ -54,6 +71,93 @@ class simplifyPath
 	//"simplifyWithRDP" returns the simplified path with a Point vector. The function takes in the paths to be simplified and a customerized thresholds for the simplication.
 	public:
 		std::vector<Point> simplifyWithRDP(std::vector<Point> &Points, double epsilon) const;
+
+	//"simplifyRDP" is the same algorithm without recursion over any random access range of points, e.g. the
+	//std::vector<Eigen::Vector2f> of Grid::compute_path. The indices of the kept points are written to "kept" in
+	//increasing order and their number returned; first and last are always kept. Pending splits go to an explicit
+	//stack, so once "kept" and the stack of the calling thread have grown no memory is allocated.
+	public:
+		template <typename Points>
+		std::size_t simplifyRDP(const Points &points, double epsilon, std::vector<std::uint32_t> &kept) const
+		{
+			kept.clear();
+			const std::size_t n = std::size(points);
+			if (n == 0)
+				return 0;
+			kept.push_back(0);
+			thread_local std::vector<std::pair<std::uint32_t, std::uint32_t>> stack;
+			stack.clear();
+			if (n > 1)
+				stack.emplace_back(0, n - 1);
+			while (not stack.empty())
+			{
+				const auto [first, last] = stack.back();
+				stack.pop_back();
+				std::uint32_t index = first;
+				double Mdist = -1;
+				for (std::uint32_t i = first + 1; i < last; i++)
+					if (const double Dist = simplify_detail::distance(points[i], points[first], points[last]); Dist > Mdist)
+					{
+						Mdist = Dist;
+						index = i;
+					}
+				if (index != first and Mdist >= epsilon)
+				{ //left half on top, so points are kept in order
+					stack.emplace_back(index, last);
+					stack.emplace_back(first, index);
+				}
+				else
+					kept.push_back(last);
+			}
+			return kept.size();
+		}
+};
+
+//"simplifyStream" simplifies a trajectory while it grows, point by point (opening window). The last kept point is the
+//anchor: a new point extends the current segment while every point received since the anchor lies within epsilon of the
+//line from the anchor to it, otherwise the previous point is kept and becomes the anchor. Each point is checked against
+//at most "window" points, so a push is O(window) and the output has the same tolerance as RDP.
+template <typename P>
+class simplifyStream
+{
+	public:
+		explicit simplifyStream(double epsilon_, std::size_t window_ = 64) : epsilon(epsilon_), window(window_ < 2 ? 2 : window_)
+		{}
+
+		//Adds a point. Returns true if the previous one was kept, so that points() grew by one
+		bool push(const P &p)
+		{
+			if (kept.empty() or pending.empty())
+			{
+				kept.push_back(p);
+				if (kept.size() > 1)
+					pending.push_back(p);
+				return false;
+			}
+			const P &anchor = kept[kept.size() - 2];
+			bool fits = pending.size() < window;
+			for (std::size_t i = 0; fits and i < pending.size(); i++)
+				fits = simplify_detail::distance(pending[i], anchor, p) < epsilon;
+			if (fits)
+			{
+				pending.push_back(p);
+				kept.back() = p;
+				return false;
+			}
+			pending.clear();
+			pending.push_back(p);
+			kept.push_back(p);
+			return true;
+		}
+
+		//Kept points followed by the last one received
+		const std::vector<P> &points() const { return kept; }
+		void clear() { kept.clear(); pending.clear(); }
+
+	private:
+		double epsilon;
+		std::size_t window;
+		std::vector<P> kept, pending;
 };
 
 #endif 
@@ -0,0 +1,138 @@
+#include "forcelayout.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Cells smaller than this keep all their bodies, coincident nodes would split forever
+#define MIN_CELL 1e-3
+
+int ForceLayout::newCell(std::vector<Cell> &cells, double cx, double cy, double half)
+{
+	Cell c = {cx, cy, half, 0., 0., 0., {-1, -1, -1, -1}, -1};
+	cells.push_back(c);
+	return int(cells.size()) - 1;
+}
+
+void ForceLayout::insert(std::vector<Cell> &cells, const std::vector<Body> &bodies, int body)
+{
+	const Body &p = bodies[body];
+	int c = 0;
+	while (true)
+	{
+		cells[c].mx = (cells[c].mx * cells[c].mass + p.x) / (cells[c].mass + 1);
+		cells[c].my = (cells[c].my * cells[c].mass + p.y) / (cells[c].mass + 1);
+		cells[c].mass += 1;
+		const bool leaf = cells[c].child[0] < 0 and cells[c].child[1] < 0 and cells[c].child[2] < 0 and cells[c].child[3] < 0;
+		if (leaf)
+		{
+			if (cells[c].mass == 1)
+			{
+				cells[c].body = body;
+				return;
+			}
+			if (cells[c].half < MIN_CELL)
+				return;
+			// split: the body of the leaf goes down first
+			const int other = cells[c].body;
+			const double h = cells[c].half / 2;
+			const int q = (bodies[other].x >= cells[c].cx ? 1 : 0) + (bodies[other].y >= cells[c].cy ? 2 : 0);
+			const int n = newCell(cells, cells[c].cx + (q & 1 ? h : -h), cells[c].cy + (q & 2 ? h : -h), h);
+			cells[n].mass = 1;
+			cells[n].mx = bodies[other].x;
+			cells[n].my = bodies[other].y;
+			cells[n].body = other;
+			cells[c].child[q] = n;
+			cells[c].body = -1;
+		}
+		const double h = cells[c].half / 2;
+		const int q = (p.x >= cells[c].cx ? 1 : 0) + (p.y >= cells[c].cy ? 2 : 0);
+		if (cells[c].child[q] < 0)
+		{
+			const int n = newCell(cells, cells[c].cx + (q & 1 ? h : -h), cells[c].cy + (q & 2 ? h : -h), h);
+			cells[c].child[q] = n;
+		}
+		c = cells[c].child[q];
+	}
+}
+
+std::vector<std::pair<double, double> > ForceLayout::step(const std::vector<Body> &bodies,
+	const std::vector<std::pair<int, int> > &edges, double theta)
+{
+	const int n = int(bodies.size());
+	std::vector<std::pair<double, double> > vel(n, std::make_pair(0., 0.));
+	if (n == 0)
+		return vel;
+
+	// quadtree over the bounding square of the bodies
+	double x0 = bodies[0].x, x1 = x0, y0 = bodies[0].y, y1 = y0;
+	for (const Body &b : bodies)
+	{
+		x0 = std::min(x0, b.x);
+		x1 = std::max(x1, b.x);
+		y0 = std::min(y0, b.y);
+		y1 = std::max(y1, b.y);
+	}
+	std::vector<Cell> cells;
+	cells.reserve(2 * n + 1);
+	newCell(cells, (x0 + x1) / 2, (y0 + y1) / 2, std::max(x1 - x0, y1 - y0) / 2 + 1);
+	for (int i = 0; i < n; i++)
+		insert(cells, bodies, i);
+
+	// repulsion, far cells as a single body
+	const double theta2 = theta * theta;
+	std::vector<int> stack;
+	for (int i = 0; i < n; i++)
+	{
+		if (bodies[i].fixed)
+			continue;
+		double fx = 0, fy = 0;
+		stack.assign(1, 0);
+		while (not stack.empty())
+		{
+			const Cell &c = cells[stack.back()];
+			stack.pop_back();
+			if (c.mass == 0)
+				continue;
+			const double dx = bodies[i].x - c.mx, dy = bodies[i].y - c.my;
+			const double d2 = dx * dx + dy * dy;
+			const bool leaf = c.child[0] < 0 and c.child[1] < 0 and c.child[2] < 0 and c.child[3] < 0;
+			if (leaf or 4 * c.half * c.half < theta2 * d2)
+			{
+				if (d2 > 0)
+				{
+					fx += c.mass * 300. * dx / d2;
+					fy += c.mass * 300. * dy / d2;
+				}
+			}
+			else
+				for (int k = 0; k < 4; k++)
+					if (c.child[k] >= 0)
+						stack.push_back(c.child[k]);
+		}
+		vel[i].first = fx;
+		vel[i].second = fy;
+	}
+
+	// attraction along the edges
+	std::vector<int> degree(n, 0);
+	for (const auto &e : edges)
+	{
+		degree[e.first]++;
+		if (e.second != e.first)
+			degree[e.second]++;
+	}
+	for (const auto &e : edges)
+	{
+		const double dx = bodies[e.first].x - bodies[e.second].x, dy = bodies[e.first].y - bodies[e.second].y;
+		const double wa = (degree[e.first] + 1) * 10., wb = (degree[e.second] + 1) * 10.;
+		vel[e.first].first -= dx / wa;
+		vel[e.first].second -= dy / wa;
+		vel[e.second].first += dx / wb;
+		vel[e.second].second += dy / wb;
+	}
+
+	for (int i = 0; i < n; i++)
+		if (bodies[i].fixed or (std::fabs(vel[i].first) < 0.2 and std::fabs(vel[i].second) < 0.2))
+			vel[i] = std::make_pair(0., 0.);
+	return vel;
+}
@@ -0,0 +1,39 @@
+#ifndef FORCELAYOUT_H
+#define FORCELAYOUT_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// One step of the spring layout of GraphWidget, on plain data so it can run in any thread.
+// Nodes repel each other with 300*d/|d|^2 and every edge pulls its ends with d/weight, weight being
+// 10*(edges of the node + 1), as Node::calculateForces does. The repulsion is approximated with a
+// Barnes-Hut quadtree: a cell seen under an angle smaller than theta acts as one body at its center
+// of mass, so a step is O(N log N) instead of O(N^2).
+class ForceLayout
+{
+public:
+	struct Body
+	{
+		double x, y;		// scene coordinates
+		bool fixed;			// grabbed by the mouse, never moves
+	};
+
+	// Displacement of every body, 0 for the fixed ones and under 0.2 in both axes
+	static std::vector<std::pair<double, double> > step(const std::vector<Body> &bodies,
+		const std::vector<std::pair<int, int> > &edges, double theta = 0.7);
+
+private:
+	struct Cell
+	{
+		double cx, cy, half;		// square covered by the cell
+		double mass, mx, my;		// number of bodies and their center of mass
+		int child[4];				// -1 if none
+		int body;					// body of a leaf, -1 when empty or internal
+	};
+
+	static void insert(std::vector<Cell> &cells, const std::vector<Body> &bodies, int body);
+	static int newCell(std::vector<Cell> &cells, double cx, double cy, double half);
+};
+
+#endif
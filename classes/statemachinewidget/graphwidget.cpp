@@ -1,7 +1,5 @@
 #include "graphwidget.h"
 
-#include <QCheckBox>
-
 
 GraphWidget::GraphWidget(QWidget *parent,QMenu *menu):QGraphicsView(parent)
 {
@@ -19,6 +17,8 @@ GraphWidget::GraphWidget(QWidget *parent,QMenu *menu):QGraphicsView(parent)
 
 	setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 	timerId = 0;
+	layoutEnergyThreshold = 1.0;
+	layoutTheta = 0.7;
 	scene = new QGraphicsScene(this);
 	scene->setItemIndexMethod(QGraphicsScene::NoIndex);
 
@@ -120,41 +120,76 @@ void GraphWidget::keyPressEvent(QKeyEvent *event)
      }
 }
 
+// Layout steps are pipelined: every tick applies the step computed since the previous one, in one batch, and
+// launches the next from the new positions. A tick that finds the step still running does nothing
 void GraphWidget::timerEvent(QTimerEvent *event)
 {
 	Q_UNUSED(event);
 
-	QList<Node *> nodes;
+	if (layoutJob.valid())
+	{
+		if (layoutJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+		const double energy = applyLayoutStep(layoutJob.get());
+		if (energy < layoutEnergyThreshold and scene->mouseGrabberItem() == NULL)
+		{
+			killTimer(timerId);
+			timerId = 0;
+			layoutNodes.clear();
+			return;
+		}
+	}
+	startLayoutStep();
+}
+
+// Snapshot of the nodes and edges for ForceLayout, computed off the GUI thread
+void GraphWidget::startLayoutStep()
+{
+	std::vector<ForceLayout::Body> bodies;
+	std::vector<std::pair<int, int> > links;
+	QHash<Node *, int> index;
+	layoutNodes.clear();
 	foreach (QGraphicsItem *item, scene->items()) {
 		if (Node *node = qgraphicsitem_cast<Node *>(item))
-			nodes << node;
+		{
+			// forces only depend on differences, scene coordinates serve for nodes inside other nodes too
+			const QPointF p = node->scenePos();
+			ForceLayout::Body body = {p.x(), p.y(), scene->mouseGrabberItem() == node};
+			index[node] = int(bodies.size());
+			bodies.push_back(body);
+			layoutNodes << node;
+		}
 	}
+	foreach (Node *node, index.keys())
+		foreach (Edge *edge, node->edges())
+			if (edge->sourceNode() == node and index.contains(edge->destNode()))
+				links.push_back(std::make_pair(index[node], index[edge->destNode()]));
+
+	const double theta = layoutTheta;
+	layoutJob = std::async(std::launch::async, [bodies = std::move(bodies), links = std::move(links), theta]() { return ForceLayout::step(bodies, links, theta); });
+}
 
-	static bool ddd = false;
-	static QCheckBox *c;
-	if (not ddd)
+// Moves every node of the step, clamped to the scene like Node::calculateForces, and returns the kinetic energy
+double GraphWidget::applyLayoutStep(const std::vector<std::pair<double, double> > &vel)
+{
+	const QRectF sceneRect = scene->sceneRect();
+	double energy = 0;
+	for (int i = 0; i < layoutNodes.size() and i < int(vel.size()); i++)
 	{
-		c = new QCheckBox();
-		c->show();
-		ddd = true;
-	}
-	
-	if (not c->isChecked())
-	foreach (Node *node, nodes)
-		node->calculateForces();
-		
-
-	bool itemsMoved = false;
-	foreach (Node *node, nodes) {
+		Node *node = layoutNodes[i];
+		if (node == NULL or node->scene() != scene or scene->mouseGrabberItem() == node)
+			continue;
+		const QPointF old = node->pos();
+		node->newPos = old + QPointF(vel[i].first, vel[i].second);
+		node->newPos.setX(qMin(qMax(node->newPos.x(), sceneRect.left() + 10), sceneRect.right() - 10));
+		node->newPos.setY(qMin(qMax(node->newPos.y(), sceneRect.top() + 10), sceneRect.bottom() - 10));
+		const QPointF moved = node->newPos - old;
 		if (node->advance())
-			itemsMoved = true;
-	}
-
-	if (!itemsMoved) {
-		killTimer(timerId);
-		timerId = 0;
+			energy += 0.5 * (moved.x() * moved.x() + moved.y() * moved.y());
 	}
+	return energy;
 }
+
 void GraphWidget::SetCenter(const QPointF& centerPoint) {
 	//Get the rectangle of the visible area in scene coords
 	QRectF visibleArea = mapToScene(rect()).boundingRect();
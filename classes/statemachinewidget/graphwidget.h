@@ -8,9 +8,12 @@
 #include <QWheelEvent>
 #include <QTimer>
 #include <QVBoxLayout>
+#include <QPointer>
 #include <math.h>
+#include <future>
 #include "edge.h"
 #include "node.h"
+#include "forcelayout.h"
 
 
 
@@ -25,6 +28,10 @@ public:
 	~GraphWidget();
 	
 	void itemMoved();
+	// the layout stops once the kinetic energy of a step, 0.5*sum(|v|^2), is below threshold
+	void setLayoutEnergyThreshold(double threshold) { layoutEnergyThreshold = threshold; }
+	// Barnes-Hut opening angle, 0 for the exact O(N^2) forces
+	void setLayoutTheta(double theta) { layoutTheta = theta; }
 
 //	void checkNewItems();
 	void clear();
@@ -63,10 +70,16 @@ protected:
 	void timerEvent(QTimerEvent *event);
 	
 	void drawBackground(QPainter *painter, const QRectF &rect);
+	void startLayoutStep();
+	double applyLayoutStep(const std::vector<std::pair<double, double> > &vel);
 
 	void resizeEvent ( QResizeEvent * event );
 private:
 	int timerId;
+	std::future<std::vector<std::pair<double, double> > > layoutJob;	// step being computed in another thread
+	QList<QPointer<Node> > layoutNodes;								// nodes of the step, in the order of its bodies
+	double layoutEnergyThreshold;
+	double layoutTheta;
 	QGraphicsScene *scene;
 	QMap<int,Node *> nodes_map;
 	QMap<QString,Edge*> edges_map;
@@ -0,0 +1,303 @@
+//
+// Coroutines on top of ThreadPool.
+// coro::task<T> is a lazy coroutine: it starts when it is co_awaited and resumes its awaiter when it finishes,
+// without any thread blocking in between. co_await pool.schedule() moves the rest of a coroutine to a worker.
+// coro::spawn starts a task<void> on a pool without waiting for it and coro::sync_wait runs one from plain code.
+// coro::waiter_list keeps the coroutines waiting for an event, it is used by the next() awaitables of BufferSync
+// and DoubleBuffer.
+//
+// Example: a pipeline that holds no worker while it waits for its inputs.
+//   coro::task<void> control_loop(ThreadPool &pool, BufferSync<InOut<Laser, Laser>, InOut<Odom, Odom>> &buffer)
+//   {
+//       while (running)
+//       {
+//           auto [laser] = co_await buffer.next<0>(&pool);    //resumed on a worker once a laser scan is put
+//           auto [odom] = buffer.read<1>(laser_stamp(laser), 50);
+//           auto command = co_await plan(laser, odom);         //another coro::task<Command>
+//           send(command);
+//       }
+//   }
+//   coro::spawn(pool, control_loop(pool, buffer));
+//
+// A coroutine suspended in a pool or a buffer that is destroyed is never resumed, and its frame is leaked.
+//
+
+#ifndef THREADPOOL_COROUTINE_H
+#define THREADPOOL_COROUTINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "threadpool.h"
+
+namespace coro
+{
+    template <typename T = void>
+    class task;
+
+    namespace detail
+    {
+        struct promise_base
+        {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr error;
+
+            struct final_awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+                {
+                    return h.promise().continuation;     //symmetric transfer, no stack growth along chains
+                }
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            final_awaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        template <typename T>
+        struct promise : promise_base
+        {
+            std::optional<T> value;
+
+            task<T> get_return_object();
+            template <typename U>
+            void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+            T result()
+            {
+                if (error) std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        struct promise<void> : promise_base
+        {
+            task<void> get_return_object();
+            void return_void() const noexcept {}
+            void result()
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+
+        //frame freed when it finishes, nobody owns it
+        struct detached
+        {
+            struct promise_type
+            {
+                detached get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept
+                {
+                    try { throw; }
+                    catch (const std::exception &e) { std::cerr << "coro::spawn: task failed: " << e.what() << std::endl; }
+                    catch (...) { std::cerr << "coro::spawn: task failed" << std::endl; }
+                }
+            };
+        };
+
+        //the notification is made under the lock, so the waiter cannot destroy the event while it runs
+        struct event
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool done = false;
+            void set()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+                cv.notify_one();
+            }
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return done; });
+            }
+        };
+
+        //sets done once finished, for sync_wait
+        struct signalling
+        {
+            struct promise_type
+            {
+                event *done = nullptr;
+
+                signalling get_return_object() { return signalling{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+                std::suspend_always initial_suspend() const noexcept { return {}; }
+                auto final_suspend() const noexcept
+                {
+                    struct awaiter
+                    {
+                        bool await_ready() const noexcept { return false; }
+                        void await_suspend(std::coroutine_handle<promise_type> h) const noexcept
+                        {
+                            //already suspended, so the waiting thread may destroy the frame right away
+                            h.promise().done->set();
+                        }
+                        void await_resume() const noexcept {}
+                    };
+                    return awaiter{};
+                }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }   //caught in the body
+            };
+            std::coroutine_handle<promise_type> handle;
+        };
+    }
+
+    template <typename T>
+    class task
+    {
+    public:
+        static_assert(not std::is_reference_v<T>, "coro::task of references is not supported");
+        using promise_type = detail::promise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        task(const task &) = delete;
+        task &operator=(const task &) = delete;
+        task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+        task &operator=(task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle) handle.destroy();
+                handle = std::exchange(other.handle, {});
+            }
+            return *this;
+        }
+        ~task() { if (handle) handle.destroy(); }
+
+        bool valid() const { return static_cast<bool>(handle); }
+
+        auto operator co_await() const noexcept
+        {
+            struct awaiter
+            {
+                handle_type h;
+                bool await_ready() const noexcept { return not h or h.done(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+                {
+                    h.promise().continuation = awaiting;
+                    return h;
+                }
+                T await_resume() { return h.promise().result(); }
+            };
+            return awaiter{handle};
+        }
+
+    private:
+        friend promise_type;
+        explicit task(handle_type h) : handle(h) {}
+        handle_type handle;
+    };
+
+    namespace detail
+    {
+        template <typename T>
+        task<T> promise<T>::get_return_object() { return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this)); }
+        inline task<void> promise<void>::get_return_object() { return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this)); }
+    }
+
+    //Starts t on a worker of pool and returns. Exceptions escaping t are reported on std::cerr
+    inline void spawn(ThreadPool &pool, task<void> t)
+    {
+        [](ThreadPool &p, task<void> owned) -> detail::detached
+        {
+            co_await p.schedule();
+            co_await owned;
+        }(pool, std::move(t));
+    }
+
+    //Runs t, in the calling thread until its first suspension, and blocks until it finishes
+    template <typename T>
+    T sync_wait(task<T> t)
+    {
+        detail::event done;
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+        std::exception_ptr error;
+        auto waiter = [](task<T> &inner, auto &out, std::exception_ptr &err) -> detail::signalling
+        {
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    co_await inner;
+                    out.emplace(true);
+                }
+                else
+                    out.emplace(co_await inner);
+            }
+            catch (...)
+            {
+                err = std::current_exception();
+            }
+        }(t, value, error);
+        waiter.handle.promise().done = &done;
+        waiter.handle.resume();
+        done.wait();
+        waiter.handle.destroy();
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (not std::is_void_v<T>)
+            return std::move(*value);
+    }
+
+    //Coroutines waiting for an event. The event source calls resume_all() after publishing the new state; each
+    //waiter is resumed on its pool or, without one, inline in the thread calling resume_all()
+    class waiter_list
+    {
+    public:
+        //false, and nothing is kept, when ready() already holds and the caller must not suspend
+        template <typename Ready>
+        bool suspend(std::coroutine_handle<> h, ThreadPool *pool, Ready &&ready)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            any.store(true, std::memory_order_seq_cst);
+            if (ready())
+            {
+                any.store(not waiting.empty(), std::memory_order_relaxed);
+                return false;
+            }
+            waiting.emplace_back(h, pool);
+            return true;
+        }
+
+        //A single load when nobody waits, so it can be called on every write
+        void resume_all()
+        {
+            if (not any.load(std::memory_order_seq_cst))
+                return;
+            std::vector<std::pair<std::coroutine_handle<>, ThreadPool *>> woken;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                woken.swap(waiting);
+                any.store(false, std::memory_order_relaxed);
+            }
+            for (auto &[h, pool] : woken)
+                if (pool != nullptr)
+                    pool->spawn_task([h = h]() { h.resume(); });
+                else
+                    h.resume();
+        }
+
+    private:
+        std::mutex mutex;
+        std::atomic<bool> any{false};
+        std::vector<std::pair<std::coroutine_handle<>, ThreadPool *>> waiting;
+    };
+}
+
+#endif
@@ -0,0 +1,524 @@
+//
+// Task storage for ThreadPool.
+// Task is a move only callable with INLINE_SIZE bytes of inline storage, so the usual lambdas capturing a few
+// pointers and values are queued without touching the heap. Larger callables, and the jobs of waitable tasks,
+// live in blocks of TaskBlockPool: free lists per thread and size class. A block released by another thread
+// goes back to the list of the thread that allocated it, so a producer thread reuses the blocks its workers
+// release after running its tasks.
+// TaskFuture is the future of a waitable task. Its state lives in the same block as the callable, so a waitable
+// task costs one block from the pool instead of the task and shared state allocations of std::packaged_task.
+// It is move only like std::future, but it is not one: code holding std::future<R> takes TaskFuture<R>, and
+// share() gives the copyable SharedTaskFuture<R> in place of std::shared_future<R>.
+//
+
+#ifndef THREADPOOL_TASK_H
+#define THREADPOOL_TASK_H
+
+//1 to build ThreadPool with its queue and latency counters, see ThreadPoolStats. It changes the layout of Task,
+//so it has to be the same for the whole build
+#ifndef THREADPOOL_STATS
+#define THREADPOOL_STATS 0
+#endif
+
+#include "../tracing/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+class TaskBlockPool
+{
+public:
+    static constexpr std::size_t CLASSES = 4;          //blocks of 128, 256, 512 and 1024 bytes, header included
+    static constexpr std::size_t SMALLEST = 128;
+    static constexpr std::uint32_t MAX_CACHED = 1024;  //about, per thread and class
+
+    //storage aligned to std::max_align_t. Sizes above the largest class go to operator new
+    static void *allocate(std::size_t bytes)
+    {
+        const std::size_t need = bytes + sizeof(Header);
+        std::uint32_t c = 0;
+        while (c < CLASSES and (SMALLEST << c) < need) c++;
+        if (c == CLASSES)
+            return new (::operator new(need)) Header{nullptr, nullptr, c} + 1;
+
+        List *l = mine();
+        Header *h = l->local[c];
+        if (h == nullptr)   //take back what other threads released
+            h = l->remote[c].exchange(nullptr, std::memory_order_acquire);
+        if (h != nullptr)
+        {
+            l->local[c] = h->next;
+            if (l->cached[c] > 0) l->cached[c]--;
+            return h + 1;
+        }
+        l->refs.fetch_add(1, std::memory_order_relaxed);
+        return new (::operator new(SMALLEST << c)) Header{l, nullptr, c} + 1;
+    }
+
+    static void release(void *p)
+    {
+        Header *h = static_cast<Header *>(p) - 1;
+        List *o = h->owner;
+        if (o == nullptr)
+        {
+            ::operator delete(h);
+            return;
+        }
+        const std::uint32_t c = h->size_class;
+        if (o == mine())
+        {
+            if (o->cached[c] >= MAX_CACHED)
+                return free_block(h);
+            h->next = o->local[c];
+            o->local[c] = h;
+            o->cached[c]++;
+            return;
+        }
+        //once pushed, the block may be freed by its exiting owner and the List with it: pin the List until done
+        o->refs.fetch_add(1, std::memory_order_relaxed);
+        h->next = o->remote[c].load(std::memory_order_relaxed);
+        while (not o->remote[c].compare_exchange_weak(h->next, h, std::memory_order_seq_cst, std::memory_order_relaxed));
+        if (o->orphaned.load(std::memory_order_seq_cst))   //the owner has exited, nobody will reuse it
+            free_chain(o->remote[c].exchange(nullptr, std::memory_order_acquire));
+        o->unref();
+    }
+
+private:
+    struct List;
+    struct alignas(std::max_align_t) Header
+    {
+        List *owner;
+        Header *next;
+        std::uint32_t size_class;
+    };
+    //Lives while its thread runs or any block allocated from it exists
+    struct List
+    {
+        Header *local[CLASSES] = {};
+        std::uint32_t cached[CLASSES] = {};
+        std::atomic<Header *> remote[CLASSES] = {};
+        std::atomic<std::int64_t> refs{1};
+        std::atomic_bool orphaned{false};
+        void unref() { if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this; }
+    };
+    struct ThreadCache
+    {
+        List *list = new List;
+        ~ThreadCache()
+        {
+            list->orphaned.store(true, std::memory_order_seq_cst);
+            for (std::size_t c = 0; c < CLASSES; c++)
+            {
+                free_chain(std::exchange(list->local[c], nullptr));
+                free_chain(list->remote[c].exchange(nullptr, std::memory_order_acquire));
+            }
+            list->unref();
+        }
+    };
+
+    static List *mine()
+    {
+        static thread_local ThreadCache cache;
+        return cache.list;
+    }
+    static void free_block(Header *h)
+    {
+        List *o = h->owner;
+        ::operator delete(h);
+        o->unref();
+    }
+    static void free_chain(Header *h)
+    {
+        while (h != nullptr)
+            free_block(std::exchange(h, h->next));
+    }
+};
+
+class Task
+{
+public:
+    static constexpr std::size_t INLINE_SIZE = 64;
+
+    Task() = default;
+    template <typename F>
+        requires (not std::is_same_v<std::decay_t<F>, Task> and std::is_invocable_v<std::decay_t<F> &>)
+    explicit Task(F &&f)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (fits_inline<Fn>())
+        {
+            new (storage) Fn(std::forward<F>(f));
+            ops = &inline_ops<Fn>;
+        }
+        else
+        {
+            static_assert(alignof(Fn) <= alignof(std::max_align_t), "over-aligned callables are not supported");
+            Fn *p = new (TaskBlockPool::allocate(sizeof(Fn))) Fn(std::forward<F>(f));
+            new (storage) Fn *(p);
+            ops = &pooled_ops<Fn>;
+        }
+    }
+    //Job manages its own block: run() and discard() are called once and must release it
+    template <typename Job>
+    static Task adopt(Job *job)
+    {
+        Task t;
+        new (t.storage) Job *(job);
+        t.ops = &adopted_ops<Job>;
+        return t;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&other) noexcept : ops(std::exchange(other.ops, nullptr))
+    {
+        if (ops != nullptr) ops->move(other.storage, storage);
+#if THREADPOOL_STATS
+        enqueued_ns = other.enqueued_ns;
+#endif
+#if RC_TRACING
+        trace_flow = other.trace_flow;
+#endif
+    }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops = std::exchange(other.ops, nullptr);
+            if (ops != nullptr) ops->move(other.storage, storage);
+#if THREADPOOL_STATS
+            enqueued_ns = other.enqueued_ns;
+#endif
+#if RC_TRACING
+            trace_flow = other.trace_flow;
+#endif
+        }
+        return *this;
+    }
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops != nullptr; }
+    //runs the callable and destroys it, a task runs once
+    void operator()() { std::exchange(ops, nullptr)->run(storage); }
+    //destroys the callable without running it
+    void reset() { if (ops != nullptr) std::exchange(ops, nullptr)->discard(storage); }
+
+#if THREADPOOL_STATS
+    std::uint64_t enqueued_ns = 0;     //steady clock, set by ThreadPool for the queue wait histograms
+#endif
+#if RC_TRACING
+    std::uint64_t trace_flow = 0;      //arrow from the spawn to the execution in traces, see tracing/trace.h
+#endif
+
+private:
+    struct Ops
+    {
+        void (*run)(void *);
+        void (*discard)(void *);
+        void (*move)(void *from, void *to);
+    };
+
+    template <typename Fn>
+    static constexpr bool fits_inline()
+    {
+        return sizeof(Fn) <= INLINE_SIZE and alignof(Fn) <= alignof(std::max_align_t)
+               and std::is_nothrow_move_constructible_v<Fn>;
+    }
+    template <typename Fn>
+    static Fn *&pointer(void *s) { return *std::launder(reinterpret_cast<Fn **>(s)); }
+
+    template <typename Fn>
+    static constexpr Ops inline_ops{
+        [](void *s) {
+            Fn *f = std::launder(reinterpret_cast<Fn *>(s));
+            struct Destroy { Fn *f; ~Destroy() { f->~Fn(); } } guard{f};
+            (*f)();
+        },
+        [](void *s) { std::launder(reinterpret_cast<Fn *>(s))->~Fn(); },
+        [](void *from, void *to) {
+            Fn *f = std::launder(reinterpret_cast<Fn *>(from));
+            new (to) Fn(std::move(*f));
+            f->~Fn();
+        }};
+    template <typename Fn>
+    static constexpr Ops pooled_ops{
+        [](void *s) {
+            Fn *f = pointer<Fn>(s);
+            struct Destroy { Fn *f; ~Destroy() { f->~Fn(); TaskBlockPool::release(f); } } guard{f};
+            (*f)();
+        },
+        [](void *s) { Fn *f = pointer<Fn>(s); f->~Fn(); TaskBlockPool::release(f); },
+        [](void *from, void *to) { new (to) Fn *(pointer<Fn>(from)); }};
+    template <typename Job>
+    static constexpr Ops adopted_ops{
+        [](void *s) { pointer<Job>(s)->run(); },
+        [](void *s) { pointer<Job>(s)->discard(); },
+        [](void *from, void *to) { new (to) Job *(pointer<Job>(from)); }};
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    const Ops *ops = nullptr;
+};
+
+//Timed waits on a TaskState block on one of these, picked by the address of the state. publish() only takes the
+//mutex of a state flagged by a timed waiter
+class TaskParking
+{
+public:
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    static TaskParking &of(const void *state)
+    {
+        static TaskParking slots[SLOTS];
+        return slots[(reinterpret_cast<std::uintptr_t>(state) / alignof(std::max_align_t)) % SLOTS];
+    }
+
+private:
+    static constexpr std::size_t SLOTS = 64;
+};
+
+//Result of a waitable task, shared by the job that produces it and the futures that read it.
+//Freed by whichever of them lets it go last.
+template <typename R>
+class TaskState
+{
+public:
+    using Stored = std::conditional_t<std::is_void_v<R>, std::monostate,
+                   std::conditional_t<std::is_reference_v<R>, std::add_pointer_t<std::remove_reference_t<R>>, R>>;
+
+    explicit TaskState(void (*destroy_)(TaskState *)) : destroy(destroy_) {}
+    bool is_ready() const { return (ready.load(std::memory_order_acquire) & READY) != 0; }
+    void wait() const
+    {
+        for (auto r = ready.load(std::memory_order_acquire); (r & READY) == 0; r = ready.load(std::memory_order_acquire))
+            ready.wait(r, std::memory_order_acquire);
+    }
+    //atomic waits have no timeout: the waiter flags the state and sleeps on its TaskParking until publish or the deadline
+    template <typename Clock, typename Duration>
+    bool wait_until(const std::chrono::time_point<Clock, Duration> &deadline) const
+    {
+        if (is_ready())
+            return true;
+        TaskParking &parking = TaskParking::of(this);
+        std::unique_lock lock(parking.mutex);
+        if ((ready.fetch_or(TIMED_WAITER, std::memory_order_acq_rel) & READY) != 0)
+            return true;
+        return parking.cv.wait_until(lock, deadline, [this]() { return is_ready(); });
+    }
+    void publish()
+    {
+        if ((ready.fetch_or(READY, std::memory_order_acq_rel) & TIMED_WAITER) != 0)
+        {
+            //a waiter that flagged the state is either asleep on the condition variable or sees READY under the mutex
+            TaskParking &parking = TaskParking::of(this);
+            { std::lock_guard lock(parking.mutex); }
+            parking.cv.notify_all();
+        }
+        ready.notify_all();
+        unref();
+    }
+    void ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void unref()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            destroy(this);
+    }
+
+    std::exception_ptr error;
+    std::optional<Stored> value;
+
+private:
+    static constexpr std::uint32_t READY = 1, TIMED_WAITER = 2;
+    mutable std::atomic<std::uint32_t> ready{0};
+    std::atomic<std::uint32_t> refs{2};
+    void (*destroy)(TaskState *);
+};
+
+template <typename R>
+class SharedTaskFuture;
+
+template <typename R>
+class TaskFuture
+{
+public:
+    TaskFuture() = default;
+    explicit TaskFuture(TaskState<R> *s) : state(s) {}
+    TaskFuture(const TaskFuture &) = delete;
+    TaskFuture &operator=(const TaskFuture &) = delete;
+    TaskFuture(TaskFuture &&other) noexcept : state(std::exchange(other.state, nullptr)) {}
+    TaskFuture &operator=(TaskFuture &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (state != nullptr) state->unref();
+            state = std::exchange(other.state, nullptr);
+        }
+        return *this;
+    }
+    ~TaskFuture() { if (state != nullptr) state->unref(); }
+
+    bool valid() const { return state != nullptr; }
+    bool is_ready() const { return state != nullptr and state->is_ready(); }
+    void wait() const
+    {
+        if (state == nullptr) throw std::future_error(std::future_errc::no_state);
+        state->wait();
+    }
+    template <typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+    template <typename Clock, typename Duration>
+    std::future_status wait_until(const std::chrono::time_point<Clock, Duration> &deadline) const
+    {
+        if (state == nullptr) throw std::future_error(std::future_errc::no_state);
+        return state->wait_until(deadline) ? std::future_status::ready : std::future_status::timeout;
+    }
+    //as std::future::get, the future is no longer valid afterwards
+    R get()
+    {
+        wait();
+        struct Unref { TaskState<R> *s; ~Unref() { s->unref(); } } guard{std::exchange(state, nullptr)};
+        if (guard.s->error)
+            std::rethrow_exception(guard.s->error);
+        if constexpr (std::is_void_v<R>)
+            return;
+        else if constexpr (std::is_reference_v<R>)
+            return static_cast<R>(**guard.s->value);
+        else
+            return std::move(*guard.s->value);
+    }
+    //as std::future::share, the future is no longer valid afterwards
+    SharedTaskFuture<R> share();
+
+private:
+    friend class SharedTaskFuture<R>;
+    TaskState<R> *state = nullptr;
+};
+
+//Copyable future of a waitable task, as std::shared_future: every copy can wait and get the same result
+template <typename R>
+class SharedTaskFuture
+{
+public:
+    SharedTaskFuture() = default;
+    SharedTaskFuture(TaskFuture<R> &&future) noexcept : state(std::exchange(future.state, nullptr)) {}
+    SharedTaskFuture(const SharedTaskFuture &other) : state(other.state) { if (state != nullptr) state->ref(); }
+    SharedTaskFuture(SharedTaskFuture &&other) noexcept : state(std::exchange(other.state, nullptr)) {}
+    SharedTaskFuture &operator=(SharedTaskFuture other) noexcept
+    {
+        std::swap(state, other.state);
+        return *this;
+    }
+    ~SharedTaskFuture() { if (state != nullptr) state->unref(); }
+
+    bool valid() const { return state != nullptr; }
+    bool is_ready() const { return state != nullptr and state->is_ready(); }
+    void wait() const
+    {
+        if (state == nullptr) throw std::future_error(std::future_errc::no_state);
+        state->wait();
+    }
+    template <typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+    template <typename Clock, typename Duration>
+    std::future_status wait_until(const std::chrono::time_point<Clock, Duration> &deadline) const
+    {
+        if (state == nullptr) throw std::future_error(std::future_errc::no_state);
+        return state->wait_until(deadline) ? std::future_status::ready : std::future_status::timeout;
+    }
+    //void, R for reference results and a const reference to the stored result otherwise, as std::shared_future::get
+    std::add_lvalue_reference_t<const R> get() const
+    {
+        wait();
+        if (state->error)
+            std::rethrow_exception(state->error);
+        if constexpr (std::is_void_v<R>)
+            return;
+        else if constexpr (std::is_reference_v<R>)
+            return static_cast<R>(**state->value);
+        else
+            return *state->value;
+    }
+
+private:
+    TaskState<R> *state = nullptr;
+};
+
+template <typename R>
+SharedTaskFuture<R> TaskFuture<R>::share()
+{
+    return SharedTaskFuture<R>(std::move(*this));
+}
+
+//Callable and result of a waitable task in one pool block. The callable is destroyed as soon as it has run,
+//the block when the future is gone too
+template <typename F, typename R>
+class WaitableJob : public TaskState<R>
+{
+public:
+    template <typename G>
+    static WaitableJob *create(G &&g)
+    {
+        return new (TaskBlockPool::allocate(sizeof(WaitableJob))) WaitableJob(std::forward<G>(g));
+    }
+    void run()
+    {
+        try
+        {
+            if constexpr (std::is_void_v<R>)
+                fn();
+            else if constexpr (std::is_reference_v<R>)
+            {
+                R r = fn();
+                this->value.emplace(std::addressof(r));
+            }
+            else
+                this->value.emplace(fn());
+        }
+        catch (...)
+        {
+            this->error = std::current_exception();
+        }
+        fn.~F();
+        this->publish();
+    }
+    void discard()
+    {
+        fn.~F();
+        this->error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+        this->publish();
+    }
+
+private:
+    template <typename G>
+    explicit WaitableJob(G &&g) : TaskState<R>(&destroy_job) { new (&fn) F(std::forward<G>(g)); }
+    ~WaitableJob() {}    //fn is destroyed by run or discard
+    static void destroy_job(TaskState<R> *s)
+    {
+        auto *job = static_cast<WaitableJob *>(s);
+        job->~WaitableJob();
+        TaskBlockPool::release(job);
+    }
+    union { F fn; };
+};
+
+#endif
@@ -59,7 +59,7 @@
 //
 //Example 4: waitable tasks.
 //ThreadPool tp();
-//   std::vector<std::future<int>> futs;
+//   std::vector<TaskFuture<int>> futs;
 //   for (int i = 0; i < 10; i++ ) {
 //     futs.push_back(tp.spawn_task_waitable([]() -> int {
 //      ...
@@ -71,6 +71,9 @@
 //      f.get();
 //   }
 //
+//   Futures read from several places are shared, as std::future::share:
+//   SharedTaskFuture<int> shared = tp.spawn_task_waitable([]() -> int { ... }).share();
+//
 //Example 5: When we want to execute a member function of an object we have to do it like this.
 //   std::string s = "aaa";
 //   auto f = tp.spawn_task_waitable(empty, s);
@@ -78,45 +81,114 @@
 //   tp.spawn_task(DSRGraph::join_delta_node_att, this, ...);
 //and in a lambda:
 //   tp.spawn_task([this]() { ... });
+//
+//Example 6: work stealing. Every worker owns a deque; tasks spawned from inside a worker go to its own deque
+//and idle workers steal from the others, so recursive or fine grained tasks do not contend on a single lock.
+//Tasks spawned from other threads go through a shared injection queue. Idle workers spin, yield and finally
+//sleep on a futex.
+//   ThreadPool tp(0, ThreadPool::Mode::WORK_STEALING);
+//   tp.spawn_task([&tp]() { tp.spawn_task([]() { ... }); });   //the inner task is pushed to the local deque
+//
+//Example 7: loops. The range is cut in chunks of grain indices (0 picks one), the helpers are queued with a
+//single lock and the calling thread works on the chunks too, returning when all of them are done. The body
+//takes either an index or the [begin, end) of a chunk. Exceptions are rethrown in the caller.
+//   tp.parallel_for(0, points.size(), 1024, [&](std::size_t i) { out[i] = f(points[i]); });
+//   float total = tp.parallel_reduce(0, v.size(), 0, 0.f,
+//                                    [&](std::size_t b, std::size_t e) { return std::accumulate(&v[b], &v[e], 0.f); },
+//                                    std::plus<float>());
+//   task_group g(tp);
+//   g.run([&]() { ... });
+//   g.run([&]() { ... });
+//   g.wait();    //runs queued tasks while waiting
+//
+//Example 8: priorities. Tasks go to one of three lanes and workers always take from the highest non empty one.
+//Within a lane tasks with a deadline run earliest deadline first, ahead of the ones without, which keep FIFO
+//order. Reserved workers only run HIGH tasks, so control loops are not stuck behind a long map save.
+//   ThreadPool tp(4, ThreadPool::Mode::SHARED_QUEUE, 1);    //the last worker is reserved for HIGH tasks
+//   tp.spawn_task(ThreadPool::Priority::LOW, [this]() { grid.saveToFile(file); });
+//   tp.spawn_task({ThreadPool::Priority::HIGH, std::chrono::steady_clock::now() + 1ms}, [this]() { control(); });
+//
+//Example 9: statistics. Built with -DTHREADPOOL_STATS=1 the pool keeps lock free counters: queue wait and
+//execution time histograms per worker, enqueued and dequeued tasks, the maximum queue depth and busy time.
+//Without it stats() only fills queued and the counters cost nothing.
+//   auto before = tp.stats();
+//   ...
+//   auto now = tp.stats();
+//   qInfo() << now.enqueue_rate(before) << now.workers[0].utilization << now.percentile(now.workers[0].queue_wait, 0.99);
+//
+//Example 10: placement. Two workers pinned off core 0, where the lidar driver runs, the second one reserved for
+//HIGH tasks with SCHED_FIFO.
+//   ThreadPool::Config config;
+//   config.num_threads = 2;
+//   config.reserved_high = 1;
+//   config.cpu_sets = {{1, 2}, {3}};
+//   config.policy = ThreadPool::Policy::FIFO;
+//   config.priority = 50;
+//   config.realtime_reserved_only = true;
+//   config.name = "control";
+//   ThreadPool tp(config);
+//
+//Example 11: coroutines. co_await tp.schedule() continues the coroutine on a worker; coro::task, coro::spawn and
+//the next() awaitables of BufferSync and DoubleBuffer are in coroutine.h.
+//   coro::task<void> save(ThreadPool &tp) { co_await tp.schedule(ThreadPool::Priority::LOW); grid.saveToFile(file); }
+//   coro::spawn(tp, save(tp));
+//
+//Example 12: tracing. Built with -DRC_TRACING=1 every task is a slice of its worker, with an arrow from the spawn,
+//in the traces of tracing/trace.h.
+//   rc::trace::start();
+//   ...
+//   rc::trace::dump("/tmp/pool.json");
 
 
 #ifndef SIMPLE_THREADPOOL
 #define SIMPLE_THREADPOOL
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <latch>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
+#include "task.h"
 
 
 template<typename ... T>
 concept only_rvalues  = (std::negation< std::bool_constant<std::is_lvalue_reference<T&&>::value> >::value  && ...);
 
 
-//Base Virtual Object to store any kind of callable objects and its arguments.
-class function_wrapper_base
-{
-public:
-    virtual ~function_wrapper_base(){};
-    virtual void operator()() {};
-};
-
-//Specialization
+//Callable object and its arguments, stored in a Task.
 template <typename Function, typename... Arguments>
-class function_wrapper : public function_wrapper_base
+class function_wrapper
 {
 public:
     function_wrapper(Function &&fn, std::tuple<Arguments...> args) : f(std::forward<Function>(fn)),
                                                                      args(std::move(args)){};
 
-    void operator()() override
+    decltype(auto) operator()()
     {
-        std::apply(f, std::move(args));
+        return std::apply(f, std::move(args));
     }
 
 private:
@@ -124,120 +196,980 @@ private:
     std::tuple<Arguments...> args;
 };
 
+//Chase-Lev work stealing deque of pointers to tasks boxed in TaskBlockPool blocks (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+//Only the owner calls push and take, at the bottom; any thread may steal from the top.
+//Rings replaced on growth are kept until destruction since a thief may still be reading them.
+class WorkStealingDeque
+{
+public:
+    using Item = Task *;
+
+    explicit WorkStealingDeque(std::int64_t capacity = 256)
+    {
+        rings.emplace_back(std::make_unique<Ring>(capacity));
+        ring.store(rings.back().get(), std::memory_order_relaxed);
+    }
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    void push(Item item)
+    {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed);
+        const std::int64_t t = top.load(std::memory_order_acquire);
+        Ring *r = ring.load(std::memory_order_relaxed);
+        if (b - t > r->capacity - 1)
+            r = grow(r, b, t);
+        r->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);     //publishes the item to thieves
+    }
+
+    Item take()
+    {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring *r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_relaxed);
+        Item item = nullptr;
+        if (t <= b)
+        {
+            item = r->get(b);
+            if (t == b)     //last one, race against thieves
+            {
+                if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+            bottom.store(b + 1, std::memory_order_relaxed);
+        return item;
+    }
+
+    Item steal()
+    {
+        std::int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Item item = ring.load(std::memory_order_acquire)->get(t);
+        if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;     //lost against the owner or another thief
+        return item;
+    }
+
+    std::int64_t size() const
+    {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed);
+        const std::int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    struct Ring
+    {
+        explicit Ring(std::int64_t c) : capacity(c), mask(c - 1), items(new std::atomic<Item>[c]) {}
+        Item get(std::int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void put(std::int64_t i, Item item) { items[i & mask].store(item, std::memory_order_relaxed); }
+        const std::int64_t capacity, mask;
+        std::unique_ptr<std::atomic<Item>[]> items;
+    };
+
+    Ring *grow(Ring *r, std::int64_t b, std::int64_t t)
+    {
+        rings.emplace_back(std::make_unique<Ring>(r->capacity * 2));
+        Ring *bigger = rings.back().get();
+        for (std::int64_t i = t; i < b; i++)
+            bigger->put(i, r->get(i));
+        ring.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<std::int64_t> top{0};
+    alignas(64) std::atomic<std::int64_t> bottom{0};
+    std::atomic<Ring *> ring{nullptr};
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+//Counters of a ThreadPool at one instant, see ThreadPool::stats
+struct ThreadPoolStats
+{
+    static constexpr std::size_t BUCKETS = 32;     //bucket b counts durations in [2^b, 2^(b+1)) ns, the last one above
+    using Histogram = std::array<uint64_t, BUCKETS>;
+    struct Worker
+    {
+        uint64_t executed = 0;
+        double busy_s = 0;
+        double utilization = 0;         //busy time over uptime
+        Histogram queue_wait{}, execution{};
+    };
+
+    bool enabled = false;               //THREADPOOL_STATS
+    double uptime_s = 0;
+    uint64_t enqueued = 0, dequeued = 0, max_depth = 0;
+    uint64_t queued = 0;                //waiting now
+    std::vector<Worker> workers;        //one per worker plus a last one for other threads helping in waits
+
+    double enqueue_rate(const ThreadPoolStats &before) const { return rate(enqueued, before.enqueued, before); }
+    double dequeue_rate(const ThreadPoolStats &before) const { return rate(dequeued, before.dequeued, before); }
+    //upper bound in seconds of the bucket holding quantile q (0..1) of h
+    static double percentile(const Histogram &h, double q)
+    {
+        uint64_t total = 0;
+        for (auto c : h) total += c;
+        if (total == 0) return 0;
+        const double target = q * total;
+        uint64_t acc = 0;
+        for (std::size_t b = 0; b < BUCKETS; b++)
+            if ((acc += h[b]) >= target)
+                return std::ldexp(1.0, b + 1) * 1e-9;
+        return std::ldexp(1.0, BUCKETS) * 1e-9;
+    }
+    static std::size_t bucket_of(uint64_t ns)
+    {
+        return ns == 0 ? 0 : std::min<std::size_t>(BUCKETS - 1, std::bit_width(ns) - 1);
+    }
+
+private:
+    double rate(uint64_t now, uint64_t then, const ThreadPoolStats &before) const
+    {
+        const double dt = uptime_s - before.uptime_s;
+        return dt > 0 ? (now - then) / dt : 0;
+    }
+};
+
 class ThreadPool
 {
 public:
+    //SHARED_QUEUE: one queue and one lock for all workers.
+    //WORK_STEALING: a deque per worker, see Example 6.
+    enum class Mode { SHARED_QUEUE, WORK_STEALING };
+    enum class Priority : uint8_t { HIGH = 0, NORMAL = 1, LOW = 2 };
+    enum class CoreType { ANY, BIG, LITTLE };
+    enum class Policy { OTHER, FIFO, RR };
+    static constexpr std::size_t LANES = 3;
+    struct TaskOptions
+    {
+        Priority priority = Priority::NORMAL;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();   //max: none
+    };
+    //Worker placement and scheduling, applied by every worker before it takes its first task (Linux only,
+    //ignored elsewhere)
+    struct Config
+    {
+        uint32_t num_threads = 0;                   //0: hardware_concurrency()
+        Mode mode = Mode::SHARED_QUEUE;
+        uint32_t reserved_high = 0;                 //see Example 8
+        std::vector<std::vector<int>> cpu_sets;     //worker i runs on cpu_sets[i % size]. Empty: no pinning
+        CoreType core_type = CoreType::ANY;         //without cpu_sets, keep the workers on the big or little cores
+        Policy policy = Policy::OTHER;              //FIFO and RR need CAP_SYS_NICE or an rtprio limit
+        int priority = 0;                           //1..99 for FIFO and RR
+        bool realtime_reserved_only = false;        //policy only for the reserved workers
+        std::string name = "pool";                  //workers are named name/i, cut to 15 characters
+        //create the per worker deque from the worker itself, once pinned, so first touch places it on its
+        //NUMA node. Only meaningful with cpu_sets within a node
+        bool numa_local = true;
+    };
+
+    static Config basic_config(uint32_t num_threads, Mode mode_, uint32_t reserved_high)
+    {
+        Config c;
+        c.num_threads = num_threads;
+        c.mode = mode_;
+        c.reserved_high = reserved_high;
+        return c;
+    }
 
     //The threadpool can't be copied.
     ThreadPool(const ThreadPool &tp) = delete;
     ThreadPool(ThreadPool &tp) = delete;
     ThreadPool &operator=(const ThreadPool &tp) = delete;
 
-    ThreadPool(uint32_t num_threads = 0) : done(false)
+    //reserved_high workers, at most num_threads - 1, only run HIGH priority tasks
+    ThreadPool(uint32_t num_threads = 0, Mode mode_ = Mode::SHARED_QUEUE, uint32_t reserved_high = 0)
+        : ThreadPool(basic_config(num_threads, mode_, reserved_high)) {}
+
+    //Returns once every worker has applied the configuration. Settings the system refuses (e.g. SCHED_FIFO
+    //without CAP_SYS_NICE) are reported on std::cerr and the worker runs without them
+    explicit ThreadPool(const Config &config_) : done(false), mode(config_.mode), config(config_)
     {
-        uint32_t nt = (num_threads == 0) ? std::thread::hardware_concurrency() : num_threads;
+        uint32_t nt = (config.num_threads == 0) ? std::thread::hardware_concurrency() : config.num_threads;
+        if (nt == 0) nt = 1;
+        workers = nt;
+        reserved = std::min(config.reserved_high, nt - 1);
+        if (config.cpu_sets.empty() and config.core_type != CoreType::ANY)
+            preferred_cpus = cpus_of_type(config.core_type);
+#if THREADPOOL_STATS
+        counters = std::vector<WorkerCounters>(nt + 1);
+        started_ns = now_ns();
+#endif
+        if (mode == Mode::WORK_STEALING)
+            deques.resize(nt);      //created by their workers
+        started = std::make_unique<std::latch>(nt + 1);
         for (std::size_t i = 0; i < nt; i++)
         {
-            threads.emplace_back(std::thread(&ThreadPool::thread_loop, this, i));
+            if (mode == Mode::WORK_STEALING)
+                threads.emplace_back(std::thread(&ThreadPool::stealing_loop, this, i));
+            else
+                threads.emplace_back(std::thread(&ThreadPool::thread_loop, this, i));
         }
+        started->arrive_and_wait();
     }
 
     ~ThreadPool()
     {
 
         std::unique_lock<std::mutex> lock(tp_mutex);
-        std::queue<std::unique_ptr<function_wrapper_base>> tmp;
-        std::swap(tasks, tmp);
+        std::array<Lane, LANES> tmp;
+        std::swap(lanes, tmp);
+        for (auto &q : queued)
+            q.store(0, std::memory_order_relaxed);
         lock.unlock();
 
         done = true;
         cv.notify_all();
+        high_cv.notify_all();
+        for (auto *epoch : {&wake_epoch, &high_epoch})
+        {
+            epoch->fetch_add(1, std::memory_order_seq_cst);
+            epoch->notify_all();
+        }
 
         for (auto &th : threads)
         {
             if (th.joinable())
                 th.join();
         }
+
+        //tasks left in the deques are discarded as the ones in the shared queue
+        for (auto &d : deques)
+            while (auto t = d->take())
+                unbox(t);
+        lanes = {};
+    }
+
+    //tasks waiting, from atomic counters so it never touches the queues of the workers
+    uint32_t remaining_tasks() const {
+        std::int64_t n = 0;
+        for (auto &q : queued)
+            n += q.load(std::memory_order_relaxed);
+        for (auto &d : deques)
+            n += d->size();
+        return static_cast<uint32_t>(std::max<std::int64_t>(n, 0));
+    }
+
+    //Counters are read with relaxed loads while the workers update them, so totals can be a few tasks apart
+    ThreadPoolStats stats() const
+    {
+        ThreadPoolStats s;
+        s.queued = remaining_tasks();
+#if THREADPOOL_STATS
+        s.enabled = true;
+        s.uptime_s = (now_ns() - started_ns.load(std::memory_order_relaxed)) * 1e-9;
+        s.enqueued = enqueued.load(std::memory_order_relaxed);
+        s.max_depth = max_depth.load(std::memory_order_relaxed);
+        s.workers.resize(counters.size());
+        for (std::size_t w = 0; w < counters.size(); w++)
+        {
+            auto &c = counters[w];
+            auto &o = s.workers[w];
+            o.executed = c.executed.load(std::memory_order_relaxed);
+            o.busy_s = c.busy_ns.load(std::memory_order_relaxed) * 1e-9;
+            o.utilization = s.uptime_s > 0 ? o.busy_s / s.uptime_s : 0;
+            for (std::size_t b = 0; b < ThreadPoolStats::BUCKETS; b++)
+            {
+                o.queue_wait[b] = c.queue_wait[b].load(std::memory_order_relaxed);
+                o.execution[b] = c.execution[b].load(std::memory_order_relaxed);
+            }
+            s.dequeued += o.executed;
+        }
+#endif
+        return s;
+    }
+    void reset_stats()
+    {
+#if THREADPOOL_STATS
+        for (auto &c : counters)
+        {
+            c.executed.store(0, std::memory_order_relaxed);
+            c.busy_ns.store(0, std::memory_order_relaxed);
+            for (std::size_t b = 0; b < ThreadPoolStats::BUCKETS; b++)
+            {
+                c.queue_wait[b].store(0, std::memory_order_relaxed);
+                c.execution[b].store(0, std::memory_order_relaxed);
+            }
+        }
+        enqueued.store(0, std::memory_order_relaxed);
+        max_depth.store(0, std::memory_order_relaxed);
+        started_ns.store(now_ns(), std::memory_order_relaxed);
+#endif
+    }
+
+    Mode scheduling_mode() const { return mode; }
+    std::size_t num_threads() const { return threads.size(); }
+    uint32_t reserved_workers() const { return reserved; }
+
+    //fn(i) for every i in [begin, end), or fn(b, e) for every chunk
+    template <typename Function>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Function &&fn)
+        requires (std::is_invocable_v<Function &, std::size_t> || std::is_invocable_v<Function &, std::size_t, std::size_t>)
+    {
+        if (begin >= end)
+            return;
+        grain = chunk_size(end - begin, grain);
+        run_chunks(begin, end, grain, [&fn](std::size_t b, std::size_t e)
+        {
+            if constexpr (std::is_invocable_v<Function &, std::size_t, std::size_t>)
+                fn(b, e);
+            else
+                for (std::size_t i = b; i < e; i++)
+                    fn(i);
+        });
     }
 
-    uint32_t remaining_tasks() {
-        return tasks.size();
+    //reduce(...reduce(reduce(identity, map(chunk 0)), map(chunk 1))...), always in chunk order so results do not
+    //depend on scheduling
+    template <typename T, typename Map, typename Reduce>
+    T parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, T identity, Map &&map, Reduce &&reduce)
+        requires (std::is_invocable_r_v<T, Map &, std::size_t, std::size_t> && std::is_invocable_r_v<T, Reduce &, T, T>)
+    {
+        if (begin >= end)
+            return identity;
+        grain = chunk_size(end - begin, grain);
+        std::vector<T> partial((end - begin + grain - 1) / grain, identity);
+        run_chunks(begin, end, grain, [&](std::size_t b, std::size_t e) { partial[(b - begin) / grain] = map(b, e); });
+        for (auto &p : partial)
+            identity = reduce(std::move(identity), std::move(p));
+        return identity;
+    }
+
+    //Runs one queued task in the calling thread, false if there was none. Used by waits that help
+    bool run_pending_task()
+    {
+        Task t;
+        const bool high_only = current_pool == this and is_reserved(current_index);
+        if (mode == Mode::WORK_STEALING)
+        {
+            thread_local uint32_t seed = 0x2545F491u;
+            t = find_task(current_pool == this ? current_index : NOT_A_WORKER, seed, high_only);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> task_queue_lock(tp_mutex);
+            t = pop_lanes(high_only);
+        }
+        if (not t)
+            return false;
+        execute(t, current_pool == this ? current_index : workers);
+        return true;
     }
 
     template <typename Function, typename... Arguments>
     void spawn_task(Function &&fn, Arguments &&... args)
         requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
     {
-        std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
-        task_queue_lock.lock();
-        auto tmp_ptr = std::unique_ptr<function_wrapper_base>(new function_wrapper<Function, Arguments...>(std::forward<Function>(fn), std::forward_as_tuple(std::move(args)...)));
-        tasks.emplace(std::move(tmp_ptr));
-        task_queue_lock.unlock();
-        cv.notify_one();
+        push_task(Task(function_wrapper<Function, Arguments...>(std::forward<Function>(fn), std::forward_as_tuple(std::move(args)...))));
+    }
+
+    template <typename Function, typename... Arguments>
+    void spawn_task(const TaskOptions &options, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        push_task(Task(function_wrapper<Function, Arguments...>(std::forward<Function>(fn), std::forward_as_tuple(std::move(args)...))), options);
+    }
+
+    template <typename Function, typename... Arguments>
+    void spawn_task(Priority priority, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        spawn_task(TaskOptions{priority}, std::forward<Function>(fn), std::forward<Arguments>(args)...);
     }
 
+    //Returns a TaskFuture, which offers the get/wait/wait_for/wait_until/valid of std::future but is not one: store it
+    //as TaskFuture<R>, or call share() for a copyable SharedTaskFuture<R> where std::shared_future was used. If the
+    //pool is destroyed before the task runs get() throws std::future_error(broken_promise).
     template <typename Function, typename... Arguments>
     auto spawn_task_waitable(Function &&fn, Arguments &&... args)
         requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
     {
-        std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
+        return spawn_task_waitable(TaskOptions{}, std::forward<Function>(fn), std::forward<Arguments>(args)...);
+    }
+
+    template <typename Function, typename... Arguments>
+    auto spawn_task_waitable(const TaskOptions &options, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        using Result = std::invoke_result_t<Function, Arguments...>;
+        using Job = WaitableJob<function_wrapper<Function, Arguments...>, Result>;
+        auto job = Job::create(function_wrapper<Function, Arguments...>(std::forward<Function>(fn), std::forward_as_tuple(std::move(args)...)));
+        TaskFuture<Result> future(job);
+        push_task(Task::adopt(job), options);
+        return future;
+    }
+
+    template <typename Function, typename... Arguments>
+    auto spawn_task_waitable(Priority priority, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        return spawn_task_waitable(TaskOptions{priority}, std::forward<Function>(fn), std::forward<Arguments>(args)...);
+    }
+
+    //co_await pool.schedule() suspends the coroutine and resumes it as a task of the pool. A coroutine still
+    //queued when the pool is destroyed is never resumed
+    struct ScheduleAwaiter
+    {
+        ThreadPool &pool;
+        TaskOptions options;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            //the awaiter lives in the frame, which may be gone once the task is visible to the workers
+            ThreadPool &p = pool;
+            const TaskOptions o = options;
+            p.push_task(Task([h]() { h.resume(); }), o);
+        }
+        void await_resume() const noexcept {}
+    };
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{*this, TaskOptions{}}; }
+    ScheduleAwaiter schedule(Priority priority) { return ScheduleAwaiter{*this, TaskOptions{priority}}; }
+    ScheduleAwaiter schedule(const TaskOptions &options) { return ScheduleAwaiter{*this, options}; }
+
+private:
 
-        auto task = std::packaged_task<std::invoke_result_t<Function, Arguments...>()>(
-                [fn_ = std::forward<Function>(fn), args_ = std::forward_as_tuple(args...)]() mutable -> auto {
-                    return std::apply(std::move(fn_), std::move(args_));
+    //the deques hold pointers, so tasks going through them are moved to a pool block
+    static Task *box(Task &&t) { return new (TaskBlockPool::allocate(sizeof(Task))) Task(std::move(t)); }
+    static Task unbox(Task *p)
+    {
+        Task t(std::move(*p));
+        p->~Task();
+        TaskBlockPool::release(p);
+        return t;
+    }
+
+    static constexpr uint32_t NOT_A_WORKER = std::numeric_limits<uint32_t>::max();
+    static constexpr std::size_t lane_of(Priority p) { return static_cast<std::size_t>(p); }
+    bool is_reserved(uint32_t i) const { return i != NOT_A_WORKER and i >= workers - reserved; }
+
+    //Tasks of a priority: the ones with a deadline in a heap, earliest first, then the rest in FIFO order
+    struct Lane
+    {
+        struct Timed
+        {
+            std::chrono::steady_clock::time_point deadline;
+            uint64_t seq;
+            Task task;
+        };
+        static bool later(const Timed &a, const Timed &b)
+        {
+            return a.deadline != b.deadline ? a.deadline > b.deadline : a.seq > b.seq;
+        }
+
+        bool empty() const { return fifo.empty() and edf.empty(); }
+        std::size_t size() const { return fifo.size() + edf.size(); }
+        void push(Task &&t, std::chrono::steady_clock::time_point deadline, uint64_t seq)
+        {
+            if (deadline == std::chrono::steady_clock::time_point::max())
+                fifo.emplace(std::move(t));
+            else
+            {
+                edf.push_back(Timed{deadline, seq, std::move(t)});
+                std::push_heap(edf.begin(), edf.end(), later);
+            }
+        }
+        Task pop()
+        {
+            Task t;
+            if (not edf.empty())
+            {
+                std::pop_heap(edf.begin(), edf.end(), later);
+                t = std::move(edf.back().task);
+                edf.pop_back();
+            }
+            else if (not fifo.empty())
+            {
+                t = std::move(fifo.front());
+                fifo.pop();
+            }
+            return t;
+        }
+
+        std::queue<Task> fifo;
+        std::vector<Timed> edf;
+    };
+
+    //with tp_mutex held
+    bool has_task(bool high_only) const
+    {
+        if (high_only)
+            return not lanes[lane_of(Priority::HIGH)].empty();
+        for (auto &l : lanes)
+            if (not l.empty()) return true;
+        return false;
+    }
+    Task pop_lanes(bool high_only)
+    {
+        for (std::size_t l = 0; l < (high_only ? 1 : LANES); l++)
+            if (not lanes[l].empty())
+            {
+                queued[l].fetch_sub(1, std::memory_order_relaxed);
+                return lanes[l].pop();
+            }
+        return {};
+    }
+    Task pop_lane_locked(std::size_t l)
+    {
+        if (queued[l].load(std::memory_order_seq_cst) <= 0)
+            return {};
+        std::lock_guard<std::mutex> task_queue_lock(tp_mutex);
+        if (lanes[l].empty())
+            return {};
+        queued[l].fetch_sub(1, std::memory_order_relaxed);
+        return lanes[l].pop();
+    }
+
+    //about four chunks per thread when not given, so uneven chunks still balance
+    std::size_t chunk_size(std::size_t n, std::size_t grain) const
+    {
+        const std::size_t parts = 4 * (threads.size() + 1);
+        if (grain == 0)
+            grain = (n + parts - 1) / parts;
+        return std::max<std::size_t>({grain, 1, (n + std::numeric_limits<uint32_t>::max() - 1) / std::numeric_limits<uint32_t>::max()});
+    }
+
+    //Chunks are claimed from a shared counter by the caller and up to num_threads() helper tasks. The caller
+    //returns once every chunk is done; helpers starting later find none left and never touch body
+    struct LoopState
+    {
+        std::size_t begin, end, grain;
+        uint32_t chunks;
+        void (*invoke)(void *, std::size_t, std::size_t);
+        void *body;
+        std::atomic<std::size_t> next{0};
+        std::atomic<uint32_t> done{0};
+        std::atomic_bool failed{false};
+        std::exception_ptr error;
+
+        void work()
+        {
+            for (std::size_t c = next.fetch_add(1, std::memory_order_relaxed); c < chunks; c = next.fetch_add(1, std::memory_order_relaxed))
+            {
+                if (not failed.load(std::memory_order_relaxed))
+                {
+                    const std::size_t b = begin + c * grain;
+                    try { invoke(body, b, std::min(end, b + grain)); }
+                    catch (...)
+                    {
+                        if (not failed.exchange(true))
+                            error = std::current_exception();
+                    }
                 }
-        );
+                if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks)
+                    done.notify_all();
+            }
+        }
+    };
+
+    template <typename Body>
+    void run_chunks(std::size_t begin, std::size_t end, std::size_t grain, Body &&body)
+    {
+        auto state = std::make_shared<LoopState>();
+        state->begin = begin;
+        state->end = end;
+        state->grain = grain;
+        state->chunks = static_cast<uint32_t>((end - begin + grain - 1) / grain);
+        state->invoke = [](void *b, std::size_t cb, std::size_t ce) { (*static_cast<std::remove_reference_t<Body> *>(b))(cb, ce); };
+        state->body = &body;
+        const std::size_t helpers = std::min<std::size_t>(threads.size(), state->chunks - 1);
+        push_tasks(helpers, [&state]() { return Task([state]() { state->work(); }); });
+        state->work();
+        for (uint32_t d = state->done.load(std::memory_order_acquire); d < state->chunks; d = state->done.load(std::memory_order_acquire))
+            state->done.wait(d, std::memory_order_acquire);
+        if (state->error)
+            std::rethrow_exception(state->error);
+    }
+
+    //n tasks from make() with one lock and one wake up per task
+    template <typename Make>
+    void push_tasks(std::size_t n, Make &&make)
+    {
+        if (n == 0)
+            return;
+        if (mode == Mode::WORK_STEALING)
+        {
+            if (current_pool == this and not is_reserved(current_index))
+                for (std::size_t k = 0; k < n; k++)
+                    deques[current_index]->push(box(stamped(make())));
+            else
+            {
+                std::lock_guard<std::mutex> task_queue_lock(tp_mutex);
+                for (std::size_t k = 0; k < n; k++)
+                    lanes[lane_of(Priority::NORMAL)].fifo.emplace(stamped(make()));
+                queued[lane_of(Priority::NORMAL)].fetch_add(n, std::memory_order_seq_cst);
+            }
+            for (std::size_t k = 0; k < n; k++)
+                wake_one(wake_epoch, sleepers);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> task_queue_lock(tp_mutex);
+            for (std::size_t k = 0; k < n; k++)
+                lanes[lane_of(Priority::NORMAL)].fifo.emplace(stamped(make()));
+            queued[lane_of(Priority::NORMAL)].fetch_add(n, std::memory_order_relaxed);
+        }
+        if (n >= threads.size())
+            cv.notify_all();
+        else
+            for (std::size_t k = 0; k < n; k++)
+                cv.notify_one();
+    }
+
+#if THREADPOOL_STATS
+    //updated with relaxed atomics, only by the worker owning the slot except the last one
+    struct alignas(64) WorkerCounters
+    {
+        std::atomic<uint64_t> executed{0}, busy_ns{0};
+        std::array<std::atomic<uint64_t>, ThreadPoolStats::BUCKETS> queue_wait{}, execution{};
+    };
+    static uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+#endif
+
+    Task stamped(Task t)
+    {
+#if THREADPOOL_STATS
+        t.enqueued_ns = now_ns();
+        enqueued.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t depth = remaining_tasks() + 1;
+        uint64_t m = max_depth.load(std::memory_order_relaxed);
+        while (depth > m and not max_depth.compare_exchange_weak(m, depth, std::memory_order_relaxed));
+#endif
+#if RC_TRACING
+        t.trace_flow = RC_TRACE_FLOW_BEGIN("threadpool", "spawn");
+#endif
+        return t;
+    }
 
-        auto future = task.get_future();
+    //slot: worker index, or workers for threads outside the pool
+    void execute(Task &t, [[maybe_unused]] uint32_t slot)
+    {
+#if THREADPOOL_STATS
+        auto &c = counters[std::min(slot, workers)];
+        const uint64_t start = now_ns();
+        c.queue_wait[ThreadPoolStats::bucket_of(start - t.enqueued_ns)].fetch_add(1, std::memory_order_relaxed);
+        struct Account
+        {
+            WorkerCounters &c;
+            uint64_t start;
+            ~Account()
+            {
+                const uint64_t d = now_ns() - start;
+                c.execution[ThreadPoolStats::bucket_of(d)].fetch_add(1, std::memory_order_relaxed);
+                c.busy_ns.fetch_add(d, std::memory_order_relaxed);
+                c.executed.fetch_add(1, std::memory_order_relaxed);
+            }
+        } account{c, start};
+#endif
+#if RC_TRACING
+        RC_TRACE_SCOPE("threadpool", "task");
+        RC_TRACE_FLOW_END("threadpool", "spawn", t.trace_flow);
+#endif
+        t();
+    }
 
-        task_queue_lock.lock();
-        auto tmp_ptr = std::unique_ptr<function_wrapper_base>(
-                new function_wrapper<std::packaged_task<std::invoke_result_t<Function, Arguments...>()>>(
-                        std::move(task), std::tuple<>{}));
-        tasks.emplace(std::move(tmp_ptr));
-        task_queue_lock.unlock();
+    void push_task(Task t) { push_task(std::move(t), TaskOptions{}); }
+    void push_task(Task t, const TaskOptions &options)
+    {
+        t = stamped(std::move(t));
+        const std::size_t l = lane_of(options.priority);
+        const bool plain = options.priority == Priority::NORMAL and options.deadline == std::chrono::steady_clock::time_point::max();
+        if (mode == Mode::WORK_STEALING and plain and current_pool == this and not is_reserved(current_index))
+            deques[current_index]->push(box(std::move(t)));
+        else
+        {
+            std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
+            task_queue_lock.lock();
+            lanes[l].push(std::move(t), options.deadline, next_seq++);
+            queued[l].fetch_add(1, std::memory_order_seq_cst);
+            task_queue_lock.unlock();
+        }
+        if (mode == Mode::WORK_STEALING)
+        {
+            if (options.priority == Priority::HIGH and reserved > 0)
+                wake_one(high_epoch, high_sleepers);
+            wake_one(wake_epoch, sleepers);
+            return;
+        }
+        if (options.priority == Priority::HIGH and reserved > 0)
+            high_cv.notify_one();
         cv.notify_one();
+    }
 
-        return future;
+    //Cores whose capacity (cpu_capacity on ARM, else the maximum frequency) is above the midpoint of the range
+    //for BIG, the rest for LITTLE. Empty when the cores are all alike or it can not be read
+    static std::vector<int> cpus_of_type(CoreType type)
+    {
+        std::vector<std::pair<int, long>> capacity;
+        for (unsigned c = 0; c < std::thread::hardware_concurrency(); c++)
+        {
+            const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c);
+            long v = 0;
+            if (std::ifstream f(dir + "/cpu_capacity"); not (f >> v))
+                if (std::ifstream g(dir + "/cpufreq/cpuinfo_max_freq"); not (g >> v))
+                    return {};
+            capacity.emplace_back(c, v);
+        }
+        if (capacity.empty())
+            return {};
+        const auto [lo, hi] = std::minmax_element(capacity.begin(), capacity.end(),
+                                                  [](auto &a, auto &b) { return a.second < b.second; });
+        if (lo->second == hi->second)
+            return {};
+        const long mid = (lo->second + hi->second) / 2;
+        std::vector<int> cpus;
+        for (auto &[c, v] : capacity)
+            if ((type == CoreType::BIG) == (v > mid))
+                cpus.push_back(c);
+        return cpus;
     }
 
-private:
+    void setup_worker(uint32_t i)
+    {
+#if defined(__linux__)
+        const pthread_t self = pthread_self();
+        const std::string name = (config.name + "/" + std::to_string(i)).substr(0, 15);
+        pthread_setname_np(self, name.c_str());
+#if RC_TRACING
+        rc::trace::set_thread_name(config.name + "/" + std::to_string(i));
+#endif
+        const std::vector<int> &cpus = config.cpu_sets.empty() ? preferred_cpus : config.cpu_sets[i % config.cpu_sets.size()];
+        if (not cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int c : cpus)
+                if (c >= 0 and c < CPU_SETSIZE) CPU_SET(c, &set);
+            if (const int e = pthread_setaffinity_np(self, sizeof(set), &set); e != 0)
+                std::cerr << "ThreadPool: can not pin worker " << i << ": " << std::strerror(e) << std::endl;
+        }
+        if (config.policy != Policy::OTHER and (not config.realtime_reserved_only or is_reserved(i)))
+        {
+            sched_param param{};
+            param.sched_priority = config.priority;
+            if (const int e = pthread_setschedparam(self, config.policy == Policy::FIFO ? SCHED_FIFO : SCHED_RR, &param); e != 0)
+                std::cerr << "ThreadPool: can not set real time policy of worker " << i << ": " << std::strerror(e) << std::endl;
+        }
+#endif
+        if (mode == Mode::WORK_STEALING)
+            deques[i] = std::make_unique<WorkStealingDeque>();
+        started->arrive_and_wait();     //so nobody steals from a deque not created yet
+    }
 
     void thread_loop(int i)
     {
-        [[maybe_unused]] static thread_local uint32_t thread_index = i;
+        setup_worker(i);
+        current_pool = this;
+        current_index = i;
+        const bool high_only = is_reserved(i);
+        auto &my_cv = high_only ? high_cv : cv;
         std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
         while (!done)
         {
             task_queue_lock.lock();
 
-            cv.wait(task_queue_lock,
-                    [&]() -> bool { return !tasks.empty() || done; });
+            my_cv.wait(task_queue_lock,
+                    [&]() -> bool { return has_task(high_only) || done; });
 
             if (done) {
                 task_queue_lock.unlock();
-                cv.notify_all();
+                my_cv.notify_all();
                 break;
             }
 
-            std::unique_ptr<function_wrapper_base> t = std::move(tasks.front());
-            tasks.pop();
+            Task t = pop_lanes(high_only);
             task_queue_lock.unlock();
 
-            if (t != nullptr)
+            if (t)
             {
-                (*t)();
+                execute(t, i);
             }
 
         }
     }
 
+    //Pairs with the sleepers increment in stealing_loop: a worker either sees the new task when it checks
+    //the queues again or is counted here and woken.
+    //Reserved workers sleep on their own epoch so a wake up meant for a NORMAL task never lands on them.
+    static void wake_one(std::atomic<uint32_t> &epoch, std::atomic<uint32_t> &waiting)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    //HIGH lane, own deque (LIFO, cache hot), NORMAL lane (the injection queue), steal (FIFO) from the others
+    //and last the LOW lane. i is NOT_A_WORKER for threads helping from outside
+    Task find_task(uint32_t i, uint32_t &seed, bool high_only = false)
+    {
+        if (auto t = pop_lane_locked(lane_of(Priority::HIGH)))
+            return t;
+        if (high_only)
+            return {};
+        if (i != NOT_A_WORKER)
+            if (auto t = deques[i]->take())
+                return unbox(t);
+        if (auto t = pop_lane_locked(lane_of(Priority::NORMAL)))
+            return t;
+        const uint32_t n = deques.size();
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        for (uint32_t k = 0, v = seed % n; k < n; k++, v = (v + 1 == n) ? 0 : v + 1)
+            if (v != i)
+                if (auto t = deques[v]->steal())
+                    return unbox(t);
+        return pop_lane_locked(lane_of(Priority::LOW));
+    }
+
+    void stealing_loop(uint32_t i)
+    {
+        static constexpr uint32_t SPINS = 64, YIELDS = 16;
+        setup_worker(i);
+        current_pool = this;
+        current_index = i;
+        uint32_t seed = 0x9E3779B9u * (i + 1);
+        uint32_t idle = 0;
+        const bool high_only = is_reserved(i);
+        auto &epoch_ = high_only ? high_epoch : wake_epoch;
+        auto &sleepers_ = high_only ? high_sleepers : sleepers;
+        while (not done.load(std::memory_order_acquire))
+        {
+            if (auto t = find_task(i, seed, high_only))
+            {
+                execute(t, i);
+                idle = 0;
+                continue;
+            }
+            if (++idle < SPINS)
+            {
+                cpu_relax();
+                continue;
+            }
+            if (idle < SPINS + YIELDS)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            const uint32_t epoch = epoch_.load(std::memory_order_acquire);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            if (auto t = find_task(i, seed, high_only))
+            {
+                sleepers_.fetch_sub(1, std::memory_order_relaxed);
+                execute(t, i);
+                idle = 0;
+                continue;
+            }
+            if (not done.load(std::memory_order_acquire))
+                epoch_.wait(epoch, std::memory_order_acquire);
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            idle = 0;
+        }
+    }
+
     std::vector<std::thread> threads;
-    std::queue<std::unique_ptr<function_wrapper_base>> tasks;
-    static thread_local uint32_t thread_index;
-    std::condition_variable cv;
+    std::array<Lane, LANES> lanes;      //shared queues. When stealing the NORMAL one is the injection queue
+    std::array<std::atomic<std::int64_t>, LANES> queued{};
+    uint64_t next_seq = 0;
+    uint32_t workers = 0, reserved = 0;
+    static inline thread_local ThreadPool *current_pool = nullptr;
+    static inline thread_local uint32_t current_index = 0;
+    std::condition_variable cv, high_cv;
     std::atomic_bool done = false;
+    const Mode mode;
+    const Config config;
+    std::vector<int> preferred_cpus;
+    std::unique_ptr<std::latch> started;
     mutable std::mutex tp_mutex;
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+    std::atomic<uint32_t> wake_epoch{0}, high_epoch{0};
+    std::atomic<uint32_t> sleepers{0}, high_sleepers{0};
+#if THREADPOOL_STATS
+    std::vector<WorkerCounters> counters;
+    std::atomic<uint64_t> enqueued{0}, max_depth{0}, started_ns{0};
+#endif
+};
+
+//Tasks waited for together. wait() runs queued tasks of the pool while the group is not done, so it can be
+//called from a worker without blocking it, and rethrows the first exception of the group's tasks.
+class task_group
+{
+public:
+    explicit task_group(ThreadPool &pool_) : pool(pool_) {}
+    task_group(const task_group &) = delete;
+    task_group &operator=(const task_group &) = delete;
+    ~task_group()
+    {
+        try { wait(); } catch (...) {}
+    }
+
+    template <typename Function>
+    void run(Function &&fn)
+        requires std::is_invocable_v<std::decay_t<Function> &>
+    {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.spawn_task([this, fn_ = std::forward<Function>(fn)]() mutable
+        {
+            try { fn_(); }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (not error) error = std::current_exception();
+            }
+            finish_one();
+        });
+    }
+
+    void wait()
+    {
+        while (pending.load(std::memory_order_acquire) != 0)
+            if (not pool.run_pending_task())
+                break;
+        //the last task signals holding the lock, so once it is taken here the group can be destroyed
+        std::unique_lock<std::mutex> lock(error_mutex);
+        done_cv.wait(lock, [this]() { return pending.load(std::memory_order_acquire) == 0; });
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+
+private:
+    void finish_one()
+    {
+        uint32_t p = pending.load(std::memory_order_relaxed);
+        while (p > 1 and not pending.compare_exchange_weak(p, p - 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+        if (p > 1)
+            return;
+        std::lock_guard<std::mutex> lock(error_mutex);
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+        done_cv.notify_all();
+    }
+
+    ThreadPool &pool;
+    std::atomic<uint32_t> pending{0};
+    std::mutex error_mutex;
+    std::condition_variable done_cv;
+    std::exception_ptr error;
 };
 
 
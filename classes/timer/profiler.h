@@ -0,0 +1,284 @@
+// Use:
+/*
+	void SpecificWorker::compute()
+	{
+		RC_PROFILE_SCOPE("compute");            // whole scope, steady_clock, into this thread's histogram of the probe
+		...
+		{
+			RC_PROFILE_SCOPE("compute/lidar");
+			...
+		}
+		reporter.tick();                        // rc::ProfileReporter reporter{1000}; prints p50/p99/max every second
+	}
+
+  Every probe has a static id, taken the first time its scope runs. A scope costs two clock reads and a few relaxed
+  stores into a histogram of the calling thread: no locks and no allocations after the first call of a thread.
+  Histograms are HDR style, log-linear buckets of nanoseconds with 32 sub-buckets per power of two, so every
+  percentile is within 3% of the true value, from 1 ns to 18 minutes. rc::Profiler::stats merges the threads.
+*/
+
+#ifndef ROBOCOMP_PROFILER_H
+#define ROBOCOMP_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rc
+{
+    class Histogram
+    {
+        public:
+            static constexpr int SUB_BITS = 5;
+            static constexpr int SUB = 1 << SUB_BITS;
+            static constexpr int MAX_BITS = 40;                             // 2^40 ns, larger values are clamped
+            static constexpr int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB;
+
+            static int bucket(std::uint64_t ns)
+            {
+                ns = std::min<std::uint64_t>(ns, (std::uint64_t(1) << MAX_BITS) - 1);
+                if (ns < SUB)
+                    return int(ns);
+                const int shift = std::bit_width(ns) - 1 - SUB_BITS;
+                return (shift + 1) * SUB + int((ns >> shift) - SUB);
+            }
+            // middle of the values that fall in bucket b
+            static double value(int b)
+            {
+                if (b < SUB)
+                    return b;
+                const int shift = b / SUB - 1;
+                return double((std::uint64_t(b % SUB + SUB) << shift) + ((std::uint64_t(1) << shift) >> 1));
+            }
+
+            // only the owner thread records: plain loads and stores, readable from other threads
+            void record(std::uint64_t ns)
+            {
+                auto &c = counts[bucket(ns)];
+                c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+                if (ns > max.load(std::memory_order_relaxed))
+                    max.store(ns, std::memory_order_relaxed);
+            }
+
+            std::array<std::atomic<std::uint64_t>, BUCKETS> counts{};
+            std::atomic<std::uint64_t> total{0}, sum{0}, max{0};
+    };
+
+    struct ProbeStats
+    {
+        std::string name;
+        std::uint64_t count = 0;
+        double mean = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;   // ns
+    };
+
+    class Profiler
+    {
+        public:
+            // id of a probe name, the same for every call with that name
+            static int probe(const char *name)
+            {
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                for (std::size_t i = 0; i < r.names.size(); i++)
+                    if (r.names[i] == name)
+                        return int(i);
+                r.names.emplace_back(name);
+                return int(r.names.size() - 1);
+            }
+
+            static void record(int id, std::uint64_t ns)
+            {
+                thread_local Local local;
+                if (id >= int(local.histograms.size()) or local.histograms[id] == nullptr)
+                    local.histograms = registry().attach(local.block, id);
+                local.histograms[id]->record(ns);
+            }
+
+            // Every probe, merged over all threads, alive or finished. With 'sinceLast' only what was recorded after
+            // the previous call with 'sinceLast'
+            static std::vector<ProbeStats> stats(bool sinceLast = false)
+            {
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                std::vector<ProbeStats> out;
+                std::vector<std::uint64_t> merged(Histogram::BUCKETS);
+                r.previous.resize(r.names.size());
+                for (std::size_t id = 0; id < r.names.size(); id++)
+                {
+                    std::fill(merged.begin(), merged.end(), 0);
+                    std::uint64_t count = 0, sum = 0, max = 0;
+                    for (const auto &block : r.blocks)
+                        if (id < block->size() and (*block)[id])
+                        {
+                            const Histogram &h = *(*block)[id];
+                            for (int b = 0; b < Histogram::BUCKETS; b++)
+                                merged[b] += h.counts[b].load(std::memory_order_relaxed);
+                            count += h.total.load(std::memory_order_relaxed);
+                            sum += h.sum.load(std::memory_order_relaxed);
+                            max = std::max(max, h.max.load(std::memory_order_relaxed));
+                        }
+                    auto &prev = r.previous[id];
+                    if (sinceLast)
+                    {
+                        // the window maximum is the largest bucket touched in the window
+                        prev.counts.resize(Histogram::BUCKETS);
+                        const auto cumulative = merged;
+                        for (int b = 0; b < Histogram::BUCKETS; b++)
+                            merged[b] -= prev.counts[b];
+                        const std::uint64_t windowCount = count - prev.count, windowSum = sum - prev.sum;
+                        prev.counts = cumulative;
+                        prev.count = count;
+                        prev.sum = sum;
+                        count = windowCount;
+                        sum = windowSum;
+                        max = 0;
+                        for (int b = Histogram::BUCKETS - 1; b >= 0; b--)
+                            if (merged[b] != 0)
+                            {
+                                max = std::uint64_t(Histogram::value(b));
+                                break;
+                            }
+                    }
+                    ProbeStats s;
+                    s.name = r.names[id];
+                    s.count = count;
+                    if (count != 0)
+                    {
+                        s.mean = double(sum) / count;
+                        s.p50 = percentile(merged, count, 0.50);
+                        s.p90 = percentile(merged, count, 0.90);
+                        s.p99 = percentile(merged, count, 0.99);
+                        s.max = double(max);
+                    }
+                    out.push_back(std::move(s));
+                }
+                return out;
+            }
+
+            static void print(const std::vector<ProbeStats> &stats, std::ostream &os = std::cout)
+            {
+                for (const auto &s : stats)
+                    if (s.count != 0)
+                        os << std::left << std::setw(24) << s.name << std::right << " n = " << s.count << std::fixed << std::setprecision(3)
+                           << " mean = " << s.mean * 1e-6 << "ms p50 = " << s.p50 * 1e-6 << "ms p99 = " << s.p99 * 1e-6
+                           << "ms max = " << s.max * 1e-6 << "ms" << std::defaultfloat << std::endl;
+            }
+
+        private:
+            using Block = std::vector<std::unique_ptr<Histogram>>;
+            struct Previous
+            {
+                std::vector<std::uint64_t> counts;
+                std::uint64_t count = 0, sum = 0;
+            };
+            struct Registry
+            {
+                std::mutex mutex;
+                std::vector<std::string> names;
+                std::vector<std::shared_ptr<Block>> blocks;     // one per thread that recorded, kept after it ends
+                std::vector<Previous> previous;
+
+                // histogram of probe 'id' created in the block of the calling thread; returns the raw view of it
+                std::vector<Histogram *> attach(std::shared_ptr<Block> &block, int id)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (not block)
+                    {
+                        block = std::make_shared<Block>();
+                        blocks.push_back(block);
+                    }
+                    if (id >= int(block->size()))
+                        block->resize(id + 1);
+                    if (not (*block)[id])
+                        (*block)[id] = std::make_unique<Histogram>();
+                    std::vector<Histogram *> view(block->size());
+                    for (std::size_t i = 0; i < block->size(); i++)
+                        view[i] = (*block)[i].get();
+                    return view;
+                }
+            };
+            struct Local
+            {
+                std::shared_ptr<Block> block;
+                std::vector<Histogram *> histograms;
+            };
+
+            static Registry &registry()
+            {
+                static Registry r;
+                return r;
+            }
+
+            static double percentile(const std::vector<std::uint64_t> &counts, std::uint64_t total, double q)
+            {
+                const auto rank = std::uint64_t(std::max(1.0, q * double(total) + 0.5));
+                std::uint64_t seen = 0;
+                for (int b = 0; b < Histogram::BUCKETS; b++)
+                    if ((seen += counts[b]) >= rank)
+                        return Histogram::value(b);
+                return Histogram::value(Histogram::BUCKETS - 1);
+            }
+    };
+
+    template<class ClockT = std::chrono::steady_clock>
+    class ScopedTimer
+    {
+        public:
+            explicit ScopedTimer(int probe_) : probe(probe_), start(ClockT::now()) {}
+            ~ScopedTimer()
+            {
+                Profiler::record(probe, std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(ClockT::now() - start).count()));
+            }
+            ScopedTimer(const ScopedTimer &) = delete;
+            ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        private:
+            int probe;
+            typename ClockT::time_point start;
+    };
+
+    // Publishes the stats of the last period, cheap to call on every iteration: one clock read until the period ends.
+    // The default sink prints them
+    class ProfileReporter
+    {
+        public:
+            using Sink = std::function<void(const std::vector<ProbeStats> &)>;
+            explicit ProfileReporter(unsigned int msPeriod = 1000, Sink sink_ = [](const auto &s) { Profiler::print(s); })
+                : period(std::chrono::milliseconds(msPeriod)), sink(std::move(sink_)), last(std::chrono::steady_clock::now()) {}
+
+            bool tick()
+            {
+                const auto now = std::chrono::steady_clock::now();
+                if (now - last < period)
+                    return false;
+                last = now;
+                sink(Profiler::stats(true));
+                return true;
+            }
+
+        private:
+            std::chrono::steady_clock::duration period;
+            Sink sink;
+            std::chrono::steady_clock::time_point last;
+    };
+}
+
+#define RC_PROFILE_CONCAT_(a, b) a##b
+#define RC_PROFILE_CONCAT(a, b) RC_PROFILE_CONCAT_(a, b)
+#define RC_PROFILE_SCOPE(name) \
+    static const int RC_PROFILE_CONCAT(rc_probe_, __LINE__) = rc::Profiler::probe(name); \
+    rc::ScopedTimer<> RC_PROFILE_CONCAT(rc_scoped_timer_, __LINE__)(RC_PROFILE_CONCAT(rc_probe_, __LINE__))
+
+#endif
@@ -4,17 +4,21 @@
 	clock.tick();
 		code you want to measure 
 	clock.tock() or clock.print()
+
+  For latency histograms of hot paths see profiler.h
 */
 
 #ifndef ROBOCOMP_TIMER_H
 #define ROBOCOMP_TIMER_H
 
 #include <chrono>
+#include <iostream>
+#include <string_view>
 namespace rc
 {
 
     template<class DT = std::chrono::milliseconds,
-            class ClockT = std::chrono::system_clock>
+            class ClockT = std::chrono::steady_clock>
     class Timer
     {
         using timep_t = typename ClockT::time_point;
@@ -0,0 +1,336 @@
+//
+// Event tracing for Chrome's about:tracing and ui.perfetto.dev, which opens the same JSON.
+// Built with -DRC_TRACING=1 ThreadPool, BufferSync, DoubleBuffer and the map update and path planning of Grid
+// record their work: slices for what took time and flow arrows from every spawned task to its execution, so a late
+// frame shows whether it waited in a queue, in a conversion or in the planner. Without it the macros are empty.
+// Recording is also off at runtime until start(). Every thread writes into its own ring of the last events, without
+// locks; dump() merges the rings of all the threads into a trace file, at any time and as often as needed.
+//
+//   rc::trace::start();                                     //16384 events kept per thread
+//   rc::trace::dump_on_signal(SIGUSR2, "/tmp/robot.json");  //kill -USR2 <pid> writes the last events
+//   {
+//       RC_TRACE_SCOPE("control", "compute");              //slice from here to the end of the scope
+//       ...
+//   }
+//   rc::trace::dump("/tmp/robot.json");
+//
+// In a Qt component the dump can be triggered with UnixSignalWatcher (sigwatch) instead:
+//   watcher.watchForSignal(SIGUSR2);
+//   connect(&watcher, &UnixSignalWatcher::unixSignal, [](int) { rc::trace::dump("/tmp/robot.json"); });
+//
+// Names and categories must be string literals, or live as long as the events, since only the pointer is stored.
+//
+
+#ifndef RC_TRACE_H
+#define RC_TRACE_H
+
+//1 to compile the trace points in. ThreadPool tasks carry a flow id with it, so it has to be the same for the whole build
+#ifndef RC_TRACING
+#define RC_TRACING 0
+#endif
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rc::trace
+{
+    enum class Phase : char { COMPLETE = 'X', INSTANT = 'i', FLOW_BEGIN = 's', FLOW_END = 'f' };
+
+    inline std::uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    namespace detail
+    {
+        //A slot is written by its thread and read by dump at any time: 'seq' is zeroed before the fields are written and
+        //set to the event number after, so a reader keeps the slot only if it saw the same number before and after
+        struct Slot
+        {
+            std::atomic<std::uint64_t> seq{0}, ts{0}, dur{0}, id{0};
+            std::atomic<const char *> name{nullptr}, category{nullptr};
+            std::atomic<char> phase{0};
+        };
+        struct Event
+        {
+            std::uint64_t ts, dur, id;
+            const char *name, *category;
+            Phase phase;
+            std::uint32_t tid;
+        };
+
+        struct ThreadRing
+        {
+            ThreadRing(std::size_t capacity, std::uint32_t tid_) : slots(capacity), tid(tid_) {}
+            std::vector<Slot> slots;
+            std::uint64_t written = 0;      //only touched by the owner
+            std::uint32_t tid;
+            std::mutex name_mutex;
+            std::string name;
+
+            void push(Phase p, const char *category, const char *name_, std::uint64_t ts, std::uint64_t dur, std::uint64_t id)
+            {
+                Slot &s = slots[written % slots.size()];
+                s.seq.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s.ts.store(ts, std::memory_order_relaxed);
+                s.dur.store(dur, std::memory_order_relaxed);
+                s.id.store(id, std::memory_order_relaxed);
+                s.name.store(name_, std::memory_order_relaxed);
+                s.category.store(category, std::memory_order_relaxed);
+                s.phase.store(char(p), std::memory_order_relaxed);
+                s.seq.store(++written, std::memory_order_release);
+            }
+
+            void collect(std::vector<Event> &out) const
+            {
+                for (const Slot &s : slots)
+                {
+                    const std::uint64_t before = s.seq.load(std::memory_order_acquire);
+                    if (before == 0)
+                        continue;
+                    Event e{s.ts.load(std::memory_order_relaxed), s.dur.load(std::memory_order_relaxed), s.id.load(std::memory_order_relaxed),
+                            s.name.load(std::memory_order_relaxed), s.category.load(std::memory_order_relaxed),
+                            Phase(s.phase.load(std::memory_order_relaxed)), tid};
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (s.seq.load(std::memory_order_relaxed) == before)
+                        out.push_back(e);
+                }
+            }
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<std::shared_ptr<ThreadRing>> rings;     //kept after their threads end
+            std::atomic<bool> enabled{false};
+            std::size_t capacity = 16384;
+            std::uint32_t next_tid = 1;
+            std::atomic<std::uint64_t> next_flow{1};
+        };
+        inline Registry &registry()
+        {
+            static Registry r;
+            return r;
+        }
+
+        inline ThreadRing &ring()
+        {
+            thread_local std::shared_ptr<ThreadRing> mine;
+            if (not mine)
+            {
+                auto &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                mine = std::make_shared<ThreadRing>(r.capacity, r.next_tid++);
+                r.rings.push_back(mine);
+            }
+            return *mine;
+        }
+
+        inline void escape(std::ostream &os, const char *s)
+        {
+            os << '"';
+            for (; s != nullptr and *s; s++)
+            {
+                const unsigned char c = *s;
+                if (c == '"' or c == '\\')
+                    os << '\\' << char(c);
+                else if (c < 0x20)
+                {
+                    char u[8];
+                    std::snprintf(u, sizeof(u), "\\u%04x", c);
+                    os << u;
+                }
+                else
+                    os << char(c);
+            }
+            os << '"';
+        }
+    }
+
+    inline bool enabled() { return detail::registry().enabled.load(std::memory_order_relaxed); }
+
+    //Starts recording; the rings of threads that have not traced yet get 'events_per_thread' slots
+    inline void start(std::size_t events_per_thread = 16384)
+    {
+        auto &r = detail::registry();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.capacity = std::max<std::size_t>(events_per_thread, 16);
+        }
+        r.enabled.store(true, std::memory_order_relaxed);
+    }
+    inline void stop() { detail::registry().enabled.store(false, std::memory_order_relaxed); }
+
+    //Name of the calling thread in the trace. ThreadPool names its workers with the name of its Config
+    inline void set_thread_name(const std::string &name)
+    {
+        auto &ring = detail::ring();
+        std::lock_guard<std::mutex> lock(ring.name_mutex);
+        ring.name = name;
+    }
+
+    inline void instant(const char *category, const char *name)
+    {
+        if (enabled())
+            detail::ring().push(Phase::INSTANT, category, name, now_ns(), 0, 0);
+    }
+
+    //Start of an arrow in the slice open in the calling thread; its id goes to flow_end, e.g. in another thread
+    inline std::uint64_t flow_begin(const char *category, const char *name)
+    {
+        if (not enabled())
+            return 0;
+        const std::uint64_t id = detail::registry().next_flow.fetch_add(1, std::memory_order_relaxed);
+        detail::ring().push(Phase::FLOW_BEGIN, category, name, now_ns(), 0, id);
+        return id;
+    }
+    inline void flow_end(const char *category, const char *name, std::uint64_t id)
+    {
+        if (id != 0 and enabled())
+            detail::ring().push(Phase::FLOW_END, category, name, now_ns(), 0, id);
+    }
+
+    //Slice from construction to destruction, recorded as one complete event when it ends
+    class Scope
+    {
+        public:
+            Scope(const char *category_, const char *name_) : category(category_), name(name_), start(enabled() ? now_ns() : 0) {}
+            ~Scope()
+            {
+                if (start != 0 and enabled())
+                    detail::ring().push(Phase::COMPLETE, category, name, start, now_ns() - start, 0);
+            }
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+
+        private:
+            const char *category, *name;
+            std::uint64_t start;
+    };
+
+    //Chrome trace event JSON of the events in the rings, oldest first
+    inline void write_json(std::ostream &os)
+    {
+        auto &r = detail::registry();
+        std::vector<std::shared_ptr<detail::ThreadRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            rings = r.rings;
+        }
+        std::vector<detail::Event> events;
+        for (const auto &ring : rings)
+            ring->collect(events);
+        std::sort(events.begin(), events.end(), [](const auto &a, const auto &b) { return a.ts < b.ts; });
+
+        const int pid = getpid();
+        char number[32];
+        auto us = [&number](std::uint64_t ns) { std::snprintf(number, sizeof(number), "%.3f", ns * 1e-3); return number; };
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto &ring : rings)
+        {
+            std::lock_guard<std::mutex> lock(ring->name_mutex);
+            if (ring->name.empty())
+                continue;
+            os << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+            detail::escape(os, ring->name.c_str());
+            os << "}}";
+            first = false;
+        }
+        for (const auto &e : events)
+        {
+            os << (first ? "" : ",\n") << "{\"ph\":\"" << char(e.phase) << "\",\"cat\":";
+            detail::escape(os, e.category);
+            os << ",\"name\":";
+            detail::escape(os, e.name);
+            os << ",\"pid\":" << pid << ",\"tid\":" << e.tid << ",\"ts\":" << us(e.ts);
+            switch (e.phase)
+            {
+                case Phase::COMPLETE: os << ",\"dur\":" << us(e.dur); break;
+                case Phase::INSTANT: os << ",\"s\":\"t\""; break;
+                case Phase::FLOW_BEGIN: os << ",\"id\":" << e.id; break;
+                case Phase::FLOW_END: os << ",\"id\":" << e.id << ",\"bp\":\"e\""; break;
+            }
+            os << '}';
+            first = false;
+        }
+        os << "\n]}\n";
+    }
+
+    inline bool dump(const std::string &path)
+    {
+        std::ofstream file(path, std::ios::trunc);
+        if (not file)
+            return false;
+        write_json(file);
+        return bool(file);
+    }
+
+    //Writes 'path' every time the process gets 'signal'. The handler only writes to a pipe, the dump runs in a thread
+    //of its own, so it is safe whatever the signal interrupts. One signal at a time
+    inline bool dump_on_signal(int signal, const std::string &path)
+    {
+        static int pipe_fds[2] = {-1, -1};
+        static std::mutex mutex;
+        static std::string target;
+        std::lock_guard<std::mutex> lock(mutex);
+        target = path;
+        if (pipe_fds[0] < 0)
+        {
+            if (pipe(pipe_fds) != 0)
+                return false;
+            std::thread([]()
+            {
+                char s;
+                while (read(pipe_fds[0], &s, 1) == 1)
+                {
+                    std::string p;
+                    {
+                        std::lock_guard<std::mutex> l(mutex);
+                        p = target;
+                    }
+                    dump(p);
+                }
+            }).detach();
+        }
+        struct sigaction action{};
+        action.sa_handler = [](int s)
+        {
+            const char c = char(s);
+            [[maybe_unused]] auto n = write(pipe_fds[1], &c, 1);
+        };
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        return sigaction(signal, &action, nullptr) == 0;
+    }
+}
+
+#define RC_TRACE_CONCAT_(a, b) a##b
+#define RC_TRACE_CONCAT(a, b) RC_TRACE_CONCAT_(a, b)
+#if RC_TRACING
+#define RC_TRACE_SCOPE(category, name) rc::trace::Scope RC_TRACE_CONCAT(rc_trace_scope_, __LINE__)(category, name)
+#define RC_TRACE_INSTANT(category, name) rc::trace::instant(category, name)
+#define RC_TRACE_FLOW_BEGIN(category, name) rc::trace::flow_begin(category, name)
+#define RC_TRACE_FLOW_END(category, name, id) rc::trace::flow_end(category, name, id)
+#else
+#define RC_TRACE_SCOPE(category, name) do {} while (0)
+#define RC_TRACE_INSTANT(category, name) do {} while (0)
+#define RC_TRACE_FLOW_BEGIN(category, name) std::uint64_t(0)
+#define RC_TRACE_FLOW_END(category, name, id) do { (void)(id); } while (0)
+#endif
+
+#endif
@@ -81,4 +81,61 @@ function(robocomp_idsl_to_src IDSL_SRCS)
         set(NEW_SRCS ${NEW_SRCS} ${SRC_FILES})
     ENDFOREACH( IFACE_NAME )
     set(${IDSL_SRCS} ${NEW_SRCS} PARENT_SCOPE)
-endfunction(robocomp_idsl_to_src)
\ No newline at end of file
+endfunction(robocomp_idsl_to_src)
+
+###############################################################################
+# Google Benchmark targets, built only with -DBUILD_BENCHMARKS=ON.
+#   robocomp_add_benchmark(bench_grid SOURCES bench_grid.cpp ../grid2d/grid.cpp LIBRARIES Qt6::Widgets)
+# Each benchmark gets a run_<name> target writing ${ROBOCOMP_BENCHMARK_OUTPUT_DIR}/<name>.json, and run_benchmarks runs
+# them all. The JSON holds ROBOCOMP_BENCHMARK_REPETITIONS repetitions aggregated (mean, median, stddev, cv) plus the
+# git revision and build type in its context, so files from different releases can be compared with
+# benchmark's tools/compare.py. A benchmark without its own main gets the one of ROBOCOMP_BENCHMARK_MAIN.
+option(BUILD_BENCHMARKS "Build the micro-benchmarks of the classes (needs Google Benchmark)" OFF)
+set(ROBOCOMP_BENCHMARK_OUTPUT_DIR "${CMAKE_BINARY_DIR}/benchmarks" CACHE PATH "Directory of the JSON results of run_benchmarks")
+set(ROBOCOMP_BENCHMARK_REPETITIONS 5 CACHE STRING "Repetitions of every benchmark in run_benchmarks")
+
+function(robocomp_add_benchmark NAME)
+    if(NOT BUILD_BENCHMARKS)
+        return()
+    endif()
+    cmake_parse_arguments(BENCH "NO_MAIN" "" "SOURCES;LIBRARIES;INCLUDES;DEFINITIONS" ${ARGN})
+    find_package(benchmark REQUIRED)
+    find_package(Threads REQUIRED)
+    if(NOT DEFINED ROBOCOMP_GIT_REVISION)
+        execute_process(COMMAND git describe --always --dirty --tags
+                        WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
+                        OUTPUT_VARIABLE revision OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET)
+        set(ROBOCOMP_GIT_REVISION "${revision}" CACHE INTERNAL "")
+    endif()
+
+    set(sources ${BENCH_SOURCES})
+    if(NOT BENCH_NO_MAIN AND DEFINED ROBOCOMP_BENCHMARK_MAIN)
+        list(APPEND sources ${ROBOCOMP_BENCHMARK_MAIN})
+    endif()
+    add_executable(${NAME} ${sources})
+    target_include_directories(${NAME} PRIVATE ${BENCH_INCLUDES})
+    target_compile_definitions(${NAME} PRIVATE ${BENCH_DEFINITIONS}
+                               ROBOCOMP_GIT_REVISION="${ROBOCOMP_GIT_REVISION}"
+                               ROBOCOMP_BUILD_TYPE="${CMAKE_BUILD_TYPE}")
+    if(BENCH_NO_MAIN OR DEFINED ROBOCOMP_BENCHMARK_MAIN)
+        target_link_libraries(${NAME} PRIVATE benchmark::benchmark Threads::Threads ${BENCH_LIBRARIES})
+    else()
+        target_link_libraries(${NAME} PRIVATE benchmark::benchmark_main Threads::Threads ${BENCH_LIBRARIES})
+    endif()
+
+    file(MAKE_DIRECTORY ${ROBOCOMP_BENCHMARK_OUTPUT_DIR})
+    add_custom_target(run_${NAME}
+            COMMAND ${NAME}
+                    --benchmark_out=${ROBOCOMP_BENCHMARK_OUTPUT_DIR}/${NAME}.json
+                    --benchmark_out_format=json
+                    --benchmark_repetitions=${ROBOCOMP_BENCHMARK_REPETITIONS}
+                    --benchmark_report_aggregates_only=true
+            DEPENDS ${NAME}
+            WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+            COMMENT "Running ${NAME}, results in ${ROBOCOMP_BENCHMARK_OUTPUT_DIR}/${NAME}.json"
+            USES_TERMINAL)
+    if(NOT TARGET run_benchmarks)
+        add_custom_target(run_benchmarks)
+    endif()
+    add_dependencies(run_benchmarks run_${NAME})
+endfunction(robocomp_add_benchmark)